@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxfs.h>
+#include <pthread.h>
+#include "agscan.h"
+#include "io.h"
+#include "type.h"
+#include "output.h"
+#include "init.h"
+#include "malloc.h"
+
+/*
+ * Parallel AG scans for the commands that walk the whole filesystem.
+ *
+ * A command's per-AG scan function runs under agscan_lock, which a scan
+ * thread drops only while it waits for a read in agscan_set_cur.  So the
+ * state the command keeps across AGs needs no locking of its own, but
+ * anything a scan holds on to across a read has to be per thread, as the
+ * cursor stack is.  Each AG's messages are captured and printed in AG
+ * order as its scan completes, so the output is the same as scanning the
+ * AGs one at a time.
+ */
+typedef struct agscan {
+	dbcapture_t	out;		/* messages from this AG's scan */
+	int		done;
+} agscan_t;
+
+static pthread_mutex_t	agscan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	agscan_cond = PTHREAD_COND_INITIALIZER;
+static agscan_t		*agscans;
+static xfs_agnumber_t	agscan_next;
+static agscan_f		agscan_fn;
+
+static void *
+agscan_worker(
+	void		*arg)
+{
+	xfs_agnumber_t	agno;
+
+	pthread_mutex_lock(&agscan_lock);
+	while ((agno = agscan_next) < mp->m_sb.sb_agcount) {
+		agscan_next++;
+		dbcapture_start(&agscans[agno].out);
+		agscan_fn(agno);
+		dbcapture_stop();
+		agscans[agno].done = 1;
+		pthread_cond_broadcast(&agscan_cond);
+	}
+	pthread_mutex_unlock(&agscan_lock);
+
+	/* the cursor stack dies with the thread */
+	xfree(iocur_base);
+	return NULL;
+}
+
+/*
+ * Call scan for every AG, and then done (if given) in AG order once each
+ * scan's output is out.  The threads spend most of their time waiting for
+ * reads, so run a few per CPU.  If serial is set, or no threads can be
+ * started, the scans run one after another on this thread.
+ */
+void
+agscan_run(
+	agscan_f	scan,
+	agscan_f	done,
+	int		serial)
+{
+	xfs_agnumber_t	agno;
+	int		i;
+	int		nthreads;
+	pthread_t	*tids;
+
+	agscans = xcalloc(mp->m_sb.sb_agcount, sizeof(*agscans));
+	agscan_next = 0;
+	agscan_fn = scan;
+	nthreads = serial ? 1 :
+		min(libxfs_nproc() * 4, (int)mp->m_sb.sb_agcount);
+	tids = xcalloc(nthreads, sizeof(*tids));
+	pthread_mutex_lock(&agscan_lock);
+	for (i = 0; nthreads > 1 && i < nthreads; i++) {
+		if (pthread_create(&tids[i], NULL, agscan_worker, NULL))
+			break;
+	}
+	nthreads = i;
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		if (nthreads) {
+			while (!agscans[agno].done)
+				pthread_cond_wait(&agscan_cond, &agscan_lock);
+			pthread_mutex_unlock(&agscan_lock);
+			dbcapture_flush(&agscans[agno].out);
+			pthread_mutex_lock(&agscan_lock);
+		} else
+			scan(agno);
+		if (done)
+			done(agno);
+	}
+	pthread_mutex_unlock(&agscan_lock);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	xfree(tids);
+	xfree(agscans);
+	agscans = NULL;
+}
+
+/*
+ * set_cur for scan functions: let the other scans get on with things
+ * while this one waits for its block.
+ */
+void
+agscan_set_cur(
+	const typ_t	*t,
+	__int64_t	d,
+	int		c,
+	bbmap_t		*bbmap)
+{
+	pthread_mutex_unlock(&agscan_lock);
+	set_cur(t, d, c, DB_RING_IGN, bbmap);
+	pthread_mutex_lock(&agscan_lock);
+}
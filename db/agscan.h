@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+struct bbmap;
+struct typ;
+
+typedef void	(*agscan_f)(xfs_agnumber_t agno);
+
+extern void	agscan_run(agscan_f scan, agscan_f done, int serial);
+extern void	agscan_set_cur(const struct typ *t, __int64_t d, int c,
+			       struct bbmap *bbmap);
@@ -19,6 +19,7 @@
 #include <xfs/libxfs.h>
 #include <math.h>
 #include <sys/time.h>
+#include "agscan.h"
 #include "bmap.h"
 #include "check.h"
 #include "command.h"
@@ -32,6 +33,7 @@
 #include "init.h"
 #include "malloc.h"
 #include "dir2.h"
+#include "ncheck.h"
 
 typedef enum {
 	IS_USER_QUOTA, IS_PROJECT_QUOTA, IS_GROUP_QUOTA,
@@ -110,17 +112,93 @@ typedef struct dirhash {
 #define	DIR_HASH_SIZE	1024
 #define	DIR_HASH_FUNC(h,a)	(((h) ^ (a)) % DIR_HASH_SIZE)
 
-static xfs_extlen_t	agffreeblks;
-static xfs_extlen_t	agflongest;
+/*
+ * Block types fit in 5 bits, so the type map packs twelve blocks into
+ * each 64 bit word rather than spending a byte per block.
+ */
+#define	DBM_BITS	5
+#define	DBM_PER_WORD	(64 / DBM_BITS)
+#define	DBM_MASK	((1ULL << DBM_BITS) - 1)
+#define	DBM_WORDS(n)	(((n) + DBM_PER_WORD - 1) / DBM_PER_WORD)
+
+/*
+ * Block ownership is kept as runs of blocks claimed by the same inode,
+ * plus a bit per block so that double claims can be caught without a
+ * lookup.  Runs are appended in scan order and only sorted when a lookup
+ * needs them; they never overlap, since a claim on an owned block is
+ * refused.
+ */
+typedef struct inorun {
+	xfs_drfsbno_t	bno;
+	xfs_extlen_t	len;
+	inodata_t	*id;
+} inorun_t;
+
+typedef struct inomap {
+	__uint64_t	*claimed;
+	inorun_t	*runs;
+	long		nruns;
+	long		maxruns;
+	int		sorted;
+} inomap_t;
+
+/*
+ * blockget -c saves the block map, block owners and inode names to a file
+ * so that a later session on the same, unchanged filesystem can load them
+ * instead of scanning again.  The file is only trusted if the uuid, the
+ * geometry, the last LSN in the log and the contents of every AG header
+ * still match; it is in host byte order.
+ */
+#define	CACHE_MAGIC	0x5846534442494458ULL	/* XFSDBIDX */
+#define	CACHE_VERSION	1
+#define	CACHE_NONAME	0xffffffffU
+
+typedef struct cachehdr {
+	__uint64_t	magic;
+	__uint32_t	version;
+	__uint32_t	nflag;		/* inode names are present */
+	uuid_t		uuid;
+	xfs_lsn_t	lsn;		/* last log record when saved */
+	__uint32_t	hdrsum;		/* crc32c of all the AG headers */
+	__uint32_t	agcount;
+	__uint32_t	agblocks;
+	__uint32_t	pad;
+	__uint64_t	rblocks;
+	__int32_t	error;		/* results of the scan */
+	__int32_t	exitcode;
+} cachehdr_t;
+
+typedef struct cacherun {
+	__uint64_t	bno;
+	__uint64_t	ino;
+	__uint32_t	len;
+	__uint32_t	pad;
+} cacherun_t;
+
+typedef struct cacheino {
+	__uint64_t	ino;
+	__uint64_t	parent;
+	__uint32_t	link_set;
+	__uint32_t	link_add;
+	__uint32_t	namelen;
+	__uint8_t	isdir;
+	__uint8_t	security;
+	__uint8_t	pad[2];
+} cacheino_t;
+
+static __thread xfs_extlen_t	agffreeblks;
+static __thread xfs_extlen_t	agflongest;
 static __uint64_t	agf_aggr_freeblks;	/* aggregate count over all */
-static __uint32_t	agfbtreeblks;
+static __thread __uint32_t	agfbtreeblks;
 static int		lazycount;
-static xfs_agino_t	agicount;
-static xfs_agino_t	agifreecount;
+static __thread xfs_agino_t	agicount;
+static __thread xfs_agino_t	agifreecount;
+static int		*agsbver_err;	/* bad sb versions, per AG */
 static xfs_fsblock_t	*blist;
 static int		blist_size;
-static char		**dbmap;	/* really dbm_t:8 */
-static dirhash_t	**dirhash;
+static char		*cachefile;
+static __uint64_t	**dbmap;	/* packed dbm_t:5 */
+static __thread dirhash_t **dirhash;
 static int		error;
 static __uint64_t	fdblocks;
 static __uint64_t	frextents;
@@ -128,7 +206,9 @@ static __uint64_t	icount;
 static __uint64_t	ifree;
 static inodata_t	***inodata;
 static int		inodata_hash_size;
-static inodata_t	***inomap;
+static int		iflag;
+static inomap_t		*inomap;
+static xfs_lsn_t	loglsn;
 static int		nflag;
 static int		pflag;
 static int		tflag;
@@ -225,6 +305,10 @@ static int		blockfree_f(int argc, char **argv);
 static int		blockget_f(int argc, char **argv);
 static int		blocktrash_f(int argc, char **argv);
 static int		blockuse_f(int argc, char **argv);
+static void		cache_key(cachehdr_t *hdr);
+static int		cache_load(char *name);
+static void		cache_save(char *name);
+static int		cache_save_chain(FILE *f, inodata_t *hp);
 static int		check_blist(xfs_fsblock_t bno);
 static void		check_dbmap(xfs_agnumber_t agno, xfs_agblock_t agbno,
 				    xfs_extlen_t len, dbm_t type);
@@ -251,6 +335,9 @@ static void		checknot_dbmap(xfs_agnumber_t agno, xfs_agblock_t agbno,
 				       xfs_extlen_t len, int typemask);
 static void		checknot_rdbmap(xfs_drfsbno_t bno, xfs_extlen_t len,
 					int typemask);
+static dbm_t		dbmap_get(__uint64_t *map, xfs_drfsbno_t bno);
+static void		dbmap_set(__uint64_t *map, xfs_drfsbno_t bno,
+				  dbm_t type);
 static void		dir_hash_add(xfs_dahash_t hash,
 				     xfs_dir2_dataptr_t addr);
 static void		dir_hash_check(inodata_t *id, int v);
@@ -262,6 +349,12 @@ static inodata_t	*find_inode(xfs_ino_t ino, int add);
 static void		free_inodata(xfs_agnumber_t agno);
 static int		init(int argc, char **argv);
 static char		*inode_name(xfs_ino_t ino, inodata_t **ipp);
+static void		inomap_alloc(inomap_t *im, xfs_drfsbno_t nblocks);
+static void		inomap_free(inomap_t *im);
+static inodata_t	*inomap_lookup(inomap_t *im, xfs_drfsbno_t bno);
+static void		inomap_set(inomap_t *im, xfs_drfsbno_t bno,
+				   xfs_extlen_t len, inodata_t *id);
+static int		inorun_cmp(const void *a, const void *b);
 static int		ncheck_f(int argc, char **argv);
 static char		*prepend_path(char *oldpath, char *parent);
 static xfs_ino_t	process_block_dir_v2(blkmap_t *blkmap, int *dot,
@@ -320,6 +413,7 @@ static void		quota_add1(qdata_t **qt, xfs_dqid_t id, int dq,
 static void		quota_check(char *s, qdata_t **qt);
 static void		quota_init(void);
 static void		scan_ag(xfs_agnumber_t agno);
+static void		scan_ag_done(xfs_agnumber_t agno);
 static void		scan_freelist(xfs_agf_t *agf);
 static void		scan_lbtree(xfs_fsblock_t root, int nlevels,
 				    scan_lbtree_f_t func, dbm_t type,
@@ -362,7 +456,7 @@ static const cmdinfo_t	blockfree_cmd =
 	  NULL, N_("free block usage information"), NULL };
 static const cmdinfo_t	blockget_cmd =
 	{ "blockget", "check", blockget_f, 0, -1, 0,
-	  N_("[-s|-v] [-n] [-t] [-b bno]... [-i ino] ..."),
+	  N_("[-s|-v] [-n] [-t] [-c cachefile] [-b bno]... [-i ino] ..."),
 	  N_("get block usage and check consistency"), NULL };
 static const cmdinfo_t	blocktrash_cmd =
 	{ "blocktrash", NULL, blocktrash_f, 0, -1, 0,
@@ -753,12 +847,12 @@ blockfree_f(
 	rt = mp->m_sb.sb_rextents != 0;
 	for (c = 0; c < mp->m_sb.sb_agcount; c++) {
 		xfree(dbmap[c]);
-		xfree(inomap[c]);
+		inomap_free(&inomap[c]);
 		free_inodata(c);
 	}
 	if (rt) {
 		xfree(dbmap[c]);
-		xfree(inomap[c]);
+		inomap_free(&inomap[c]);
 		xfree(sumcompute);
 		xfree(sumfile);
 		sumcompute = sumfile = NULL;
@@ -782,7 +876,6 @@ blockget_f(
 {
 	xfs_agnumber_t	agno;
 	int		oldprefix;
-	int		sbyell;
 
 	if (dbmap) {
 		dbprintf(_("already have block usage information\n"));
@@ -809,16 +902,24 @@ blockget_f(
 			exitcode = 1;
 		return 0;
 	}
-	oldprefix = dbprefix;
-	dbprefix |= pflag;
-	for (agno = 0, sbyell = 0; agno < mp->m_sb.sb_agcount; agno++) {
-		scan_ag(agno);
-		if (sbver_err > 4 && !sbyell && sbver_err >= agno) {
-			sbyell = 1;
-			dbprintf(_("WARNING: this may be a newer XFS "
-				 "filesystem.\n"));
+	/* tracing is only seen during a real scan */
+	if (cachefile && !verbose && !iflag && !blist_size) {
+		switch (cache_load(cachefile)) {
+		case 1:
+			return 0;
+		case -1:
+			blockfree_f(0, NULL);
+			if (!init(argc, argv))
+				return 0;
+			break;
 		}
 	}
+	oldprefix = dbprefix;
+	dbprefix |= pflag;
+	/* tracing shows each update as it is made, so keep those in order */
+	agsbver_err = xcalloc(mp->m_sb.sb_agcount, sizeof(*agsbver_err));
+	agscan_run(scan_ag, scan_ag_done, verbose || iflag || blist_size);
+	xfree(agsbver_err);
 	if (blist_size) {
 		xfree(blist);
 		blist = NULL;
@@ -926,6 +1027,8 @@ blockget_f(
 		dbprintf(_("WARNING: this may be a newer XFS filesystem.\n"));
 	if (error)
 		exitcode = 3;
+	if (cachefile)
+		cache_save(cachefile);
 	dbprefix = oldprefix;
 	return 0;
 }
@@ -1002,13 +1105,13 @@ blocktrash_f(
 	int		argc,
 	char		**argv)
 {
+	xfs_drfsbno_t	*agblocks;
 	xfs_agblock_t	agbno;
 	xfs_agnumber_t	agno;
 	xfs_drfsbno_t	bi;
 	xfs_drfsbno_t	blocks;
 	int		c;
 	int		count;
-	int		done;
 	int		goodmask;
 	int		i;
 	ltab_t		*lentab;
@@ -1022,6 +1125,7 @@ blocktrash_f(
 	uint		seed;
 	int		sopt;
 	int		tmask;
+	dbm_t		type;
 
 	if (!dbmap) {
 		dbprintf(_("must run blockget first\n"));
@@ -1126,13 +1230,17 @@ blocktrash_f(
 		} else
 			lentab[lentablen - 1].max = i;
 	}
+	/*
+	 * Count the candidates in each AG once, so that finding the n'th one
+	 * only needs to look through the AG it is in.
+	 */
+	agblocks = xcalloc(mp->m_sb.sb_agcount, sizeof(*agblocks));
 	for (blocks = 0, agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
-		for (agbno = 0, p = dbmap[agno];
-		     agbno < mp->m_sb.sb_agblocks;
-		     agbno++, p++) {
-			if ((1 << *p) & tmask)
-				blocks++;
+		for (agbno = 0; agbno < mp->m_sb.sb_agblocks; agbno++) {
+			if ((1 << dbmap_get(dbmap[agno], agbno)) & tmask)
+				agblocks[agno]++;
 		}
+		blocks += agblocks[agno];
 	}
 	if (blocks == 0) {
 		dbprintf(_("blocktrash: no matching blocks\n"));
@@ -1144,24 +1252,21 @@ blocktrash_f(
 	for (i = 0; i < count; i++) {
 		randb = (xfs_drfsbno_t)((((__int64_t)random() << 32) |
 					 random()) % blocks);
-		for (bi = 0, agno = 0, done = 0;
-		     !done && agno < mp->m_sb.sb_agcount;
-		     agno++) {
-			for (agbno = 0, p = dbmap[agno];
-			     agbno < mp->m_sb.sb_agblocks;
-			     agbno++, p++) {
-				if (!((1 << *p) & tmask))
-					continue;
-				if (bi++ < randb)
-					continue;
-				blocktrash_b(agno, agbno, (dbm_t)*p,
-					&lentab[random() % lentablen], mode);
-				done = 1;
-				break;
-			}
+		for (agno = 0; randb >= agblocks[agno]; agno++)
+			randb -= agblocks[agno];
+		for (bi = 0, agbno = 0; agbno < mp->m_sb.sb_agblocks; agbno++) {
+			type = dbmap_get(dbmap[agno], agbno);
+			if (!((1 << type) & tmask))
+				continue;
+			if (bi++ < randb)
+				continue;
+			blocktrash_b(agno, agbno, type,
+				&lentab[random() % lentablen], mode);
+			break;
 		}
 	}
 out:
+	xfree(agblocks);
 	xfree(lentab);
 	return 0;
 }
@@ -1214,11 +1319,10 @@ blockuse_f(
 		}
 	}
 	while (agbno <= end) {
-		p = &dbmap[agno][agbno];
-		i = inomap[agno][agbno];
+		i = inomap_lookup(&inomap[agno], agbno);
 		dbprintf(_("block %llu (%u/%u) type %s"),
 			(xfs_dfsbno_t)XFS_AGB_TO_FSB(mp, agno, agbno),
-			agno, agbno, typename[(dbm_t)*p]);
+			agno, agbno, typename[dbmap_get(dbmap[agno], agbno)]);
 		if (i) {
 			dbprintf(_(" inode %lld"), i->ino);
 			if (shownames && (p = inode_name(i->ino, NULL))) {
@@ -1232,6 +1336,265 @@ blockuse_f(
 	return 0;
 }
 
+/*
+ * Fill in what a cache file must match to be used for this filesystem.
+ */
+static void
+cache_key(
+	cachehdr_t	*hdr)
+{
+	typnm_t		typs[] = { TYP_SB, TYP_AGF, TYP_AGI, TYP_AGFL };
+	xfs_daddr_t	daddrs[] = { XFS_SB_DADDR, XFS_AGF_DADDR(mp),
+				     XFS_AGI_DADDR(mp), XFS_AGFL_DADDR(mp) };
+	xfs_agnumber_t	agno;
+	int		i;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = CACHE_MAGIC;
+	hdr->version = CACHE_VERSION;
+	memcpy(&hdr->uuid, &mp->m_sb.sb_uuid, sizeof(hdr->uuid));
+	hdr->lsn = loglsn;
+	hdr->agcount = mp->m_sb.sb_agcount;
+	hdr->agblocks = mp->m_sb.sb_agblocks;
+	hdr->rblocks = mp->m_sb.sb_rblocks;
+
+	/* catches changes that don't go through the log, e.g. xfs_repair */
+	hdr->hdrsum = ~0U;
+	push_cur();
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		for (i = 0; i < sizeof(typs) / sizeof(typs[0]); i++) {
+			set_cur(&typtab[typs[i]],
+				XFS_AG_DADDR(mp, agno, daddrs[i]),
+				XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
+			if (iocur_top->data == NULL)
+				continue;
+			hdr->hdrsum = crc32c(hdr->hdrsum, iocur_top->data,
+					     mp->m_sb.sb_sectsize);
+		}
+	}
+	pop_cur();
+}
+
+/*
+ * Load the results of an earlier scan.  Returns 1 if that worked, 0 if
+ * there's no usable cache, and -1 if it went bad partway through and the
+ * maps need starting again.
+ */
+static int
+cache_load(
+	char		*name)
+{
+	cachehdr_t	hdr;
+	cachehdr_t	want;
+	cacheino_t	ce;
+	cacherun_t	cr;
+	FILE		*f;
+	inomap_t	*im;
+	inodata_t	*id;
+	inodata_t	**ids = NULL;
+	xfs_ino_t	*parents = NULL;
+	__uint64_t	count;
+	__uint64_t	i;
+	xfs_drfsbno_t	nblocks;
+	int		c;
+	int		rt;
+
+	f = fopen(name, "r");
+	if (f == NULL)
+		return 0;
+	cache_key(&want);
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    hdr.magic != want.magic || hdr.version != want.version ||
+	    memcmp(&hdr.uuid, &want.uuid, sizeof(hdr.uuid)) ||
+	    hdr.lsn != want.lsn || hdr.hdrsum != want.hdrsum ||
+	    hdr.agcount != want.agcount || hdr.agblocks != want.agblocks ||
+	    hdr.rblocks != want.rblocks || (nflag && !hdr.nflag)) {
+		fclose(f);
+		return 0;
+	}
+
+	/* parents can be in any AG, so hook them up once all are in */
+	if (fread(&count, sizeof(count), 1, f) != 1 ||
+	    count > (__uint64_t)mp->m_sb.sb_agcount * mp->m_sb.sb_agblocks *
+			mp->m_sb.sb_inopblock)
+		goto bad;
+	ids = xmalloc(count * sizeof(*ids));
+	parents = xmalloc(count * sizeof(*parents));
+	for (i = 0; i < count; i++) {
+		if (fread(&ce, sizeof(ce), 1, f) != 1 ||
+		    !(id = find_inode(ce.ino, 1)))
+			goto bad;
+		id->link_set = ce.link_set;
+		id->link_add = ce.link_add;
+		id->isdir = ce.isdir;
+		id->security = ce.security;
+		if (ce.namelen != CACHE_NONAME) {
+			if (ce.namelen > MAXNAMELEN)
+				goto bad;
+			id->name = xmalloc(ce.namelen + 1);
+			if (fread(id->name, 1, ce.namelen, f) != ce.namelen)
+				goto bad;
+			id->name[ce.namelen] = '\0';
+		}
+		ids[i] = id;
+		parents[i] = ce.parent;
+	}
+	for (i = 0; i < count; i++)
+		if (parents[i] != NULLFSINO)
+			ids[i]->parent = find_inode(parents[i], 0);
+	xfree(ids);
+	xfree(parents);
+	ids = NULL;
+	parents = NULL;
+
+	rt = mp->m_sb.sb_rextents != 0;
+	for (c = 0; c < mp->m_sb.sb_agcount + rt; c++) {
+		nblocks = c < mp->m_sb.sb_agcount ? mp->m_sb.sb_agblocks :
+						    mp->m_sb.sb_rblocks;
+		im = &inomap[c];
+		if (fread(dbmap[c], sizeof(**dbmap), DBM_WORDS(nblocks), f) !=
+				DBM_WORDS(nblocks) ||
+		    fread(im->claimed, sizeof(*im->claimed),
+				howmany(nblocks, 64), f) !=
+				howmany(nblocks, 64) ||
+		    fread(&count, sizeof(count), 1, f) != 1 ||
+		    count > nblocks)
+			goto bad;
+		im->runs = count ? xmalloc(count * sizeof(*im->runs)) : NULL;
+		im->nruns = im->maxruns = count;
+		im->sorted = 0;
+		for (i = 0; i < count; i++) {
+			if (fread(&cr, sizeof(cr), 1, f) != 1)
+				goto bad;
+			im->runs[i].bno = cr.bno;
+			im->runs[i].len = cr.len;
+			im->runs[i].id = NULL;
+			if (cr.ino != NULLFSINO &&
+			    !(im->runs[i].id = find_inode(cr.ino, 1)))
+				goto bad;
+		}
+	}
+	fclose(f);
+
+	error = hdr.error;
+	if (hdr.exitcode)
+		exitcode = hdr.exitcode;
+	if (error && !sflag)
+		dbprintf(_("%d problems were found when %s was saved\n"),
+			error, name);
+	return 1;
+
+bad:
+	dbprintf(_("block usage cache %s is corrupt, ignoring it\n"), name);
+	xfree(ids);
+	xfree(parents);
+	fclose(f);
+	return -1;
+}
+
+/*
+ * Save the results of this scan.  Write to a temporary file and rename it
+ * into place so that a failed write never leaves a cache that looks valid.
+ */
+static void
+cache_save(
+	char		*name)
+{
+	cachehdr_t	hdr;
+	cacherun_t	cr;
+	FILE		*f;
+	inomap_t	*im;
+	inodata_t	*hp;
+	__uint64_t	count;
+	long		i;
+	xfs_drfsbno_t	nblocks;
+	char		*tmp;
+	int		c;
+	int		ok;
+	int		rt;
+
+	tmp = xmalloc(strlen(name) + 5);
+	sprintf(tmp, "%s.tmp", name);
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		dbprintf(_("can't create %s: %s\n"), tmp, strerror(errno));
+		xfree(tmp);
+		return;
+	}
+	cache_key(&hdr);
+	hdr.nflag = nflag;
+	hdr.error = error;
+	hdr.exitcode = exitcode;
+	ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+
+	count = 0;
+	for (c = 0; c < mp->m_sb.sb_agcount; c++)
+		for (i = 0; i < inodata_hash_size; i++)
+			for (hp = inodata[c][i]; hp; hp = hp->next)
+				count++;
+	ok = ok && fwrite(&count, sizeof(count), 1, f) == 1;
+	for (c = 0; ok && c < mp->m_sb.sb_agcount; c++)
+		for (i = 0; ok && i < inodata_hash_size; i++)
+			ok = cache_save_chain(f, inodata[c][i]);
+
+	rt = mp->m_sb.sb_rextents != 0;
+	for (c = 0; ok && c < mp->m_sb.sb_agcount + rt; c++) {
+		nblocks = c < mp->m_sb.sb_agcount ? mp->m_sb.sb_agblocks :
+						    mp->m_sb.sb_rblocks;
+		im = &inomap[c];
+		count = im->nruns;
+		ok = fwrite(dbmap[c], sizeof(**dbmap), DBM_WORDS(nblocks), f) ==
+				DBM_WORDS(nblocks) &&
+		     fwrite(im->claimed, sizeof(*im->claimed),
+				howmany(nblocks, 64), f) ==
+				howmany(nblocks, 64) &&
+		     fwrite(&count, sizeof(count), 1, f) == 1;
+		memset(&cr, 0, sizeof(cr));
+		for (i = 0; ok && i < im->nruns; i++) {
+			cr.bno = im->runs[i].bno;
+			cr.len = im->runs[i].len;
+			cr.ino = im->runs[i].id ? im->runs[i].id->ino :
+						  NULLFSINO;
+			ok = fwrite(&cr, sizeof(cr), 1, f) == 1;
+		}
+	}
+
+	if (fclose(f) != 0)
+		ok = 0;
+	if (!ok || rename(tmp, name) < 0) {
+		dbprintf(_("can't write %s: %s\n"), name, strerror(errno));
+		unlink(tmp);
+	}
+	xfree(tmp);
+}
+
+/*
+ * Write out a hash chain back to front, so that loading it (which adds to
+ * the front) gives the same order and ncheck lists names the same way.
+ */
+static int
+cache_save_chain(
+	FILE		*f,
+	inodata_t	*hp)
+{
+	cacheino_t	ce;
+
+	if (hp == NULL)
+		return 1;
+	if (!cache_save_chain(f, hp->next))
+		return 0;
+	memset(&ce, 0, sizeof(ce));
+	ce.ino = hp->ino;
+	ce.parent = hp->parent ? hp->parent->ino : NULLFSINO;
+	ce.link_set = hp->link_set;
+	ce.link_add = hp->link_add;
+	ce.namelen = hp->name ? strlen(hp->name) : CACHE_NONAME;
+	ce.isdir = hp->isdir;
+	ce.security = hp->security;
+	return fwrite(&ce, sizeof(ce), 1, f) == 1 &&
+	       (!hp->name || fwrite(hp->name, 1, ce.namelen, f) == ce.namelen);
+}
+
 static int
 check_blist(
 	xfs_fsblock_t	bno)
@@ -1253,15 +1616,16 @@ check_dbmap(
 	dbm_t		type)
 {
 	xfs_extlen_t	i;
-	char		*p;
+	dbm_t		t;
 
-	for (i = 0, p = &dbmap[agno][agbno]; i < len; i++, p++) {
-		if ((dbm_t)*p != type) {
+	for (i = 0; i < len; i++) {
+		t = dbmap_get(dbmap[agno], agbno + i);
+		if (t != type) {
 			if (!sflag || CHECK_BLISTA(agno, agbno + i))
 				dbprintf(_("block %u/%u expected type %s got "
 					 "%s\n"),
 					agno, agbno + i, typename[type],
-					typename[(dbm_t)*p]);
+					typename[t]);
 			error++;
 		}
 	}
@@ -1286,7 +1650,7 @@ check_inomap(
 	xfs_ino_t	c_ino)
 {
 	xfs_extlen_t	i;
-	inodata_t	**idp;
+	inodata_t	*id;
 	int		rval;
 
 	if (!check_range(agno, agbno, len))  {
@@ -1294,13 +1658,14 @@ check_inomap(
 			agno, agbno, agbno + len - 1, c_ino);
 		return 0;
 	}
-	for (i = 0, rval = 1, idp = &inomap[agno][agbno]; i < len; i++, idp++) {
-		if (*idp) {
-			if (!sflag || (*idp)->ilist ||
+	for (i = 0, rval = 1; i < len; i++) {
+		id = inomap_lookup(&inomap[agno], agbno + i);
+		if (id) {
+			if (!sflag || id->ilist ||
 			    CHECK_BLISTA(agno, agbno + i))
 				dbprintf(_("block %u/%u claimed by inode %lld, "
 					 "previous inum %lld\n"),
-					agno, agbno + i, c_ino, (*idp)->ino);
+					agno, agbno + i, c_ino, id->ino);
 			error++;
 			rval = 0;
 		}
@@ -1419,15 +1784,16 @@ check_rdbmap(
 	dbm_t		type)
 {
 	xfs_extlen_t	i;
-	char		*p;
+	dbm_t		t;
 
-	for (i = 0, p = &dbmap[mp->m_sb.sb_agcount][bno]; i < len; i++, p++) {
-		if ((dbm_t)*p != type) {
+	for (i = 0; i < len; i++) {
+		t = dbmap_get(dbmap[mp->m_sb.sb_agcount], bno + i);
+		if (t != type) {
 			if (!sflag || CHECK_BLIST(bno + i))
 				dbprintf(_("rtblock %llu expected type %s got "
 					 "%s\n"),
 					bno + i, typename[type],
-					typename[(dbm_t)*p]);
+					typename[t]);
 			error++;
 		}
 	}
@@ -1440,7 +1806,7 @@ check_rinomap(
 	xfs_ino_t	c_ino)
 {
 	xfs_extlen_t	i;
-	inodata_t	**idp;
+	inodata_t	*id;
 	int		rval;
 
 	if (!check_rrange(bno, len)) {
@@ -1448,14 +1814,13 @@ check_rinomap(
 			bno, bno + len - 1, c_ino);
 		return 0;
 	}
-	for (i = 0, rval = 1, idp = &inomap[mp->m_sb.sb_agcount][bno];
-	     i < len;
-	     i++, idp++) {
-		if (*idp) {
-			if (!sflag || (*idp)->ilist || CHECK_BLIST(bno + i))
+	for (i = 0, rval = 1; i < len; i++) {
+		id = inomap_lookup(&inomap[mp->m_sb.sb_agcount], bno + i);
+		if (id) {
+			if (!sflag || id->ilist || CHECK_BLIST(bno + i))
 				dbprintf(_("rtblock %llu claimed by inode %lld, "
 					 "previous inum %lld\n"),
-					bno + i, c_ino, (*idp)->ino);
+					bno + i, c_ino, id->ino);
 			error++;
 			rval = 0;
 		}
@@ -1513,7 +1878,6 @@ check_set_dbmap(
 {
 	xfs_extlen_t	i;
 	int		mayprint;
-	char		*p;
 
 	if (!check_range(agno, agbno, len))  {
 		dbprintf(_("blocks %u/%u..%u claimed by block %u/%u\n"), agno,
@@ -1522,8 +1886,8 @@ check_set_dbmap(
 	}
 	check_dbmap(agno, agbno, len, type1);
 	mayprint = verbose | blist_size;
-	for (i = 0, p = &dbmap[agno][agbno]; i < len; i++, p++) {
-		*p = (char)type2;
+	for (i = 0; i < len; i++) {
+		dbmap_set(dbmap[agno], agbno + i, type2);
 		if (mayprint && (verbose || CHECK_BLISTA(agno, agbno + i)))
 			dbprintf(_("setting block %u/%u to %s\n"), agno, agbno + i,
 				typename[type2]);
@@ -1539,14 +1903,13 @@ check_set_rdbmap(
 {
 	xfs_extlen_t	i;
 	int		mayprint;
-	char		*p;
 
 	if (!check_rrange(bno, len))
 		return;
 	check_rdbmap(bno, len, type1);
 	mayprint = verbose | blist_size;
-	for (i = 0, p = &dbmap[mp->m_sb.sb_agcount][bno]; i < len; i++, p++) {
-		*p = (char)type2;
+	for (i = 0; i < len; i++) {
+		dbmap_set(dbmap[mp->m_sb.sb_agcount], bno + i, type2);
 		if (mayprint && (verbose || CHECK_BLIST(bno + i)))
 			dbprintf(_("setting rtblock %llu to %s\n"),
 				bno + i, typename[type2]);
@@ -1587,15 +1950,16 @@ checknot_dbmap(
 	int		typemask)
 {
 	xfs_extlen_t	i;
-	char		*p;
+	dbm_t		t;
 
 	if (!check_range(agno, agbno, len))
 		return;
-	for (i = 0, p = &dbmap[agno][agbno]; i < len; i++, p++) {
-		if ((1 << *p) & typemask) {
+	for (i = 0; i < len; i++) {
+		t = dbmap_get(dbmap[agno], agbno + i);
+		if ((1 << t) & typemask) {
 			if (!sflag || CHECK_BLISTA(agno, agbno + i))
 				dbprintf(_("block %u/%u type %s not expected\n"),
-					agno, agbno + i, typename[(dbm_t)*p]);
+					agno, agbno + i, typename[t]);
 			error++;
 		}
 	}
@@ -1608,20 +1972,42 @@ checknot_rdbmap(
 	int		typemask)
 {
 	xfs_extlen_t	i;
-	char		*p;
+	dbm_t		t;
 
 	if (!check_rrange(bno, len))
 		return;
-	for (i = 0, p = &dbmap[mp->m_sb.sb_agcount][bno]; i < len; i++, p++) {
-		if ((1 << *p) & typemask) {
+	for (i = 0; i < len; i++) {
+		t = dbmap_get(dbmap[mp->m_sb.sb_agcount], bno + i);
+		if ((1 << t) & typemask) {
 			if (!sflag || CHECK_BLIST(bno + i))
 				dbprintf(_("rtblock %llu type %s not expected\n"),
-					bno + i, typename[(dbm_t)*p]);
+					bno + i, typename[t]);
 			error++;
 		}
 	}
 }
 
+static dbm_t
+dbmap_get(
+	__uint64_t	*map,
+	xfs_drfsbno_t	bno)
+{
+	return (dbm_t)((map[bno / DBM_PER_WORD] >>
+			((bno % DBM_PER_WORD) * DBM_BITS)) & DBM_MASK);
+}
+
+static void
+dbmap_set(
+	__uint64_t	*map,
+	xfs_drfsbno_t	bno,
+	dbm_t		type)
+{
+	__uint64_t	*wp = &map[bno / DBM_PER_WORD];
+	int		shift = (bno % DBM_PER_WORD) * DBM_BITS;
+
+	*wp = (*wp & ~(DBM_MASK << shift)) | ((__uint64_t)type << shift);
+}
+
 static void
 dir_hash_add(
 	xfs_dahash_t		hash,
@@ -1672,15 +2058,15 @@ dir_hash_done(void)
 			n = p->next;
 			free(p);
 		}
-		dirhash[i] = NULL;
 	}
+	free(dirhash);
+	dirhash = NULL;
 }
 
 static void
 dir_hash_init(void)
 {
-	if (!dirhash)
-		dirhash = calloc(DIR_HASH_SIZE, sizeof(*dirhash));
+	dirhash = xcalloc(DIR_HASH_SIZE, sizeof(*dirhash));
 }
 
 static int
@@ -1776,11 +2162,11 @@ init(
 		serious_error = 1;
 		return 0;
 	}
-	if (!sb_logcheck())
+	if (!sb_logcheck(&loglsn))
 		return 0;
 	rt = mp->m_sb.sb_rextents != 0;
 	dbmap = xmalloc((mp->m_sb.sb_agcount + rt) * sizeof(*dbmap));
-	inomap = xmalloc((mp->m_sb.sb_agcount + rt) * sizeof(*inomap));
+	inomap = xcalloc(mp->m_sb.sb_agcount + rt, sizeof(*inomap));
 	inodata = xmalloc(mp->m_sb.sb_agcount * sizeof(*inodata));
 	inodata_hash_size =
 		(int)MAX(MIN(mp->m_sb.sb_icount /
@@ -1788,26 +2174,33 @@ init(
 			     MAX_INODATA_HASH_SIZE),
 			 MIN_INODATA_HASH_SIZE);
 	for (c = 0; c < mp->m_sb.sb_agcount; c++) {
-		dbmap[c] = xcalloc(mp->m_sb.sb_agblocks, sizeof(**dbmap));
-		inomap[c] = xcalloc(mp->m_sb.sb_agblocks, sizeof(**inomap));
+		dbmap[c] = xcalloc(DBM_WORDS(mp->m_sb.sb_agblocks),
+				   sizeof(**dbmap));
+		inomap_alloc(&inomap[c], mp->m_sb.sb_agblocks);
 		inodata[c] = xcalloc(inodata_hash_size, sizeof(**inodata));
 	}
 	if (rt) {
-		dbmap[c] = xcalloc(mp->m_sb.sb_rblocks, sizeof(**dbmap));
-		inomap[c] = xcalloc(mp->m_sb.sb_rblocks, sizeof(**inomap));
+		dbmap[c] = xcalloc(DBM_WORDS(mp->m_sb.sb_rblocks),
+				   sizeof(**dbmap));
+		inomap_alloc(&inomap[c], mp->m_sb.sb_rblocks);
 		sumfile = xcalloc(mp->m_rsumsize, 1);
 		sumcompute = xcalloc(mp->m_rsumsize, 1);
 	}
-	nflag = sflag = tflag = verbose = optind = 0;
-	while ((c = getopt(argc, argv, "b:i:npstv")) != EOF) {
+	iflag = nflag = sflag = tflag = verbose = optind = 0;
+	cachefile = NULL;
+	while ((c = getopt(argc, argv, "b:c:i:npstv")) != EOF) {
 		switch (c) {
 		case 'b':
 			bno = strtoll(optarg, NULL, 10);
 			add_blist(bno);
 			break;
+		case 'c':
+			cachefile = optarg;
+			break;
 		case 'i':
 			ino = strtoll(optarg, NULL, 10);
 			add_ilist(ino);
+			iflag = 1;
 			break;
 		case 'n':
 			nflag = 1;
@@ -1831,6 +2224,7 @@ init(
 	}
 	error = sbver_err = serious_error = 0;
 	fdblocks = frextents = icount = ifree = 0;
+	lazycount = xfs_sb_version_haslazysbcount(&mp->m_sb);
 	sbversion = XFS_SB_VERSION_4;
 	if (mp->m_sb.sb_inoalignmt)
 		sbversion |= XFS_SB_VERSION_ALIGNBIT;
@@ -1870,6 +2264,108 @@ inode_name(
 	return path;
 }
 
+static void
+inomap_alloc(
+	inomap_t	*im,
+	xfs_drfsbno_t	nblocks)
+{
+	im->claimed = xcalloc(howmany(nblocks, 64), sizeof(*im->claimed));
+	im->runs = NULL;
+	im->nruns = im->maxruns = 0;
+	im->sorted = 1;
+}
+
+static void
+inomap_free(
+	inomap_t	*im)
+{
+	xfree(im->claimed);
+	xfree(im->runs);
+	im->claimed = NULL;
+	im->runs = NULL;
+	im->nruns = im->maxruns = 0;
+}
+
+static inodata_t *
+inomap_lookup(
+	inomap_t	*im,
+	xfs_drfsbno_t	bno)
+{
+	inorun_t	*r;
+	long		lo;
+	long		hi;
+	long		mid;
+
+	if (!(im->claimed[bno / 64] & (1ULL << (bno % 64))))
+		return NULL;
+	if (!im->sorted) {
+		qsort(im->runs, im->nruns, sizeof(*im->runs), inorun_cmp);
+		im->sorted = 1;
+	}
+	for (lo = 0, hi = im->nruns; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		r = &im->runs[mid];
+		if (bno < r->bno)
+			hi = mid;
+		else if (bno >= r->bno + r->len)
+			lo = mid + 1;
+		else
+			return r->id;
+	}
+	return NULL;
+}
+
+/*
+ * Record blocks bno..bno+len-1 as owned by id.  The caller has already
+ * checked that none of them are claimed.  Extents of a file are usually
+ * added in order, so try to extend the last run before starting a new one.
+ */
+static void
+inomap_set(
+	inomap_t	*im,
+	xfs_drfsbno_t	bno,
+	xfs_extlen_t	len,
+	inodata_t	*id)
+{
+	inorun_t	*r;
+	xfs_extlen_t	i;
+
+	for (i = 0; i < len; i++)
+		im->claimed[(bno + i) / 64] |= 1ULL << ((bno + i) % 64);
+	if (im->nruns) {
+		r = &im->runs[im->nruns - 1];
+		if (r->id == id && r->bno + r->len == bno &&
+		    r->len + len > r->len) {
+			r->len += len;
+			return;
+		}
+		if (bno < r->bno)
+			im->sorted = 0;
+	}
+	if (im->nruns == im->maxruns) {
+		im->maxruns = im->maxruns ? im->maxruns * 2 : 64;
+		im->runs = xrealloc(im->runs,
+				    im->maxruns * sizeof(*im->runs));
+	}
+	r = &im->runs[im->nruns++];
+	r->bno = bno;
+	r->len = len;
+	r->id = id;
+}
+
+static int
+inorun_cmp(
+	const void	*a,
+	const void	*b)
+{
+	const inorun_t	*ra = a;
+	const inorun_t	*rb = b;
+
+	if (ra->bno != rb->bno)
+		return ra->bno < rb->bno ? -1 : 1;
+	return 0;
+}
+
 static int
 ncheck_f(
 	int		argc,
@@ -1888,10 +2384,6 @@ ncheck_f(
 	char		*p;
 	int		security;
 
-	if (!inodata || !nflag) {
-		dbprintf(_("must run blockget -n first\n"));
-		return 0;
-	}
 	security = optind = ilist_size = 0;
 	ilist = NULL;
 	while ((c = getopt(argc, argv, "i:s")) != EOF) {
@@ -1911,6 +2403,11 @@ ncheck_f(
 			return 0;
 		}
 	}
+	if (!inodata || !nflag) {
+		ncheck_walk(ilist, ilist_size, security);
+		xfree(ilist);
+		return 0;
+	}
 	if (ilist) {
 		for (ilp = ilist; ilp < &ilist[ilist_size]; ilp++) {
 			ino = *ilp;
@@ -1989,8 +2486,9 @@ process_block_dir_v2(
 	push_cur();
 	if (nex > 1)
 		make_bbmap(&bbmap, nex, bmp);
-	set_cur(&typtab[TYP_DIR2], XFS_FSB_TO_DADDR(mp, bmp->startblock),
-		mp->m_dirblkfsbs * blkbb, DB_RING_IGN, nex > 1 ? &bbmap : NULL);
+	agscan_set_cur(&typtab[TYP_DIR2],
+		XFS_FSB_TO_DADDR(mp, bmp->startblock),
+		mp->m_dirblkfsbs * blkbb, nex > 1 ? &bbmap : NULL);
 	for (x = 0; !v && x < nex; x++) {
 		for (b = bmp[x].startblock;
 		     !v && b < bmp[x].startblock + bmp[x].blockcount;
@@ -2948,9 +3446,9 @@ process_leaf_node_dir_v2(
 		push_cur();
 		if (nex > 1)
 			make_bbmap(&bbmap, nex, bmp);
-		set_cur(&typtab[TYP_DIR2], XFS_FSB_TO_DADDR(mp, bmp->startblock),
-			mp->m_dirblkfsbs * blkbb, DB_RING_IGN,
-			nex > 1 ? &bbmap : NULL);
+		agscan_set_cur(&typtab[TYP_DIR2],
+			XFS_FSB_TO_DADDR(mp, bmp->startblock),
+			mp->m_dirblkfsbs * blkbb, nex > 1 ? &bbmap : NULL);
 		free(bmp);
 		if (iocur_top->data == NULL) {
 			if (!sflag || v)
@@ -3225,8 +3723,8 @@ process_quota(
 		cb = CHECK_BLIST(bno);
 		scicb = !sflag || id->ilist || cb;
 		push_cur();
-		set_cur(&typtab[TYP_DQBLK], XFS_FSB_TO_DADDR(mp, bno), blkbb,
-			DB_RING_IGN, NULL);
+		agscan_set_cur(&typtab[TYP_DQBLK], XFS_FSB_TO_DADDR(mp, bno),
+			blkbb, NULL);
 		if ((dqb = iocur_top->data) == NULL) {
 			if (scicb)
 				dbprintf(_("can't read block %lld for %s quota "
@@ -3328,8 +3826,8 @@ process_rtbitmap(
 			continue;
 		}
 		push_cur();
-		set_cur(&typtab[TYP_RTBITMAP], XFS_FSB_TO_DADDR(mp, bno), blkbb,
-			DB_RING_IGN, NULL);
+		agscan_set_cur(&typtab[TYP_RTBITMAP], XFS_FSB_TO_DADDR(mp, bno),
+			blkbb, NULL);
 		if ((words = iocur_top->data) == NULL) {
 			if (!sflag)
 				dbprintf(_("can't read block %lld for rtbitmap "
@@ -3395,8 +3893,8 @@ process_rtsummary(
 			continue;
 		}
 		push_cur();
-		set_cur(&typtab[TYP_RTSUMMARY], XFS_FSB_TO_DADDR(mp, bno),
-			blkbb, DB_RING_IGN, NULL);
+		agscan_set_cur(&typtab[TYP_RTSUMMARY], XFS_FSB_TO_DADDR(mp, bno),
+			blkbb, NULL);
 		if ((bytes = iocur_top->data) == NULL) {
 			if (!sflag)
 				dbprintf(_("can't read block %lld for rtsummary "
@@ -3653,9 +4151,9 @@ scan_ag(
 	agfbtreeblks = -2;
 	agicount = agifreecount = 0;
 	push_cur();	/* 1 pushed */
-	set_cur(&typtab[TYP_SB],
+	agscan_set_cur(&typtab[TYP_SB],
 		XFS_AG_DADDR(mp, agno, XFS_SB_DADDR),
-		XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
+		XFS_FSS_TO_BB(mp, 1), NULL);
 
 	if (!iocur_top->data) {
 		dbprintf(_("can't read superblock for ag %u\n"), agno);
@@ -3676,7 +4174,7 @@ scan_ag(
 			dbprintf(_("bad sb version # %#x in ag %u\n"),
 				sb->sb_versionnum, agno);
 		error++;
-		sbver_err++;
+		agsbver_err[agno]++;
 	}
 	if (!lazycount && xfs_sb_version_haslazysbcount(sb)) {
 		lazycount = 1;
@@ -3691,9 +4189,9 @@ scan_ag(
 		set_dbmap(agno, XFS_FSB_TO_AGBNO(mp, sb->sb_logstart),
 			sb->sb_logblocks, DBM_LOG, agno, XFS_SB_BLOCK(mp));
 	push_cur();	/* 2 pushed */
-	set_cur(&typtab[TYP_AGF],
+	agscan_set_cur(&typtab[TYP_AGF],
 		XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
-		XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
+		XFS_FSS_TO_BB(mp, 1), NULL);
 	if ((agf = iocur_top->data) == NULL) {
 		dbprintf(_("can't read agf block for ag %u\n"), agno);
 		serious_error++;
@@ -3719,9 +4217,9 @@ scan_ag(
 			sb->sb_agblocks - be32_to_cpu(agf->agf_length),
 			DBM_MISSING, agno, XFS_SB_BLOCK(mp));
 	push_cur();	/* 3 pushed */
-	set_cur(&typtab[TYP_AGI],
+	agscan_set_cur(&typtab[TYP_AGI],
 		XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
-		XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
+		XFS_FSS_TO_BB(mp, 1), NULL);
 	if ((agi = iocur_top->data) == NULL) {
 		dbprintf(_("can't read agi block for ag %u\n"), agno);
 		serious_error++;
@@ -3814,6 +4312,25 @@ pop1_out:
 	pop_cur();
 }
 
+/*
+ * Called in AG order once each AG's scan is done.
+ */
+static void
+scan_ag_done(
+	xfs_agnumber_t	agno)
+{
+	static int	sbyell;
+
+	if (agno == 0)
+		sbyell = 0;
+	sbver_err += agsbver_err[agno];
+	if (sbver_err > 4 && !sbyell && sbver_err >= agno) {
+		sbyell = 1;
+		dbprintf(_("WARNING: this may be a newer XFS "
+			 "filesystem.\n"));
+	}
+}
+
 static void
 scan_freelist(
 	xfs_agf_t	*agf)
@@ -3833,9 +4350,9 @@ scan_freelist(
 	if (be32_to_cpu(agf->agf_flcount) == 0)
 		return;
 	push_cur();
-	set_cur(&typtab[TYP_AGFL],
+	agscan_set_cur(&typtab[TYP_AGFL],
 		XFS_AG_DADDR(mp, seqno, XFS_AGFL_DADDR(mp)),
-		XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
+		XFS_FSS_TO_BB(mp, 1), NULL);
 	if ((agfl = iocur_top->data) == NULL) {
 		dbprintf(_("can't read agfl block for ag %u\n"), seqno);
 		serious_error++;
@@ -3894,8 +4411,7 @@ scan_lbtree(
 	typnm_t		btype)
 {
 	push_cur();
-	set_cur(&typtab[btype], XFS_FSB_TO_DADDR(mp, root), blkbb, DB_RING_IGN,
-		NULL);
+	agscan_set_cur(&typtab[btype], XFS_FSB_TO_DADDR(mp, root), blkbb, NULL);
 	if (iocur_top->data == NULL) {
 		if (!sflag)
 			dbprintf(_("can't read btree block %u/%u\n"),
@@ -3922,8 +4438,8 @@ scan_sbtree(
 	xfs_agnumber_t	seqno = be32_to_cpu(agf->agf_seqno);
 
 	push_cur();
-	set_cur(&typtab[btype],
-		XFS_AGB_TO_DADDR(mp, seqno, root), blkbb, DB_RING_IGN, NULL);
+	agscan_set_cur(&typtab[btype],
+		XFS_AGB_TO_DADDR(mp, seqno, root), blkbb, NULL);
 	if (iocur_top->data == NULL) {
 		if (!sflag)
 			dbprintf(_("can't read btree block %u/%u\n"), seqno, root);
@@ -4220,11 +4736,11 @@ scanfunc_ino(
 			ifree += be32_to_cpu(rp[i].ir_freecount);
 			agifreecount += be32_to_cpu(rp[i].ir_freecount);
 			push_cur();
-			set_cur(&typtab[TYP_INODE],
+			agscan_set_cur(&typtab[TYP_INODE],
 				XFS_AGB_TO_DADDR(mp, seqno,
 						 XFS_AGINO_TO_AGBNO(mp, agino)),
 				(int)XFS_FSB_TO_BB(mp, XFS_IALLOC_BLOCKS(mp)),
-				DB_RING_IGN, NULL);
+				NULL);
 			if (iocur_top->data == NULL) {
 				if (!sflag)
 					dbprintf(_("can't read inode block "
@@ -4290,16 +4806,14 @@ set_inomap(
 	inodata_t	*id)
 {
 	xfs_extlen_t	i;
-	inodata_t	**idp;
 	int		mayprint;
 
 	if (!check_inomap(agno, agbno, len, id->ino))
 		return;
+	inomap_set(&inomap[agno], agbno, len, id);
 	mayprint = verbose | id->ilist | blist_size;
-	for (i = 0, idp = &inomap[agno][agbno]; i < len; i++, idp++) {
-		*idp = id;
-		if (mayprint &&
-		    (verbose || id->ilist || CHECK_BLISTA(agno, agbno + i)))
+	for (i = 0; mayprint && i < len; i++) {
+		if (verbose || id->ilist || CHECK_BLISTA(agno, agbno + i))
 			dbprintf(_("setting inode to %lld for block %u/%u\n"),
 				id->ino, agno, agbno + i);
 	}
@@ -4321,17 +4835,14 @@ set_rinomap(
 	inodata_t	*id)
 {
 	xfs_extlen_t	i;
-	inodata_t	**idp;
 	int		mayprint;
 
 	if (!check_rinomap(bno, len, id->ino))
 		return;
+	inomap_set(&inomap[mp->m_sb.sb_agcount], bno, len, id);
 	mayprint = verbose | id->ilist | blist_size;
-	for (i = 0, idp = &inomap[mp->m_sb.sb_agcount][bno];
-	     i < len;
-	     i++, idp++) {
-		*idp = id;
-		if (mayprint && (verbose || id->ilist || CHECK_BLIST(bno + i)))
+	for (i = 0; mayprint && i < len; i++) {
+		if (verbose || id->ilist || CHECK_BLIST(bno + i))
 			dbprintf(_("setting inode to %lld for rtblock %llu\n"),
 				id->ino, bno + i);
 	}
@@ -43,6 +43,7 @@
 #include "metadump.h"
 #include "output.h"
 #include "print.h"
+#include "query.h"
 #include "quit.h"
 #include "sb.h"
 #include "write.h"
@@ -135,6 +136,7 @@ init_commands(void)
 	metadump_init();
 	output_init();
 	print_init();
+	query_init();
 	quit_init();
 	sb_init();
 	type_init();
@@ -18,6 +18,7 @@
 
 #include <xfs/libxfs.h>
 #include <sys/time.h>
+#include "agscan.h"
 #include "bmap.h"
 #include "command.h"
 #include "frag.h"
@@ -42,8 +43,10 @@ typedef	struct extmap {
 
 static int		aflag;
 static int		dflag;
-static __uint64_t	extcount_actual;
-static __uint64_t	extcount_ideal;
+static __thread __uint64_t extcount_actual;	/* for the AG being scanned */
+static __thread __uint64_t extcount_ideal;
+static __uint64_t	total_actual;
+static __uint64_t	total_ideal;
 static int		fflag;
 static int		lflag;
 static int		qflag;
@@ -158,20 +161,18 @@ frag_f(
 	int		argc,
 	char		**argv)
 {
-	xfs_agnumber_t	agno;
 	double		answer;
 
 	if (!init(argc, argv))
 		return 0;
-	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)
-		scan_ag(agno);
-	if (extcount_actual)
-		answer = (double)(extcount_actual - extcount_ideal) * 100.0 /
-			 (double)extcount_actual;
+	agscan_run(scan_ag, NULL, 0);
+	if (total_actual)
+		answer = (double)(total_actual - total_ideal) * 100.0 /
+			 (double)total_actual;
 	else
 		answer = 0.0;
 	dbprintf(_("actual %llu, ideal %llu, fragmentation factor %.2f%%\n"),
-		extcount_actual, extcount_ideal, answer);
+		total_actual, total_ideal, answer);
 	return 0;
 }
 
@@ -217,7 +218,7 @@ init(
 	}
 	if (!aflag && !dflag && !fflag && !lflag && !qflag && !Rflag && !rflag)
 		aflag = dflag = fflag = lflag = qflag = Rflag = rflag = 1;
-	extcount_actual = extcount_ideal = 0;
+	total_actual = total_ideal = 0;
 	return 1;
 }
 
@@ -257,6 +258,9 @@ process_btinode(
 	}
 	pp = XFS_BMDR_PTR_ADDR(dib, 1,
 		xfs_bmdr_maxrecs(mp, XFS_DFORK_SIZE(dip, mp, whichfork), 0));
+	for (i = 0; i < be16_to_cpu(dib->bb_numrecs); i++)
+		libxfs_readahead(mp->m_ddev_targp,
+			XFS_FSB_TO_DADDR(mp, be64_to_cpu(pp[i])), blkbb);
 	for (i = 0; i < be16_to_cpu(dib->bb_numrecs); i++)
 		scan_lbtree(be64_to_cpu(pp[i]), be16_to_cpu(dib->bb_level), 
 			scanfunc_bmap, extmapp,
@@ -358,19 +362,20 @@ scan_ag(
 	xfs_agf_t	*agf;
 	xfs_agi_t	*agi;
 
+	extcount_actual = extcount_ideal = 0;
 	push_cur();
-	set_cur(&typtab[TYP_AGF],
+	agscan_set_cur(&typtab[TYP_AGF],
 		XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
-		XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
+		XFS_FSS_TO_BB(mp, 1), NULL);
 	if ((agf = iocur_top->data) == NULL) {
 		dbprintf(_("can't read agf block for ag %u\n"), agno);
 		pop_cur();
 		return;
 	}
 	push_cur();
-	set_cur(&typtab[TYP_AGI],
+	agscan_set_cur(&typtab[TYP_AGI],
 		XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
-		XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
+		XFS_FSS_TO_BB(mp, 1), NULL);
 	if ((agi = iocur_top->data) == NULL) {
 		dbprintf(_("can't read agi block for ag %u\n"), agno);
 		pop_cur();
@@ -381,6 +386,8 @@ scan_ag(
 			be32_to_cpu(agi->agi_level), scanfunc_ino, TYP_INOBT);
 	pop_cur();
 	pop_cur();
+	total_actual += extcount_actual;
+	total_ideal += extcount_ideal;
 }
 
 static void
@@ -392,8 +399,7 @@ scan_lbtree(
 	typnm_t		btype)
 {
 	push_cur();
-	set_cur(&typtab[btype], XFS_FSB_TO_DADDR(mp, root), blkbb, DB_RING_IGN,
-		NULL);
+	agscan_set_cur(&typtab[btype], XFS_FSB_TO_DADDR(mp, root), blkbb, NULL);
 	if (iocur_top->data == NULL) {
 		dbprintf(_("can't read btree block %u/%u\n"),
 			XFS_FSB_TO_AGNO(mp, root),
@@ -415,8 +421,8 @@ scan_sbtree(
 	xfs_agnumber_t	seqno = be32_to_cpu(agf->agf_seqno);
 
 	push_cur();
-	set_cur(&typtab[btype], XFS_AGB_TO_DADDR(mp, seqno, root),
-		blkbb, DB_RING_IGN, NULL);
+	agscan_set_cur(&typtab[btype], XFS_AGB_TO_DADDR(mp, seqno, root),
+		blkbb, NULL);
 	if (iocur_top->data == NULL) {
 		dbprintf(_("can't read btree block %u/%u\n"), seqno, root);
 		return;
@@ -456,6 +462,9 @@ scanfunc_bmap(
 		return;
 	}
 	pp = XFS_BMBT_PTR_ADDR(mp, block, 1, mp->m_bmap_dmxr[0]);
+	for (i = 0; i < nrecs; i++)
+		libxfs_readahead(mp->m_ddev_targp,
+			XFS_FSB_TO_DADDR(mp, be64_to_cpu(pp[i])), blkbb);
 	for (i = 0; i < nrecs; i++)
 		scan_lbtree(be64_to_cpu(pp[i]), level, scanfunc_bmap, extmapp, 
 									btype);
@@ -477,15 +486,21 @@ scanfunc_ino(
 
 	if (level == 0) {
 		rp = XFS_INOBT_REC_ADDR(mp, block, 1);
+		for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++) {
+			agino = be32_to_cpu(rp[i].ir_startino);
+			libxfs_readahead(mp->m_ddev_targp,
+				XFS_AGB_TO_DADDR(mp, seqno,
+						 XFS_AGINO_TO_AGBNO(mp, agino)),
+				XFS_FSB_TO_BB(mp, XFS_IALLOC_BLOCKS(mp)));
+		}
 		for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++) {
 			agino = be32_to_cpu(rp[i].ir_startino);
 			off = XFS_INO_TO_OFFSET(mp, agino);
 			push_cur();
-			set_cur(&typtab[TYP_INODE],
+			agscan_set_cur(&typtab[TYP_INODE],
 				XFS_AGB_TO_DADDR(mp, seqno,
 						 XFS_AGINO_TO_AGBNO(mp, agino)),
-				XFS_FSB_TO_BB(mp, XFS_IALLOC_BLOCKS(mp)),
-				DB_RING_IGN, NULL);
+				XFS_FSB_TO_BB(mp, XFS_IALLOC_BLOCKS(mp)), NULL);
 			if (iocur_top->data == NULL) {
 				dbprintf(_("can't read inode block %u/%u\n"),
 					seqno, XFS_AGINO_TO_AGBNO(mp, agino));
@@ -503,6 +518,9 @@ scanfunc_ino(
 		return;
 	}
 	pp = XFS_INOBT_PTR_ADDR(mp, block, 1, mp->m_inobt_mxr[1]);
+	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
+		libxfs_readahead(mp->m_ddev_targp,
+			XFS_AGB_TO_DADDR(mp, seqno, be32_to_cpu(pp[i])), blkbb);
 	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
 		scan_sbtree(agf, be32_to_cpu(pp[i]), level, scanfunc_ino, 
 								TYP_INOBT);
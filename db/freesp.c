@@ -17,6 +17,7 @@
  */
 
 #include <xfs/libxfs.h>
+#include "agscan.h"
 #include "command.h"
 #include "freesp.h"
 #include "io.h"
@@ -92,18 +93,13 @@ freesp_f(
 	int		argc,
 	char		**argv)
 {
-	xfs_agnumber_t	agno;
-
 	if (!init(argc, argv))
 		return 0;
 
 	if (dumpflag)
 		dbprintf("%8s %8s %8s\n", "agno", "agbno", "len");
 
-	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)  {
-		if (inaglist(agno))
-			scan_ag(agno);
-	}
+	agscan_run(scan_ag, NULL, 0);
 	if (histcount)
 		printhist();
 	if (summaryflag) {
@@ -211,9 +207,12 @@ scan_ag(
 {
 	xfs_agf_t	*agf;
 
+	if (!inaglist(agno))
+		return;
 	push_cur();
-	set_cur(&typtab[TYP_AGF], XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
-				XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
+	agscan_set_cur(&typtab[TYP_AGF],
+		XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
+		XFS_FSS_TO_BB(mp, 1), NULL);
 	agf = iocur_top->data;
 	scan_freelist(agf);
 	if (countflag)
@@ -240,8 +239,9 @@ scan_freelist(
 	if (be32_to_cpu(agf->agf_flcount) == 0)
 		return;
 	push_cur();
-	set_cur(&typtab[TYP_AGFL], XFS_AG_DADDR(mp, seqno, XFS_AGFL_DADDR(mp)),
-				XFS_FSS_TO_BB(mp, 1), DB_RING_IGN, NULL);
+	agscan_set_cur(&typtab[TYP_AGFL],
+		XFS_AG_DADDR(mp, seqno, XFS_AGFL_DADDR(mp)),
+		XFS_FSS_TO_BB(mp, 1), NULL);
 	agfl = iocur_top->data;
 	i = be32_to_cpu(agf->agf_flfirst);
 
@@ -283,8 +283,8 @@ scan_sbtree(
 	xfs_agnumber_t	seqno = be32_to_cpu(agf->agf_seqno);
 
 	push_cur();
-	set_cur(&typtab[typ], XFS_AGB_TO_DADDR(mp, seqno, root),
-		blkbb, DB_RING_IGN, NULL);
+	agscan_set_cur(&typtab[typ], XFS_AGB_TO_DADDR(mp, seqno, root),
+		blkbb, NULL);
 	if (iocur_top->data == NULL) {
 		dbprintf(_("can't read btree block %u/%u\n"), seqno, root);
 		return;
@@ -318,6 +318,10 @@ scanfunc_bno(
 		return;
 	}
 	pp = XFS_ALLOC_PTR_ADDR(mp, block, 1, mp->m_alloc_mxr[1]);
+	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
+		libxfs_readahead(mp->m_ddev_targp,
+			XFS_AGB_TO_DADDR(mp, be32_to_cpu(agf->agf_seqno),
+					 be32_to_cpu(pp[i])), blkbb);
 	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
 		scan_sbtree(agf, be32_to_cpu(pp[i]), typ, level, scanfunc_bno);
 }
@@ -346,6 +350,10 @@ scanfunc_cnt(
 		return;
 	}
 	pp = XFS_ALLOC_PTR_ADDR(mp, block, 1, mp->m_alloc_mxr[1]);
+	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
+		libxfs_readahead(mp->m_ddev_targp,
+			XFS_AGB_TO_DADDR(mp, be32_to_cpu(agf->agf_seqno),
+					 be32_to_cpu(pp[i])), blkbb);
 	for (i = 0; i < be16_to_cpu(block->bb_numrecs); i++)
 		scan_sbtree(agf, be32_to_cpu(pp[i]), typ, level, scanfunc_cnt);
 }
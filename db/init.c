@@ -44,7 +44,7 @@ static void
 usage(void)
 {
 	fprintf(stderr, _(
-		"Usage: %s [-ifFrxV] [-p prog] [-l logdev] [-c cmd]... device\n"
+		"Usage: %s [-ifFmrxV] [-p prog] [-l logdev] [-c cmd]... device\n"
 		), progname);
 	exit(1);
 }
@@ -63,7 +63,7 @@ init(
 	textdomain(PACKAGE);
 
 	progname = basename(argv[0]);
-	while ((c = getopt(argc, argv, "c:fFip:rxVl:")) != EOF) {
+	while ((c = getopt(argc, argv, "c:fFimp:rxVl:")) != EOF) {
 		switch (c) {
 		case 'c':
 			cmdline = xrealloc(cmdline, (ncmdline+1)*sizeof(char*));
@@ -78,6 +78,10 @@ init(
 		case 'i':
 			x.isreadonly = (LIBXFS_ISREADONLY|LIBXFS_ISINACTIVE);
 			break;
+		case 'm':
+			x.disfile = 1;
+			x.dismetadump = 1;
+			break;
 		case 'p':
 			progname = optarg;
 			break;
@@ -103,6 +107,10 @@ init(
 		/*NOTREACHED*/
 	}
 
+	/* metadump images are never written to */
+	if (x.dismetadump)
+		x.isreadonly |= LIBXFS_ISREADONLY;
+
 	fsdevice = argv[optind];
 	if (!x.disfile)
 		x.volname = fsdevice;
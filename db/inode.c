@@ -624,37 +624,30 @@ inode_u_symlink_count(
 }
 
 /*
- * We are now using libxfs for our IO backend, so we should always try to use
- * inode cluster buffers rather than filesystem block sized buffers for reading
- * inodes. This means that we always use the same buffers as libxfs operations
- * does, and that avoids buffer cache issues caused by overlapping buffers. This
- * can be seen clearly when trying to read the root inode. Much of this logic is
- * similar to libxfs_imap().
+ * Find the cluster buffer holding an inode, and the inode's index in it.
+ * Returns 0 if the inode number is bad.
  */
-void
-set_cur_inode(
-	xfs_ino_t	ino)
+int
+inode_cluster(
+	xfs_ino_t	ino,
+	__int64_t	*daddr,
+	int		*count,
+	int		*offset)
 {
 	xfs_agblock_t	agbno;
 	xfs_agino_t	agino;
 	xfs_agnumber_t	agno;
-	xfs_dinode_t	*dip;
-	int		offset;
 	int		numblks = blkbb;
 	xfs_agblock_t	cluster_agbno;
 
-
 	agno = XFS_INO_TO_AGNO(mp, ino);
 	agino = XFS_INO_TO_AGINO(mp, ino);
 	agbno = XFS_AGINO_TO_AGBNO(mp, agino);
-	offset = XFS_AGINO_TO_OFFSET(mp, agino);
+	*offset = XFS_AGINO_TO_OFFSET(mp, agino);
 	if (agno >= mp->m_sb.sb_agcount || agbno >= mp->m_sb.sb_agblocks ||
-	    offset >= mp->m_sb.sb_inopblock ||
-	    XFS_AGINO_TO_INO(mp, agno, agino) != ino) {
-		dbprintf(_("bad inode number %lld\n"), ino);
-		return;
-	}
-	cur_agno = agno;
+	    *offset >= mp->m_sb.sb_inopblock ||
+	    XFS_AGINO_TO_INO(mp, agno, agino) != ino)
+		return 0;
 
 	if (mp->m_inode_cluster_size > mp->m_sb.sb_blocksize &&
 	    mp->m_inoalign_mask) {
@@ -668,20 +661,26 @@ set_cur_inode(
 		chunk_agbno = agbno - offset_agbno;
 		cluster_agbno = chunk_agbno +
 			((offset_agbno / blks_per_cluster) * blks_per_cluster);
-		offset += ((agbno - cluster_agbno) * mp->m_sb.sb_inopblock);
+		*offset += ((agbno - cluster_agbno) * mp->m_sb.sb_inopblock);
 		numblks = XFS_FSB_TO_BB(mp, blks_per_cluster);
 	} else
 		cluster_agbno = agbno;
 
-	/*
-	 * First set_cur to the block with the inode
-	 * then use off_cur to get the right part of the buffer.
-	 */
-	ASSERT(typtab[TYP_INODE].typnm == TYP_INODE);
+	*daddr = XFS_AGB_TO_DADDR(mp, agno, cluster_agbno);
+	*count = numblks;
+	return 1;
+}
+
+/*
+ * Point the current cluster buffer at one of its inodes.
+ */
+void
+off_cur_inode(
+	xfs_ino_t	ino,
+	int		offset)
+{
+	xfs_dinode_t	*dip;
 
-	/* ingore ring update here, do it explicitly below */
-	set_cur(&typtab[TYP_INODE], XFS_AGB_TO_DADDR(mp, agno, cluster_agbno),
-		numblks, DB_RING_IGN, NULL);
 	off_cur(offset << mp->m_sb.sb_inodelog, mp->m_sb.sb_inodesize);
 	dip = iocur_top->data;
 	iocur_top->ino_crc_ok = libxfs_dinode_verify(mp, ino, dip);
@@ -690,6 +689,39 @@ set_cur_inode(
 	iocur_top->mode = be16_to_cpu(dip->di_mode);
 	if ((iocur_top->mode & S_IFMT) == S_IFDIR)
 		iocur_top->dirino = ino;
+}
+
+/*
+ * We are now using libxfs for our IO backend, so we should always try to use
+ * inode cluster buffers rather than filesystem block sized buffers for reading
+ * inodes. This means that we always use the same buffers as libxfs operations
+ * does, and that avoids buffer cache issues caused by overlapping buffers. This
+ * can be seen clearly when trying to read the root inode. Much of this logic is
+ * similar to libxfs_imap().
+ */
+void
+set_cur_inode(
+	xfs_ino_t	ino)
+{
+	__int64_t	daddr;
+	int		numblks;
+	int		offset;
+
+	if (!inode_cluster(ino, &daddr, &numblks, &offset)) {
+		dbprintf(_("bad inode number %lld\n"), ino);
+		return;
+	}
+	cur_agno = XFS_INO_TO_AGNO(mp, ino);
+
+	/*
+	 * First set_cur to the block with the inode
+	 * then use off_cur to get the right part of the buffer.
+	 */
+	ASSERT(typtab[TYP_INODE].typnm == TYP_INODE);
+
+	/* ingore ring update here, do it explicitly below */
+	set_cur(&typtab[TYP_INODE], daddr, numblks, DB_RING_IGN, NULL);
+	off_cur_inode(ino, offset);
 
 	/* track updated info in ring */
 	ring_add();
@@ -29,8 +29,11 @@ extern const struct field	timestamp_flds[];
 extern int	fp_dinode_fmt(void *obj, int bit, int count, char *fmtstr,
 			      int size, int arg, int base, int array);
 extern int	inode_a_size(void *obj, int startoff, int idx);
+extern int	inode_cluster(xfs_ino_t ino, __int64_t *daddr, int *count,
+			      int *offset);
 extern void	inode_init(void);
 extern typnm_t	inode_next_type(void);
 extern int	inode_size(void *obj, int startoff, int idx);
 extern int	inode_u_size(void *obj, int startoff, int idx);
+extern void	off_cur_inode(xfs_ino_t ino, int offset);
 extern void	set_cur_inode(xfs_ino_t ino);
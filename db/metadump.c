@@ -56,7 +56,7 @@ static void	metadump_help(void);
 
 static const cmdinfo_t	metadump_cmd =
 	{ "metadump", NULL, metadump_f, 0, -1, 0,
-		N_("[-e] [-g] [-m max_extent] [-w] [-o] filename"),
+		N_("[-e] [-g] [-i base] [-m max_extent] [-s] [-w] [-o] filename"),
 		N_("dump metadata to a file"), metadump_help };
 
 static FILE		*outf;		/* metadump file */
@@ -74,9 +74,23 @@ static int		show_progress = 0;
 static int		stop_on_read_error = 0;
 static int		max_extent_size = DEFAULT_MAX_EXT_SIZE;
 static int		dont_obfuscate = 0;
+static int		stable_names = 0;
 static int		show_warnings = 0;
 static int		progress_since_warning = 0;
 
+/* earlier dumps for an incremental dump, oldest first */
+#define MAX_BASE_DUMPS		32
+static struct {
+	char			*name;
+	int			fd;
+	struct xfs_mdmap	*md;
+} base[MAX_BASE_DUMPS];
+static int		nbase;
+static char		*base_buf;	/* newest earlier copy of a segment */
+static int		*base_owner;	/* which dump each sector came from */
+static int		base_buf_len;	/* in sectors */
+static __uint64_t	base_skipped;
+
 void
 metadump_init(void)
 {
@@ -94,8 +108,12 @@ metadump_help(void)
 " Options:\n"
 "   -e -- Ignore read errors and keep going\n"
 "   -g -- Display dump progress\n"
+"   -i -- Only dump blocks that differ from an earlier dump; give -i once\n"
+"         for the full dump and again for each later incremental, in order\n"
 "   -m -- Specify max extent size in blocks to copy (default = %d blocks)\n"
 "   -o -- Don't obfuscate names and extended attributes\n"
+"   -s -- Obfuscate names the same way in every dump, so that the dump\n"
+"         can be the base of an incremental dump (implied by -i)\n"
 "   -w -- Show warnings of bad metadata information\n"
 "\n"), DEFAULT_MAX_EXT_SIZE);
 }
@@ -166,6 +184,100 @@ write_index(void)
 	return 0;
 }
 
+/* how names are written to this dump, for mb_info */
+static __uint8_t
+metadump_info(void)
+{
+	if (dont_obfuscate)
+		return XFS_METADUMP_INFO_FLAGS;
+	if (stable_names)
+		return XFS_METADUMP_INFO_FLAGS | XFS_METADUMP_OBFUSCATED |
+		       XFS_METADUMP_STABLE;
+	return XFS_METADUMP_INFO_FLAGS | XFS_METADUMP_OBFUSCATED;
+}
+
+/*
+ * Names in an incremental dump only match those in its base if both were
+ * written the same way, and if obfuscated, reproducibly.  Otherwise
+ * nearly every directory and attribute block differs and the dump ends
+ * up almost as big as a full one, so refuse such a base.
+ */
+static int
+base_names_match(
+	int			b)
+{
+	xfs_metablock_t		mb;
+	__uint8_t		want = metadump_info();
+
+	if (pread64(base[b].fd, &mb, sizeof(mb), 0) != sizeof(mb)) {
+		print_warning("cannot read base dump file %s", base[b].name);
+		return 0;
+	}
+	if (!(mb.mb_info & XFS_METADUMP_INFO_FLAGS) ||
+	    (mb.mb_info & XFS_METADUMP_OBFUSCATED) !=
+				(want & XFS_METADUMP_OBFUSCATED) ||
+	    (mb.mb_info & XFS_METADUMP_STABLE) !=
+				(want & XFS_METADUMP_STABLE)) {
+		print_warning("base dump file %s was not made with %s",
+				base[b].name, dont_obfuscate ? "-o" : "-s");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * For an incremental dump, work out which earlier dump holds the newest
+ * copy of each sector in this range and read each sector from that dump
+ * only, one read per run of sectors that share it.  base_owner[] is left
+ * holding the dump index for each sector, or -1 if no dump has it.
+ *
+ * Return 0 for success, errno for failure.
+ */
+static int
+read_base_segment(
+	__int64_t	off,
+	int		len)
+{
+	int		i;
+	int		j;
+	int		b;
+	int		ret;
+	char		*p;
+	int		*o;
+
+	if (len > base_buf_len) {
+		p = realloc(base_buf, BBTOB(len));
+		if (!p)
+			return ENOMEM;
+		base_buf = p;
+		o = realloc(base_owner, len * sizeof(*base_owner));
+		if (!o)
+			return ENOMEM;
+		base_owner = o;
+		base_buf_len = len;
+	}
+
+	for (i = 0; i < len; i++) {
+		for (b = nbase - 1; b >= 0; b--)
+			if (libxfs_mdmap_mapped(base[b].md, off + i))
+				break;
+		base_owner[i] = b;
+	}
+
+	for (i = 0; i < len; i = j) {
+		for (j = i + 1; j < len && base_owner[j] == base_owner[i]; j++)
+			;
+		if (base_owner[i] < 0)
+			continue;
+		ret = libxfs_mdmap_read(base[base_owner[i]].md,
+					base_buf + BBTOB(i), BBTOB(j - i),
+					LIBXFS_BBTOOFF64(off + i));
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
 /*
  * Return 0 for success, -errno for failure.
  */
@@ -178,7 +290,23 @@ write_buf_segment(
 	int		i;
 	int		ret;
 
+	/*
+	 * For an incremental dump, leave out every sector that matches the
+	 * newest copy held by the earlier dumps.  The primary superblock is
+	 * always written as it has to lead the dump.
+	 */
+	if (nbase) {
+		ret = read_base_segment(off, len);
+		if (ret)
+			return -ret;
+	}
+
 	for (i = 0; i < len; i++, off++, data += BBSIZE) {
+		if (nbase && base_owner[i] >= 0 && off != XFS_SB_DADDR &&
+		    !memcmp(data, base_buf + BBTOB(i), BBSIZE)) {
+			base_skipped++;
+			continue;
+		}
 		block_index[cur_index] = cpu_to_be64(off);
 		memcpy(&block_buffer[cur_index << BBSHIFT], data, BBSIZE);
 		if (++cur_index == num_indicies) {
@@ -398,28 +526,52 @@ copy_free_cnt_btree(
 
 /* filename and extended attribute obfuscation routines */
 
+/*
+ * The name table holds the names already used in the directory (or
+ * attribute fork) being obfuscated.  It is cleared for every inode, and a
+ * single directory can hold millions of names, so it is an open-addressed
+ * table that grows as needed and is cleared in constant time by bumping a
+ * generation number.  The names themselves are packed into one buffer
+ * which is simply rewound when the table is cleared.
+ */
 struct name_ent {
-	struct name_ent		*next;
+	__uint32_t		gen;	/* entry is live if == nametable.gen */
 	xfs_dahash_t		hash;
 	int			namelen;
-	uchar_t			name[1];
+	size_t			name;	/* offset of name in nametable.names */
 };
 
-#define NAME_TABLE_SIZE		4096
+#define NAME_TABLE_MIN		4096	/* initial slots, power of 2 */
 
-static struct name_ent		*nametable[NAME_TABLE_SIZE];
+static struct {
+	struct name_ent		*ents;
+	__uint32_t		size;	/* number of slots */
+	__uint32_t		count;	/* live entries */
+	__uint32_t		gen;
+	uchar_t			*names;
+	size_t			names_len;
+	size_t			names_size;
+} nametable;
+
+static inline __uint32_t
+nametable_slot(xfs_dahash_t hash)
+{
+	/* names sharing a directory hash are rare; spread the rest */
+	return (hash * 0x9e3779b1U) & (nametable.size - 1);
+}
 
 static void
 nametable_clear(void)
 {
-	int		i;
-	struct name_ent	*ent;
-
-	for (i = 0; i < NAME_TABLE_SIZE; i++) {
-		while ((ent = nametable[i])) {
-			nametable[i] = ent->next;
-			free(ent);
-		}
+	if (!nametable.count)
+		return;
+	nametable.count = 0;
+	nametable.names_len = 0;
+	if (++nametable.gen == 0) {
+		/* generation wrapped, stale entries would look live */
+		memset(nametable.ents, 0,
+			nametable.size * sizeof(struct name_ent));
+		nametable.gen = 1;
 	}
 }
 
@@ -431,13 +583,48 @@ static struct name_ent *
 nametable_find(xfs_dahash_t hash, int namelen, uchar_t *name)
 {
 	struct name_ent	*ent;
+	__uint32_t	i;
 
-	for (ent = nametable[hash % NAME_TABLE_SIZE]; ent; ent = ent->next) {
+	if (!nametable.count)
+		return NULL;
+
+	for (i = nametable_slot(hash); ; i = (i + 1) & (nametable.size - 1)) {
+		ent = &nametable.ents[i];
+		if (ent->gen != nametable.gen)
+			return NULL;
 		if (ent->hash == hash && ent->namelen == namelen &&
-				!memcmp(ent->name, name, namelen))
+				!memcmp(nametable.names + ent->name, name,
+					namelen))
 			return ent;
 	}
-	return NULL;
+}
+
+static int
+nametable_grow(void)
+{
+	struct name_ent	*old = nametable.ents;
+	__uint32_t	old_size = nametable.size;
+	__uint32_t	i;
+	__uint32_t	j;
+
+	nametable.size = old_size ? old_size * 2 : NAME_TABLE_MIN;
+	nametable.ents = calloc(nametable.size, sizeof(struct name_ent));
+	if (!nametable.ents) {
+		nametable.ents = old;
+		nametable.size = old_size;
+		return 0;
+	}
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].gen != nametable.gen)
+			continue;
+		j = nametable_slot(old[i].hash);
+		while (nametable.ents[j].gen == nametable.gen)
+			j = (j + 1) & (nametable.size - 1);
+		nametable.ents[j] = old[i];
+	}
+	free(old);
+	return 1;
 }
 
 /*
@@ -448,17 +635,38 @@ static struct name_ent *
 nametable_add(xfs_dahash_t hash, int namelen, uchar_t *name)
 {
 	struct name_ent	*ent;
+	__uint32_t	i;
 
-	ent = malloc(sizeof *ent + namelen);
-	if (!ent)
+	if (!nametable.gen)
+		nametable.gen = 1;
+
+	/* keep the table at most half full so probe chains stay short */
+	if ((nametable.count + 1) * 2 > nametable.size && !nametable_grow())
 		return NULL;
 
-	ent->namelen = namelen;
-	memcpy(ent->name, name, namelen);
-	ent->hash = hash;
-	ent->next = nametable[hash % NAME_TABLE_SIZE];
+	if (nametable.names_len + namelen > nametable.names_size) {
+		size_t	size = max(nametable.names_size * 2,
+				   nametable.names_len + namelen + 65536);
+		uchar_t	*names = realloc(nametable.names, size);
+
+		if (!names)
+			return NULL;
+		nametable.names = names;
+		nametable.names_size = size;
+	}
 
-	nametable[hash % NAME_TABLE_SIZE] = ent;
+	i = nametable_slot(hash);
+	while (nametable.ents[i].gen == nametable.gen)
+		i = (i + 1) & (nametable.size - 1);
+
+	ent = &nametable.ents[i];
+	ent->gen = nametable.gen;
+	ent->hash = hash;
+	ent->namelen = namelen;
+	ent->name = nametable.names_len;
+	memcpy(nametable.names + nametable.names_len, name, namelen);
+	nametable.names_len += namelen;
+	nametable.count++;
 
 	return ent;
 }
@@ -466,6 +674,23 @@ nametable_add(xfs_dahash_t hash, int namelen, uchar_t *name)
 #define is_invalid_char(c)	((c) == '/' || (c) == '\0')
 #define rol32(x,y)		(((x) << (y)) | ((x) >> (32 - (y))))
 
+/*
+ * With stable_names set, obfuscated names are drawn from a generator that
+ * is reseeded from the inode number for every inode, so an inode that has
+ * not changed produces exactly the same blocks every time it is dumped.
+ * Incremental dumps rely on this to recognise unchanged directory and
+ * attribute blocks.  Otherwise names come from random() as they always
+ * have.
+ */
+static __uint64_t	name_seed;
+
+static inline void
+seed_filename_chars(xfs_ino_t ino)
+{
+	if (stable_names)
+		name_seed = (ino + 1) * 0x9e3779b97f4a7c15ULL;
+}
+
 static inline uchar_t
 random_filename_char(void)
 {
@@ -473,7 +698,16 @@ random_filename_char(void)
 						"abcdefghijklmnopqrstuvwxyz"
 						"0123456789-_";
 
-	return filename_alphabet[random() % (sizeof filename_alphabet - 1)];
+	if (!stable_names)
+		return filename_alphabet[random() %
+					 (sizeof filename_alphabet - 1)];
+
+	/* xorshift64* */
+	name_seed ^= name_seed >> 12;
+	name_seed ^= name_seed << 25;
+	name_seed ^= name_seed >> 27;
+	return filename_alphabet[((name_seed * 0x2545f4914f6cdd1dULL) >> 32) %
+				 (sizeof filename_alphabet - 1)];
 }
 
 #define	ORPHANAGE	"lost+found"
@@ -1766,6 +2000,7 @@ process_inode(
 
 	success = 1;
 	cur_ino = XFS_AGINO_TO_INO(mp, agno, agino);
+	seed_filename_chars(cur_ino);
 
 	/* we only care about crc recalculation if we are obfuscating names. */
 	if (!dont_obfuscate) {
@@ -2192,11 +2427,13 @@ metadump_f(
 	int		c;
 	int		start_iocur_sp;
 	char		*p;
+	int		b;
 
 	exitcode = 1;
 	show_progress = 0;
 	show_warnings = 0;
 	stop_on_read_error = 0;
+	stable_names = 0;
 
 	if (mp->m_sb.sb_magicnum != XFS_SB_MAGIC) {
 		print_warning("bad superblock magic number %x, giving up",
@@ -2204,7 +2441,7 @@ metadump_f(
 		return 0;
 	}
 
-	while ((c = getopt(argc, argv, "egm:ow")) != EOF) {
+	while ((c = getopt(argc, argv, "egi:m:osw")) != EOF) {
 		switch (c) {
 			case 'e':
 				stop_on_read_error = 1;
@@ -2212,38 +2449,66 @@ metadump_f(
 			case 'g':
 				show_progress = 1;
 				break;
+			case 'i':
+				if (nbase == MAX_BASE_DUMPS) {
+					print_warning("too many base dumps");
+					goto out_base;
+				}
+				base[nbase].fd = -1;
+				base[nbase++].name = optarg;
+				stable_names = 1;
+				break;
 			case 'm':
 				max_extent_size = (int)strtol(optarg, &p, 0);
 				if (*p != '\0' || max_extent_size <= 0) {
 					print_warning("bad max extent size %s",
 							optarg);
-					return 0;
+					goto out_base;
 				}
 				break;
 			case 'o':
 				dont_obfuscate = 1;
 				break;
+			case 's':
+				stable_names = 1;
+				break;
 			case 'w':
 				show_warnings = 1;
 				break;
 			default:
 				print_warning("bad option for metadump command");
-				return 0;
+				goto out_base;
 		}
 	}
 
 	if (optind != argc - 1) {
 		print_warning("too few options for metadump (no filename given)");
-		return 0;
+		goto out_base;
+	}
+
+	base_skipped = 0;
+	for (b = 0; b < nbase; b++) {
+		base[b].fd = open(base[b].name, O_RDONLY);
+		if (base[b].fd < 0) {
+			print_warning("cannot open base dump file %s: %s",
+					base[b].name, strerror(errno));
+			goto out_base;
+		}
+		base[b].md = libxfs_mdmap_open(base[b].fd, base[b].name);
+		if (!base[b].md)
+			goto out_base;
+		if (!base_names_match(b))
+			goto out_base;
 	}
 
 	metablock = (xfs_metablock_t *)calloc(BBSIZE + 1, BBSIZE);
 	if (metablock == NULL) {
 		print_warning("memory allocation failure");
-		return 0;
+		goto out_base;
 	}
 	metablock->mb_blocklog = BBSHIFT;
 	metablock->mb_magic = cpu_to_be32(XFS_MD_MAGIC);
+	metablock->mb_info = metadump_info();
 
 	block_index = (__be64 *)((char *)metablock + sizeof(xfs_metablock_t));
 	block_buffer = (char *)metablock + BBSIZE;
@@ -2255,7 +2520,7 @@ metadump_f(
 		if (isatty(fileno(stdout))) {
 			print_warning("cannot write to a terminal");
 			free(metablock);
-			return 0;
+			goto out_base;
 		}
 		outf = stdout;
 	} else {
@@ -2263,7 +2528,7 @@ metadump_f(
 		if (outf == NULL) {
 			print_warning("cannot create dump file");
 			free(metablock);
-			return 0;
+			goto out_base;
 		}
 	}
 
@@ -2291,6 +2556,11 @@ metadump_f(
 	if (progress_since_warning)
 		fputc('\n', (outf == stdout) ? stderr : stdout);
 
+	if (nbase && show_progress)
+		fprintf((outf == stdout) ? stderr : stdout,
+			_("%llu unchanged sectors not dumped\n"),
+			(unsigned long long)base_skipped);
+
 	if (outf != stdout)
 		fclose(outf);
 
@@ -2300,5 +2570,19 @@ metadump_f(
 
 	free(metablock);
 
+out_base:
+	for (b = 0; b < nbase; b++) {
+		if (base[b].md)
+			libxfs_mdmap_close(base[b].md);
+		if (base[b].fd >= 0)
+			close(base[b].fd);
+	}
+	memset(base, 0, sizeof(base));
+	nbase = 0;
+	free(base_buf);
+	free(base_owner);
+	base_buf = NULL;
+	base_owner = NULL;
+	base_buf_len = 0;
 	return 0;
 }
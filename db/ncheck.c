@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxfs.h>
+#include "bmap.h"
+#include "io.h"
+#include "type.h"
+#include "fprint.h"
+#include "faddr.h"
+#include "field.h"
+#include "inode.h"
+#include "ncheck.h"
+#include "output.h"
+#include "sig.h"
+#include "init.h"
+#include "malloc.h"
+
+/*
+ * ncheck without blockget: walk the directory tree depth first from the
+ * root and print each name as it is found.
+ *
+ * Memory only grows with the depth of the tree.  Each directory being
+ * walked keeps its current block (or, for shortform directories, its
+ * inode) on the I/O stack together with its data fork mapping, and the
+ * path is a single buffer that names are pushed onto and popped off.
+ */
+
+typedef struct nframe {
+	xfs_ino_t	ino;
+	int		pathlen;	/* length of this directory's path */
+	int		local;		/* shortform, entries are in the inode */
+	bmap_ext_t	*ext;		/* data fork mapping */
+	int		nex;
+	int		exti;		/* first extent not yet passed */
+	xfs_dfiloff_t	dabno;		/* current directory block */
+	int		off;		/* next entry in the block or inode */
+	int		idx;		/* ... and its index, if shortform */
+	int		valid;		/* the I/O stack holds the block */
+} nframe_t;
+
+typedef struct nent {
+	xfs_ino_t	ino;
+	char		*name;
+	int		namelen;
+	int		ftype;
+} nent_t;
+
+static int		ncheck_cur_inode(xfs_ino_t ino);
+static int		ncheck_next(nframe_t *f, nent_t *ent);
+static int		ncheck_next_block(nframe_t *f);
+static int		ncheck_push(xfs_ino_t ino, int pathlen);
+
+static nframe_t		*frames;
+static int		nframes;
+static int		maxframes;
+static bmap_ext_t	*pieces;
+
+/*
+ * Point the top of the I/O stack at an inode, without adding it to the
+ * position ring.
+ */
+static int
+ncheck_cur_inode(
+	xfs_ino_t	ino)
+{
+	__int64_t	daddr;
+	int		count;
+	int		offset;
+
+	if (!inode_cluster(ino, &daddr, &count, &offset))
+		return 0;
+	set_cur(&typtab[TYP_INODE], daddr, count, DB_RING_IGN, NULL);
+	if (iocur_top->data == NULL)
+		return 0;
+	off_cur_inode(ino, offset);
+	return 1;
+}
+
+/*
+ * Start walking a directory.
+ */
+static int
+ncheck_push(
+	xfs_ino_t	ino,
+	int		pathlen)
+{
+	xfs_dinode_t	*dip;
+	nframe_t	*f;
+
+	push_cur();
+	if (!ncheck_cur_inode(ino) ||
+	    (iocur_top->mode & S_IFMT) != S_IFDIR) {
+		pop_cur();
+		return 0;
+	}
+	if (nframes == maxframes) {
+		maxframes = maxframes ? maxframes * 2 : 64;
+		frames = xrealloc(frames, maxframes * sizeof(*frames));
+	}
+	f = &frames[nframes++];
+	memset(f, 0, sizeof(*f));
+	f->ino = ino;
+	f->pathlen = pathlen;
+	f->dabno = NULLDFILOFF;
+	dip = iocur_top->data;
+	switch (dip->di_format) {
+	case XFS_DINODE_FMT_LOCAL:
+		f->local = 1;
+		f->off = (char *)xfs_dir2_sf_firstentry(
+			(struct xfs_dir2_sf_hdr *)XFS_DFORK_DPTR(dip)) -
+			(char *)XFS_DFORK_DPTR(dip);
+		f->valid = 1;
+		break;
+	case XFS_DINODE_FMT_EXTENTS:
+	case XFS_DINODE_FMT_BTREE:
+		f->nex = be32_to_cpu(dip->di_nextents);
+		if (f->nex <= 0)
+			break;
+		f->ext = xmalloc(f->nex * sizeof(*f->ext));
+		bmap(0, mp->m_dirleafblk, XFS_DATA_FORK, &f->nex, f->ext);
+		break;
+	}
+	return 1;
+}
+
+/*
+ * Move a directory on to its next data block.  Returns 0 at the end.
+ */
+static int
+ncheck_next_block(
+	nframe_t	*f)
+{
+	struct xfs_dir2_data_hdr *hdr;
+	bbmap_t		bbmap;
+	bmap_ext_t	*e;
+	xfs_dfiloff_t	da;
+	xfs_dfiloff_t	end;
+	xfs_dfiloff_t	s;
+	int		bs = mp->m_dirblkfsbs;
+	int		len;
+	int		n;
+	int		j;
+
+	da = f->dabno == NULLDFILOFF ? 0 : f->dabno + bs;
+	for (;;) {
+		while (f->exti < f->nex &&
+		       f->ext[f->exti].startoff + f->ext[f->exti].blockcount <=
+				da)
+			f->exti++;
+		if (f->exti >= f->nex)
+			return 0;
+		e = &f->ext[f->exti];
+		if (da < e->startoff)
+			da = e->startoff - e->startoff % bs;
+		if (da >= mp->m_dirleafblk)
+			return 0;
+
+		/* gather the pieces of the block; skip it if any are missing */
+		for (j = f->exti, n = len = 0;
+		     j < f->nex && f->ext[j].startoff < da + bs; j++) {
+			e = &f->ext[j];
+			if (e->startoff + e->blockcount <= da)
+				continue;
+			s = max(e->startoff, da);
+			end = min(e->startoff + e->blockcount, da + bs);
+			pieces[n].startblock = e->startblock + (s - e->startoff);
+			pieces[n].blockcount = end - s;
+			len += end - s;
+			n++;
+		}
+		f->dabno = da;
+		if (len == bs) {
+			if (n > 1)
+				make_bbmap(&bbmap, n, pieces);
+			set_cur(&typtab[TYP_DIR2],
+				XFS_FSB_TO_DADDR(mp, pieces[0].startblock),
+				bs * blkbb, DB_RING_IGN, n > 1 ? &bbmap : NULL);
+			hdr = iocur_top->data;
+			if (hdr &&
+			    (hdr->magic == cpu_to_be32(XFS_DIR2_BLOCK_MAGIC) ||
+			     hdr->magic == cpu_to_be32(XFS_DIR3_BLOCK_MAGIC) ||
+			     hdr->magic == cpu_to_be32(XFS_DIR2_DATA_MAGIC) ||
+			     hdr->magic == cpu_to_be32(XFS_DIR3_DATA_MAGIC))) {
+				f->off = (char *)xfs_dir3_data_unused_p(hdr) -
+					 (char *)hdr;
+				f->valid = 1;
+				return 1;
+			}
+		}
+		da += bs;
+	}
+}
+
+/*
+ * Get the next entry of a directory.  Returns 0 at the end; a damaged
+ * block or inode just ends the walk of that part of the directory early.
+ */
+static int
+ncheck_next(
+	nframe_t			*f,
+	nent_t				*ent)
+{
+	struct xfs_dir2_sf_hdr		*sf;
+	struct xfs_dir2_data_hdr	*hdr;
+	xfs_dir2_sf_entry_t		*sfe;
+	xfs_dir2_data_entry_t		*dep;
+	xfs_dir2_data_unused_t		*dup;
+	xfs_dinode_t			*dip;
+	char				*endptr;
+	char				*ptr;
+
+	if (f->local) {
+		dip = iocur_top->data;
+		sf = (struct xfs_dir2_sf_hdr *)XFS_DFORK_DPTR(dip);
+		if (f->idx >= sf->count)
+			return 0;
+		sfe = (xfs_dir2_sf_entry_t *)((char *)sf + f->off);
+		if (f->off + xfs_dir3_sf_entsize(mp, sf, sfe->namelen) >
+				be64_to_cpu(dip->di_size) ||
+		    f->off + xfs_dir3_sf_entsize(mp, sf, sfe->namelen) >
+				XFS_DFORK_DSIZE(dip, mp))
+			return 0;
+		ent->ino = xfs_dir3_sfe_get_ino(mp, sf, sfe);
+		ent->name = (char *)sfe->name;
+		ent->namelen = sfe->namelen;
+		ent->ftype = xfs_dir3_sfe_get_ftype(mp, sf, sfe);
+		f->off += xfs_dir3_sf_entsize(mp, sf, sfe->namelen);
+		f->idx++;
+		return 1;
+	}
+
+	for (;;) {
+		if (!f->valid && !ncheck_next_block(f))
+			return 0;
+		hdr = iocur_top->data;
+		if (hdr->magic == cpu_to_be32(XFS_DIR2_BLOCK_MAGIC) ||
+		    hdr->magic == cpu_to_be32(XFS_DIR3_BLOCK_MAGIC)) {
+			endptr = (char *)xfs_dir2_block_leaf_p(
+					xfs_dir2_block_tail_p(mp, hdr));
+			if (endptr > (char *)hdr + mp->m_dirblksize)
+				endptr = (char *)hdr + mp->m_dirblksize;
+		} else
+			endptr = (char *)hdr + mp->m_dirblksize;
+		for (ptr = (char *)hdr + f->off; ptr < endptr; ) {
+			dup = (xfs_dir2_data_unused_t *)ptr;
+			if (be16_to_cpu(dup->freetag) ==
+					XFS_DIR2_DATA_FREE_TAG) {
+				if (be16_to_cpu(dup->length) == 0 ||
+				    (be16_to_cpu(dup->length) &
+				     (XFS_DIR2_DATA_ALIGN - 1)))
+					break;
+				ptr += be16_to_cpu(dup->length);
+				continue;
+			}
+			dep = (xfs_dir2_data_entry_t *)ptr;
+			if (dep->namelen == 0 ||
+			    ptr + xfs_dir3_data_entsize(mp, dep->namelen) >
+					endptr)
+				break;
+			ent->ino = be64_to_cpu(dep->inumber);
+			ent->name = (char *)dep->name;
+			ent->namelen = dep->namelen;
+			ent->ftype = xfs_dir3_dirent_get_ftype(mp, dep);
+			ptr += xfs_dir3_data_entsize(mp, dep->namelen);
+			f->off = ptr - (char *)hdr;
+			return 1;
+		}
+		f->valid = 0;
+	}
+}
+
+/*
+ * Print the names of the inodes in ilist, or of every inode if there is
+ * no list.  With a list only the first name found for each inode is
+ * printed, and the walk stops once they have all been seen.
+ */
+void
+ncheck_walk(
+	xfs_ino_t	*ilist,
+	int		ilist_size,
+	int		security)
+{
+	nframe_t	*f;
+	nent_t		ent;
+	char		*path = NULL;
+	char		*found = NULL;
+	int		maxpath = 0;
+	int		nfound = 0;
+	int		isdir;
+	int		print;
+	int		len;
+	int		i;
+
+	pieces = xmalloc(mp->m_dirblkfsbs * sizeof(*pieces));
+	if (ilist)
+		found = xcalloc(ilist_size, 1);
+	if (!ncheck_push(mp->m_sb.sb_rootino, 0)) {
+		dbprintf(_("can't read root directory inode %lld\n"),
+			mp->m_sb.sb_rootino);
+		goto out;
+	}
+	while (nframes && !seenint() && (!ilist || nfound < ilist_size)) {
+		f = &frames[nframes - 1];
+
+		/* get this directory's buffer back after walking a child */
+		if (f->valid && !f->local && iocur_top->data == NULL)
+			f->valid = 0;
+		if (!ncheck_next(f, &ent)) {
+			xfree(f->ext);
+			nframes--;
+			pop_cur();
+			continue;
+		}
+		if ((ent.namelen == 1 && ent.name[0] == '.') ||
+		    (ent.namelen == 2 && ent.name[0] == '.' &&
+		     ent.name[1] == '.'))
+			continue;
+
+		len = f->pathlen + (f->pathlen != 0) + ent.namelen;
+		if (len + 3 > maxpath) {
+			maxpath = len + 3 + MAXNAMELEN;
+			path = xrealloc(path, maxpath);
+		}
+		if (f->pathlen)
+			path[f->pathlen] = '/';
+		memcpy(path + f->pathlen + (f->pathlen != 0), ent.name,
+		       ent.namelen);
+		path[len] = '\0';
+
+		print = !ilist;
+		for (i = 0; ilist && i < ilist_size; i++) {
+			if (ilist[i] == ent.ino && !found[i]) {
+				found[i] = 1;
+				nfound++;
+				print = 1;
+			}
+		}
+
+		/* without a file type in the entry, look at the inode */
+		isdir = ent.ftype == XFS_DIR3_FT_DIR;
+		if (!xfs_sb_version_hasftype(&mp->m_sb) ||
+		    (security && print)) {
+			push_cur();
+			if (ncheck_cur_inode(ent.ino)) {
+				isdir = (iocur_top->mode & S_IFMT) == S_IFDIR;
+				switch (iocur_top->mode & S_IFMT) {
+				case S_IFDIR:
+				case S_IFLNK:
+					print &= !security;
+					break;
+				case S_IFREG:
+					print &= !security ||
+						(iocur_top->mode &
+						 (S_ISUID | S_ISGID)) != 0;
+					break;
+				}
+			} else
+				print = isdir = 0;
+			pop_cur();
+		}
+		if (print)
+			dbprintf("%11llu %s%s\n", ent.ino, path,
+				 isdir ? "/." : "");
+		if (!isdir)
+			continue;
+
+		/* don't go round in circles if the tree is damaged */
+		for (i = 0; i < nframes; i++)
+			if (frames[i].ino == ent.ino)
+				break;
+		if (i == nframes)
+			ncheck_push(ent.ino, len);
+	}
+out:
+	while (nframes) {
+		xfree(frames[nframes - 1].ext);
+		nframes--;
+		pop_cur();
+	}
+	xfree(frames);
+	frames = NULL;
+	maxframes = 0;
+	xfree(pieces);
+	xfree(found);
+	xfree(path);
+}
@@ -33,6 +33,58 @@ static const cmdinfo_t	log_cmd =
 int		dbprefix;
 static FILE	*log_file;
 static char	*log_file_name;
+static __thread dbcapture_t *capture;
+
+/*
+ * Send this thread's output to memory until dbcapture_stop.  If that can't
+ * be set up the output goes straight out as usual.
+ */
+void
+dbcapture_start(
+	dbcapture_t	*cap)
+{
+	memset(cap, 0, sizeof(*cap));
+	cap->out = open_memstream(&cap->outbuf, &cap->outlen);
+	cap->log = open_memstream(&cap->logbuf, &cap->loglen);
+	capture = cap;
+	if (!cap->out || !cap->log)
+		dbcapture_stop();
+}
+
+void
+dbcapture_stop(void)
+{
+	dbcapture_t	*cap = capture;
+
+	capture = NULL;
+	if (!cap)
+		return;
+	if (cap->out)
+		fclose(cap->out);
+	if (cap->log)
+		fclose(cap->log);
+	cap->out = cap->log = NULL;
+}
+
+/*
+ * Write out and free what was captured.
+ */
+void
+dbcapture_flush(
+	dbcapture_t	*cap)
+{
+	if (cap->outlen && !seenint()) {
+		blockint();
+		fwrite(cap->outbuf, 1, cap->outlen, stdout);
+		unblockint();
+	}
+	if (cap->loglen && log_file)
+		fwrite(cap->logbuf, 1, cap->loglen, log_file);
+	free(cap->outbuf);
+	free(cap->logbuf);
+	cap->outbuf = cap->logbuf = NULL;
+	cap->outlen = cap->loglen = 0;
+}
 
 int
 dbprintf(const char *fmt, ...)
@@ -42,6 +94,20 @@ dbprintf(const char *fmt, ...)
 
 	if (seenint())
 		return 0;
+	if (capture) {
+		va_start(ap, fmt);
+		i = 0;
+		if (dbprefix)
+			i += fprintf(capture->out, "%s: ", fsdevice);
+		i += vfprintf(capture->out, fmt, ap);
+		va_end(ap);
+		if (log_file) {
+			va_start(ap, fmt);
+			vfprintf(capture->log, fmt, ap);
+			va_end(ap);
+		}
+		return i;
+	}
 	va_start(ap, fmt);
 	blockint();
 	i = 0;
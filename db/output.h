@@ -16,8 +16,24 @@
  * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+/*
+ * Output from helper threads is captured, then replayed in a fixed order
+ * once they are done so that it doesn't interleave.
+ */
+typedef struct dbcapture {
+	FILE		*out;
+	FILE		*log;
+	char		*outbuf;
+	size_t		outlen;
+	char		*logbuf;
+	size_t		loglen;
+} dbcapture_t;
+
 extern int	dbprefix;
 
+extern void	dbcapture_flush(dbcapture_t *cap);
+extern void	dbcapture_start(dbcapture_t *cap);
+extern void	dbcapture_stop(void);
 extern int	dbprintf(const char *, ...);
 extern void	logprintf(const char *, ...);
 extern void	output_init(void);
@@ -0,0 +1,568 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxfs.h>
+#include "command.h"
+#include "query.h"
+#include "io.h"
+#include "type.h"
+#include "faddr.h"
+#include "fprint.h"
+#include "field.h"
+#include "flist.h"
+#include "inode.h"
+#include "print.h"
+#include "output.h"
+#include "sig.h"
+#include "init.h"
+#include "malloc.h"
+
+/*
+ * Batch queries: print some fields of a whole list of inodes (or of
+ * metadata blocks given by daddr) in one go, as JSON or CSV.
+ *
+ * The targets are sorted by disk address before anything is read, so the
+ * disk is walked in one pass and every inode in a cluster is printed from
+ * the one buffer.  Values are formatted by the same code as the print
+ * command, so they read back exactly as they would interactively; they
+ * are emitted as strings and records come out in disk order, each one
+ * tagged with the inode number or daddr it answers.
+ */
+
+#define	QUERY_RA	256	/* targets to read ahead of the current one */
+
+typedef struct qtarget {
+	__uint64_t	id;		/* inode number or daddr */
+	__int64_t	daddr;		/* buffer holding it */
+	int		count;		/* buffer length, 0 if id is bad */
+	int		offset;		/* inode index within the buffer */
+	int		seq;		/* position in the input */
+} qtarget_t;
+
+typedef struct qval {
+	char		*key;
+	char		*val;
+} qval_t;
+
+static int	query_add(char *s);
+static int	query_cmp(const void *a, const void *b);
+static void	query_csv_chars(FILE *f, const char *s);
+static void	query_csv_str(FILE *f, const char *s);
+static void	query_emit(FILE *f, qtarget_t *t, const field_t *fields,
+			   int inodes, const char *error);
+static int	query_f(int argc, char **argv);
+static char	*query_field(const field_t *fields, char *name);
+static void	query_help(void);
+static void	query_json_str(FILE *f, const char *s);
+static int	query_read(char *name);
+static int	query_split(char *buf);
+
+static int		csvflag;
+static char		*fieldbuf;
+static char		**qfields;
+static int		nqfields;
+static qtarget_t	*targets;
+static int		ntargets;
+static int		maxtargets;
+static qval_t		*qvals;
+static int		maxqvals;
+
+static const cmdinfo_t	query_cmd =
+	{ "query", NULL, query_f, 1, -1, 0,
+	  N_("[-c] [-f file] [-l bbcount] [-t type] field[,field]... "
+	     "[target]..."),
+	  N_("print fields of many inodes or blocks"), query_help };
+
+static void
+query_help(void)
+{
+	dbprintf(_(
+"\n"
+" Print the named fields of a list of inodes as JSON, one object per line\n"
+" inside a single array.  The targets are inode numbers given on the command\n"
+" line and/or read from a file, one or more per line ('-' reads stdin).\n"
+" They are sorted by disk address and read in a single pass, so records come\n"
+" out in disk order; each carries the inode number it describes.  Field\n"
+" names are as for 'print', e.g. core.size or u.bmx[0]; a field naming a\n"
+" structure expands to all of its members, and a field that the object does\n"
+" not have is null.\n"
+"\n"
+" Options:\n"
+"   -c -- write CSV, with a header line, instead of JSON\n"
+"   -f -- read targets from file\n"
+"   -l -- buffer length in basic blocks for daddr targets\n"
+"   -t -- targets are daddrs of metadata of this type rather than inodes\n"
+"\n"
+" Example:\n"
+"\n"
+" xfs_db -c 'query -f inodes.txt core.mode,core.size,core.nextents' /dev/sda1\n"
+"\n"));
+}
+
+static int
+query_add(
+	char		*s)
+{
+	char		*p;
+	__uint64_t	id;
+
+	id = strtoull(s, &p, 0);
+	if (*s == '\0' || *p != '\0') {
+		dbprintf(_("bad query target %s\n"), s);
+		return 0;
+	}
+	if (ntargets == maxtargets) {
+		maxtargets = maxtargets ? maxtargets * 2 : 1024;
+		targets = xrealloc(targets, maxtargets * sizeof(*targets));
+	}
+	memset(&targets[ntargets], 0, sizeof(*targets));
+	targets[ntargets].id = id;
+	targets[ntargets].seq = ntargets;
+	ntargets++;
+	return 1;
+}
+
+static int
+query_cmp(
+	const void	*a,
+	const void	*b)
+{
+	const qtarget_t	*ta = a;
+	const qtarget_t	*tb = b;
+
+	if (ta->daddr != tb->daddr)
+		return ta->daddr < tb->daddr ? -1 : 1;
+	if (ta->offset != tb->offset)
+		return ta->offset < tb->offset ? -1 : 1;
+	return ta->seq - tb->seq;
+}
+
+static void
+query_csv_chars(
+	FILE		*f,
+	const char	*s)
+{
+	for (; *s; s++) {
+		if (*s == '"')
+			putc('"', f);
+		putc(*s, f);
+	}
+}
+
+static void
+query_csv_str(
+	FILE		*f,
+	const char	*s)
+{
+	putc('"', f);
+	query_csv_chars(f, s);
+	putc('"', f);
+}
+
+static void
+query_emit(
+	FILE		*f,
+	qtarget_t	*t,
+	const field_t	*fields,
+	int		inodes,
+	const char	*error)
+{
+	char		*buf;
+	int		i;
+	int		j;
+	int		n;
+
+	if (csvflag)
+		fprintf(f, "%llu", (unsigned long long)t->id);
+	else
+		fprintf(f, "{\"%s\": %llu", inodes ? "ino" : "daddr",
+			(unsigned long long)t->id);
+	if (error) {
+		if (csvflag) {
+			for (i = 0; i < nqfields; i++)
+				putc(',', f);
+		} else {
+			fprintf(f, ", \"error\": ");
+			query_json_str(f, error);
+			putc('}', f);
+		}
+		return;
+	}
+	for (i = 0; i < nqfields; i++) {
+		buf = query_field(fields, qfields[i]);
+		n = buf ? query_split(buf) : 0;
+		if (csvflag) {
+			putc(',', f);
+			if (n == 1)
+				query_csv_str(f, qvals[0].val);
+			else if (n > 1) {
+				/* a structure: one "name = value" per line */
+				putc('"', f);
+				for (j = 0; j < n; j++) {
+					if (j)
+						putc('\n', f);
+					query_csv_chars(f, qvals[j].key);
+					fprintf(f, " = ");
+					query_csv_chars(f, qvals[j].val);
+				}
+				putc('"', f);
+			}
+		} else if (n == 0) {
+			fprintf(f, ", ");
+			query_json_str(f, qfields[i]);
+			fprintf(f, ": null");
+		} else {
+			for (j = 0; j < n; j++) {
+				fprintf(f, ", ");
+				query_json_str(f, qvals[j].key);
+				fprintf(f, ": ");
+				query_json_str(f, qvals[j].val);
+			}
+		}
+		free(buf);
+	}
+	if (!csvflag)
+		putc('}', f);
+}
+
+static int
+query_f(
+	int		argc,
+	char		**argv)
+{
+	const field_t	*fields;
+	const typ_t	*typ = &typtab[TYP_INODE];
+	qtarget_t	*t;
+	FILE		*rec;
+	char		*recbuf;
+	size_t		reclen;
+	char		*p;
+	char		*error;
+	flist_t		*fl;
+	int		bbcount = 0;
+	int		c;
+	int		i;
+	int		ra;
+	int		inodes;
+	int		loaded;
+	int		nrecs;
+
+	csvflag = 0;
+	ntargets = 0;
+	optind = 0;
+	while ((c = getopt(argc, argv, "cf:l:t:")) != EOF) {
+		switch (c) {
+		case 'c':
+			csvflag = 1;
+			break;
+		case 'f':
+			if (!query_read(optarg))
+				goto out;
+			break;
+		case 'l':
+			bbcount = (int)strtol(optarg, &p, 0);
+			if (*p != '\0' || bbcount <= 0) {
+				dbprintf(_("bad buffer length %s\n"), optarg);
+				goto out;
+			}
+			break;
+		case 't':
+			typ = findtyp(optarg);
+			if (typ == NULL) {
+				dbprintf(_("no such type %s\n"), optarg);
+				goto out;
+			}
+			break;
+		default:
+			dbprintf(_("bad option for query command\n"));
+			goto out;
+		}
+	}
+	inodes = typ->typnm == TYP_INODE;
+	if (inodes && bbcount) {
+		dbprintf(_("-l is only for daddr targets\n"));
+		goto out;
+	}
+	if (typ->fields == NULL) {
+		dbprintf(_("type %s has no fields\n"), typ->name);
+		goto out;
+	}
+	fields = typ->fields;
+	if (fields->name[0] == '\0')
+		fields = ftattrtab[fields->ftyp].subfld;
+	if (optind >= argc) {
+		dbprintf(_("no fields to query\n"));
+		goto out;
+	}
+
+	/* check the field names now rather than once per target */
+	fieldbuf = xstrdup(argv[optind++]);
+	nqfields = 0;
+	for (p = strtok(fieldbuf, ","); p; p = strtok(NULL, ",")) {
+		fl = flist_scan(p);
+		if (!fl)
+			goto out;
+		flist_free(fl);
+		qfields = xrealloc(qfields, (nqfields + 1) * sizeof(*qfields));
+		qfields[nqfields++] = p;
+	}
+	if (!nqfields) {
+		dbprintf(_("no fields to query\n"));
+		goto out;
+	}
+	for (; optind < argc; optind++)
+		if (!query_add(argv[optind]))
+			goto out;
+
+	for (i = 0, t = targets; i < ntargets; i++, t++) {
+		if (!inodes) {
+			t->daddr = t->id;
+			if (bbcount)
+				t->count = bbcount;
+			else if (typ->typnm == TYP_SB || typ->typnm == TYP_AGF ||
+				 typ->typnm == TYP_AGFL || typ->typnm == TYP_AGI)
+				t->count = XFS_FSS_TO_BB(mp, 1);
+			else if (typ->typnm == TYP_DIR2)
+				t->count = XFS_FSB_TO_BB(mp, mp->m_dirblkfsbs);
+			else
+				t->count = blkbb;
+		} else if (!inode_cluster(t->id, &t->daddr, &t->count,
+					  &t->offset)) {
+			t->daddr = -1;
+			t->count = 0;
+		}
+	}
+	qsort(targets, ntargets, sizeof(*targets), query_cmp);
+
+	if (csvflag) {
+		rec = open_memstream(&recbuf, &reclen);
+		if (rec) {
+			fprintf(rec, "%s", inodes ? "ino" : "daddr");
+			for (i = 0; i < nqfields; i++) {
+				putc(',', rec);
+				query_csv_str(rec, qfields[i]);
+			}
+			fclose(rec);
+			dbprintf("%s\n", recbuf);
+			free(recbuf);
+		}
+	} else {
+		if (seenint())
+			goto out;
+		dbprintf("[\n");
+	}
+
+	push_cur();
+	loaded = 0;
+	nrecs = 0;
+	ra = 0;
+	for (i = 0, t = targets; i < ntargets && !seenint(); i++, t++) {
+		error = NULL;
+		if (t->count == 0)
+			error = _("bad inode number");
+		else if (!loaded || t->daddr != iocur_top->bb ||
+			 t->count != iocur_top->blen) {
+			for (; ra < ntargets && ra < i + QUERY_RA; ra++) {
+				if (targets[ra].count &&
+				    (ra == 0 ||
+				     targets[ra].daddr != targets[ra - 1].daddr))
+					libxfs_readahead(mp->m_ddev_targp,
+						targets[ra].daddr,
+						targets[ra].count);
+			}
+			set_cur(typ, t->daddr, t->count, DB_RING_IGN, NULL);
+			loaded = iocur_top->data != NULL;
+		}
+		if (!error && !loaded)
+			error = _("cannot read block");
+		if (!error && inodes)
+			off_cur_inode(t->id, t->offset);
+
+		rec = open_memstream(&recbuf, &reclen);
+		if (!rec) {
+			dbprintf(_("cannot allocate query record\n"));
+			break;
+		}
+		query_emit(rec, t, fields, inodes, error);
+		fclose(rec);
+		/*
+		 * The JSON separator goes before each record after the
+		 * first, so the array is still well formed if the loop
+		 * stops early.
+		 */
+		if (csvflag)
+			dbprintf("%s\n", recbuf);
+		else
+			dbprintf("%s%s", nrecs ? ",\n" : "", recbuf);
+		nrecs++;
+		free(recbuf);
+	}
+	pop_cur();
+	if (!csvflag) {
+		/* dbprintf() prints nothing once interrupted */
+		clearint();
+		dbprintf("%s]\n", nrecs ? "\n" : "");
+	}
+out:
+	xfree(targets);
+	targets = NULL;
+	ntargets = maxtargets = 0;
+	xfree(qfields);
+	qfields = NULL;
+	nqfields = 0;
+	xfree(fieldbuf);
+	fieldbuf = NULL;
+	xfree(qvals);
+	qvals = NULL;
+	maxqvals = 0;
+	return 0;
+}
+
+/*
+ * Print one field of the current object into a buffer, exactly as the
+ * print command would.  Returns NULL if the object has no such field.
+ */
+static char *
+query_field(
+	const field_t	*fields,
+	char		*name)
+{
+	dbcapture_t	cap;
+	flist_t		*fl;
+	int		oldprefix = dbprefix;
+	int		ok;
+
+	fl = flist_scan(name);
+	if (!fl)
+		return NULL;
+	dbprefix = 0;
+	dbcapture_start(&cap);
+	ok = cap.out != NULL && flist_parse(fields, fl, iocur_top->data, 0);
+	if (ok)
+		print_flist(fl);
+	dbcapture_stop();
+	dbprefix = oldprefix;
+	flist_free(fl);
+	free(cap.logbuf);
+	if (!ok || !cap.outbuf || !cap.outlen) {
+		free(cap.outbuf);
+		return NULL;
+	}
+	return cap.outbuf;
+}
+
+static void
+query_json_str(
+	FILE		*f,
+	const char	*s)
+{
+	putc('"', f);
+	for (; *s; s++) {
+		switch (*s) {
+		case '"':
+		case '\\':
+			fprintf(f, "\\%c", *s);
+			break;
+		case '\n':
+			fprintf(f, "\\n");
+			break;
+		case '\t':
+			fprintf(f, "\\t");
+			break;
+		default:
+			if ((unsigned char)*s < 0x20)
+				fprintf(f, "\\u%04x", *s);
+			else
+				putc(*s, f);
+			break;
+		}
+	}
+	putc('"', f);
+}
+
+/*
+ * Add the targets listed in a file, separated by white space.
+ */
+static int
+query_read(
+	char		*name)
+{
+	FILE		*f;
+	char		*line = NULL;
+	size_t		len = 0;
+	char		*p;
+	int		ok = 1;
+
+	if (strcmp(name, "-") == 0)
+		f = stdin;
+	else if ((f = fopen(name, "r")) == NULL) {
+		dbprintf(_("can't open %s: %s\n"), name, strerror(errno));
+		return 0;
+	}
+	while (ok && getline(&line, &len, f) >= 0) {
+		for (p = strtok(line, " \t\n"); ok && p;
+		     p = strtok(NULL, " \t\n"))
+			ok = query_add(p);
+	}
+	free(line);
+	if (f != stdin)
+		fclose(f);
+	return ok;
+}
+
+/*
+ * Break printed output into its "name = value" lines, in place.  A line
+ * without a name carries on the value before it.
+ */
+static int
+query_split(
+	char		*buf)
+{
+	char		*eol;
+	char		*eq;
+	int		n = 0;
+
+	while (*buf) {
+		eol = strchr(buf, '\n');
+		if (eol)
+			*eol = '\0';
+		eq = strstr(buf, " = ");
+		if (eq) {
+			if (n == maxqvals) {
+				maxqvals = maxqvals ? maxqvals * 2 : 16;
+				qvals = xrealloc(qvals,
+						 maxqvals * sizeof(*qvals));
+			}
+			*eq = '\0';
+			qvals[n].key = buf;
+			qvals[n].val = eq + 3;
+			n++;
+		} else if (n)
+			buf[-1] = '\n';
+		if (!eol)
+			break;
+		buf = eol + 1;
+	}
+	return n;
+}
+
+void
+query_init(void)
+{
+	add_command(&query_cmd);
+}
@@ -222,8 +222,14 @@ int xlog_recover_do_trans(struct xlog *log, xlog_recover_t *t, int p)
 	return 0;
 }
 
+/*
+ * Make sure the log is clean.  If lsnp is given it is set to the LSN of the
+ * last record written, which changes whenever the filesystem is modified
+ * through the log.
+ */
 int
-sb_logcheck(void)
+sb_logcheck(
+	xfs_lsn_t	*lsnp)
 {
 	struct xlog	log;
 	xfs_daddr_t	head_blk, tail_blk;
@@ -271,13 +277,15 @@ sb_logcheck(void)
 "of the filesystem before doing this.\n"), progname);
 		return 0;
 	}
+	if (lsnp)
+		*lsnp = log.l_last_sync_lsn;
 	return 1;
 }
 
 static int
 sb_logzero(uuid_t *uuidp)
 {
-	if (!sb_logcheck())
+	if (!sb_logcheck(NULL))
 		return 0;
 
 	dbprintf(_("Clearing log and setting UUID\n"));
@@ -287,7 +295,7 @@ sb_logzero(uuid_t *uuidp)
 			(xfs_extlen_t)XFS_FSB_TO_BB(mp, mp->m_sb.sb_logblocks),
 			uuidp,
 			xfs_sb_version_haslogv2(&mp->m_sb) ? 2 : 1,
-			mp->m_sb.sb_logsunit, XLOG_FMT)) {
+			mp->m_sb.sb_logsunit, XLOG_FMT, XLOG_INIT_CYCLE)) {
 		dbprintf(_("ERROR: cannot clear the log\n"));
 		return 0;
 	}
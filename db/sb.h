@@ -20,5 +20,5 @@ extern const struct field	sb_flds[];
 extern const struct field	sb_hfld[];
 
 extern void	sb_init(void);
-extern int	sb_logcheck(void);
+extern int	sb_logcheck(xfs_lsn_t *lsnp);
 extern int	sb_size(void *obj, int startoff, int idx);
@@ -40,10 +40,9 @@
 #include "text.h"
 #include "symlink.h"
 
-static const typ_t	*findtyp(char *name);
 static int		type_f(int argc, char **argv);
 
-const typ_t	*cur_typ;
+__thread const typ_t	*cur_typ;
 
 static const cmdinfo_t	type_cmd =
 	{ "type", NULL, type_f, 0, 1, 1, N_("[newtype]"),
@@ -115,7 +114,7 @@ type_set_tab_crc(void)
 	typtab = __typtab_crc;
 }
 
-static const typ_t *
+const typ_t *
 findtyp(
 	char		*name)
 {
@@ -0,0 +1,180 @@
+#!/bin/sh -f
+#
+# Copyright (c) 2014 Silicon Graphics, Inc.  All Rights Reserved.
+#
+# Fuzz campaign driver: make a number of copies of a filesystem image,
+# trash metadata in each one with "xfs_db -x blocktrash", then run
+# xfs_repair on it and record how long it took, how much memory it used
+# and what the outcome was.  Each variant uses seed + its number for
+# blocktrash, so any one of them can be reproduced later with -s and -v.
+#
+# The copies are made with "cp --reflink=auto", so on a filesystem that
+# can share extents they cost almost nothing.  The results are written
+# to <dir>/results, one line per variant:
+#
+#	variant seed seconds maxrss_kb repair_status outcome
+#
+# where outcome is one of
+#	clean	repair succeeded and a second "xfs_repair -n" reports the
+#		same as it does for the original image
+#	dirty	repair succeeded but the second pass still found problems
+#	failed	repair exited with an error
+#	crashed	repair was killed by a signal
+# maxrss_kb is "-" unless GNU time is installed as /usr/bin/time.
+#
+# XFS_DB and XFS_REPAIR may be set to use binaries from a build tree.
+#
+
+XFS_DB=${XFS_DB:-xfs_db}
+XFS_REPAIR=${XFS_REPAIR:-xfs_repair}
+TIME=/usr/bin/time
+COUNT=1
+DIR=
+JOBS=`getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1`
+KEEP=false
+NVARIANTS=8
+ROPTS=" "
+SEED=`date +%s`
+TOPTS=" "
+VARIANT=
+USAGE="Usage: xfs_fuzz [-k] [-c count] [-j jobs] [-n variants] [-o dir] [-r repair_opts] [-s seed] [-t type]... [-v variant] image"
+
+while getopts "c:j:kn:o:r:s:t:v:" c
+do
+	case $c in
+	c)	COUNT=$OPTARG;;
+	j)	JOBS=$OPTARG;;
+	k)	KEEP=true;;
+	n)	NVARIANTS=$OPTARG;;
+	o)	DIR=$OPTARG;;
+	r)	ROPTS=" "$OPTARG" ";;
+	s)	SEED=$OPTARG;;
+	t)	TOPTS=$TOPTS"-t "$OPTARG" ";;
+	v)	VARIANT=$OPTARG;;
+	\?)	echo $USAGE 1>&2
+		exit 2
+		;;
+	esac
+done
+set -- extra $@
+shift $OPTIND
+if [ $# -ne 1 ]; then
+	echo $USAGE 1>&2
+	exit 2
+fi
+IMAGE=$1
+if [ ! -f "$IMAGE" ]; then
+	echo "xfs_fuzz: $IMAGE is not a regular file" 1>&2
+	exit 1
+fi
+[ -z "$DIR" ] && DIR=$IMAGE.fuzz
+mkdir -p "$DIR" || exit 1
+[ -x $TIME ] && $TIME -f "" true 2>/dev/null || TIME=
+
+#
+# Trash and repair a single variant, appending its line to $DIR/results.$2
+#
+fuzz_one()
+{
+	i=$1
+	out=$2
+	img=$DIR/img.$i
+	seed=`expr $SEED + $i`
+
+	if ! cp --reflink=auto --sparse=always "$IMAGE" "$img"; then
+		echo "$i $seed - - - nocopy" >> $out
+		return
+	fi
+	$XFS_DB -x -c "blockget" -c "blocktrash -s $seed -n $COUNT$TOPTS" \
+		"$img" > "$img.trash" 2>&1
+
+	if [ -n "$TIME" ]; then
+		$TIME -o "$img.time" -f "%e %M" \
+			$XFS_REPAIR -f$ROPTS"$img" > "$img.repair" 2>&1
+		status=$?
+		set -- `tail -n 1 "$img.time"`
+		secs=$1
+		rss=$2
+	else
+		start=`date +%s.%N`
+		$XFS_REPAIR -f$ROPTS"$img" > "$img.repair" 2>&1
+		status=$?
+		end=`date +%s.%N`
+		secs=`echo "$end $start" | awk '{ printf "%.2f", $1 - $2 }'`
+		rss=-
+	fi
+
+	if [ $status -gt 128 ]; then
+		outcome=crashed
+	elif [ $status -ne 0 ]; then
+		outcome=failed
+	else
+		$XFS_REPAIR -f -n "$img" > "$img.verify" 2>&1
+		if grep -v "$AGNO" "$img.verify" | cmp -s - $DIR/verify; then
+			outcome=clean
+		else
+			outcome=dirty
+		fi
+	fi
+	echo "$i $seed $secs $rss $status $outcome" >> $out
+
+	# keep the evidence for anything that did not come out clean
+	if ! $KEEP && [ $outcome = clean ]; then
+		rm -f "$img" "$img.trash" "$img.time" "$img.repair" \
+			"$img.verify"
+	fi
+}
+
+#
+# Each worker takes every $JOBS'th variant, so no locking is needed.
+#
+worker()
+{
+	w=$1
+	i=$w
+	while [ $i -lt $NVARIANTS ]; do
+		fuzz_one $i $DIR/results.$w
+		i=`expr $i + $JOBS`
+	done
+}
+
+#
+# xfs_repair -n does not exit with 0 for every clean filesystem (it warns
+# about image files on a host that is not XFS, for example), so a variant
+# is judged by whether it now looks the same as the original.  The AGs
+# may be reported in any order.
+#
+AGNO='^[ 	]*- agno = '
+$XFS_REPAIR -f -n "$IMAGE" 2>&1 | grep -v "$AGNO" > $DIR/verify
+
+if [ -n "$VARIANT" ]; then
+	rm -f $DIR/results.$VARIANT
+	fuzz_one $VARIANT $DIR/results.$VARIANT
+	cat $DIR/results.$VARIANT
+	rm -f $DIR/results.$VARIANT
+	exit 0
+fi
+
+[ $JOBS -gt $NVARIANTS ] && JOBS=$NVARIANTS
+w=0
+while [ $w -lt $JOBS ]; do
+	rm -f $DIR/results.$w
+	worker $w &
+	w=`expr $w + 1`
+done
+wait
+
+w=0
+while [ $w -lt $JOBS ]; do
+	cat $DIR/results.$w
+	rm -f $DIR/results.$w
+	w=`expr $w + 1`
+done | sort -n > $DIR/results
+
+awk '{ n[$6]++; t += $3 }
+END {
+	printf "%d variants, %.2f seconds of repair\n", NR, t
+	for (o in n)
+		printf "%8d %s\n", n[o], o
+}' $DIR/results
+exit 0
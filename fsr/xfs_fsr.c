@@ -35,6 +35,7 @@
 #include <sys/vfs.h>
 #include <sys/statvfs.h>
 #include <sys/xattr.h>
+#include <pthread.h>
 
 
 #ifndef XFS_XFLAG_NODEFRAG
@@ -56,6 +57,7 @@ int dflag = 0;
 int argv_blksz_dio;
 extern int max_ext_size;
 static int npasses = 10;
+static int maxjobs = 1;
 static int startpass = 0;
 
 struct getbmap  *outmap = NULL;
@@ -76,6 +78,12 @@ static __int64_t	minimumfree = 2048;
 #define	V_ALL		2
 #define BUFFER_SIZE	(1<<16)
 #define BUFFER_MAX	(1<<24)
+#define FSR_QUEUE_MAX	(1<<20)		/* files queued per filesystem */
+#define FSR_SCORE_MINSIZE (64ULL<<20)
+#define FSR_PIPE_DEPTH	4		/* copy buffers in flight */
+#define FSR_PIPE_MEM	BUFFER_MAX	/* bytes of copy buffers per job */
+#define FSR_MAX_JOBS	16
+#define FSR_LOOKAHEAD	64		/* candidates looked at for -j */
 
 static time_t howlong = 7200;		/* default seconds of reorganizing */
 static char *leftofffile = _PATH_FSRLAST; /* where we left off last */
@@ -91,7 +99,7 @@ static int  fsrfile_common( char *fname, char *tname, char *mnt,
 static int  packfile(char *fname, char *tname, int fd,
                      xfs_bstat_t *statp, struct fsxattr *fsxp);
 static void fsrdir(char *dirname);
-static int  fsrfs(char *mntdir, xfs_ino_t ino, int targetrange);
+static int  fsrfs(char *mntdir, int targetrange);
 static void initallfs(char *mtab);
 static void fsrallfs(char *mtab, int howlong, char *leftofffile);
 static void fsrall_cleanup(int timeout);
@@ -102,7 +110,6 @@ char * gettmpname(char *fname);
 char * getparent(char *fname);
 int fsrprintf(const char *fmt, ...);
 int read_fd_bmap(int, xfs_bstat_t *, int *);
-int cmp(const void *, const void *);
 static void tmp_init(char *mnt);
 static char * tmp_next(char *mnt);
 static void tmp_close(char *mnt);
@@ -250,7 +257,7 @@ main(int argc, char **argv)
 
 	gflag = ! isatty(0);
 
-	while ((c = getopt(argc, argv, "C:p:e:MgsdnvTt:f:m:b:N:FV")) != -1) {
+	while ((c = getopt(argc, argv, "C:p:e:MgsdnvTt:f:m:b:N:FVj:")) != -1) {
 		switch (c) {
 		case 'M':
 			Mflag = 1;
@@ -289,6 +296,14 @@ main(int argc, char **argv)
 		case 'p':
 			npasses = atoi(optarg);
 			break;
+		case 'j':
+			maxjobs = atoi(optarg);
+			if (maxjobs < 1 || maxjobs > FSR_MAX_JOBS) {
+				fprintf(stderr, _("%s: bad job count: %s\n"),
+					progname, optarg);
+				usage(1);
+			}
+			break;
 		case 'C':
 			/* Testing opt: coerses frag count in result */
 			if (getenv("FSRXFSTEST") != NULL) {
@@ -350,7 +365,7 @@ main(int argc, char **argv)
 
 			mntp = find_mountpoint(mtab, argname, &sb);
 			if (mntp != NULL) {
-				fsrfs(mntp, 0, 100);
+				fsrfs(mntp, 100);
 			} else if (S_ISCHR(sb.st_mode)) {
 				fprintf(stderr, _(
 					"%s: char special not supported: %s\n"),
@@ -384,13 +399,15 @@ void
 usage(int ret)
 {
 	fprintf(stderr, _(
-"Usage: %s [-d] [-v] [-g] [-t time] [-p passes] [-f leftf] [-m mtab]\n"
-"       %s [-d] [-v] [-g] xfsdev | dir | file ...\n"
+"Usage: %s [-d] [-v] [-g] [-j jobs] [-t time] [-p passes] [-f leftf]\n"
+"                [-m mtab]\n"
+"       %s [-d] [-v] [-g] [-j jobs] xfsdev | dir | file ...\n"
 "       %s -V\n\n"
 "Options:\n"
 "       -g              Print to syslog (default if stdout not a tty).\n"
 "       -t time         How long to run in seconds.\n"
 "       -p passes       Number of passes before terminating global re-org.\n"
+"       -j jobs         Defragment up to this many files at once (max 16).\n"
 "       -f leftoff      Use this instead of %s.\n"
 "       -m mtab         Use something other than /etc/mtab.\n"
 "       -d              Debug, print even more.\n"
@@ -504,7 +521,6 @@ fsrallfs(char *mtab, int howlong, char *leftofffile)
 	char buf[SMBUFSZ];
 	int mdonly = Mflag;
 	char *ptr;
-	xfs_ino_t startino = 0;
 	fsdesc_t *fsp;
 	struct stat64 sb, sb2;
 
@@ -567,14 +583,14 @@ fsrallfs(char *mtab, int howlong, char *leftofffile)
 			if (! found)
 				fs = fsbase;
 
+			/*
+			 * The inode number after the pass is only there
+			 * for older versions; each pass scans the whole
+			 * filesystem to pick the files to work on.
+			 */
 			ptr = strchr(buf, ' ');
-			if (ptr) {
+			if (ptr)
 				startpass = atoi(++ptr);
-				ptr = strchr(ptr, ' ');
-				if (ptr) {
-					startino = strtoull(++ptr, NULL, 10);
-				}
-			}
 			if (startpass < 0)
 				startpass = 0;
 
@@ -590,9 +606,8 @@ fsrallfs(char *mtab, int howlong, char *leftofffile)
 	}
 
 	if (vflag) {
-		fsrprintf(_("START: pass=%d ino=%llu %s %s\n"),
-			  fs->npass, (unsigned long long)startino,
-			  fs->dev, fs->mnt);
+		fsrprintf(_("START: pass=%d %s %s\n"),
+			  fs->npass, fs->dev, fs->mnt);
 	}
 
 	signal(SIGABRT, aborter);
@@ -621,7 +636,7 @@ fsrallfs(char *mtab, int howlong, char *leftofffile)
 			exit(1);
 			break;
 		case 0:
-			error = fsrfs(fs->mnt, startino, TARGETRANGE);
+			error = fsrfs(fs->mnt, TARGETRANGE);
 			exit (error);
 			break;
 		default:
@@ -632,7 +647,6 @@ fsrallfs(char *mtab, int howlong, char *leftofffile)
 			}
 			break;
 		}
-		startino = 0;  /* reset after the first time through */
 		fs->npass++;
 		fs++;
 	}
@@ -672,25 +686,313 @@ fsrall_cleanup(int timeout)
 	}
 }
 
+/*
+ * A candidate for defragmentation, found by the scan of a filesystem.
+ */
+typedef struct fsr_cand {
+	double		score;
+	xfs_ino_t	ino;
+} fsr_cand_t;
+
+/*
+ * The worst fragmented files of a filesystem.  This is a min-heap on the
+ * score, so once it is full a new candidate only has to beat the root to
+ * get in, and memory use stays bounded however many files there are.
+ */
+typedef struct fsr_queue {
+	fsr_cand_t	*cand;
+	int		count;
+	int		size;		/* allocated */
+	long long	found;		/* candidates seen by the scan */
+} fsr_queue_t;
+
+/*
+ * Rank files by extents per GB, so that the files where the fewest bytes
+ * copied get rid of the most extents come first.  Files smaller than
+ * FSR_SCORE_MINSIZE are scored as if they were that big, which weights
+ * the ordering towards larger files: a small file with a handful of
+ * extents costs little to read but gains little from defragmenting too.
+ */
+static double
+fsr_score(xfs_bstat_t *p)
+{
+	__uint64_t	bytes = (__uint64_t)p->bs_blocks * p->bs_blksize;
+
+	bytes = max(bytes, FSR_SCORE_MINSIZE);
+	return (p->bs_extents - 1) * (double)(1ULL << 30) / bytes;
+}
+
+static void
+fsr_heap_down(fsr_cand_t *h, int n, int i)
+{
+	fsr_cand_t	tmp;
+	int		c;
+
+	for (; (c = 2 * i + 1) < n; i = c) {
+		if (c + 1 < n && h[c + 1].score < h[c].score)
+			c++;
+		if (h[i].score <= h[c].score)
+			break;
+		tmp = h[i];
+		h[i] = h[c];
+		h[c] = tmp;
+	}
+}
+
+static void
+fsr_queue_add(fsr_queue_t *q, xfs_bstat_t *p)
+{
+	fsr_cand_t	cand;
+	fsr_cand_t	tmp;
+	fsr_cand_t	*new;
+	int		i;
+
+	cand.score = fsr_score(p);
+	cand.ino = p->bs_ino;
+	q->found++;
+
+	if (q->count == FSR_QUEUE_MAX) {
+		if (cand.score <= q->cand[0].score)
+			return;
+		q->cand[0] = cand;
+		fsr_heap_down(q->cand, q->count, 0);
+		return;
+	}
+	if (q->count == q->size) {
+		q->size = q->size ? min(q->size * 2, FSR_QUEUE_MAX) : 1024;
+		new = realloc(q->cand, q->size * sizeof(fsr_cand_t));
+		if (!new) {
+			/* make do with what fits */
+			q->size = q->count;
+			if (!q->count || cand.score <= q->cand[0].score)
+				return;
+			q->cand[0] = cand;
+			fsr_heap_down(q->cand, q->count, 0);
+			return;
+		}
+		q->cand = new;
+	}
+
+	/* sift up */
+	for (i = q->count++, q->cand[i] = cand; i > 0; i = (i - 1) / 2) {
+		if (q->cand[(i - 1) / 2].score <= q->cand[i].score)
+			break;
+		tmp = q->cand[i];
+		q->cand[i] = q->cand[(i - 1) / 2];
+		q->cand[(i - 1) / 2] = tmp;
+	}
+}
+
+/*
+ * Heapsort the queue in place.  Taking the minimum off the end each time
+ * leaves the candidates worst first.
+ */
+static void
+fsr_queue_sort(fsr_queue_t *q)
+{
+	fsr_cand_t	tmp;
+	int		n;
+
+	for (n = q->count - 1; n > 0; n--) {
+		tmp = q->cand[0];
+		q->cand[0] = q->cand[n];
+		q->cand[n] = tmp;
+		fsr_heap_down(q->cand, n, 0);
+	}
+}
+
+/*
+ * With -j, files are defragmented by child processes, several at once.
+ * No two jobs read a file from the same allocation group or write their
+ * temporary file into the same one, so they do not compete for the same
+ * part of the disk or the same AG locks.
+ */
+typedef struct fsr_job {
+	pid_t		pid;
+	int		agno;		/* AG of the file's inode */
+	int		tmpag;		/* AG of the temporary file */
+} fsr_job_t;
+
+static fsr_job_t	*jobs;
+static int		njobs;
+static int		jobslots;	/* -j, at most one per AG */
+static int		agino_log;
+static int		ndefragged;	/* files packfile swapped, with jobs' */
+
+static int
+fsr_ino_agno(xfs_ino_t ino)
+{
+	return ino >> agino_log;
+}
+
+static int
+fsr_job_busy(int agno, int tmpag)
+{
+	int		i;
+
+	for (i = 0; i < njobs; i++) {
+		if (agno >= 0 && jobs[i].agno == agno)
+			return 1;
+		if (tmpag >= 0 && jobs[i].tmpag == tmpag)
+			return 1;
+	}
+	return 0;
+}
+
+/* wait for a job to finish */
+static void
+fsr_job_reap(void)
+{
+	pid_t		pid;
+	int		status;
+	int		i;
+
+	do {
+		pid = wait(&status);
+	} while (pid < 0 && errno == EINTR);
+	if (pid < 0) {
+		njobs = 0;
+		return;
+	}
+	for (i = 0; i < njobs; i++) {
+		if (jobs[i].pid == pid) {
+			/* a job exits 0 if it defragmented its file */
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+				ndefragged++;
+			jobs[i] = jobs[--njobs];
+			break;
+		}
+	}
+}
+
+/*
+ * Wait for a free job slot, then move the worst candidate in the next
+ * FSR_LOOKAHEAD whose AG no other job is working in up to position i.
+ */
+static void
+fsr_job_pick(fsr_queue_t *q, int i, int todo)
+{
+	fsr_cand_t	cand;
+	int		j;
+
+	for (;;) {
+		while (njobs == jobslots)
+			fsr_job_reap();
+		for (j = i; j < todo && j < i + FSR_LOOKAHEAD; j++) {
+			if (!fsr_job_busy(fsr_ino_agno(q->cand[j].ino), -1))
+				goto found;
+		}
+		if (!njobs)
+			return;
+		fsr_job_reap();
+	}
+found:
+	cand = q->cand[j];
+	memmove(&q->cand[i + 1], &q->cand[i], (j - i) * sizeof(cand));
+	q->cand[i] = cand;
+}
+
+/* the next temporary file name in an AG no job is writing to */
+static char *
+fsr_job_tmp(char *mntdir, int *tmpag)
+{
+	char		*tname;
+	int		n;
+
+	n = 0;
+	do {
+		*tmpag = tmp_agi;
+		tname = tmp_next(mntdir);
+	} while (fsr_job_busy(-1, *tmpag) && ++n < fsgeom.agcount);
+	return tname;
+}
+
+static void
+fsr_job_start(
+	char		*fname,
+	char		*tname,
+	char		*mntdir,
+	int		fd,
+	xfs_bstat_t	*statp,
+	int		tmpag)
+{
+	pid_t		pid;
+
+	fflush(stdout);
+	pid = fork();
+	switch (pid) {
+	case -1:
+		fsrprintf(_("couldn't fork sub process: %s\n"),
+			strerror(errno));
+		fsrfile_common(fname, tname, mntdir, fd, statp);
+		return;
+	case 0:
+		/* recording where we got to is up to the parent */
+		signal(SIGABRT, SIG_DFL);
+		signal(SIGHUP, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGQUIT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		ndefragged = 0;
+		fsrfile_common(fname, tname, mntdir, fd, statp);
+		exit(ndefragged ? 0 : 1);
+	}
+	jobs[njobs].pid = pid;
+	jobs[njobs].agno = fsr_ino_agno(statp->bs_ino);
+	jobs[njobs].tmpag = tmpag;
+	njobs++;
+}
+
+/*
+ * Give up on the filesystem if we have run out of time, recording how
+ * far through the passes we got.
+ */
+static void
+fsr_check_time(char *mntdir, int fsfd, int scanning)
+{
+	if (endtime && endtime < time(0)) {
+		if (scanning)
+			fsrprintf(_("%s: ran out of time scanning for "
+				"fragmented files\n"), mntdir);
+		while (njobs)
+			fsr_job_reap();
+		tmp_close(mntdir);
+		close(fsfd);
+		fsrall_cleanup(1);
+		exit(1);
+	}
+}
+
 /*
  * fsrfs -- reorganize a file system
+ *
+ * Bulkstat the whole filesystem first, keeping the worst fragmented
+ * files in a bounded queue, then work through them in order of how
+ * fragmented they are until targetrange percent of them have been
+ * defragmented.  Files that are skipped or can't be improved don't count.
+ * Each file is stat'ed again before it is defragmented, since it may
+ * well have changed since the scan.
  */
 static int
-fsrfs(char *mntdir, xfs_ino_t startino, int targetrange)
+fsrfs(char *mntdir, int targetrange)
 {
 
 	int	fsfd, fd;
-	int	count = 0;
+	long long count;
+	int	i;
 	int	ret;
+	int	tmpag;
 	__s32	buflenout;
 	xfs_bstat_t buf[GRABSZ];
+	xfs_bstat_t statbuf;
 	char	fname[64];
 	char	*tname;
 	jdm_fshandle_t	*fshandlep;
-	xfs_ino_t	lastino = startino;
+	xfs_ino_t	lastino = 0;
+	xfs_ino_t	ino;
+	fsr_queue_t	queue = { NULL };
 
-	fsrprintf(_("%s start inode=%llu\n"), mntdir,
-		(unsigned long long)startino);
+	fsrprintf(_("%s start\n"), mntdir);
 
 	fshandlep = jdm_getfshandle( mntdir );
 	if ( ! fshandlep ) {
@@ -716,81 +1018,108 @@ fsrfs(char *mntdir, xfs_ino_t startino, int targetrange)
 
 	tmp_init(mntdir);
 
+	jobslots = min(maxjobs, fsgeom.agcount);
+	if (jobslots > 1) {
+		jobs = calloc(jobslots, sizeof(fsr_job_t));
+		if (!jobs) {
+			fsrprintf(_("could not allocate jobs: %s\n"),
+				strerror(errno));
+			jobslots = 1;
+		}
+	}
+	for (i = fsgeom.agblocks - 1, agino_log = 0; i > 0; i >>= 1)
+		agino_log++;
+	for (i = fsgeom.blocksize / fsgeom.inodesize; i > 1; i >>= 1)
+		agino_log++;
+
 	while ((ret = xfs_bulkstat(fsfd,
 				&lastino, GRABSZ, &buf[0], &buflenout) == 0)) {
 		xfs_bstat_t *p;
 		xfs_bstat_t *endp;
 
 		if (buflenout == 0)
-			goto out0;
-
-		/* Each loop through, defrag targetrange percent of the files */
-		count = (buflenout * targetrange) / 100;
-
-		qsort((char *)buf, buflenout, sizeof(struct xfs_bstat), cmp);
+			break;
 
 		for (p = buf, endp = (buf + buflenout); p < endp ; p++) {
 			/* Do some obvious checks now */
 			if (((p->bs_mode & S_IFMT) != S_IFREG) ||
-			     (p->bs_extents < 2))
+			     (p->bs_extents < 2) ||
+			     (p->bs_xflags & XFS_XFLAG_NODEFRAG))
 				continue;
+			fsr_queue_add(&queue, p);
+		}
+		fsr_check_time(mntdir, fsfd, 1);
+	}
+	if (ret < 0) {
+		fsrprintf(_("%s: xfs_bulkstat: %s\n"), progname, strerror(errno));
+		goto out0;
+	}
 
-			fd = jdm_open(fshandlep, p, O_RDWR|O_DIRECT);
-			if (fd < 0) {
-				/* This probably means the file was
-				 * removed while in progress of handling
-				 * it.  Just quietly ignore this file.
-				 */
-				if (dflag)
-					fsrprintf(_("could not open: "
-						"inode %llu\n"), p->bs_ino);
-				continue;
-			}
+	fsr_queue_sort(&queue);
+	count = max(((long long)queue.count * targetrange) / 100, 1);
+	if (vflag)
+		fsrprintf(_("%s: %lld fragmented files, defragmenting %lld\n"),
+			mntdir, queue.found, min(count, (long long)queue.count));
+
+	ndefragged = 0;
+	for (i = 0; i < queue.count; i++) {
+		/* jobs still running may yet use up what's left */
+		while (njobs && ndefragged + njobs >= count)
+			fsr_job_reap();
+		if (ndefragged >= count)
+			break;
+		if (jobslots > 1)
+			fsr_job_pick(&queue, i, queue.count);
+		ino = queue.cand[i].ino;
+		if (xfs_bulkstat_single(fsfd, &ino, &statbuf) < 0 ||
+		    statbuf.bs_ino != queue.cand[i].ino ||
+		    (statbuf.bs_mode & S_IFMT) != S_IFREG ||
+		    statbuf.bs_extents < 2)
+			continue;
 
-			/* Don't know the pathname, so make up something */
-			sprintf(fname, "ino=%lld", (long long)p->bs_ino);
+		fd = jdm_open(fshandlep, &statbuf, O_RDWR|O_DIRECT);
+		if (fd < 0) {
+			/* This probably means the file was
+			 * removed while in progress of handling
+			 * it.  Just quietly ignore this file.
+			 */
+			if (dflag)
+				fsrprintf(_("could not open: "
+					"inode %llu\n"), statbuf.bs_ino);
+			continue;
+		}
 
-			/* Get a tmp file name */
-			tname = tmp_next(mntdir);
+		/* Don't know the pathname, so make up something */
+		sprintf(fname, "ino=%lld", (long long)statbuf.bs_ino);
 
-			ret = fsrfile_common(fname, tname, mntdir, fd, p);
+		/* Get a tmp file name */
+		if (jobslots > 1) {
+			tname = fsr_job_tmp(mntdir, &tmpag);
+			fsr_job_start(fname, tname, mntdir, fd, &statbuf,
+				      tmpag);
+		} else {
+			tname = tmp_next(mntdir);
+			fsrfile_common(fname, tname, mntdir, fd, &statbuf);
+		}
 
-			leftoffino = p->bs_ino;
+		leftoffino = statbuf.bs_ino;
 
-			close(fd);
+		close(fd);
 
-			if (ret == 0) {
-				if (--count <= 0)
-					break;
-			}
-		}
-		if (endtime && endtime < time(0)) {
-			tmp_close(mntdir);
-			close(fsfd);
-			fsrall_cleanup(1);
-			exit(1);
-		}
+		fsr_check_time(mntdir, fsfd, 0);
 	}
-	if (ret < 0)
-		fsrprintf(_("%s: xfs_bulkstat: %s\n"), progname, strerror(errno));
 out0:
+	while (njobs)
+		fsr_job_reap();
+	free(jobs);
+	jobs = NULL;
+	free(queue.cand);
 	tmp_close(mntdir);
 	close(fsfd);
 	free(fshandlep);
 	return 0;
 }
 
-/*
- * To compare bstat structs for qsort.
- */
-int
-cmp(const void *s1, const void *s2)
-{
-	return( ((xfs_bstat_t *)s2)->bs_extents -
-	        ((xfs_bstat_t *)s1)->bs_extents);
-
-}
-
 /*
  * reorganize by directory hierarchy.
  * Stay in dev (a restriction based on structure of this program -- either
@@ -1215,6 +1544,181 @@ out:
  *  0: Successfully defragmented the file
  *  1: No change / No Error
  */
+/*
+ * Copying a file is read and write bound in turn, so packfile has a
+ * thread read ahead into a ring of FSR_PIPE_DEPTH buffers while the
+ * caller writes them out to the temporary file.  The reader stops at
+ * the first short read, which is the end of the file.  The ring is no
+ * bigger than FSR_PIPE_MEM, the most a single copy buffer can be, so
+ * each -j job uses no more memory than one copying without the ring.
+ */
+typedef struct fsr_pipe {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	int		fd;
+	int		nextents;
+	unsigned	blksz_dio;
+	unsigned	dio_min;
+	char		*bufs;
+	off64_t		offset[FSR_PIPE_DEPTH];
+	ssize_t		len[FSR_PIPE_DEPTH];	/* read, or -errno */
+	int		head;		/* next buffer to write out */
+	int		count;		/* buffers to write out */
+	int		done;		/* reader has finished */
+	int		stop;		/* writer has given up */
+} fsr_pipe_t;
+
+static void *
+fsr_pipe_reader(void *arg)
+{
+	fsr_pipe_t	*pp = arg;
+	off64_t		pos, end;
+	ssize_t		ct;
+	size_t		len;
+	int		extent;
+	int		slot;
+	int		stop;
+
+	for (extent = 0; extent < pp->nextents; extent++) {
+		if (outmap[extent].bmv_block == -1 ||
+		    outmap[extent].bmv_length == 0)
+			continue;
+		pos = outmap[extent].bmv_offset;
+		end = pos + outmap[extent].bmv_length;
+		for (; pos < end; pos += len) {
+			pthread_mutex_lock(&pp->lock);
+			while (pp->count == FSR_PIPE_DEPTH && !pp->stop)
+				pthread_cond_wait(&pp->cond, &pp->lock);
+			stop = pp->stop;
+			slot = (pp->head + pp->count) % FSR_PIPE_DEPTH;
+			pthread_mutex_unlock(&pp->lock);
+			if (stop)
+				goto out;
+
+			len = min(roundup(end - pos, pp->dio_min),
+				  pp->blksz_dio);
+			ct = pread64(pp->fd, pp->bufs +
+					(size_t)slot * pp->blksz_dio, len, pos);
+
+			pthread_mutex_lock(&pp->lock);
+			pp->offset[slot] = pos;
+			pp->len[slot] = ct < 0 ? -errno : ct;
+			pp->count++;
+			pthread_cond_broadcast(&pp->cond);
+			pthread_mutex_unlock(&pp->lock);
+			if (ct < (ssize_t)len)
+				goto out;
+		}
+	}
+out:
+	pthread_mutex_lock(&pp->lock);
+	pp->done = 1;
+	pthread_cond_broadcast(&pp->cond);
+	pthread_mutex_unlock(&pp->lock);
+	return NULL;
+}
+
+/*
+ * Copy the data extents in outmap from fd to the same offsets in tfd.
+ * Returns 0 if the file was copied, 1 if the reader could not be set
+ * up and the caller should copy the file itself, and -1 on error.
+ */
+static int
+fsr_copy_pipe(
+	char		*fname,
+	char		*tname,
+	int		fd,
+	int		tfd,
+	int		nextents,
+	unsigned	blksz_dio,
+	unsigned	dio_min,
+	unsigned	dio_mem)
+{
+	fsr_pipe_t	pp;
+	pthread_t	reader;
+	char		*buf;
+	ssize_t		ct;
+	int		error = 0;
+	int		ready;
+	int		resid;
+	int		slot;
+	int		wc;
+
+	/* a power of two, so still a multiple of dio_min */
+	if (blksz_dio > FSR_PIPE_MEM / FSR_PIPE_DEPTH)
+		blksz_dio = FSR_PIPE_MEM / FSR_PIPE_DEPTH;
+
+	memset(&pp, 0, sizeof(pp));
+	pp.bufs = memalign(dio_mem, (size_t)blksz_dio * FSR_PIPE_DEPTH);
+	if (!pp.bufs)
+		return 1;
+	pthread_mutex_init(&pp.lock, NULL);
+	pthread_cond_init(&pp.cond, NULL);
+	pp.fd = fd;
+	pp.nextents = nextents;
+	pp.blksz_dio = blksz_dio;
+	pp.dio_min = dio_min;
+	if (pthread_create(&reader, NULL, fsr_pipe_reader, &pp)) {
+		error = 1;
+		goto out_free;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&pp.lock);
+		while (!pp.count && !pp.done)
+			pthread_cond_wait(&pp.cond, &pp.lock);
+		slot = pp.head;
+		ready = pp.count;
+		pthread_mutex_unlock(&pp.lock);
+		if (!ready)
+			break;
+
+		buf = pp.bufs + (size_t)slot * blksz_dio;
+		ct = pp.len[slot];
+		if (ct < 0) {
+			fsrprintf(_("bad read from %s: %s\n"),
+				fname, strerror(-ct));
+			error = -1;
+			break;
+		}
+		/* Ensure we do direct I/O to correct block boundaries. */
+		wc = roundup(ct, dio_min);
+		if (wc) {
+			ct = pwrite64(tfd, buf, wc, pp.offset[slot]);
+			if (ct >= 0 && ct < wc) {
+				/* Might be out of space, try to finish */
+				resid = wc - ct;
+				if (pwrite64(tfd, buf + ct, resid,
+					     pp.offset[slot] + ct) == resid)
+					ct = wc;
+			}
+			if (ct != wc) {
+				fsrprintf(_("bad write of %d bytes "
+					"to %s: %s\n"), wc, tname, ct < 0 ? strerror(errno) :
+					_("short write"));
+				error = -1;
+				break;
+			}
+		}
+
+		pthread_mutex_lock(&pp.lock);
+		pp.head = (pp.head + 1) % FSR_PIPE_DEPTH;
+		pp.count--;
+		pthread_cond_broadcast(&pp.cond);
+		pthread_mutex_unlock(&pp.lock);
+	}
+
+	pthread_mutex_lock(&pp.lock);
+	pp.stop = 1;
+	pthread_cond_broadcast(&pp.cond);
+	pthread_mutex_unlock(&pp.lock);
+	pthread_join(reader, NULL);
+out_free:
+	pthread_cond_destroy(&pp.cond);
+	pthread_mutex_destroy(&pp.lock);
+	free(pp.bufs);
+	return error;
+}
 static int
 packfile(char *fname, char *tname, int fd,
 	 xfs_bstat_t *statp, struct fsxattr *fsxp)
@@ -1231,6 +1735,7 @@ packfile(char *fname, char *tname, int fd,
 	off64_t 	cnt, pos;
 	void 		*fbuf = NULL;
 	int 		ct, wc, wc_b4;
+	int		copied;
 	char		ffname[SMBUFSZ];
 	int		ffd = -1;
 
@@ -1299,11 +1804,6 @@ packfile(char *fname, char *tname, int fd,
 			dio.d_maxiosz, pagesize);
 	}
 
-	if (!(fbuf = (char *)memalign(dio.d_mem, blksz_dio))) {
-		fsrprintf(_("could not allocate buf: %s\n"), tname);
-		goto out;
-	}
-
 	if (nfrags) {
 		/* Create new tmp file in same AG as first */
 		sprintf(ffname, "%s.frag", tname);
@@ -1372,8 +1872,23 @@ packfile(char *fname, char *tname, int fd,
 		goto out;
 	}
 
+	copied = 0;
+	if (!nfrags) {
+		copied = fsr_copy_pipe(fname, tname, fd, tfd, nextents,
+				       blksz_dio, dio_min, dio.d_mem);
+		if (copied < 0)
+			goto out;
+		copied = !copied;
+	}
+
+	/* only needed if the pipe didn't copy the file */
+	if (!copied && !(fbuf = (char *)memalign(dio.d_mem, blksz_dio))) {
+		fsrprintf(_("could not allocate buf: %s\n"), tname);
+		goto out;
+	}
+
 	/* Loop through block map copying the file. */
-	for (extent = 0; extent < nextents; extent++) {
+	for (extent = 0; !copied && extent < nextents; extent++) {
 		pos = outmap[extent].bmv_offset;
 		if (outmap[extent].bmv_block == -1) {
 			if (lseek64(tfd, outmap[extent].bmv_length, SEEK_CUR) < 0) {
@@ -1515,6 +2030,7 @@ packfile(char *fname, char *tname, int fd,
 			  cur_nextents, new_nextents,
 			  (new_nextents <= nextents ? "DONE" : "    " ),
 		          fname);
+	ndefragged++;
 	retval = 0;
 
 out:
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <sys/time.h>
+
+/*
+ * Latency histogram, in nanoseconds.  Values below LAT_HIST_NSUB are
+ * counted exactly; above that each power of two is split into
+ * LAT_HIST_NSUB linear buckets, so every value is reported to within
+ * about 3% whatever its magnitude.
+ */
+#define LAT_HIST_SUB		5
+#define LAT_HIST_NSUB		(1 << LAT_HIST_SUB)
+#define LAT_HIST_BUCKETS	((64 - LAT_HIST_SUB + 1) * LAT_HIST_NSUB)
+
+typedef struct lat_hist {
+	long long	count;
+	__uint64_t	min;
+	__uint64_t	max;
+	double		sum;
+	long long	bucket[LAT_HIST_BUCKETS];
+} lat_hist_t;
+
+extern __uint64_t	lat_now(void);
+extern void		lat_hist_add(lat_hist_t *h, __uint64_t ns);
+extern void		lat_hist_merge(lat_hist_t *to, lat_hist_t *from);
+extern __uint64_t	lat_hist_percentile(lat_hist_t *h, double pct);
+extern void		lat_hist_print(lat_hist_t *h, const char *name);
+extern void		lat_hist_print_csv(lat_hist_t *h);
+
+/*
+ * Per-operation latency capture for a single-threaded command, with
+ * optional throughput samples over fixed intervals.  Commands bracket
+ * each operation with latency_start/latency_end; both do nothing when
+ * given a NULL latency_t, so callers need not check.
+ */
+typedef struct lat_sample {
+	__uint64_t	time;		/* end of the interval */
+	__uint64_t	length;		/* length of the interval */
+	long long	bytes;
+	long long	ops;
+} lat_sample_t;
+
+typedef struct latency {
+	lat_hist_t	hist;
+	long long	bytes;
+	__uint64_t	start;		/* start of the run */
+	__uint64_t	last;		/* end of the last operation */
+	__uint64_t	op_start;	/* start of the current operation */
+	__uint64_t	interval;	/* sample length, zero for none */
+	__uint64_t	ival_end;	/* end of the current sample */
+	lat_sample_t	cur;		/* current sample */
+	lat_sample_t	*samples;
+	int		nsamples;
+	int		maxsamples;
+} latency_t;
+
+#define LAT_JSON	(1<<0)	/* report as a JSON object */
+
+extern latency_t	*latency_alloc(unsigned long interval_ms);
+extern void		latency_free(latency_t *l);
+extern void		latency_start(latency_t *l);
+extern void		latency_end(latency_t *l, long long bytes);
+extern void		latency_report(latency_t *l, const char *name,
+					struct timeval *elapsed, int flags);
+
+#endif	/* __LATENCY_H__ */
@@ -88,6 +88,7 @@ typedef struct {
 	int             isdirect;       /* we can attempt to use direct I/O */
 	int             disfile;        /* data "subvolume" is a regular file */
 	int             dcreat;         /* try to create data subvolume */
+	int             dismetadump;    /* data "subvolume" is a metadump */
 	int             lisfile;        /* log "subvolume" is a regular file */
 	int             lcreat;         /* try to create log subvolume */
 	int             risfile;        /* realtime "subvolume" is a reg file */
@@ -145,14 +146,23 @@ extern int	libxfs_device_alignment (void);
 extern void	libxfs_report(FILE *);
 extern void	platform_findsizes(char *path, int fd, long long *sz, int *bsz);
 extern int	platform_nproc(void);
+extern int	platform_zero_range(int fd, __uint64_t start, __uint64_t len);
+
+/* block index of an uncompressed metadump image */
+struct xfs_mdmap;
+extern struct xfs_mdmap *libxfs_mdmap_open(int, char *);
+extern void	libxfs_mdmap_close(struct xfs_mdmap *);
+extern int	libxfs_mdmap_read(struct xfs_mdmap *, void *, int, off64_t);
+extern int	libxfs_mdmap_mapped(struct xfs_mdmap *, xfs_daddr_t);
 
 /* check or write log footer: specify device, log size in blocks & uuid */
 typedef xfs_caddr_t (libxfs_get_block_t)(xfs_caddr_t, int, void *);
 
 extern int	libxfs_log_clear (struct xfs_buftarg *, xfs_daddr_t, uint,
-				uuid_t *, int, int, int);
+				uuid_t *, int, int, int, int);
 extern int	libxfs_log_header (xfs_caddr_t, uuid_t *, int, int, int,
-				libxfs_get_block_t *, void *);
+				xfs_lsn_t, xfs_lsn_t, libxfs_get_block_t *,
+				void *);
 
 
 /*
@@ -453,6 +463,7 @@ extern int	libxfs_writebuf_int(xfs_buf_t *, int);
 extern int	libxfs_writebufr(struct xfs_buf *);
 extern int	libxfs_readbufr(struct xfs_buftarg *, xfs_daddr_t, xfs_buf_t *, int, int);
 extern int	libxfs_readbufr_map(struct xfs_buftarg *, struct xfs_buf *, int);
+extern void	libxfs_readahead(struct xfs_buftarg *, xfs_daddr_t, int);
 
 extern int libxfs_bhash_size;
 
@@ -74,6 +74,7 @@ extern void xlog_panic(char *fmt,...);
 extern int	print_exit;
 extern int	print_skip_uuid;
 extern int	print_record_header;
+extern xfs_lsn_t	xlog_commit_lsn;	/* record holding current commit */
 
 /* libxfs parameters */
 extern libxfs_init_t	x;
@@ -107,6 +108,15 @@ extern int	xlog_do_recovery_pass(struct xlog *log, xfs_daddr_t head_blk,
 				xfs_daddr_t tail_blk, int pass);
 extern int	xlog_recover_do_trans(struct xlog *log, xlog_recover_t *trans,
 				int pass);
+extern int	xlog_do_recovery_passes(struct xlog *log, xfs_daddr_t head_blk,
+				xfs_daddr_t tail_blk, int first_pass,
+				int last_pass, int nthreads);
+extern int	xlog_valid_rec_header(struct xlog *log,
+				xlog_rec_header_t *rhead, xfs_daddr_t blkno);
+extern __le32	xlog_cksum(struct xlog *log, struct xlog_rec_header *rhead,
+			   char *dp, int size);
+extern int	xlog_unpack_data(xlog_rec_header_t *rhead, xfs_caddr_t dp,
+				struct xlog *log);
 extern int	xlog_header_check_recover(xfs_mount_t *mp, 
 				xlog_rec_header_t *head);
 extern int	xlog_header_check_mount(xfs_mount_t *mp,
@@ -20,6 +20,8 @@
 #include <xfs/command.h>
 #include <linux/fiemap.h>
 #include <linux/fs.h>
+#include <ftw.h>
+#include <pthread.h>
 #include "init.h"
 #include "io.h"
 
@@ -46,6 +48,14 @@ fiemap_help(void)
 " -l -- also displays the length of each extent in 512-byte blocks.\n"
 " -n -- query n extents.\n"
 " -v -- Verbose information\n"
+" -s -- instead of the map, print the number of extents, the ideal number\n"
+"       of extents (logically contiguous runs), the fragmentation factor,\n"
+"       how many extent boundaries are physically contiguous, and a\n"
+"       histogram of extent sizes.\n"
+" -R -- with -s, add up the stats of every regular file below the open\n"
+"       directory, staying on the one filesystem.\n"
+" -t N -- with -R, map files with N threads (default 1).\n"
+" -w N -- with -s, also list the N files with the most excess extents.\n"
 "\n"));
 }
 
@@ -206,6 +216,401 @@ calc_print_format(
 	}
 }
 
+/*
+ * Aggregate extent map statistics for fiemap -s.  A file's "ideal" extent
+ * count is the number of logically contiguous runs in its map, as xfs_db
+ * frag works it out, so the gap between actual and ideal is the number of
+ * extents defragmenting would be expected to get rid of.
+ */
+#define FM_STATS_EXTENTS	512	/* extents asked for per ioctl */
+#define FM_STATS_HIST		64	/* power of two size buckets */
+#define FM_STATS_QUEUE		1024	/* paths queued for workers */
+#define FM_MAX_THREADS		256
+
+typedef struct fm_stats {
+	long long	files;
+	long long	errors;
+	long long	extents;
+	long long	ideal;
+	long long	contig;		/* physically follow the last */
+	long long	blocks;		/* 512 byte blocks mapped */
+	long long	hist[FM_STATS_HIST];
+	long long	hist_blocks[FM_STATS_HIST];
+} fm_stats_t;
+
+typedef struct fm_worst {
+	long long	extents;
+	long long	ideal;
+	char		*path;
+} fm_worst_t;
+
+typedef struct fm_thread {
+	pthread_t	tid;
+	fm_stats_t	stats;
+	struct fiemap	*fiemap;
+} fm_thread_t;
+
+/*
+ * State shared by the directory walk and the workers.  nftw gives its
+ * callback no argument, so this has to be file scope.
+ */
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	wait_full;
+	pthread_cond_t	wait_empty;
+	char		*queue[FM_STATS_QUEUE];
+	int		head;
+	int		count;
+	int		done;
+	fm_worst_t	*worst;		/* most excess extents first */
+	int		nworst;
+	int		maxworst;
+} fm_walk = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wait_full = PTHREAD_COND_INITIALIZER,
+	.wait_empty = PTHREAD_COND_INITIALIZER,
+};
+
+static struct fiemap *
+fiemap_stats_alloc(void)
+{
+	struct fiemap	*fiemap;
+
+	fiemap = malloc(sizeof(struct fiemap) +
+			FM_STATS_EXTENTS * sizeof(struct fiemap_extent));
+	if (!fiemap)
+		perror("malloc");
+	return fiemap;
+}
+
+static void
+fiemap_stats_worst(
+	const char	*path,
+	long long	extents,
+	long long	ideal)
+{
+	fm_worst_t	*w;
+	long long	excess = extents - ideal;
+	int		i;
+
+	if (!fm_walk.maxworst || !excess)
+		return;
+	pthread_mutex_lock(&fm_walk.lock);
+	i = fm_walk.nworst;
+	if (i == fm_walk.maxworst) {
+		w = &fm_walk.worst[i - 1];
+		if (w->extents - w->ideal >= excess)
+			goto out;
+		free(w->path);
+		i--;
+	}
+	for (; i > 0; i--) {
+		w = &fm_walk.worst[i - 1];
+		if (w->extents - w->ideal >= excess)
+			break;
+		fm_walk.worst[i] = *w;
+	}
+	w = &fm_walk.worst[i];
+	w->extents = extents;
+	w->ideal = ideal;
+	w->path = strdup(path);
+	if (fm_walk.nworst < fm_walk.maxworst)
+		fm_walk.nworst++;
+out:
+	pthread_mutex_unlock(&fm_walk.lock);
+}
+
+/*
+ * Walk the whole data fork map of one file and add it to the stats.
+ * Delayed allocation extents have no blocks yet and are skipped rather
+ * than forcing writeback of every file looked at.
+ */
+static int
+fiemap_stats_file(
+	int		fd,
+	const char	*path,
+	struct fiemap	*fiemap,
+	fm_stats_t	*st)
+{
+	struct fiemap_extent *extent;
+	__u64		next_logical = 0;
+	__u64		next_physical = 0;
+	__u64		start = 0;
+	__u64		len;
+	long long	extents = 0;
+	long long	ideal = 0;
+	int		b;
+	int		i;
+	int		last = 0;
+
+	while (!last) {
+		memset(fiemap, 0, sizeof(struct fiemap));
+		fiemap->fm_start = start;
+		fiemap->fm_length = -1LL;
+		fiemap->fm_extent_count = FM_STATS_EXTENTS;
+		if (ioctl(fd, FS_IOC_FIEMAP, (unsigned long)fiemap) < 0) {
+			fprintf(stderr, "%s: ioctl(FS_IOC_FIEMAP) [\"%s\"]: "
+				"%s\n", progname, path, strerror(errno));
+			st->errors++;
+			return -1;
+		}
+		if (!fiemap->fm_mapped_extents)
+			break;
+
+		for (i = 0; i < fiemap->fm_mapped_extents; i++) {
+			extent = &fiemap->fm_extents[i];
+			start = extent->fe_logical + extent->fe_length;
+			if (extent->fe_flags & FIEMAP_EXTENT_LAST)
+				last = 1;
+			if (extent->fe_flags & (FIEMAP_EXTENT_DELALLOC |
+						FIEMAP_EXTENT_UNKNOWN))
+				continue;
+
+			if (!extents || extent->fe_logical != next_logical)
+				ideal++;
+			else if (extent->fe_physical == next_physical)
+				st->contig++;
+			extents++;
+			next_logical = start;
+			next_physical = extent->fe_physical +
+					extent->fe_length;
+
+			len = max(extent->fe_length / 512, 1);
+			b = 63 - __builtin_clzll(len);
+			st->hist[b]++;
+			st->hist_blocks[b] += len;
+			st->blocks += len;
+		}
+	}
+
+	st->files++;
+	st->extents += extents;
+	st->ideal += ideal;
+	fiemap_stats_worst(path, extents, ideal);
+	return 0;
+}
+
+static void *
+fiemap_stats_worker(
+	void		*arg)
+{
+	fm_thread_t	*t = arg;
+	char		*path;
+	int		fd;
+
+	for (;;) {
+		pthread_mutex_lock(&fm_walk.lock);
+		while (!fm_walk.count && !fm_walk.done)
+			pthread_cond_wait(&fm_walk.wait_empty, &fm_walk.lock);
+		if (!fm_walk.count) {
+			pthread_mutex_unlock(&fm_walk.lock);
+			return NULL;
+		}
+		path = fm_walk.queue[fm_walk.head];
+		fm_walk.head = (fm_walk.head + 1) % FM_STATS_QUEUE;
+		fm_walk.count--;
+		pthread_cond_signal(&fm_walk.wait_full);
+		pthread_mutex_unlock(&fm_walk.lock);
+
+		fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+		if (fd < 0) {
+			fprintf(stderr, _("%s: cannot open %s: %s\n"),
+				progname, path, strerror(errno));
+			t->stats.errors++;
+		} else {
+			fiemap_stats_file(fd, path, t->fiemap, &t->stats);
+			close(fd);
+		}
+		free(path);
+	}
+}
+
+static int
+fiemap_stats_queue(
+	const char		*path,
+	const struct stat	*stat,
+	int			status,
+	struct FTW		*data)
+{
+	char			*p;
+
+	if (status != FTW_F || !S_ISREG(stat->st_mode))
+		return 0;
+	p = strdup(path);
+	if (!p)
+		return -1;
+	pthread_mutex_lock(&fm_walk.lock);
+	while (fm_walk.count == FM_STATS_QUEUE)
+		pthread_cond_wait(&fm_walk.wait_full, &fm_walk.lock);
+	fm_walk.queue[(fm_walk.head + fm_walk.count) % FM_STATS_QUEUE] = p;
+	fm_walk.count++;
+	pthread_cond_signal(&fm_walk.wait_empty);
+	pthread_mutex_unlock(&fm_walk.lock);
+	return 0;
+}
+
+/*
+ * Walk the tree below the open directory, handing regular files to a
+ * pool of threads that map them, and add up what they found.
+ */
+static int
+fiemap_stats_tree(
+	int		nthreads,
+	fm_stats_t	*st)
+{
+	fm_thread_t	*threads;
+	int		started;
+	int		b;
+	int		i;
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!threads) {
+		perror("calloc");
+		return -1;
+	}
+	fm_walk.head = fm_walk.count = fm_walk.done = 0;
+	for (started = 0; started < nthreads; started++) {
+		threads[started].fiemap = fiemap_stats_alloc();
+		if (!threads[started].fiemap)
+			break;
+		if (pthread_create(&threads[started].tid, NULL,
+				fiemap_stats_worker, &threads[started])) {
+			perror("pthread_create");
+			free(threads[started].fiemap);
+			break;
+		}
+	}
+	if (started && nftw(file->name, fiemap_stats_queue, 100,
+				FTW_PHYS | FTW_MOUNT) < 0) {
+		fprintf(stderr, _("%s: cannot walk %s: %s\n"),
+			progname, file->name, strerror(errno));
+		st->errors++;
+	}
+
+	pthread_mutex_lock(&fm_walk.lock);
+	fm_walk.done = 1;
+	pthread_cond_broadcast(&fm_walk.wait_empty);
+	pthread_mutex_unlock(&fm_walk.lock);
+
+	for (i = 0; i < started; i++) {
+		fm_stats_t	*ts = &threads[i].stats;
+
+		pthread_join(threads[i].tid, NULL);
+		free(threads[i].fiemap);
+		st->files += ts->files;
+		st->errors += ts->errors;
+		st->extents += ts->extents;
+		st->ideal += ts->ideal;
+		st->contig += ts->contig;
+		st->blocks += ts->blocks;
+		for (b = 0; b < FM_STATS_HIST; b++) {
+			st->hist[b] += ts->hist[b];
+			st->hist_blocks[b] += ts->hist_blocks[b];
+		}
+	}
+	free(threads);
+	return started ? 0 : -1;
+}
+
+static void
+fiemap_stats_report(
+	fm_stats_t	*st)
+{
+	fm_worst_t	*w;
+	long long	breaks;
+	int		b;
+	int		i;
+
+	printf(_("files %lld, actual %lld, ideal %lld, "
+		"fragmentation factor %.2f%%\n"),
+		st->files, st->extents, st->ideal,
+		st->extents ? ((st->extents - st->ideal) * 100.0) /
+				st->extents : 0.0);
+	/* boundaries between extents inside a logically contiguous run */
+	breaks = st->extents - st->ideal;
+	printf(_("blocks %lld, average extent %.1f blocks, "
+		"physically contiguous %.2f%%\n"),
+		st->blocks,
+		st->extents ? (double)st->blocks / st->extents : 0.0,
+		breaks ? st->contig * 100.0 / breaks : 100.0);
+	if (st->errors)
+		printf(_("%lld files could not be mapped\n"), st->errors);
+
+	if (st->extents) {
+		printf("%12s %12s %10s %12s %6s\n", _("from"), _("to"),
+			_("extents"), _("blocks"), _("pct"));
+		for (b = 0; b < FM_STATS_HIST; b++) {
+			if (!st->hist[b])
+				continue;
+			printf("%12llu %12llu %10lld %12lld %6.2f\n",
+				1ULL << b, (2ULL << b) - 1, st->hist[b],
+				st->hist_blocks[b],
+				st->hist_blocks[b] * 100.0 / st->blocks);
+		}
+	}
+
+	if (!fm_walk.nworst)
+		return;
+	printf("%10s %10s %s\n", _("actual"), _("ideal"), _("file"));
+	for (i = 0, w = fm_walk.worst; i < fm_walk.nworst; i++, w++) {
+		printf("%10lld %10lld %s\n", w->extents, w->ideal, w->path);
+		free(w->path);
+	}
+}
+
+static int
+fiemap_stats(
+	int		recurse,
+	int		nthreads,
+	int		nworst)
+{
+	struct fiemap	*fiemap;
+	fm_stats_t	st;
+	struct stat	sb;
+
+	memset(&st, 0, sizeof(st));
+	fm_walk.nworst = 0;
+	fm_walk.maxworst = nworst;
+	fm_walk.worst = NULL;
+	if (nworst) {
+		fm_walk.worst = calloc(nworst, sizeof(fm_worst_t));
+		if (!fm_walk.worst) {
+			perror("calloc");
+			exitcode = 1;
+			return 0;
+		}
+	}
+
+	if (recurse) {
+		if (fstat(file->fd, &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+			printf(_("%s: -R needs an open directory\n"), progname);
+			exitcode = 1;
+			goto out;
+		}
+		if (fiemap_stats_tree(nthreads, &st) < 0) {
+			exitcode = 1;
+			goto out;
+		}
+	} else {
+		fiemap = fiemap_stats_alloc();
+		if (!fiemap) {
+			exitcode = 1;
+			goto out;
+		}
+		fiemap_stats_file(file->fd, file->name, fiemap, &st);
+		free(fiemap);
+	}
+
+	printf("%s:\n", file->name);
+	fiemap_stats_report(&st);
+	if (st.errors)
+		exitcode = 1;
+out:
+	free(fm_walk.worst);
+	fm_walk.worst = NULL;
+	return 0;
+}
+
 int
 fiemap_f(
 	int		argc,
@@ -217,6 +622,10 @@ fiemap_f(
 	int		last = 0;
 	int		lflag = 0;
 	int		vflag = 0;
+	int		Rflag = 0;
+	int		sflag = 0;
+	int		nthreads = 1;
+	int		nworst = 0;
 	int		fiemap_flags = FIEMAP_FLAG_SYNC;
 	int		c;
 	int		i;
@@ -231,7 +640,7 @@ fiemap_f(
 	__u64		last_logical = 0;
 	struct stat	st;
 
-	while ((c = getopt(argc, argv, "aln:v")) != EOF) {
+	while ((c = getopt(argc, argv, "aln:vRst:w:")) != EOF) {
 		switch (c) {
 		case 'a':
 			fiemap_flags |= FIEMAP_FLAG_XATTR;
@@ -245,11 +654,42 @@ fiemap_f(
 		case 'v':
 			vflag++;
 			break;
+		case 'R':
+			Rflag = 1;
+			break;
+		case 's':
+			sflag = 1;
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			if (nthreads < 1 || nthreads > FM_MAX_THREADS) {
+				printf(_("threads must be 1 to %d\n"),
+					FM_MAX_THREADS);
+				return 0;
+			}
+			break;
+		case 'w':
+			nworst = atoi(optarg);
+			if (nworst < 0) {
+				printf(_("bad -w count %s\n"), optarg);
+				return 0;
+			}
+			break;
 		default:
 			return command_usage(&fiemap_cmd);
 		}
 	}
 
+	if ((Rflag || nworst) && !sflag)
+		return command_usage(&fiemap_cmd);
+	if (sflag) {
+		if (fiemap_flags & FIEMAP_FLAG_XATTR) {
+			printf(_("-s maps the data fork only\n"));
+			return 0;
+		}
+		return fiemap_stats(Rflag, nthreads, nworst);
+	}
+
 	if (max_extents)
 		num_extents = min(num_extents, max_extents);
 	map_size = sizeof(struct fiemap) +
@@ -363,7 +803,7 @@ fiemap_init(void)
 	fiemap_cmd.argmin = 0;
 	fiemap_cmd.argmax = -1;
 	fiemap_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
-	fiemap_cmd.args = _("[-alv] [-n nx]");
+	fiemap_cmd.args = _("[-alv] [-n nx] | -s [-R] [-t threads] [-w n]");
 	fiemap_cmd.oneline = _("print block mapping for a file");
 	fiemap_cmd.help = fiemap_help;
 
@@ -65,6 +65,7 @@ init_commands(void)
 	help_init();
 	imap_init();
 	inject_init();
+	metabench_init();
 	seek_init();
 	madvise_init();
 	mincore_init();
@@ -83,6 +84,7 @@ init_commands(void)
 	sync_init();
 	sync_range_init();
 	truncate_init();
+	workload_init();
 	mlock_init();
 }
 
@@ -90,6 +90,15 @@ extern int		read_buffer(int, off64_t, long long, long long *,
 					int, int);
 extern void		dump_buffer(off64_t, ssize_t);
 
+/*
+ * Self-describing, checksummed data blocks (pwrite/pread -P)
+ */
+#define IO_PATTERN_SIZE	512
+extern void		pattern_init(__uint64_t);
+extern void		pattern_fill(void *, off64_t, size_t);
+extern long long	pattern_verify(void *, off64_t, size_t);
+extern void		pattern_report(int);
+
 extern void		attr_init(void);
 extern void		bmap_init(void);
 extern void		file_init(void);
@@ -100,6 +109,7 @@ extern void		getrusage_init(void);
 extern void		help_init(void);
 extern void		imap_init(void);
 extern void		inject_init(void);
+extern void		metabench_init(void);
 extern void		mmap_init(void);
 extern void		open_init(void);
 extern void		parent_init(void);
@@ -111,6 +121,7 @@ extern void		seek_init(void);
 extern void		shutdown_init(void);
 extern void		sync_init(void);
 extern void		truncate_init(void);
+extern void		workload_init(void);
 
 #ifdef HAVE_FADVISE
 extern void		fadvise_init(void);
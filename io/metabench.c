@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/xfs.h>
+#include <xfs/command.h>
+#include <xfs/input.h>
+#include <xfs/latency.h>
+#include <pthread.h>
+#include "init.h"
+#include "io.h"
+
+#ifndef __O_TMPFILE
+#if defined __alpha__
+#define __O_TMPFILE	0100000000
+#elif defined(__hppa__)
+#define __O_TMPFILE	 040000000
+#elif defined(__sparc__)
+#define __O_TMPFILE	 0x2000000
+#else
+#define __O_TMPFILE	 020000000
+#endif
+#endif /* __O_TMPFILE */
+
+#ifndef O_TMPFILE
+#define O_TMPFILE (__O_TMPFILE | O_DIRECTORY)
+#endif
+
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH	0x1000
+#endif
+
+static cmdinfo_t metabench_cmd;
+
+#define MB_MAX_THREADS	256
+#define MB_MAX_DIRS	65536
+
+/*
+ * The phases of a run, in order.  Every thread finishes a phase before
+ * any starts the next, so each is measured on its own.
+ */
+enum {
+	MB_CREATE = 0,
+	MB_STAT,
+	MB_RENAME,
+	MB_UNLINK,
+	MB_NPHASES
+};
+
+static const char *mb_phase_names[MB_NPHASES] = {
+	"create", "stat", "rename", "unlink",
+};
+
+typedef struct mb_ctx {
+	int		*dirfds;	/* the directories under test */
+	int		ndirs;
+	long long	nfiles;		/* files per thread */
+	int		tmpfile;	/* create with O_TMPFILE + linkat */
+	int		phase;
+} mb_ctx_t;
+
+typedef struct mb_thread {
+	pthread_t	tid;
+	mb_ctx_t	*ctx;
+	int		id;
+	int		error;
+	long long	ops[MB_NPHASES];
+	lat_hist_t	hist[MB_NPHASES];
+} mb_thread_t;
+
+static void
+metabench_help(void)
+{
+	printf(_(
+"\n"
+" runs a parallel create/stat/rename/unlink workload in the open directory\n"
+"\n"
+" Example:\n"
+" 'metabench -t 8 -d 64 -n 10000' - eight threads each create 10000 files\n"
+" spread over 64 directories, stat them all, rename each one into the next\n"
+" directory along, then unlink them all\n"
+"\n"
+" The directories are made in the open directory and removed again at the\n"
+" end.  Each phase is timed separately and reported with its operation rate\n"
+" and latency distribution.\n"
+" -t N -- number of threads (default 1)\n"
+" -d N -- number of directories to spread the files over (default 1)\n"
+" -n N -- number of files each thread creates (default 1000)\n"
+" -O   -- create files with O_TMPFILE and link them in with linkat(2)\n"
+" -k   -- keep the files and directories, skipping the unlink phase\n"
+" -C   -- print the results in a comma separated format\n"
+"\n"));
+}
+
+/*
+ * Link an O_TMPFILE inode into place.  AT_EMPTY_PATH needs privilege,
+ * the /proc path does not.
+ */
+static int
+mb_linkat(
+	int		fd,
+	int		dirfd,
+	char		*name)
+{
+	char		path[64];
+
+	if (linkat(fd, "", dirfd, name, AT_EMPTY_PATH) == 0)
+		return 0;
+	if (errno != EPERM && errno != ENOENT)
+		return -1;
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	return linkat(AT_FDCWD, path, dirfd, name, AT_SYMLINK_FOLLOW);
+}
+
+static int
+mb_create(
+	mb_ctx_t	*ctx,
+	int		dirfd,
+	char		*name)
+{
+	int		fd;
+
+	if (ctx->tmpfile) {
+		fd = openat(dirfd, ".", O_TMPFILE | O_WRONLY, 0600);
+		if (fd < 0)
+			return -1;
+		if (mb_linkat(fd, dirfd, name) < 0) {
+			close(fd);
+			return -1;
+		}
+	} else {
+		fd = openat(dirfd, name, O_CREAT | O_EXCL | O_WRONLY, 0600);
+		if (fd < 0)
+			return -1;
+	}
+	return close(fd);
+}
+
+/*
+ * File i of thread t lives in directory (t + i) % ndirs as f.t.i, and is
+ * renamed to r.t.i in the directory after that, so the threads' files
+ * are interleaved through every directory and the renames all cross
+ * directories when there is more than one.
+ */
+static void *
+mb_worker(
+	void		*arg)
+{
+	mb_thread_t	*t = arg;
+	mb_ctx_t	*ctx = t->ctx;
+	struct stat64	st;
+	__uint64_t	start;
+	long long	i;
+	char		name[64], rname[64];
+	int		d, nd, error;
+
+	for (i = 0; i < ctx->nfiles; i++) {
+		d = (t->id + i) % ctx->ndirs;
+		nd = (d + 1) % ctx->ndirs;
+		snprintf(name, sizeof(name), "f.%d.%lld", t->id, i);
+		snprintf(rname, sizeof(rname), "r.%d.%lld", t->id, i);
+
+		start = lat_now();
+		switch (ctx->phase) {
+		case MB_CREATE:
+			error = mb_create(ctx, ctx->dirfds[d], name);
+			break;
+		case MB_STAT:
+			error = fstatat64(ctx->dirfds[d], name, &st,
+					AT_SYMLINK_NOFOLLOW);
+			break;
+		case MB_RENAME:
+			error = renameat(ctx->dirfds[d], name,
+					ctx->dirfds[nd], rname);
+			break;
+		case MB_UNLINK:
+			error = unlinkat(ctx->dirfds[nd], rname, 0);
+			break;
+		default:
+			error = -1;
+			errno = EINVAL;
+		}
+		if (error) {
+			t->error = errno;
+			break;
+		}
+		lat_hist_add(&t->hist[ctx->phase], lat_now() - start);
+		t->ops[ctx->phase]++;
+	}
+	return NULL;
+}
+
+/*
+ * Run one phase on all threads; returns the first error seen.
+ */
+static int
+mb_phase(
+	mb_ctx_t	*ctx,
+	mb_thread_t	*threads,
+	int		nthreads)
+{
+	int		i, started, c;
+	int		error = 0;
+
+	for (started = 0; started < nthreads; started++) {
+		c = pthread_create(&threads[started].tid, NULL, mb_worker,
+				&threads[started]);
+		if (c) {
+			error = c;
+			break;
+		}
+	}
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i].tid, NULL);
+		if (threads[i].error && !error)
+			error = threads[i].error;
+	}
+	return error;
+}
+
+static int
+metabench_f(
+	int		argc,
+	char		**argv)
+{
+	mb_ctx_t	ctx;
+	mb_thread_t	*threads = NULL;
+	lat_hist_t	*hist = NULL;
+	struct stat64	st;
+	struct timeval	t1, t2;
+	long long	ops;
+	char		name[64], ts[64];
+	char		*sp;
+	int		Cflag = 0, kflag = 0;
+	int		nthreads = 1;
+	int		c, i, nphases;
+	int		error = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.ndirs = 1;
+	ctx.nfiles = 1000;
+
+	while ((c = getopt(argc, argv, "Cd:kn:Ot:")) != EOF) {
+		switch (c) {
+		case 'C':
+			Cflag = 1;
+			break;
+		case 'd':
+			ctx.ndirs = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg ||
+			    ctx.ndirs < 1 || ctx.ndirs > MB_MAX_DIRS) {
+				printf(_("bad directory count -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
+		case 'k':
+			kflag = 1;
+			break;
+		case 'n':
+			ctx.nfiles = strtoull(optarg, &sp, 0);
+			if (!sp || sp == optarg || ctx.nfiles < 1) {
+				printf(_("bad file count -- %s\n"), optarg);
+				return 0;
+			}
+			break;
+		case 'O':
+			ctx.tmpfile = 1;
+			break;
+		case 't':
+			nthreads = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg ||
+			    nthreads < 1 || nthreads > MB_MAX_THREADS) {
+				printf(_("bad thread count -- %s\n"), optarg);
+				return 0;
+			}
+			break;
+		default:
+			return command_usage(&metabench_cmd);
+		}
+	}
+	if (optind != argc)
+		return command_usage(&metabench_cmd);
+	if (fstat64(file->fd, &st) < 0) {
+		perror("fstat64");
+		return 0;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		printf(_("%s is not a directory\n"), file->name);
+		return 0;
+	}
+
+	ctx.dirfds = calloc(ctx.ndirs, sizeof(int));
+	threads = calloc(nthreads, sizeof(*threads));
+	hist = calloc(MB_NPHASES, sizeof(*hist));
+	if (!ctx.dirfds || !threads || !hist) {
+		perror("calloc");
+		goto out;
+	}
+	for (i = 0; i < ctx.ndirs; i++)
+		ctx.dirfds[i] = -1;
+	for (i = 0; i < ctx.ndirs; i++) {
+		snprintf(name, sizeof(name), "metabench.%d", i);
+		if (mkdirat(file->fd, name, 0700) < 0 && errno != EEXIST) {
+			perror(name);
+			goto out;
+		}
+		ctx.dirfds[i] = openat(file->fd, name, O_RDONLY | O_DIRECTORY);
+		if (ctx.dirfds[i] < 0) {
+			perror(name);
+			goto out;
+		}
+	}
+	if (ctx.tmpfile) {
+		c = openat(ctx.dirfds[0], ".", O_TMPFILE | O_WRONLY, 0600);
+		if (c < 0) {
+			printf(_("O_TMPFILE not supported here, "
+				"creating files normally\n"));
+			ctx.tmpfile = 0;
+		} else {
+			close(c);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		threads[i].ctx = &ctx;
+		threads[i].id = i;
+	}
+
+	nphases = kflag ? MB_UNLINK : MB_NPHASES;
+	for (ctx.phase = 0; ctx.phase < nphases; ctx.phase++) {
+		gettimeofday(&t1, NULL);
+		error = mb_phase(&ctx, threads, nthreads);
+		gettimeofday(&t2, NULL);
+		t2 = tsub(t2, t1);
+
+		ops = 0;
+		for (i = 0; i < nthreads; i++) {
+			ops += threads[i].ops[ctx.phase];
+			lat_hist_merge(&hist[ctx.phase],
+					&threads[i].hist[ctx.phase]);
+		}
+
+		/* Finally, report back -- -C gives a parsable format */
+		timestr(&t2, ts, sizeof(ts), Cflag ? VERBOSE_FIXED_TIME : 0);
+		if (!Cflag) {
+			printf(_("%s: %lld ops; %s (%.4f ops/sec)\n"),
+				mb_phase_names[ctx.phase], ops, ts,
+				tdiv((double)ops, t2));
+			lat_hist_print(&hist[ctx.phase],
+					mb_phase_names[ctx.phase]);
+		} else {/* phase,ops,time,ops/sec,latencies */
+			printf("%s,%lld,%s,%.3f", mb_phase_names[ctx.phase],
+				ops, ts, tdiv((double)ops, t2));
+			lat_hist_print_csv(&hist[ctx.phase]);
+			printf("\n");
+		}
+		if (error) {
+			fprintf(stderr, _("%s: metabench %s: %s\n"), progname,
+				mb_phase_names[ctx.phase], strerror(error));
+			exitcode = 1;
+			break;
+		}
+	}
+
+out:
+	for (i = 0; ctx.dirfds && i < ctx.ndirs; i++) {
+		if (ctx.dirfds[i] < 0)
+			break;
+		close(ctx.dirfds[i]);
+		/* leaves anything a failed run did not clean up */
+		if (!kflag) {
+			snprintf(name, sizeof(name), "metabench.%d", i);
+			unlinkat(file->fd, name, AT_REMOVEDIR);
+		}
+	}
+	free(hist);
+	free(threads);
+	free(ctx.dirfds);
+	return 0;
+}
+
+void
+metabench_init(void)
+{
+	metabench_cmd.name = "metabench";
+	metabench_cmd.cfunc = metabench_f;
+	metabench_cmd.argmin = 0;
+	metabench_cmd.argmax = -1;
+	metabench_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
+	metabench_cmd.args =
+		_("[-t threads] [-d dirs] [-n files] [-O] [-k] [-C]");
+	metabench_cmd.oneline =
+		_("runs a parallel create/stat/rename/unlink workload");
+	metabench_cmd.help = metabench_help;
+
+	add_command(&metabench_cmd);
+}
@@ -19,6 +19,7 @@
 #include <xfs/xfs.h>
 #include <xfs/command.h>
 #include <xfs/input.h>
+#include <xfs/latency.h>
 #include <sys/mman.h>
 #include <signal.h>
 #include "init.h"
@@ -339,6 +340,9 @@ mread_help(void)
 " -f -- verbose mode, dump bytes with offsets relative to start of file.\n"
 " -r -- reverse order; start accessing from the end of range, moving backward\n"
 " -v -- verbose mode, dump bytes with offsets relative to start of mapping.\n"
+" -L -- report the distribution of the time taken to access each page\n"
+" -I N -- also report the throughput over each N millisecond interval\n"
+" -J -- report the page access latencies as a JSON object\n"
 " The accesses are performed sequentially from the start offset by default.\n"
 " Notes:\n"
 "   References to whole pages following the end of the backing file results\n"
@@ -357,16 +361,33 @@ mread_f(
 	off64_t		offset, tmp, dumpoffset, printoffset;
 	ssize_t		length;
 	size_t		dumplen, cnt = 0;
-	char		*bp;
+	char		*bp, *sp;
 	void		*start;
+	latency_t	*lat = NULL;
+	unsigned long	interval = 0;
 	int		dump = 0, rflag = 0, c;
+	int		Lflag = 0, lflags = 0;
 	size_t		blocksize, sectsize;
 
-	while ((c = getopt(argc, argv, "frv")) != EOF) {
+	while ((c = getopt(argc, argv, "fI:JLrv")) != EOF) {
 		switch (c) {
 		case 'f':
 			dump = 2;	/* file offset dump */
 			break;
+		case 'I':
+			interval = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || !interval) {
+				printf(_("bad sample interval -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
+		case 'J':
+			lflags |= LAT_JSON;
+			break;
+		case 'L':
+			Lflag = 1;
+			break;
 		case 'r':
 			rflag = 1;	/* read in reverse */
 			break;
@@ -416,12 +437,20 @@ mread_f(
 	dumplen = length % pagesize;
 	if (!dumplen)
 		dumplen = pagesize;
+	if (Lflag || interval || lflags) {
+		lat = latency_alloc(interval);
+		if (!lat)
+			return 0;
+	}
 
 	if (rflag) {
 		for (tmp = length - 1, c = 0; tmp >= 0; tmp--, c = 1) {
+			if (!cnt)
+				latency_start(lat);
 			*bp = *(((char *)mapping->addr) + dumpoffset + tmp);
 			cnt++;
 			if (c && cnt == dumplen) {
+				latency_end(lat, dumplen);
 				if (dump) {
 					dump_buffer(printoffset, dumplen);
 					printoffset += dumplen;
@@ -435,9 +464,12 @@ mread_f(
 		}
 	} else {
 		for (tmp = 0, c = 0; tmp < length; tmp++, c = 1) {
+			if (!cnt)
+				latency_start(lat);
 			*bp = *(((char *)mapping->addr) + dumpoffset + tmp);
 			cnt++;
 			if (c && cnt == dumplen) {
+				latency_end(lat, dumplen);
 				if (dump)
 					dump_buffer(printoffset + tmp -
 						(dumplen - 1), dumplen);
@@ -449,6 +481,8 @@ mread_f(
 			}
 		}
 	}
+	latency_report(lat, "mread", NULL, lflags);
+	latency_free(lat);
 	return 0;
 }
 
@@ -502,6 +536,9 @@ mwrite_help(void)
 " The default stored value is 'X', repeated to fill the range specified.\n"
 " -S -- use an alternate seed character\n"
 " -r -- reverse order; start storing from the end of range, moving backward\n"
+" -L -- report the distribution of the time taken to store to each page\n"
+" -I N -- also report the throughput over each N millisecond interval\n"
+" -J -- report the page store latencies as a JSON object\n"
 " The stores are performed sequentially from the start offset by default.\n"
 "\n"));
 }
@@ -511,17 +548,34 @@ mwrite_f(
 	int		argc,
 	char		**argv)
 {
-	off64_t		offset, tmp;
-	ssize_t		length;
+	off64_t		offset, tmp, end;
+	ssize_t		length, bytes;
 	void		*start;
 	char		*sp;
+	latency_t	*lat = NULL;
+	unsigned long	interval = 0;
 	int		seed = 'X';
 	int		rflag = 0;
+	int		Lflag = 0, lflags = 0;
 	int		c;
 	size_t		blocksize, sectsize;
 
-	while ((c = getopt(argc, argv, "rS:")) != EOF) {
+	while ((c = getopt(argc, argv, "I:JLrS:")) != EOF) {
 		switch (c) {
+		case 'I':
+			interval = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || !interval) {
+				printf(_("bad sample interval -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
+		case 'J':
+			lflags |= LAT_JSON;
+			break;
+		case 'L':
+			Lflag = 1;
+			break;
 		case 'r':
 			rflag = 1;
 			break;
@@ -563,15 +617,35 @@ mwrite_f(
 	if (!start)
 		return 0;
 
+	if (Lflag || interval || lflags) {
+		lat = latency_alloc(interval);
+		if (!lat)
+			return 0;
+	}
+
+	/* the stores are timed a page's worth at a time */
 	offset -= mapping->offset;
 	if (rflag) {
-		for (tmp = offset + length -1; tmp >= offset; tmp--)
-			((char *)mapping->addr)[tmp] = seed;
+		for (tmp = offset + length - 1; tmp >= offset; ) {
+			end = max(offset, tmp - (off64_t)pagesize + 1);
+			bytes = tmp - end + 1;
+			latency_start(lat);
+			for (; tmp >= end; tmp--)
+				((char *)mapping->addr)[tmp] = seed;
+			latency_end(lat, bytes);
+		}
 	} else {
-		for (tmp = offset; tmp < offset + length; tmp++)
-			((char *)mapping->addr)[tmp] = seed;
+		for (tmp = offset; tmp < offset + length; ) {
+			end = min(offset + length, tmp + (off64_t)pagesize);
+			bytes = end - tmp;
+			latency_start(lat);
+			for (; tmp < end; tmp++)
+				((char *)mapping->addr)[tmp] = seed;
+			latency_end(lat, bytes);
+		}
 	}
-
+	latency_report(lat, "mwrite", NULL, lflags);
+	latency_free(lat);
 	return 0;
 }
 
@@ -655,7 +729,7 @@ mmap_init(void)
 	mread_cmd.argmin = 0;
 	mread_cmd.argmax = -1;
 	mread_cmd.flags = CMD_NOFILE_OK | CMD_FOREIGN_OK;
-	mread_cmd.args = _("[-r] [off len]");
+	mread_cmd.args = _("[-r] [-L] [-I ms] [-J] [off len]");
 	mread_cmd.oneline =
 		_("reads data from a region in the current memory mapping");
 	mread_cmd.help = mread_help;
@@ -684,7 +758,7 @@ mmap_init(void)
 	mwrite_cmd.argmin = 0;
 	mwrite_cmd.argmax = -1;
 	mwrite_cmd.flags = CMD_NOFILE_OK | CMD_FOREIGN_OK;
-	mwrite_cmd.args = _("[-r] [-S seed] [off len]");
+	mwrite_cmd.args = _("[-r] [-S seed] [-L] [-I ms] [-J] [off len]");
 	mwrite_cmd.oneline =
 		_("writes data into a region in the current memory mapping");
 	mwrite_cmd.help = mwrite_help;
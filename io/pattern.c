@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxfs.h>
+#include "io.h"
+
+/*
+ * Self-describing data for pwrite/pread -P.  Every IO_PATTERN_SIZE block
+ * written starts with a header giving the file offset it was written to
+ * and the generation of the run that wrote it, and carries a CRC32c of
+ * the whole block, so a read can tell stale, misdirected, torn and
+ * corrupted data apart without knowing anything else about the file.
+ * The header is big endian and the CRC is stored the way XFS metadata
+ * stores it, so files can be checked on a different host.
+ */
+#define IO_PATTERN_MAGIC	0x5846535f50415454ULL	/* XFS_PATT */
+#define IO_PATTERN_REPORT	10	/* mismatches to report in detail */
+
+struct io_pattern_hdr {
+	__be64		magic;
+	__be64		offset;
+	__be64		gen;
+	__be32		crc;
+	__be32		pad;
+};
+
+#define IO_PATTERN_CRC_OFF	offsetof(struct io_pattern_hdr, crc)
+
+static __uint64_t	pattern_gen;
+static char		pattern_block[IO_PATTERN_SIZE];
+static long long	pattern_blocks;		/* blocks verified */
+static long long	pattern_bad;		/* of which were bad */
+
+/*
+ * Set up for a run of the given generation.  The payload after the
+ * header depends only on the generation, so it is made once here and
+ * each block written just gets a new header and CRC.
+ */
+void
+pattern_init(
+	__uint64_t	gen)
+{
+	__uint64_t	*p = (__uint64_t *)pattern_block;
+	__uint64_t	x = gen ^ IO_PATTERN_MAGIC;
+	int		i;
+
+	pattern_gen = gen;
+	pattern_blocks = pattern_bad = 0;
+	for (i = 0; i < IO_PATTERN_SIZE / sizeof(*p); i++) {
+		/* xorshift64 */
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		p[i] = x;
+	}
+}
+
+void
+pattern_fill(
+	void		*buf,
+	off64_t		offset,
+	size_t		len)
+{
+	struct io_pattern_hdr *hdr;
+	char		*p = buf;
+
+	for (; len >= IO_PATTERN_SIZE; len -= IO_PATTERN_SIZE) {
+		memcpy(p, pattern_block, IO_PATTERN_SIZE);
+		hdr = (struct io_pattern_hdr *)p;
+		hdr->magic = cpu_to_be64(IO_PATTERN_MAGIC);
+		hdr->offset = cpu_to_be64(offset);
+		hdr->gen = cpu_to_be64(pattern_gen);
+		hdr->pad = 0;
+		xfs_update_cksum(p, IO_PATTERN_SIZE, IO_PATTERN_CRC_OFF);
+		p += IO_PATTERN_SIZE;
+		offset += IO_PATTERN_SIZE;
+	}
+}
+
+static void
+pattern_mismatch(
+	off64_t		offset,
+	struct io_pattern_hdr *hdr)
+{
+	if (++pattern_bad > IO_PATTERN_REPORT)
+		return;
+	printf(_("pattern mismatch at offset %lld: "), (long long)offset);
+	if (be64_to_cpu(hdr->magic) != IO_PATTERN_MAGIC)
+		printf(_("no pattern header\n"));
+	else if (be64_to_cpu(hdr->offset) != offset)
+		printf(_("block was written at offset %lld\n"),
+			(long long)be64_to_cpu(hdr->offset));
+	else if (be64_to_cpu(hdr->gen) != pattern_gen)
+		printf(_("generation %llu, expected %llu\n"),
+			(unsigned long long)be64_to_cpu(hdr->gen),
+			(unsigned long long)pattern_gen);
+	else
+		printf(_("bad CRC\n"));
+}
+
+/*
+ * Check the blocks in a buffer just read from offset.  The cheap header
+ * compares are done first; the CRC is only worked out for blocks whose
+ * header is right.  Returns the number of bad blocks found.
+ */
+long long
+pattern_verify(
+	void		*buf,
+	off64_t		offset,
+	size_t		len)
+{
+	struct io_pattern_hdr *hdr;
+	char		*p = buf;
+	long long	bad = pattern_bad;
+
+	for (; len >= IO_PATTERN_SIZE; len -= IO_PATTERN_SIZE) {
+		hdr = (struct io_pattern_hdr *)p;
+		pattern_blocks++;
+		if (hdr->magic != cpu_to_be64(IO_PATTERN_MAGIC) ||
+		    hdr->offset != cpu_to_be64(offset) ||
+		    hdr->gen != cpu_to_be64(pattern_gen) ||
+		    !xfs_verify_cksum(p, IO_PATTERN_SIZE, IO_PATTERN_CRC_OFF))
+			pattern_mismatch(offset, hdr);
+		p += IO_PATTERN_SIZE;
+		offset += IO_PATTERN_SIZE;
+	}
+	return pattern_bad - bad;
+}
+
+void
+pattern_report(
+	int		Cflag)
+{
+	if (Cflag) {
+		printf(",%lld,%lld", pattern_blocks, pattern_bad);
+		return;
+	}
+	if (pattern_bad > IO_PATTERN_REPORT)
+		printf(_("... %lld more mismatches not shown\n"),
+			pattern_bad - IO_PATTERN_REPORT);
+	printf(_("verified %lld blocks of %d bytes, %lld bad\n"),
+		pattern_blocks, IO_PATTERN_SIZE, pattern_bad);
+}
@@ -20,11 +20,14 @@
 #include <xfs/xfs.h>
 #include <xfs/command.h>
 #include <xfs/input.h>
+#include <xfs/latency.h>
 #include <ctype.h>
 #include "init.h"
 #include "io.h"
 
 static cmdinfo_t pread_cmd;
+static latency_t *pread_lat;	/* per-read timing, if asked for */
+static int pread_pattern;	/* verify -P pattern blocks */
 
 static void
 pread_help(void)
@@ -50,6 +53,10 @@ pread_help(void)
 #ifdef HAVE_PREADV
 " -V N -- use vectored IO with N iovecs of blocksize each (preadv)\n"
 #endif
+" -L   -- report the distribution of the read latencies\n"
+" -I N -- also report the throughput over each N millisecond interval\n"
+" -J   -- report the results and latencies as a JSON object\n"
+" -P N -- verify the blocks read were written by 'pwrite -P N'\n"
 "\n"
 " When in \"random\" mode, the number of read operations will equal the\n"
 " number required to do a complete forward/backward scan of the range.\n"
@@ -214,10 +221,18 @@ do_pread(
 	ssize_t		count,
 	ssize_t		buffer_size)
 {
-	if (!vectors)
-		return pread64(fd, buffer, min(count, buffer_size), offset);
+	ssize_t		bytes;
 
-	return do_preadv(fd, offset, count, buffer_size);
+	latency_start(pread_lat);
+	if (!vectors)
+		bytes = pread64(fd, buffer, min(count, buffer_size), offset);
+	else
+		bytes = do_preadv(fd, offset, count, buffer_size);
+	latency_end(pread_lat, bytes);
+	if (pread_pattern && bytes > 0 &&
+	    pattern_verify(buffer, offset, bytes))
+		exitcode = 1;
+	return bytes;
 }
 
 static int
@@ -382,15 +397,18 @@ pread_f(
 	struct timeval	t1, t2;
 	char		s1[64], s2[64], ts[64];
 	char		*sp;
-	int		Cflag, qflag, uflag, vflag;
+	unsigned long	interval = 0;
+	int		Cflag, Lflag, Pflag, qflag, uflag, vflag;
 	int		eof = 0, direction = IO_FORWARD;
+	__uint64_t	gen = 0;
+	int		lflags = 0;
 	int		c;
 
-	Cflag = qflag = uflag = vflag = 0;
+	Cflag = Lflag = Pflag = qflag = uflag = vflag = 0;
 	init_cvtnum(&fsblocksize, &fssectsize);
 	bsize = fsblocksize;
 
-	while ((c = getopt(argc, argv, "b:BCFRquvV:Z:")) != EOF) {
+	while ((c = getopt(argc, argv, "b:BCFI:JLP:RquvV:Z:")) != EOF) {
 		switch (c) {
 		case 'b':
 			tmp = cvtnum(fsblocksize, fssectsize, optarg);
@@ -409,6 +427,29 @@ pread_f(
 		case 'B':
 			direction = IO_BACKWARD;
 			break;
+		case 'I':
+			interval = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || !interval) {
+				printf(_("bad sample interval -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
+		case 'J':
+			lflags |= LAT_JSON;
+			break;
+		case 'L':
+			Lflag = 1;
+			break;
+		case 'P':
+			gen = strtoull(optarg, &sp, 0);
+			if (!sp || sp == optarg) {
+				printf(_("non-numeric generation -- %s\n"),
+					optarg);
+				return 0;
+			}
+			Pflag = 1;
+			break;
 		case 'R':
 			direction = IO_RANDOM;
 			break;
@@ -461,8 +502,24 @@ pread_f(
 		return 0;
 	}
 
+	if (Pflag && (vectors || bsize % IO_PATTERN_SIZE ||
+		      (!eof && (offset | count) % IO_PATTERN_SIZE))) {
+		printf(_("-P needs offset, length and bsize in multiples of "
+			"%d bytes, and no -V\n"), IO_PATTERN_SIZE);
+		return 0;
+	}
+
 	if (alloc_buffer(bsize, uflag, 0xabababab) < 0)
 		return 0;
+	if (Pflag) {
+		pattern_init(gen);
+		pread_pattern = 1;
+	}
+	if (Lflag || interval || lflags) {
+		pread_lat = latency_alloc(interval);
+		if (!pread_lat)
+			return 0;
+	}
 
 	gettimeofday(&t1, NULL);
 	switch (direction) {
@@ -482,12 +539,14 @@ pread_f(
 	default:
 		ASSERT(0);
 	}
-	if (c < 0)
-		return 0;
-	if (qflag)
-		return 0;
+	if (c < 0 || qflag)
+		goto done;
 	gettimeofday(&t2, NULL);
 	t2 = tsub(t2, t1);
+	if (lflags & LAT_JSON) {
+		latency_report(pread_lat, "pread", &t2, lflags);
+		goto done;
+	}
 
 	/* Finally, report back -- -C gives a parsable format */
 	timestr(&t2, ts, sizeof(ts), Cflag ? VERBOSE_FIXED_TIME : 0);
@@ -498,11 +557,23 @@ pread_f(
 			total, count, (long long)offset);
 		printf(_("%s, %d ops; %s (%s/sec and %.4f ops/sec)\n"),
 			s1, c, ts, s2, tdiv((double)c, t2));
-	} else {/* bytes,ops,time,bytes/sec,ops/sec */
-		printf("%lld,%d,%s,%.3f,%.3f\n",
+		latency_report(pread_lat, "pread", &t2, 0);
+		if (Pflag)
+			pattern_report(0);
+	} else {/* bytes,ops,time,bytes/sec,ops/sec[,latencies][,blocks,bad] */
+		printf("%lld,%d,%s,%.3f,%.3f",
 			total, c, ts,
 			tdiv((double)total, t2), tdiv((double)c, t2));
+		if (pread_lat)
+			lat_hist_print_csv(&pread_lat->hist);
+		if (Pflag)
+			pattern_report(1);
+		printf("\n");
 	}
+done:
+	latency_free(pread_lat);
+	pread_lat = NULL;
+	pread_pattern = 0;
 	return 0;
 }
 
@@ -515,7 +586,8 @@ pread_init(void)
 	pread_cmd.argmin = 2;
 	pread_cmd.argmax = -1;
 	pread_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
-	pread_cmd.args = _("[-b bs] [-v] [-i N] [-FBR [-Z N]] off len");
+	pread_cmd.args =
+_("[-b bs] [-v] [-i N] [-FBR [-Z N]] [-L] [-I ms] [-J] [-P gen] off len");
 	pread_cmd.oneline = _("reads a number of bytes at a specified offset");
 	pread_cmd.help = pread_help;
 
@@ -20,10 +20,13 @@
 #include <xfs/xfs.h>
 #include <xfs/command.h>
 #include <xfs/input.h>
+#include <xfs/latency.h>
 #include "init.h"
 #include "io.h"
 
 static cmdinfo_t pwrite_cmd;
+static latency_t *pwrite_lat;	/* per-write timing, if asked for */
+static int pwrite_pattern;	/* write -P pattern blocks */
 
 static void
 pwrite_help(void)
@@ -54,6 +57,10 @@ pwrite_help(void)
 #ifdef HAVE_PWRITEV
 " -V N -- use vectored IO with N iovecs of blocksize each (pwritev)\n"
 #endif
+" -L   -- report the distribution of the write latencies\n"
+" -I N -- also report the throughput over each N millisecond interval\n"
+" -J   -- report the results and latencies as a JSON object\n"
+" -P N -- write self-describing blocks of generation N (see 'pread -P')\n"
 "\n"));
 }
 
@@ -101,10 +108,17 @@ do_pwrite(
 	ssize_t		count,
 	ssize_t		buffer_size)
 {
-	if (!vectors)
-		return pwrite64(fd, buffer, min(count, buffer_size), offset);
+	ssize_t		bytes;
 
-	return do_pwritev(fd, offset, count, buffer_size);
+	if (pwrite_pattern)
+		pattern_fill(buffer, offset, min(count, buffer_size));
+	latency_start(pwrite_lat);
+	if (!vectors)
+		bytes = pwrite64(fd, buffer, min(count, buffer_size), offset);
+	else
+		bytes = do_pwritev(fd, offset, count, buffer_size);
+	latency_end(pwrite_lat, bytes);
+	return bytes;
 }
 
 static int
@@ -253,15 +267,18 @@ pwrite_f(
 	struct timeval	t1, t2;
 	char		s1[64], s2[64], ts[64];
 	char		*sp, *infile = NULL;
-	int		Cflag, qflag, uflag, dflag, wflag, Wflag;
+	unsigned long	interval = 0;
+	int		Cflag, Lflag, Pflag, qflag, uflag, dflag, wflag, Wflag;
 	int		direction = IO_FORWARD;
+	__uint64_t	gen = 0;
+	int		lflags = 0;
 	int		c, fd = -1;
 
-	Cflag = qflag = uflag = dflag = wflag = Wflag = 0;
+	Cflag = Lflag = Pflag = qflag = uflag = dflag = wflag = Wflag = 0;
 	init_cvtnum(&fsblocksize, &fssectsize);
 	bsize = fsblocksize;
 
-	while ((c = getopt(argc, argv, "b:Cdf:i:qs:S:uV:wWZ:")) != EOF) {
+	while ((c = getopt(argc, argv, "b:Cdf:i:I:JLP:qs:S:uV:wWZ:")) != EOF) {
 		switch (c) {
 		case 'b':
 			tmp = cvtnum(fsblocksize, fssectsize, optarg);
@@ -290,6 +307,29 @@ pwrite_f(
 		case 'i':
 			infile = optarg;
 			break;
+		case 'I':
+			interval = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || !interval) {
+				printf(_("bad sample interval -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
+		case 'J':
+			lflags |= LAT_JSON;
+			break;
+		case 'L':
+			Lflag = 1;
+			break;
+		case 'P':
+			gen = strtoull(optarg, &sp, 0);
+			if (!sp || sp == optarg) {
+				printf(_("non-numeric generation -- %s\n"),
+					optarg);
+				return 0;
+			}
+			Pflag = 1;
+			break;
 		case 's':
 			skip = cvtnum(fsblocksize, fssectsize, optarg);
 			if (skip < 0) {
@@ -351,12 +391,28 @@ pwrite_f(
 		return 0;
 	}
 
+	if (Pflag && (infile || vectors || bsize % IO_PATTERN_SIZE ||
+		      (offset | count) % IO_PATTERN_SIZE)) {
+		printf(_("-P needs offset, length and bsize in multiples of "
+			"%d bytes, and no -i or -V\n"), IO_PATTERN_SIZE);
+		return 0;
+	}
+
 	if (alloc_buffer(bsize, uflag, seed) < 0)
 		return 0;
+	if (Pflag) {
+		pattern_init(gen);
+		pwrite_pattern = 1;
+	}
 
 	c = IO_READONLY | (dflag ? IO_DIRECT : 0);
 	if (infile && ((fd = openfile(infile, NULL, c, 0)) < 0))
 		return 0;
+	if (Lflag || interval || lflags) {
+		pwrite_lat = latency_alloc(interval);
+		if (!pwrite_lat)
+			goto done;
+	}
 
 	gettimeofday(&t1, NULL);
 	switch (direction) {
@@ -385,6 +441,10 @@ pwrite_f(
 		goto done;
 	gettimeofday(&t2, NULL);
 	t2 = tsub(t2, t1);
+	if (lflags & LAT_JSON) {
+		latency_report(pwrite_lat, "pwrite", &t2, lflags);
+		goto done;
+	}
 
 	/* Finally, report back -- -C gives a parsable format */
 	timestr(&t2, ts, sizeof(ts), Cflag ? VERBOSE_FIXED_TIME : 0);
@@ -395,12 +455,19 @@ pwrite_f(
 			total, count, (long long)offset);
 		printf(_("%s, %d ops; %s (%s/sec and %.4f ops/sec)\n"),
 			s1, c, ts, s2, tdiv((double)c, t2));
-	} else {/* bytes,ops,time,bytes/sec,ops/sec */
-		printf("%lld,%d,%s,%.3f,%.3f\n",
+		latency_report(pwrite_lat, "pwrite", &t2, 0);
+	} else {/* bytes,ops,time,bytes/sec,ops/sec[,latencies] */
+		printf("%lld,%d,%s,%.3f,%.3f",
 			total, c, ts,
 			tdiv((double)total, t2), tdiv((double)c, t2));
+		if (pwrite_lat)
+			lat_hist_print_csv(&pwrite_lat->hist);
+		printf("\n");
 	}
 done:
+	latency_free(pwrite_lat);
+	pwrite_lat = NULL;
+	pwrite_pattern = 0;
 	if (infile)
 		close(fd);
 	return 0;
@@ -416,7 +483,7 @@ pwrite_init(void)
 	pwrite_cmd.argmax = -1;
 	pwrite_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
 	pwrite_cmd.args =
-_("[-i infile [-d] [-s skip]] [-b bs] [-S seed] [-wW] [-FBR [-Z N]] [-V N] off len");
+_("[-i infile [-d] [-s skip]] [-b bs] [-S seed] [-wW] [-FBR [-Z N]] [-V N] [-L] [-I ms] [-J] [-P gen] off len");
 	pwrite_cmd.oneline =
 		_("writes a number of bytes at a specified offset");
 	pwrite_cmd.help = pwrite_help;
@@ -19,6 +19,7 @@
 #include <xfs/xfs.h>
 #include <xfs/command.h>
 #include <xfs/input.h>
+#include <xfs/latency.h>
 #include "init.h"
 #include "io.h"
 
@@ -91,7 +92,8 @@ read_directory(
 	long long offset,
 	unsigned long long length,
 	int dump,
-	unsigned long long *total)
+	unsigned long long *total,
+	latency_t *lat)
 {
 	struct dirent *dirent;
 	int count = 0;
@@ -100,9 +102,11 @@ read_directory(
 
 	*total = 0;
 	while (*total < length) {
+		latency_start(lat);
 		dirent = readdir(dir);
 		if (!dirent)
 			break;
+		latency_end(lat, dirent->d_reclen);
 
 		*total += dirent->d_reclen;
 		count++;
@@ -132,11 +136,29 @@ readdir_f(
 	int verbose = 0;
 	DIR *dir;
 	int dfd;
+	latency_t *lat = NULL;
+	unsigned long interval = 0;
+	int Lflag = 0, lflags = 0;
+	char *sp;
 
 	init_cvtnum(&fsblocksize, &fssectsize);
 
-	while ((c = getopt(argc, argv, "l:o:v")) != EOF) {
+	while ((c = getopt(argc, argv, "I:JLl:o:v")) != EOF) {
 		switch (c) {
+		case 'I':
+			interval = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || !interval) {
+				printf(_("bad sample interval -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
+		case 'J':
+			lflags |= LAT_JSON;
+			break;
+		case 'L':
+			Lflag = 1;
+			break;
 		case 'l':
 			length = cvtnum(fsblocksize, fssectsize, optarg);
 			break;
@@ -166,14 +188,27 @@ readdir_f(
 		offset = telldir(dir);
 	}
 
+	if (Lflag || interval || lflags) {
+		lat = latency_alloc(interval);
+		if (!lat) {
+			closedir(dir);
+			return 0;
+		}
+	}
+
 	gettimeofday(&t1, NULL);
-	cnt = read_directory(dir, offset, length, verbose, &total);
+	cnt = read_directory(dir, offset, length, verbose, &total, lat);
 	gettimeofday(&t2, NULL);
 
 	closedir(dir);
 	close(dfd);
 
 	t2 = tsub(t2, t1);
+	if (lflags & LAT_JSON) {
+		latency_report(lat, "readdir", &t2, lflags);
+		latency_free(lat);
+		return 0;
+	}
 	timestr(&t2, ts, sizeof(ts), 0);
 
 	cvtstr(total, s1, sizeof(s1));
@@ -182,6 +217,8 @@ readdir_f(
 	printf(_("read %llu bytes from offset %lld\n"), total, offset);
 	printf(_("%s, %d ops, %s (%s/sec and %.4f ops/sec)\n"),
 		s1, cnt, ts, s2, tdiv(cnt, t2));
+	latency_report(lat, "readdir", &t2, 0);
+	latency_free(lat);
 
 	return 0;
 }
@@ -191,9 +228,9 @@ readdir_init(void)
 {
 	readdir_cmd.name = "readdir";
 	readdir_cmd.cfunc = readdir_f;
-	readdir_cmd.argmax = 5;
+	readdir_cmd.argmax = -1;
 	readdir_cmd.flags = CMD_NOMAP_OK|CMD_FOREIGN_OK;
-	readdir_cmd.args = _("[-v][-o offset][-l length]");
+	readdir_cmd.args = _("[-v][-o offset][-l length][-L][-I ms][-J]");
 	readdir_cmd.oneline = _("read directory entries");
 
 	add_command(&readdir_cmd);
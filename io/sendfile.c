@@ -19,11 +19,13 @@
 #include <xfs/xfs.h>
 #include <xfs/command.h>
 #include <xfs/input.h>
+#include <xfs/latency.h>
 #include <sys/sendfile.h>
 #include "init.h"
 #include "io.h"
 
 static cmdinfo_t sendfile_cmd;
+static latency_t *sendfile_lat;	/* per-call timing, if asked for */
 
 static void
 sendfile_help(void)
@@ -41,6 +43,9 @@ sendfile_help(void)
 " -f -- specifies an input file from which to source data to write\n"
 " -i -- specifies an input file name from which to source data to write.\n"
 " An offset and length in the source file can be optionally specified.\n"
+" -L -- report the distribution of the sendfile call latencies\n"
+" -I N -- also report the throughput over each N millisecond interval\n"
+" -J -- report the results and latencies as a JSON object\n"
 "\n"));
 }
 
@@ -57,7 +62,9 @@ send_buffer(
 
 	*total = 0;
 	while (count > 0) {
+		latency_start(sendfile_lat);
 		bytes = sendfile64(file->fd, fd, &off, bytes_remaining);
+		latency_end(sendfile_lat, bytes);
 		if (bytes == 0)
 			break;
 		if (bytes < 0) {
@@ -84,16 +91,33 @@ sendfile_f(
 	struct timeval	t1, t2;
 	char		s1[64], s2[64], ts[64];
 	char		*infile = NULL;
-	int		Cflag, qflag;
+	char		*sp;
+	unsigned long	interval = 0;
+	int		Cflag, Lflag, qflag;
+	int		lflags = 0;
 	int		c, fd = -1;
 
-	Cflag = qflag = 0;
+	Cflag = Lflag = qflag = 0;
 	init_cvtnum(&blocksize, &sectsize);
-	while ((c = getopt(argc, argv, "Cf:i:q")) != EOF) {
+	while ((c = getopt(argc, argv, "Cf:i:I:JLq")) != EOF) {
 		switch (c) {
 		case 'C':
 			Cflag = 1;
 			break;
+		case 'I':
+			interval = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || !interval) {
+				printf(_("bad sample interval -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
+		case 'J':
+			lflags |= LAT_JSON;
+			break;
+		case 'L':
+			Lflag = 1;
+			break;
 		case 'q':
 			qflag = 1;
 			break;
@@ -144,6 +168,12 @@ sendfile_f(
 		count = stat.st_size;
 	}
 
+	if (Lflag || interval || lflags) {
+		sendfile_lat = latency_alloc(interval);
+		if (!sendfile_lat)
+			goto done;
+	}
+
 	gettimeofday(&t1, NULL);
 	c = send_buffer(offset, count, fd, &total);
 	if (c < 0)
@@ -152,6 +182,10 @@ sendfile_f(
 		goto done;
 	gettimeofday(&t2, NULL);
 	t2 = tsub(t2, t1);
+	if (lflags & LAT_JSON) {
+		latency_report(sendfile_lat, "sendfile", &t2, lflags);
+		goto done;
+	}
 
 	/* Finally, report back -- -C gives a parsable format */
 	timestr(&t2, ts, sizeof(ts), Cflag ? VERBOSE_FIXED_TIME : 0);
@@ -162,12 +196,18 @@ sendfile_f(
 			total, count, (long long)offset);
 		printf(_("%s, %d ops; %s (%s/sec and %.4f ops/sec)\n"),
 			s1, c, ts, s2, tdiv((double)c, t2));
-	} else {/* bytes,ops,time,bytes/sec,ops/sec */
-		printf("%lld,%d,%s,%.3f,%.3f\n",
+		latency_report(sendfile_lat, "sendfile", &t2, 0);
+	} else {/* bytes,ops,time,bytes/sec,ops/sec[,latencies] */
+		printf("%lld,%d,%s,%.3f,%.3f",
 			total, c, ts,
 			tdiv((double)total, t2), tdiv((double)c, t2));
+		if (sendfile_lat)
+			lat_hist_print_csv(&sendfile_lat->hist);
+		printf("\n");
 	}
 done:
+	latency_free(sendfile_lat);
+	sendfile_lat = NULL;
 	if (infile)
 		close(fd);
 	return 0;
@@ -183,7 +223,7 @@ sendfile_init(void)
 	sendfile_cmd.argmax = -1;
 	sendfile_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
 	sendfile_cmd.args =
-		_("-i infile | -f N [off len]");
+		_("-i infile | -f N [-L] [-I ms] [-J] [off len]");
 	sendfile_cmd.oneline =
 		_("Transfer data directly between file descriptors");
 	sendfile_cmd.help = sendfile_help;
@@ -0,0 +1,539 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/xfs.h>
+#include <xfs/command.h>
+#include <xfs/input.h>
+#include <xfs/latency.h>
+#include <pthread.h>
+#ifdef HAVE_LINUX_AIO
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#endif
+#include "init.h"
+#include "io.h"
+
+static cmdinfo_t workload_cmd;
+
+#define WL_MAX_THREADS	256
+#define WL_MAX_DEPTH	1024
+
+#define WL_READ		0
+#define WL_WRITE	1
+
+/*
+ * State shared by all the threads of one run.  I/Os are numbered as they
+ * are claimed; the number picks the block for a sequential run and ends
+ * a size bound run.
+ */
+typedef struct wl_ctx {
+	int		fd;
+	size_t		bsize;
+	off64_t		offset;		/* start of the range */
+	long long	nblocks;	/* blocks in the range */
+	long long	nops;		/* I/Os to issue, unless timed */
+	long long	next;		/* next I/O number */
+	__uint64_t	deadline;	/* end of a timed run */
+	int		timed;
+	int		depth;
+	int		rmix;		/* percentage of reads */
+	int		random;
+	void		*wbuf;		/* write data, shared */
+} wl_ctx_t;
+
+typedef struct wl_thread {
+	pthread_t	tid;
+	wl_ctx_t	*ctx;
+	unsigned int	seed;
+	int		error;
+	long long	ops[2];
+	long long	bytes[2];
+	lat_hist_t	hist[2];
+} wl_thread_t;
+
+static void
+workload_help(void)
+{
+	printf(_(
+"\n"
+" runs a concurrent read/write workload against a range of the open file\n"
+"\n"
+" Example:\n"
+" 'workload -t 4 -Q 16 -M 70 -R -T 30 0 1g' - four threads, each keeping\n"
+" 16 I/Os in flight, 70%% reads, at random offsets in the first gigabyte of\n"
+" the file for 30 seconds\n"
+"\n"
+" I/O is done in blocksize units (-b option, default is the filesystem block\n"
+" size) within the given range.  Without -T the run transfers length bytes\n"
+" and stops; with -T it keeps going round the range until the time is up.\n"
+" Open the file with -d to measure the device rather than the page cache.\n"
+" The report includes the latency distribution of the reads and the writes.\n"
+" -t N -- number of threads issuing I/O (default 1)\n"
+" -Q N -- number of I/Os each thread keeps in flight (default 1)\n"
+" -M N -- percentage of the I/Os that are reads (default 100)\n"
+" -R   -- use random offsets within the range (default is sequential)\n"
+" -T N -- run for N seconds, rather than until length bytes are done\n"
+" -S N -- fill pattern for the write buffer (default 0xcdcdcdcd)\n"
+" -Z N -- seed the random number generator (used for -R and -M)\n"
+" -w   -- call fdatasync(2) at the end (included in timing results)\n"
+" -C   -- print the results in a comma separated format\n"
+"\n"));
+}
+
+/*
+ * Claim the next I/O and work out where it goes and which way.  Returns
+ * zero once a size bound run has issued all of its I/O, or a timed run
+ * has reached its deadline.
+ */
+static int
+wl_next(
+	wl_thread_t	*t,
+	off64_t		*off,
+	int		*rw)
+{
+	wl_ctx_t	*ctx = t->ctx;
+	__uint64_t	n;
+
+	if (ctx->timed && lat_now() >= ctx->deadline)
+		return 0;
+	n = __sync_fetch_and_add(&ctx->next, 1);
+	if (!ctx->timed && n >= ctx->nops)
+		return 0;
+	if (ctx->random)
+		n = ((__uint64_t)rand_r(&t->seed) << 31) | rand_r(&t->seed);
+	*off = ctx->offset + (n % ctx->nblocks) * ctx->bsize;
+	*rw = (rand_r(&t->seed) % 100) < ctx->rmix ? WL_READ : WL_WRITE;
+	return 1;
+}
+
+static void
+wl_done(
+	wl_thread_t	*t,
+	int		rw,
+	ssize_t		bytes,
+	__uint64_t	lat)
+{
+	t->ops[rw]++;
+	t->bytes[rw] += bytes;
+	lat_hist_add(&t->hist[rw], lat);
+}
+
+/*
+ * One I/O at a time, with plain pread/pwrite.
+ */
+static void
+wl_sync(
+	wl_thread_t	*t)
+{
+	wl_ctx_t	*ctx = t->ctx;
+	__uint64_t	start;
+	ssize_t		bytes;
+	off64_t		off;
+	void		*rbuf;
+	int		rw;
+
+	rbuf = memalign(pagesize, ctx->bsize);
+	if (!rbuf) {
+		t->error = ENOMEM;
+		return;
+	}
+	while (wl_next(t, &off, &rw)) {
+		start = lat_now();
+		if (rw == WL_READ)
+			bytes = pread64(ctx->fd, rbuf, ctx->bsize, off);
+		else
+			bytes = pwrite64(ctx->fd, ctx->wbuf, ctx->bsize, off);
+		if (bytes < 0) {
+			t->error = errno;
+			break;
+		}
+		wl_done(t, rw, bytes, lat_now() - start);
+	}
+	free(rbuf);
+}
+
+#ifdef HAVE_LINUX_AIO
+/*
+ * Keep up to ctx->depth I/Os in flight with the native Linux AIO calls.
+ * These are used directly rather than through libaio or the POSIX aio
+ * routines: glibc runs the POSIX requests for one descriptor one at a
+ * time, which would defeat the point.  The latency of an I/O runs from
+ * its submission to the io_getevents call that reaps it.
+ */
+static void
+wl_aio(
+	wl_thread_t	*t)
+{
+	wl_ctx_t	*ctx = t->ctx;
+	aio_context_t	aioctx = 0;
+	struct io_event	*events;
+	struct iocb	*cbs, *cb;
+	struct iocb	**list;
+	__uint64_t	*start;
+	__uint64_t	now;
+	size_t		stride;
+	off64_t		off;
+	char		*rbufs;
+	long		r;
+	int		*freeslots;
+	int		done = 0;
+	int		i, n, nfree;
+	int		inflight = 0;
+	int		rw, slot;
+
+	stride = (ctx->bsize + pagesize - 1) & ~(pagesize - 1);
+	cbs = calloc(ctx->depth, sizeof(*cbs));
+	list = calloc(ctx->depth, sizeof(*list));
+	events = calloc(ctx->depth, sizeof(*events));
+	start = calloc(ctx->depth, sizeof(*start));
+	freeslots = calloc(ctx->depth, sizeof(*freeslots));
+	rbufs = memalign(pagesize, stride * ctx->depth);
+	if (!cbs || !list || !events || !start || !freeslots || !rbufs) {
+		t->error = ENOMEM;
+		goto out;
+	}
+	if (syscall(__NR_io_setup, ctx->depth, &aioctx) < 0) {
+		t->error = errno;
+		goto out;
+	}
+	for (nfree = 0; nfree < ctx->depth; nfree++)
+		freeslots[nfree] = nfree;
+
+	for (;;) {
+		for (n = 0; !done && nfree > 0; n++) {
+			if (!wl_next(t, &off, &rw)) {
+				done = 1;
+				break;
+			}
+			slot = freeslots[--nfree];
+			cb = &cbs[slot];
+			memset(cb, 0, sizeof(*cb));
+			cb->aio_data = slot;
+			cb->aio_fildes = ctx->fd;
+			cb->aio_nbytes = ctx->bsize;
+			cb->aio_offset = off;
+			if (rw == WL_READ) {
+				cb->aio_lio_opcode = IOCB_CMD_PREAD;
+				cb->aio_buf = (unsigned long)(rbufs +
+							slot * stride);
+			} else {
+				cb->aio_lio_opcode = IOCB_CMD_PWRITE;
+				cb->aio_buf = (unsigned long)ctx->wbuf;
+			}
+			list[n] = cb;
+		}
+
+		now = lat_now();
+		for (i = 0; i < n; i++)
+			start[list[i]->aio_data] = now;
+		for (i = 0; i < n; i += r) {
+			r = syscall(__NR_io_submit, aioctx, n - i, list + i);
+			if (r <= 0) {
+				t->error = r < 0 ? errno : EAGAIN;
+				done = 1;
+				for (; i < n; i++)
+					freeslots[nfree++] = list[i]->aio_data;
+				break;
+			}
+			inflight += r;
+		}
+		if (!inflight)
+			break;
+
+		r = syscall(__NR_io_getevents, aioctx, 1, inflight, events,
+				NULL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			t->error = errno;
+			break;
+		}
+		now = lat_now();
+		for (i = 0; i < r; i++) {
+			slot = events[i].data;
+			rw = cbs[slot].aio_lio_opcode == IOCB_CMD_PREAD ?
+				WL_READ : WL_WRITE;
+			if ((long long)events[i].res < 0) {
+				t->error = -(long long)events[i].res;
+				done = 1;
+			} else {
+				wl_done(t, rw, events[i].res,
+					now - start[slot]);
+			}
+			freeslots[nfree++] = slot;
+		}
+		inflight -= r;
+	}
+	syscall(__NR_io_destroy, aioctx);
+out:
+	free(rbufs);
+	free(freeslots);
+	free(start);
+	free(events);
+	free(list);
+	free(cbs);
+}
+#endif
+
+static void *
+wl_worker(
+	void		*arg)
+{
+	wl_thread_t	*t = arg;
+
+#ifdef HAVE_LINUX_AIO
+	if (t->ctx->depth > 1) {
+		wl_aio(t);
+		return NULL;
+	}
+#endif
+	wl_sync(t);
+	return NULL;
+}
+
+static int
+workload_f(
+	int		argc,
+	char		**argv)
+{
+	wl_ctx_t	ctx;
+	wl_thread_t	*threads, *t;
+	lat_hist_t	*hist;
+	long long	bytes[2] = { 0, 0 };
+	long long	ops[2] = { 0, 0 };
+	long long	count, total, tmp;
+	off64_t		offset;
+	size_t		fsblocksize, fssectsize;
+	struct timeval	t1, t2;
+	char		s1[64], s2[64], s3[64], s4[64], ts[64];
+	char		*sp;
+	unsigned long	secs = 0;
+	unsigned int	seed = 0xcdcdcdcd;
+	unsigned int	zeed = 0;
+	int		Cflag = 0, wflag = 0;
+	int		nthreads = 1, started;
+	int		c, error = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.depth = 1;
+	ctx.rmix = 100;
+	init_cvtnum(&fsblocksize, &fssectsize);
+	ctx.bsize = fsblocksize;
+
+	while ((c = getopt(argc, argv, "b:CM:Q:RS:t:T:wZ:")) != EOF) {
+		switch (c) {
+		case 'b':
+			tmp = cvtnum(fsblocksize, fssectsize, optarg);
+			if (tmp <= 0) {
+				printf(_("non-numeric bsize -- %s\n"), optarg);
+				return 0;
+			}
+			ctx.bsize = tmp;
+			break;
+		case 'C':
+			Cflag = 1;
+			break;
+		case 'M':
+			ctx.rmix = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || ctx.rmix > 100) {
+				printf(_("bad read percentage -- %s\n"),
+					optarg);
+				return 0;
+			}
+			break;
+		case 'Q':
+			ctx.depth = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg ||
+			    ctx.depth < 1 || ctx.depth > WL_MAX_DEPTH) {
+				printf(_("bad queue depth -- %s\n"), optarg);
+				return 0;
+			}
+			break;
+		case 'R':
+			ctx.random = 1;
+			break;
+		case 'S':
+			seed = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg) {
+				printf(_("non-numeric seed -- %s\n"), optarg);
+				return 0;
+			}
+			break;
+		case 't':
+			nthreads = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg ||
+			    nthreads < 1 || nthreads > WL_MAX_THREADS) {
+				printf(_("bad thread count -- %s\n"), optarg);
+				return 0;
+			}
+			break;
+		case 'T':
+			secs = cvttime(optarg);
+			if (!secs) {
+				printf(_("bad run time -- %s\n"), optarg);
+				return 0;
+			}
+			break;
+		case 'w':
+			wflag = 1;
+			break;
+		case 'Z':
+			zeed = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg) {
+				printf(_("non-numeric seed -- %s\n"), optarg);
+				return 0;
+			}
+			break;
+		default:
+			return command_usage(&workload_cmd);
+		}
+	}
+	if (optind != argc - 2)
+		return command_usage(&workload_cmd);
+	offset = cvtnum(fsblocksize, fssectsize, argv[optind]);
+	if (offset < 0) {
+		printf(_("non-numeric offset argument -- %s\n"), argv[optind]);
+		return 0;
+	}
+	optind++;
+	count = cvtnum(fsblocksize, fssectsize, argv[optind]);
+	if (count < 0) {
+		printf(_("non-numeric length argument -- %s\n"), argv[optind]);
+		return 0;
+	}
+	if (count < ctx.bsize) {
+		printf(_("length %lld is less than the block size %lld\n"),
+			count, (long long)ctx.bsize);
+		return 0;
+	}
+#ifndef HAVE_LINUX_AIO
+	if (ctx.depth > 1) {
+		printf(_("queue depths above 1 need Linux AIO support\n"));
+		return 0;
+	}
+#endif
+
+	ctx.fd = file->fd;
+	ctx.offset = offset;
+	ctx.nblocks = count / ctx.bsize;
+	ctx.nops = ctx.nblocks;
+	ctx.timed = secs != 0;
+	ctx.wbuf = memalign(pagesize, ctx.bsize);
+	threads = calloc(nthreads, sizeof(*threads));
+	hist = calloc(2, sizeof(*hist));
+	if (!ctx.wbuf || !threads || !hist) {
+		perror("calloc");
+		goto done;
+	}
+	memset(ctx.wbuf, seed, ctx.bsize);
+	if (!zeed)
+		zeed = time(NULL);
+
+	gettimeofday(&t1, NULL);
+	ctx.deadline = lat_now() + secs * 1000000000ULL;
+	for (started = 0; started < nthreads; started++) {
+		t = &threads[started];
+		t->ctx = &ctx;
+		t->seed = zeed + started;
+		c = pthread_create(&t->tid, NULL, wl_worker, t);
+		if (c) {
+			fprintf(stderr, _("%s: cannot create thread: %s\n"),
+				progname, strerror(c));
+			/* stop the ones already running */
+			ctx.timed = 0;
+			ctx.nops = 0;
+			break;
+		}
+	}
+	for (c = 0; c < started; c++) {
+		t = &threads[c];
+		pthread_join(t->tid, NULL);
+		if (t->error && !error)
+			error = t->error;
+		bytes[WL_READ] += t->bytes[WL_READ];
+		bytes[WL_WRITE] += t->bytes[WL_WRITE];
+		ops[WL_READ] += t->ops[WL_READ];
+		ops[WL_WRITE] += t->ops[WL_WRITE];
+		lat_hist_merge(&hist[WL_READ], &t->hist[WL_READ]);
+		lat_hist_merge(&hist[WL_WRITE], &t->hist[WL_WRITE]);
+	}
+	if (wflag)
+		fdatasync(file->fd);
+	gettimeofday(&t2, NULL);
+	t2 = tsub(t2, t1);
+	if (error)
+		fprintf(stderr, _("%s: workload: %s\n"),
+			progname, strerror(error));
+
+	total = bytes[WL_READ] + bytes[WL_WRITE];
+	c = ops[WL_READ] + ops[WL_WRITE];
+
+	/* Finally, report back -- -C gives a parsable format */
+	timestr(&t2, ts, sizeof(ts), Cflag ? VERBOSE_FIXED_TIME : 0);
+	if (!Cflag) {
+		printf(_("%d threads, queue depth %d"), started, ctx.depth);
+		if (ops[WL_READ]) {
+			cvtstr((double)bytes[WL_READ], s1, sizeof(s1));
+			printf(_(", read %s in %lld ops"), s1, ops[WL_READ]);
+		}
+		if (ops[WL_WRITE]) {
+			cvtstr((double)bytes[WL_WRITE], s2, sizeof(s2));
+			printf(_(", wrote %s in %lld ops"), s2, ops[WL_WRITE]);
+		}
+		printf("\n");
+		cvtstr((double)total, s3, sizeof(s3));
+		cvtstr(tdiv((double)total, t2), s4, sizeof(s4));
+		printf(_("%s, %d ops; %s (%s/sec and %.4f ops/sec)\n"),
+			s3, c, ts, s4, tdiv((double)c, t2));
+		lat_hist_print(&hist[WL_READ], _("read"));
+		lat_hist_print(&hist[WL_WRITE], _("write"));
+	} else {
+		/* bytes,ops,time,bytes/sec,ops/sec, then for reads and
+		 * writes: bytes,ops,min,avg,p50,p90,p99,p99.9,max */
+		printf("%lld,%d,%s,%.3f,%.3f",
+			total, c, ts,
+			tdiv((double)total, t2), tdiv((double)c, t2));
+		printf(",%lld,%lld", bytes[WL_READ], ops[WL_READ]);
+		lat_hist_print_csv(&hist[WL_READ]);
+		printf(",%lld,%lld", bytes[WL_WRITE], ops[WL_WRITE]);
+		lat_hist_print_csv(&hist[WL_WRITE]);
+		printf("\n");
+	}
+done:
+	free(hist);
+	free(threads);
+	free(ctx.wbuf);
+	return 0;
+}
+
+void
+workload_init(void)
+{
+	workload_cmd.name = "workload";
+	workload_cmd.cfunc = workload_f;
+	workload_cmd.argmin = 2;
+	workload_cmd.argmax = -1;
+	workload_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
+	workload_cmd.args =
+_("[-b bs] [-t threads] [-Q depth] [-M read%] [-R [-Z N]] [-T secs] [-S seed] [-wC] off len");
+	workload_cmd.oneline =
+		_("runs a multithreaded, asynchronous read/write workload");
+	workload_cmd.help = workload_help;
+
+	add_command(&workload_cmd);
+}
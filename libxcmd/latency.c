@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/xfs.h>
+#include <xfs/input.h>
+#include <xfs/latency.h>
+
+__uint64_t
+lat_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+lat_hist_bucket(
+	__uint64_t	v)
+{
+	int		shift;
+
+	if (v < LAT_HIST_NSUB)
+		return v;
+	shift = 63 - __builtin_clzll(v) - LAT_HIST_SUB;
+	return (shift + 1) * LAT_HIST_NSUB +
+		((v >> shift) & (LAT_HIST_NSUB - 1));
+}
+
+/* middle of the range of values a bucket holds */
+static __uint64_t
+lat_hist_value(
+	int		b)
+{
+	int		shift;
+
+	if (b < LAT_HIST_NSUB)
+		return b;
+	shift = b / LAT_HIST_NSUB - 1;
+	return ((__uint64_t)(LAT_HIST_NSUB + (b & (LAT_HIST_NSUB - 1))) <<
+		shift) + ((1ULL << shift) >> 1);
+}
+
+void
+lat_hist_add(
+	lat_hist_t	*h,
+	__uint64_t	v)
+{
+	if (!h->count || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->bucket[lat_hist_bucket(v)]++;
+}
+
+void
+lat_hist_merge(
+	lat_hist_t	*to,
+	lat_hist_t	*from)
+{
+	int		b;
+
+	if (!from->count)
+		return;
+	if (!to->count || from->min < to->min)
+		to->min = from->min;
+	if (from->max > to->max)
+		to->max = from->max;
+	to->count += from->count;
+	to->sum += from->sum;
+	for (b = 0; b < LAT_HIST_BUCKETS; b++)
+		to->bucket[b] += from->bucket[b];
+}
+
+__uint64_t
+lat_hist_percentile(
+	lat_hist_t	*h,
+	double		pct)
+{
+	double		want = h->count * pct / 100.0;
+	long long	seen = 0;
+	int		b;
+
+	if (!h->count)
+		return 0;
+	for (b = 0; b < LAT_HIST_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen && seen >= want)
+			return max(h->min, min(h->max, lat_hist_value(b)));
+	}
+	return h->max;
+}
+
+static double
+lat_hist_mean(
+	lat_hist_t	*h)
+{
+	return h->count ? h->sum / h->count : 0.0;
+}
+
+void
+lat_hist_print(
+	lat_hist_t	*h,
+	const char	*name)
+{
+	if (!h->count)
+		return;
+	if (name)
+		printf(_("%s "), name);
+	printf(_("latency (usec): min %.1f, avg %.1f, p50 %.1f, p90 %.1f, "
+		"p99 %.1f, p99.9 %.1f, max %.1f\n"),
+		h->min / 1000.0, lat_hist_mean(h) / 1000.0,
+		lat_hist_percentile(h, 50.0) / 1000.0,
+		lat_hist_percentile(h, 90.0) / 1000.0,
+		lat_hist_percentile(h, 99.0) / 1000.0,
+		lat_hist_percentile(h, 99.9) / 1000.0,
+		h->max / 1000.0);
+}
+
+/* ,min,avg,p50,p90,p99,p99.9,max in usec, to tack onto a -C line */
+void
+lat_hist_print_csv(
+	lat_hist_t	*h)
+{
+	printf(",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f",
+		h->min / 1000.0, lat_hist_mean(h) / 1000.0,
+		lat_hist_percentile(h, 50.0) / 1000.0,
+		lat_hist_percentile(h, 90.0) / 1000.0,
+		lat_hist_percentile(h, 99.0) / 1000.0,
+		lat_hist_percentile(h, 99.9) / 1000.0,
+		h->max / 1000.0);
+}
+
+latency_t *
+latency_alloc(
+	unsigned long	interval_ms)
+{
+	latency_t	*l;
+
+	l = calloc(1, sizeof(*l));
+	if (!l) {
+		perror("calloc");
+		return NULL;
+	}
+	l->interval = interval_ms * 1000000ULL;
+	return l;
+}
+
+void
+latency_free(
+	latency_t	*l)
+{
+	if (!l)
+		return;
+	free(l->samples);
+	free(l);
+}
+
+static void
+latency_push(
+	latency_t	*l,
+	__uint64_t	end)
+{
+	lat_sample_t	*s;
+
+	if (l->nsamples == l->maxsamples) {
+		l->maxsamples = l->maxsamples ? l->maxsamples * 2 : 64;
+		s = realloc(l->samples, l->maxsamples * sizeof(*s));
+		if (!s) {
+			/* keep what we have, but stop sampling */
+			l->interval = 0;
+			return;
+		}
+		l->samples = s;
+	}
+	l->cur.time = end - l->start;
+	l->cur.length = end - (l->ival_end - l->interval);
+	l->samples[l->nsamples++] = l->cur;
+	l->cur.bytes = l->cur.ops = 0;
+}
+
+/*
+ * The clock for the run starts with its first operation, so commands can
+ * set up buffers and the like after allocating the latency_t.
+ */
+void
+latency_start(
+	latency_t	*l)
+{
+	if (!l)
+		return;
+	l->op_start = lat_now();
+	if (!l->start) {
+		l->start = l->op_start;
+		l->ival_end = l->start + l->interval;
+	}
+}
+
+void
+latency_end(
+	latency_t	*l,
+	long long	bytes)
+{
+	__uint64_t	now;
+
+	if (!l)
+		return;
+	now = lat_now();
+	lat_hist_add(&l->hist, now - l->op_start);
+	l->last = now;
+	if (bytes > 0)
+		l->bytes += bytes;
+
+	/* an operation counts towards the interval it completed in */
+	while (l->interval && now >= l->ival_end) {
+		latency_push(l, l->ival_end);
+		l->ival_end += l->interval;
+	}
+	l->cur.ops++;
+	if (bytes > 0)
+		l->cur.bytes += bytes;
+}
+
+static void
+latency_report_json(
+	latency_t	*l,
+	const char	*name,
+	double		secs)
+{
+	lat_hist_t	*h = &l->hist;
+	lat_sample_t	*s;
+	int		i;
+
+	printf("{\"command\": \"%s\", \"seconds\": %.6f, "
+		"\"ops\": %lld, \"bytes\": %lld, "
+		"\"ops_per_sec\": %.3f, \"bytes_per_sec\": %.3f,\n",
+		name, secs, h->count, l->bytes,
+		secs > 0 ? h->count / secs : 0.0,
+		secs > 0 ? l->bytes / secs : 0.0);
+	printf(" \"latency_ns\": {\"min\": %llu, \"mean\": %.0f, "
+		"\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+		"\"p99.9\": %llu, \"p99.99\": %llu, \"max\": %llu}",
+		(unsigned long long)h->min, lat_hist_mean(h),
+		(unsigned long long)lat_hist_percentile(h, 50.0),
+		(unsigned long long)lat_hist_percentile(h, 90.0),
+		(unsigned long long)lat_hist_percentile(h, 99.0),
+		(unsigned long long)lat_hist_percentile(h, 99.9),
+		(unsigned long long)lat_hist_percentile(h, 99.99),
+		(unsigned long long)h->max);
+	if (l->nsamples) {
+		printf(",\n \"intervals\": [");
+		for (i = 0, s = l->samples; i < l->nsamples; i++, s++)
+			printf("%s\n  {\"time\": %.3f, \"seconds\": %.3f, "
+				"\"ops\": %lld, \"bytes\": %lld}",
+				i ? "," : "", s->time / 1e9, s->length / 1e9,
+				s->ops, s->bytes);
+		printf("\n ]");
+	}
+	printf("}\n");
+}
+
+static void
+latency_report_samples(
+	latency_t	*l)
+{
+	lat_sample_t	*s;
+	double		secs;
+	char		s1[64];
+	int		i;
+
+	printf(_("%10s %10s %12s %14s %12s\n"),
+		_("time"), _("ops"), _("bytes"), _("bytes/sec"), _("ops/sec"));
+	for (i = 0, s = l->samples; i < l->nsamples; i++, s++) {
+		secs = max(s->length, 1) / 1e9;
+		cvtstr(s->bytes / secs, s1, sizeof(s1));
+		printf("%10.3f %10lld %12lld %14s %12.1f\n",
+			s->time / 1e9, s->ops, s->bytes, s1, s->ops / secs);
+	}
+}
+
+/*
+ * Report the latency distribution, and the interval samples if any were
+ * taken.  The elapsed time is the command's own measure of the run if it
+ * has one, otherwise the run is taken to be first to last operation.
+ */
+void
+latency_report(
+	latency_t	*l,
+	const char	*name,
+	struct timeval	*elapsed,
+	int		flags)
+{
+	double		secs;
+
+	if (!l)
+		return;
+	if (l->interval && l->cur.ops)
+		latency_push(l, l->last);
+	if (elapsed)
+		secs = elapsed->tv_sec + elapsed->tv_usec / 1e6;
+	else
+		secs = (l->last - l->start) / 1e9;
+
+	if (flags & LAT_JSON) {
+		latency_report_json(l, name, secs);
+		return;
+	}
+	lat_hist_print(&l->hist, NULL);
+	if (l->nsamples)
+		latency_report_samples(l);
+}
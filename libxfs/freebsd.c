@@ -185,6 +185,15 @@ platform_nproc(void)
 	return ncpu;
 }
 
+int
+platform_zero_range(
+	int		fd,
+	__uint64_t	start,
+	__uint64_t	len)
+{
+	return EOPNOTSUPP;
+}
+
 unsigned long
 platform_physmem(void)
 {
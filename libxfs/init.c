@@ -37,8 +37,9 @@ kmem_zone_t	*xfs_inode_zone;
 #define MAX_DEVS 10	/* arbitary maximum */
 int nextfakedev = -1;	/* device number to give to next fake device */
 static struct dev_to_fd {
-	dev_t	dev;
-	int	fd;
+	dev_t			dev;
+	int			fd;
+	struct xfs_mdmap	*md;	/* set if the device is a metadump */
 } dev_map[MAX_DEVS]={{0}};
 
 /*
@@ -82,6 +83,37 @@ libxfs_device_to_fd(dev_t device)
 	/* NOTREACHED */
 }
 
+/* libxfs_device_to_mdmap:
+ *     lookup a device number in the device map
+ *     return the metadump index if the device is a metadump image
+ */
+struct xfs_mdmap *
+libxfs_device_to_mdmap(dev_t device)
+{
+	int	d;
+
+	for (d = 0; d < MAX_DEVS; d++)
+		if (dev_map[d].dev == device)
+			return dev_map[d].md;
+	return NULL;
+}
+
+/* libxfs_device_open_metadump:
+ *     attach the block index of a metadump image to an open device
+ */
+static int
+libxfs_device_open_metadump(dev_t device, char *path)
+{
+	int	d;
+
+	for (d = 0; d < MAX_DEVS; d++)
+		if (dev_map[d].dev == device) {
+			dev_map[d].md = libxfs_mdmap_open(dev_map[d].fd, path);
+			return dev_map[d].md != NULL;
+		}
+	return 0;
+}
+
 /* libxfs_device_open:
  *     open a device and return its device number
  */
@@ -167,6 +199,10 @@ libxfs_device_close(dev_t dev)
 
 			fd = dev_map[d].fd;
 			dev_map[d].dev = dev_map[d].fd = 0;
+			if (dev_map[d].md) {
+				libxfs_mdmap_close(dev_map[d].md);
+				dev_map[d].md = NULL;
+			}
 
 			fsync(fd);
 			platform_flush_device(fd, dev);
@@ -265,6 +301,9 @@ libxfs_init(libxfs_init_t *a)
 			a->ddev= libxfs_device_open(dname, a->dcreat, flags,
 						    a->setblksize);
 			a->dfd = libxfs_device_to_fd(a->ddev);
+			if (a->dismetadump &&
+			    !libxfs_device_open_metadump(a->ddev, dname))
+				goto done;
 		} else {
 			if (!check_open(dname, flags, &rawfile, &blockfile))
 				goto done;
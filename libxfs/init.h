@@ -34,4 +34,7 @@ extern int platform_align_blockdev (void);
 extern unsigned long platform_physmem(void);	/* in kilobytes */
 extern int platform_has_uuid;
 
+struct xfs_mdmap;
+extern struct xfs_mdmap *libxfs_device_to_mdmap (dev_t);
+
 #endif	/* LIBXFS_INIT_H */
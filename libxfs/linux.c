@@ -25,6 +25,9 @@
 #include <sys/mount.h>
 #include <sys/ioctl.h>
 #include <sys/sysinfo.h>
+#ifdef HAVE_FALLOCATE
+#include <linux/falloc.h>
+#endif
 
 int platform_has_uuid = 1;
 extern char *progname;
@@ -36,6 +39,21 @@ static int max_block_alignment;
 #ifndef BLKBSZSET
 # define BLKBSZSET	_IOW(0x12,113,size_t)
 #endif
+#ifndef BLKDISCARDZEROES
+# define BLKDISCARDZEROES	_IO(0x12,124)
+#endif
+#ifndef BLKZEROOUT
+# define BLKZEROOUT	_IO(0x12,127)
+#endif
+#ifndef FALLOC_FL_KEEP_SIZE
+# define FALLOC_FL_KEEP_SIZE	0x01
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+# define FALLOC_FL_PUNCH_HOLE	0x02
+#endif
+#ifndef FALLOC_FL_ZERO_RANGE
+# define FALLOC_FL_ZERO_RANGE	0x10
+#endif
 #ifndef BLKSSZGET
 # define BLKSSZGET	_IO(0x12,104)
 #endif
@@ -217,6 +235,50 @@ platform_nproc(void)
 	return sysconf(_SC_NPROCESSORS_ONLN);
 }
 
+/*
+ * Zero a range of a device or file without sending zeroes down to it,
+ * if the kernel can do that.  Block devices are asked to write zeroes,
+ * which they may do by discard or by writing them themselves, or failing
+ * that to discard if discarded blocks are known to read back as zeroes.
+ * Files have the range converted to unwritten extents, or punched out
+ * if it lies within the file.
+ */
+int
+platform_zero_range(
+	int		fd,
+	__uint64_t	start,
+	__uint64_t	len)
+{
+	struct stat64	st;
+	__uint64_t	range[2] = { start, len };
+	unsigned int	zeroes = 0;
+
+	if (fstat64(fd, &st) < 0)
+		return errno;
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKZEROOUT, &range) == 0)
+			return 0;
+		if (ioctl(fd, BLKDISCARDZEROES, &zeroes) == 0 && zeroes &&
+		    ioctl(fd, BLKDISCARD, &range) == 0)
+			return 0;
+		return EOPNOTSUPP;
+	}
+#ifdef HAVE_FALLOCATE
+	/*
+	 * Zeroing has to extend a file that is shorter than the range, as
+	 * writing zeroes would (mkfs relies on this for a file-backed log),
+	 * so the size is only kept when punching out a range inside it.
+	 */
+	if (fallocate(fd, FALLOC_FL_ZERO_RANGE, start, len) == 0)
+		return 0;
+	if (start + len <= st.st_size &&
+	    fallocate(fd, FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE,
+		      start, len) == 0)
+		return 0;
+#endif
+	return EOPNOTSUPP;
+}
+
 unsigned long
 platform_physmem(void)
 {
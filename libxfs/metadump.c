@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxfs.h>
+#include <xfs/xfs_metadump.h>
+#include "init.h"
+
+/*
+ * Read-only access to an uncompressed metadump image.
+ *
+ * A metadump is a sequence of metablocks, each an index of daddrs followed
+ * by the blocks themselves.  When the image is opened we walk the index
+ * blocks only, seeking over the data, and build a table of runs mapping
+ * contiguous daddr ranges onto contiguous ranges of the dump file.  Reads
+ * are then served straight from the dump; anything that was not dumped
+ * (i.e. file data and free space) reads back as zeroes, just as it would
+ * from a freshly restored image.
+ */
+struct mdmap_run {
+	__uint64_t		daddr;		/* first sector in run */
+	off64_t			offset;		/* dump file offset of daddr */
+	__uint64_t		len;		/* run length in sectors */
+};
+
+struct xfs_mdmap {
+	int			fd;
+	int			nruns;
+	int			maxruns;
+	struct mdmap_run	*runs;
+};
+
+static int
+mdmap_add(
+	struct xfs_mdmap	*md,
+	__uint64_t		daddr,
+	off64_t			offset,
+	__uint64_t		len)
+{
+	struct mdmap_run	*r;
+
+	if (md->nruns) {
+		r = &md->runs[md->nruns - 1];
+		if (r->daddr + r->len == daddr &&
+		    r->offset + BBTOB(r->len) == offset) {
+			r->len += len;
+			return 0;
+		}
+	}
+	if (md->nruns == md->maxruns) {
+		md->maxruns = md->maxruns ? md->maxruns * 2 : 1024;
+		r = realloc(md->runs, md->maxruns * sizeof(*r));
+		if (!r)
+			return ENOMEM;
+		md->runs = r;
+	}
+	r = &md->runs[md->nruns++];
+	r->daddr = daddr;
+	r->offset = offset;
+	r->len = len;
+	return 0;
+}
+
+static int
+mdmap_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct mdmap_run	*ra = a;
+	const struct mdmap_run	*rb = b;
+
+	if (ra->daddr != rb->daddr)
+		return ra->daddr < rb->daddr ? -1 : 1;
+	if (ra->offset != rb->offset)
+		return ra->offset < rb->offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Sort the runs by daddr and make them disjoint.  A block can be dumped
+ * more than once; the copy furthest into the dump is the one xfs_mdrestore
+ * would have left behind, so it wins any overlap.  Trimming an older run
+ * can leave a tail past the newer one which has to be sorted back in, so
+ * repeat until nothing is left over - overlaps are rare, so this is
+ * almost always a single pass.
+ */
+static int
+mdmap_normalize(
+	struct xfs_mdmap	*md)
+{
+	struct mdmap_run	*tails = NULL;
+	struct mdmap_run	*t;
+	struct mdmap_run	*l;
+	struct mdmap_run	r;
+	int			ntails;
+	int			out;
+	int			i;
+	__uint64_t		lend;
+	__uint64_t		rend;
+	__uint64_t		skip;
+
+	do {
+		qsort(md->runs, md->nruns, sizeof(*md->runs), mdmap_cmp);
+		ntails = 0;
+		out = 0;
+		for (i = 0; i < md->nruns; i++) {
+			r = md->runs[i];
+			while (out > 0 && r.len) {
+				l = &md->runs[out - 1];
+				lend = l->daddr + l->len;
+				if (lend <= r.daddr)
+					break;
+				rend = r.daddr + r.len;
+				if (l->offset > r.offset) {
+					skip = min(lend, rend) - r.daddr;
+					r.daddr += skip;
+					r.offset += BBTOB(skip);
+					r.len -= skip;
+					continue;
+				}
+				if (lend > rend) {
+					t = realloc(tails,
+						(ntails + 1) * sizeof(*tails));
+					if (!t) {
+						free(tails);
+						return ENOMEM;
+					}
+					tails = t;
+					tails[ntails].daddr = rend;
+					tails[ntails].offset = l->offset +
+						BBTOB(rend - l->daddr);
+					tails[ntails].len = lend - rend;
+					ntails++;
+				}
+				l->len = r.daddr - l->daddr;
+				if (l->len == 0)
+					out--;
+			}
+			if (r.len)
+				md->runs[out++] = r;
+		}
+		md->nruns = out;
+		for (i = 0; i < ntails; i++) {
+			if (mdmap_add(md, tails[i].daddr, tails[i].offset,
+					tails[i].len)) {
+				free(tails);
+				return ENOMEM;
+			}
+		}
+	} while (ntails);
+
+	free(tails);
+	return 0;
+}
+
+struct xfs_mdmap *
+libxfs_mdmap_open(
+	int			fd,
+	char			*path)
+{
+	struct xfs_mdmap	*md;
+	xfs_metablock_t		tmb;
+	xfs_metablock_t		*metablock = NULL;
+	__be64			*block_index;
+	int			block_size;
+	int			max_indicies;
+	int			mb_count = 0;
+	int			i;
+	off64_t			off;
+	struct stat64		st;
+
+	if (fstat64(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, _("%s: %s: metadump must be a regular file\n"),
+			progname, path);
+		return NULL;
+	}
+
+	if (pread64(fd, &tmb, sizeof(tmb), 0) != sizeof(tmb) ||
+	    be32_to_cpu(tmb.mb_magic) != XFS_MD_MAGIC) {
+		fprintf(stderr, _("%s: %s is not a metadata dump\n"),
+			progname, path);
+		return NULL;
+	}
+	if (tmb.mb_blocklog < BBSHIFT || tmb.mb_blocklog > 16) {
+		fprintf(stderr, _("%s: %s: bad metadump block size\n"),
+			progname, path);
+		return NULL;
+	}
+
+	block_size = 1 << tmb.mb_blocklog;
+	max_indicies = (block_size - sizeof(xfs_metablock_t)) / sizeof(__be64);
+
+	md = calloc(1, sizeof(*md));
+	metablock = malloc(block_size);
+	if (!md || !metablock)
+		goto out_nomem;
+	md->fd = fd;
+	block_index = (__be64 *)((char *)metablock + sizeof(xfs_metablock_t));
+
+	for (off = 0; ; off += (off64_t)mb_count << tmb.mb_blocklog) {
+		if (pread64(fd, metablock, block_size, off) != block_size)
+			goto out_corrupt;
+		mb_count = be16_to_cpu(metablock->mb_count);
+		if (mb_count == 0)
+			break;
+		if (be32_to_cpu(metablock->mb_magic) != XFS_MD_MAGIC ||
+		    mb_count > max_indicies)
+			goto out_corrupt;
+		off += block_size;
+		if (off + ((off64_t)mb_count << tmb.mb_blocklog) > st.st_size)
+			goto out_corrupt;
+
+		for (i = 0; i < mb_count; i++) {
+			if (mdmap_add(md, be64_to_cpu(block_index[i]),
+					off + ((off64_t)i << tmb.mb_blocklog),
+					BTOBB(block_size)))
+				goto out_nomem;
+		}
+		if (mb_count < max_indicies)
+			break;
+	}
+
+	if (!md->nruns || md->runs[0].daddr != XFS_SB_DADDR) {
+		fprintf(stderr,
+	_("%s: %s: first block is not the primary superblock\n"),
+			progname, path);
+		goto out_free;
+	}
+	if (mdmap_normalize(md))
+		goto out_nomem;
+
+	free(metablock);
+	return md;
+
+out_corrupt:
+	fprintf(stderr, _("%s: %s: metadump is truncated or corrupt "
+			  "at offset %lld\n"),
+		progname, path, (long long)off);
+	goto out_free;
+out_nomem:
+	fprintf(stderr, _("%s: %s: cannot allocate metadump index\n"),
+		progname, path);
+out_free:
+	if (md)
+		free(md->runs);
+	free(md);
+	free(metablock);
+	return NULL;
+}
+
+void
+libxfs_mdmap_close(
+	struct xfs_mdmap	*md)
+{
+	free(md->runs);
+	free(md);
+}
+
+/*
+ * Return the index of the first run that ends beyond daddr.
+ */
+static int
+mdmap_find(
+	struct xfs_mdmap	*md,
+	__uint64_t		daddr)
+{
+	struct mdmap_run	*r;
+	int			lo = 0;
+	int			hi = md->nruns;
+	int			mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		r = &md->runs[mid];
+		if (r->daddr + r->len <= daddr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Is this sector present in the dump?
+ */
+int
+libxfs_mdmap_mapped(
+	struct xfs_mdmap	*md,
+	xfs_daddr_t		daddr)
+{
+	int			i = mdmap_find(md, daddr);
+
+	return i < md->nruns && md->runs[i].daddr <= daddr;
+}
+
+/*
+ * Fill a buffer from the dump.  Both offset and len are in bytes and must
+ * be sector aligned, as they always are for buffer cache I/O.
+ */
+int
+libxfs_mdmap_read(
+	struct xfs_mdmap	*md,
+	void			*buf,
+	int			len,
+	off64_t			offset)
+{
+	struct mdmap_run	*r;
+	__uint64_t		daddr = offset >> BBSHIFT;
+	__uint64_t		end = daddr + BTOBB(len);
+	__uint64_t		s;
+	__uint64_t		e;
+	ssize_t			bytes;
+
+	memset(buf, 0, len);
+
+	for (r = &md->runs[mdmap_find(md, daddr)];
+	     r < &md->runs[md->nruns]; r++) {
+		if (r->daddr >= end)
+			break;
+		s = max(r->daddr, daddr);
+		e = min(r->daddr + r->len, end);
+		bytes = pread64(md->fd, (char *)buf + BBTOB(s - daddr),
+				BBTOB(e - s), r->offset + BBTOB(s - r->daddr));
+		if (bytes < 0)
+			return errno;
+		if (bytes != BBTOB(e - s))
+			return EIO;
+	}
+	return 0;
+}
@@ -50,55 +50,104 @@
  * propagation of stale errors into future buffer operations.
  */
 
-#define BDSTRAT_SIZE	(256 * 1024)
-
 #define IO_BCOMPARE_CHECK
 
-void
-libxfs_device_zero(struct xfs_buftarg *btp, xfs_daddr_t start, uint len)
-{
-	xfs_off_t	start_offset, end_offset, offset;
-	ssize_t		zsize, bytes;
-	char		*z;
+/*
+ * Zeroing that the kernel can't do for us is done by a few threads each
+ * writing large pieces, so that more than one write is in flight.
+ */
+#define ZERO_SIZE	(1024 * 1024)
+#define ZERO_THREADS	4
+
+struct zero_args {
 	int		fd;
+	char		*z;
+	xfs_off_t	end;
+	pthread_mutex_t	lock;
+	xfs_off_t	next;
+};
 
-	zsize = min(BDSTRAT_SIZE, BBTOB(len));
-	if ((z = memalign(libxfs_device_alignment(), zsize)) == NULL) {
-		fprintf(stderr,
-			_("%s: %s can't memalign %d bytes: %s\n"),
-			progname, __FUNCTION__, (int)zsize, strerror(errno));
-		exit(1);
+static void *
+zero_worker(void *arg)
+{
+	struct zero_args *za = arg;
+	xfs_off_t	offset;
+	ssize_t		bytes;
+	ssize_t		done;
+
+	for (;;) {
+		pthread_mutex_lock(&za->lock);
+		offset = za->next;
+		za->next += ZERO_SIZE;
+		pthread_mutex_unlock(&za->lock);
+		if (offset >= za->end)
+			break;
+		bytes = min((xfs_off_t)ZERO_SIZE, za->end - offset);
+		for (done = 0; done < bytes; ) {
+			ssize_t	n;
+
+			n = pwrite64(za->fd, za->z + done, bytes - done,
+				     offset + done);
+			if (n < 0) {
+				fprintf(stderr, _("%s: %s write failed: %s\n"),
+					progname, __FUNCTION__,
+					strerror(errno));
+				exit(1);
+			} else if (n == 0) {
+				fprintf(stderr, _("%s: %s not progressing?\n"),
+					progname, __FUNCTION__);
+				exit(1);
+			}
+			done += n;
+		}
 	}
-	memset(z, 0, zsize);
+	return NULL;
+}
+
+void
+libxfs_device_zero(struct xfs_buftarg *btp, xfs_daddr_t start, uint len)
+{
+	struct zero_args za;
+	pthread_t	threads[ZERO_THREADS];
+	xfs_off_t	start_offset, end_offset;
+	int		i, nthreads;
 
-	fd = libxfs_device_to_fd(btp->dev);
+	za.fd = libxfs_device_to_fd(btp->dev);
 	start_offset = LIBXFS_BBTOOFF64(start);
+	end_offset = LIBXFS_BBTOOFF64(start + len);
+	if (!len)
+		return;
 
-	if ((lseek64(fd, start_offset, SEEK_SET)) < 0) {
-		fprintf(stderr, _("%s: %s seek to offset %llu failed: %s\n"),
-			progname, __FUNCTION__,
-			(unsigned long long)start_offset, strerror(errno));
-		exit(1);
-	}
+	/* let the kernel or the device do it if they can */
+	if (platform_zero_range(za.fd, start_offset,
+				end_offset - start_offset) == 0)
+		return;
 
-	end_offset = LIBXFS_BBTOOFF64(start + len) - start_offset;
-	for (offset = 0; offset < end_offset; ) {
-		bytes = min((ssize_t)(end_offset - offset), zsize);
-		if ((bytes = write(fd, z, bytes)) < 0) {
-			fprintf(stderr, _("%s: %s write failed: %s\n"),
-				progname, __FUNCTION__, strerror(errno));
-			exit(1);
-		} else if (bytes == 0) {
-			fprintf(stderr, _("%s: %s not progressing?\n"),
-				progname, __FUNCTION__);
-			exit(1);
-		}
-		offset += bytes;
+	if ((za.z = memalign(libxfs_device_alignment(), ZERO_SIZE)) == NULL) {
+		fprintf(stderr,
+			_("%s: %s can't memalign %d bytes: %s\n"),
+			progname, __FUNCTION__, ZERO_SIZE, strerror(errno));
+		exit(1);
 	}
-	free(z);
+	memset(za.z, 0, ZERO_SIZE);
+	za.end = end_offset;
+	za.next = start_offset;
+	pthread_mutex_init(&za.lock, NULL);
+
+	nthreads = min((xfs_off_t)ZERO_THREADS,
+		       howmany(end_offset - start_offset, ZERO_SIZE));
+	for (i = 0; i < nthreads && nthreads > 1; i++)
+		if (pthread_create(&threads[i], NULL, zero_worker, &za))
+			break;
+	nthreads = (nthreads > 1) ? i : 0;
+	zero_worker(&za);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&za.lock);
+	free(za.z);
 }
 
-static void unmount_record(void *p)
+static void unmount_record(void *p, int cycle)
 {
 	xlog_op_header_t	*op = (xlog_op_header_t *)p;
 	/* the data section must be 32 bit size aligned */
@@ -109,7 +158,7 @@ static void unmount_record(void *p)
 	} magic = { XLOG_UNMOUNT_TYPE, 0, 0 };
 
 	memset(p, 0, BBSIZE);
-	op->oh_tid = cpu_to_be32(1);
+	op->oh_tid = cpu_to_be32(cycle);
 	op->oh_len = cpu_to_be32(sizeof(magic));
 	op->oh_clientid = XFS_LOG;
 	op->oh_flags = XLOG_UNMOUNT_TRANS;
@@ -128,6 +177,18 @@ static xfs_caddr_t next(xfs_caddr_t ptr, int offset, void *private)
 	return ptr + offset;
 }
 
+/* size of the records used to fill a log formatted past the first cycle */
+#define LOG_FILL_RECORD_BBS	BTOBB(XLOG_HEADER_CYCLE_SIZE)
+
+/*
+ * Write a clean log, i.e. a single unmount record at the start of the log.
+ *
+ * The kernel only accepts a partially zeroed log if it is on its first
+ * cycle.  Any other cycle - needed when metadata already carries LSNs from
+ * an earlier incarnation of the log - means stamping the rest of the log
+ * with records from the previous cycle so that the head is found just past
+ * the unmount record.
+ */
 int
 libxfs_log_clear(
 	struct xfs_buftarg	*btp,
@@ -136,25 +197,54 @@ libxfs_log_clear(
 	uuid_t			*fs_uuid,
 	int			version,
 	int			sunit,
-	int			fmt)
+	int			fmt,
+	int			cycle)
 {
 	xfs_buf_t		*bp;
+	xfs_daddr_t		blk;
+	xfs_daddr_t		end_blk;
+	xfs_lsn_t		lsn;
 	int			len;
 
 	if (!btp->dev || !fs_uuid)
 		return -EINVAL;
+	if (cycle < XLOG_INIT_CYCLE)
+		cycle = XLOG_INIT_CYCLE;
 
-	/* first zero the log */
-	libxfs_device_zero(btp, start, length);
+	/* first zero the log, unless it is about to be overwritten anyway */
+	if (cycle == XLOG_INIT_CYCLE)
+		libxfs_device_zero(btp, start, length);
 
 	/* then write a log record header */
 	len = ((version == 2) && sunit) ? BTOBB(sunit) : 2;
 	len = MAX(len, 2);
+	lsn = xlog_assign_lsn(cycle, 0);
 	bp = libxfs_getbufr(btp, start, len);
 	libxfs_log_header(XFS_BUF_PTR(bp),
-			  fs_uuid, version, sunit, fmt, next, bp);
+			  fs_uuid, version, sunit, fmt, lsn, lsn, next, bp);
 	bp->b_flags |= LIBXFS_B_DIRTY;
 	libxfs_putbufr(bp);
+
+	if (cycle == XLOG_INIT_CYCLE)
+		return 0;
+
+	/*
+	 * Fill the rest of the log with previous cycle records.  Never leave
+	 * a single block at the end, a record needs at least two.
+	 */
+	cycle--;
+	end_blk = start + length;
+	for (blk = start + len; blk < end_blk; blk += len) {
+		len = MIN(end_blk - blk, LOG_FILL_RECORD_BBS);
+		if (end_blk - blk - len == 1)
+			len--;
+		lsn = xlog_assign_lsn(cycle, blk - start);
+		bp = libxfs_getbufr(btp, blk, len);
+		libxfs_log_header(XFS_BUF_PTR(bp), fs_uuid, 2, BBTOB(len),
+				  fmt, lsn, lsn, next, bp);
+		bp->b_flags |= LIBXFS_B_DIRTY;
+		libxfs_putbufr(bp);
+	}
 	return 0;
 }
 
@@ -165,6 +255,8 @@ libxfs_log_header(
 	int			version,
 	int			sunit,
 	int			fmt,
+	xfs_lsn_t		lsn,
+	xfs_lsn_t		tail_lsn,
 	libxfs_get_block_t	*nextfunc,
 	void			*private)
 {
@@ -181,7 +273,7 @@ libxfs_log_header(
 	 */
 	memset(p, 0, BBSIZE);
 	head->h_magicno = cpu_to_be32(XLOG_HEADER_MAGIC_NUM);
-	head->h_cycle = cpu_to_be32(1);
+	head->h_cycle = cpu_to_be32(CYCLE_LSN(lsn));
 	head->h_version = cpu_to_be32(version);
 	if (len != 1)
 		head->h_len = cpu_to_be32(sunit - BBSIZE);
@@ -194,14 +286,14 @@ libxfs_log_header(
 	head->h_fmt = cpu_to_be32(fmt);
 	head->h_size = cpu_to_be32(XLOG_HEADER_CYCLE_SIZE);
 
-	head->h_lsn = cpu_to_be64(xlog_assign_lsn(1, 0));
-	head->h_tail_lsn = cpu_to_be64(xlog_assign_lsn(1, 0));
+	head->h_lsn = cpu_to_be64(lsn);
+	head->h_tail_lsn = cpu_to_be64(tail_lsn);
 
 	memcpy(&head->h_fs_uuid, fs_uuid, sizeof(uuid_t));
 
 	len = MAX(len, 2);
 	p = nextfunc(p, BBSIZE, private);
-	unmount_record(p);
+	unmount_record(p, CYCLE_LSN(lsn));
 
 	cycle_lsn = CYCLE_LSN_DISK(head->h_lsn);
 	for (i = 2; i < len; i++) {
@@ -723,17 +815,41 @@ __read_buf(int fd, void *buf, int len, off64_t offset, int flags)
 	return 0;
 }
 
+/*
+ * Metadump images are not laid out like the filesystem, so reads from them
+ * go through the dump's block index rather than straight to the fd.
+ */
+static int
+__read_dev(dev_t dev, void *buf, int len, off64_t offset, int flags)
+{
+	struct xfs_mdmap	*md = libxfs_device_to_mdmap(dev);
+	int			error;
+
+	if (!md)
+		return __read_buf(libxfs_device_to_fd(dev), buf, len, offset,
+				  flags);
+
+	error = libxfs_mdmap_read(md, buf, len, offset);
+	if (error) {
+		fprintf(stderr, _("%s: metadump read failed: %s\n"),
+			progname, strerror(error));
+		if (flags & LIBXFS_EXIT_ON_FAILURE)
+			exit(1);
+	}
+	return error;
+}
+
 int
 libxfs_readbufr(struct xfs_buftarg *btp, xfs_daddr_t blkno, xfs_buf_t *bp,
 		int len, int flags)
 {
-	int	fd = libxfs_device_to_fd(btp->dev);
 	int	bytes = BBTOB(len);
 	int	error;
 
 	ASSERT(BBTOB(len) <= bp->b_bcount);
 
-	error = __read_buf(fd, bp->b_addr, bytes, LIBXFS_BBTOOFF64(blkno), flags);
+	error = __read_dev(btp->dev, bp->b_addr, bytes,
+			   LIBXFS_BBTOOFF64(blkno), flags);
 	if (!error &&
 	    bp->b_target->dev == btp->dev &&
 	    bp->b_bn == blkno &&
@@ -747,6 +863,22 @@ libxfs_readbufr(struct xfs_buftarg *btp, xfs_daddr_t blkno, xfs_buf_t *bp,
 	return error;
 }
 
+/*
+ * Buffers are read synchronously, so readahead can only ask the kernel to
+ * start pulling the range into the page cache for a later read.  That is
+ * no help for metadumps, which are not laid out like the device.
+ */
+void
+libxfs_readahead(struct xfs_buftarg *btp, xfs_daddr_t blkno, int len)
+{
+#ifdef HAVE_FADVISE
+	if (libxfs_device_to_mdmap(btp->dev))
+		return;
+	posix_fadvise(libxfs_device_to_fd(btp->dev), LIBXFS_BBTOOFF64(blkno),
+		      BBTOB(len), POSIX_FADV_WILLNEED);
+#endif
+}
+
 void
 libxfs_readbuf_verify(struct xfs_buf *bp, const struct xfs_buf_ops *ops)
 {
@@ -806,18 +938,16 @@ libxfs_readbuf(struct xfs_buftarg *btp, xfs_daddr_t blkno, int len, int flags,
 int
 libxfs_readbufr_map(struct xfs_buftarg *btp, struct xfs_buf *bp, int flags)
 {
-	int	fd;
 	int	error = 0;
 	char	*buf;
 	int	i;
 
-	fd = libxfs_device_to_fd(btp->dev);
 	buf = bp->b_addr;
 	for (i = 0; i < bp->b_nmaps; i++) {
 		off64_t	offset = LIBXFS_BBTOOFF64(bp->b_map[i].bm_bn);
 		int len = BBTOB(bp->b_map[i].bm_len);
 
-		error = __read_buf(fd, buf, len, offset, flags);
+		error = __read_dev(btp->dev, buf, len, offset, flags);
 		if (error) {
 			bp->b_error = error;
 			break;
@@ -908,6 +1038,12 @@ libxfs_writebufr(xfs_buf_t *bp)
 		return bp->b_error;
 	}
 
+	/* metadump images are only ever opened read-only */
+	if (libxfs_device_to_mdmap(bp->b_target->dev)) {
+		bp->b_error = EROFS;
+		return bp->b_error;
+	}
+
 	/*
 	 * clear any pre-existing error status on the buffer. This can occur if
 	 * the buffer is corrupt on disk and the repair process doesn't clear
@@ -0,0 +1,846 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxlog.h>
+#include <pthread.h>
+
+/*
+ * Parallel log recovery front end.
+ *
+ * xlog_do_recovery_pass() reads and parses the log one record at a time,
+ * looking every op up in a small hash of transactions, and does all of
+ * that again for each pass.  Here the active part of the log is read once,
+ * in large chunks, into a single image laid out in log order, so records
+ * that wrap the physical end of the log are contiguous.  Then:
+ *
+ *  1. the record headers are walked in order to find the records;
+ *  2. the records are unpacked and their ops indexed, in parallel;
+ *  3. the tids that start a transaction are entered into an open
+ *     addressed table, claiming slots with compare-and-swap;
+ *  4. every op is pushed onto its tid's lock-free list;
+ *  5. each tid's ops are sorted back into log order and assembled into
+ *     transactions, in parallel across tids;
+ *  6. the committed transactions are handed to xlog_recover_do_trans()
+ *     in commit order, once for each pass.
+ *
+ * Items and regions come from per-thread arenas that are thrown away in
+ * one go at the end, rather than being allocated and grown one at a time.
+ */
+
+#define XLOG_PARSE_CHUNK_BBS	8192		/* 4MB log reads */
+#define XLOG_ARENA_CHUNK	(1024 * 1024)
+#define XLOG_MAX_THREADS	16
+
+struct xlog_arena_chunk {
+	struct xlog_arena_chunk	*next;
+	size_t			size;
+	size_t			used;
+	char			data[];
+};
+
+struct xlog_arena {
+	struct xlog_arena_chunk	*chunks;
+};
+
+struct xlog_op {
+	struct xlog_op		*next;		/* tid list */
+	__uint64_t		seq;		/* record << 32 | op index */
+	xfs_caddr_t		data;
+	int			len;
+	xlog_tid_t		tid;
+	uint			flags;
+	xfs_lsn_t		lsn;
+};
+
+struct xlog_prec {
+	xlog_rec_header_t	*rhead;
+	xfs_caddr_t		data;
+	struct xlog_op		*ops;
+	int			nops;
+};
+
+struct xlog_tslot {
+	int			state;		/* 0 free, 1 claiming, 2 set */
+	xlog_tid_t		tid;
+	struct xlog_op		*ops;
+};
+
+struct xlog_ctrans {
+	xlog_recover_t		*trans;
+	__uint64_t		seq;		/* of the commit op */
+};
+
+struct xlog_parse;
+
+struct xlog_pthread {
+	struct xlog_parse	*p;
+	int			idx;
+	struct xlog_arena	arena;
+	int			nstarts;
+	struct xlog_ctrans	*done;
+	int			ndone;
+	int			maxdone;
+};
+
+struct xlog_parse {
+	struct xlog		*log;
+	char			*image;
+	struct xlog_prec	*recs;
+	int			nrecs;
+	struct xlog_tslot	*table;
+	unsigned int		tmask;
+	struct xlog_pthread	*threads;
+	int			nthreads;
+	int			next;		/* work counter */
+	int			nwork;
+	int			error;
+	int			(*fn)(struct xlog_pthread *, int);
+};
+
+static void *
+xlog_arena_alloc(
+	struct xlog_arena	*a,
+	size_t			size)
+{
+	struct xlog_arena_chunk	*c = a->chunks;
+	void			*ptr;
+
+	size = roundup(size, sizeof(__uint64_t));
+	if (!c || c->used + size > c->size) {
+		size_t	csize = max(size, (size_t)XLOG_ARENA_CHUNK);
+
+		c = malloc(sizeof(*c) + csize);
+		if (!c)
+			return NULL;
+		c->size = csize;
+		c->used = 0;
+		c->next = a->chunks;
+		a->chunks = c;
+	}
+	ptr = c->data + c->used;
+	c->used += size;
+	return ptr;
+}
+
+static void
+xlog_arena_free(
+	struct xlog_arena	*a)
+{
+	struct xlog_arena_chunk	*c;
+
+	while ((c = a->chunks) != NULL) {
+		a->chunks = c->next;
+		free(c);
+	}
+}
+
+static void
+xlog_parse_set_error(
+	struct xlog_parse	*p,
+	int			error)
+{
+	__sync_bool_compare_and_swap(&p->error, 0, error);
+}
+
+static void *
+xlog_parse_worker(
+	void			*arg)
+{
+	struct xlog_pthread	*t = arg;
+	struct xlog_parse	*p = t->p;
+	int			i;
+	int			error;
+
+	while (!p->error) {
+		i = __sync_fetch_and_add(&p->next, 1);
+		if (i >= p->nwork)
+			break;
+		error = p->fn(t, i);
+		if (error)
+			xlog_parse_set_error(p, error);
+	}
+	return NULL;
+}
+
+/*
+ * Run fn over work items 0..nwork-1 on all threads and wait for them.
+ */
+static int
+xlog_parse_run(
+	struct xlog_parse	*p,
+	int			nwork,
+	int			(*fn)(struct xlog_pthread *, int))
+{
+	pthread_t		tids[XLOG_MAX_THREADS];
+	int			i;
+
+	p->next = 0;
+	p->nwork = nwork;
+	p->fn = fn;
+	for (i = 1; i < p->nthreads; i++) {
+		if (pthread_create(&tids[i], NULL, xlog_parse_worker,
+				   &p->threads[i]))
+			break;
+	}
+	/* the calling thread works too, and soldiers on if creates failed */
+	xlog_parse_worker(&p->threads[0]);
+	while (--i > 0)
+		pthread_join(tids[i], NULL);
+	return p->error;
+}
+
+/*
+ * Read blocks [blk, blk + nbblks) of the log into the image.
+ */
+static int
+xlog_parse_read(
+	struct xlog		*log,
+	xfs_buf_t		*bp,
+	char			*image,
+	xfs_daddr_t		blk,
+	int			nbblks)
+{
+	xfs_caddr_t		offset;
+	int			n;
+	int			error;
+
+	while (nbblks > 0) {
+		n = min(nbblks, min(XLOG_PARSE_CHUNK_BBS, log->l_logBBsize));
+		error = xlog_bread(log, blk, n, bp, &offset);
+		if (error)
+			return error;
+		memcpy(image, offset, BBTOB(n));
+		image += BBTOB(n);
+		blk += n;
+		nbblks -= n;
+	}
+	return 0;
+}
+
+/*
+ * Find every record in the image.  This has to be done in order as each
+ * header gives the position of the next; it's also where the per-record
+ * header checks (and header printing) are done, so they come out in order.
+ */
+static int
+xlog_parse_index(
+	struct xlog_parse	*p,
+	xfs_daddr_t		tail_blk,
+	int			nblks,
+	int			hblks)
+{
+	struct xlog		*log = p->log;
+	xlog_rec_header_t	*rhead;
+	struct xlog_prec	*recs = NULL;
+	int			maxrecs = 0;
+	int			blk;
+	int			bblks;
+	int			error;
+
+	for (blk = 0; blk < nblks; blk += hblks + bblks) {
+		if (blk + hblks > nblks)
+			return XFS_ERROR(EFSCORRUPTED);
+		rhead = (xlog_rec_header_t *)(p->image + BBTOB(blk));
+		error = xlog_valid_rec_header(log, rhead,
+				(tail_blk + blk) % log->l_logBBsize);
+		if (error)
+			return error;
+		bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
+		if (blk + hblks + bblks > nblks)
+			return XFS_ERROR(EFSCORRUPTED);
+		if (xlog_header_check_recover(log->l_mp, rhead))
+			return XFS_ERROR(EIO);
+
+		if (p->nrecs == maxrecs) {
+			maxrecs = maxrecs ? maxrecs * 2 : 1024;
+			recs = realloc(p->recs, maxrecs * sizeof(*recs));
+			if (!recs)
+				return ENOMEM;
+			p->recs = recs;
+		}
+		p->recs[p->nrecs].rhead = rhead;
+		p->recs[p->nrecs].data = p->image + BBTOB(blk + hblks);
+		p->recs[p->nrecs].ops = NULL;
+		p->recs[p->nrecs].nops = 0;
+		p->nrecs++;
+	}
+	return 0;
+}
+
+/*
+ * Unpack one record and index its ops.
+ */
+static int
+xlog_parse_record(
+	struct xlog_pthread	*t,
+	int			r)
+{
+	struct xlog_parse	*p = t->p;
+	struct xlog_prec	*rec = &p->recs[r];
+	xlog_op_header_t	*ohead;
+	struct xlog_op		*op;
+	xfs_caddr_t		dp = rec->data;
+	xfs_caddr_t		lp;
+	int			num_logops;
+	int			error;
+
+	error = xlog_unpack_data(rec->rhead, dp, p->log);
+	if (error)
+		return error;
+
+	lp = dp + be32_to_cpu(rec->rhead->h_len);
+	num_logops = be32_to_cpu(rec->rhead->h_num_logops);
+	num_logops = min(num_logops,
+			 (int)((lp - dp) / sizeof(xlog_op_header_t)));
+	rec->ops = xlog_arena_alloc(&t->arena, num_logops * sizeof(*op));
+	if (!rec->ops && num_logops)
+		return ENOMEM;
+
+	while (dp < lp && rec->nops < num_logops) {
+		if (dp + sizeof(xlog_op_header_t) > lp)
+			return XFS_ERROR(EIO);
+		ohead = (xlog_op_header_t *)dp;
+		dp += sizeof(xlog_op_header_t);
+		if (ohead->oh_clientid != XFS_TRANSACTION &&
+		    ohead->oh_clientid != XFS_LOG) {
+			xfs_warn(p->log->l_mp, "%s: bad clientid 0x%x",
+					__func__, ohead->oh_clientid);
+			return XFS_ERROR(EIO);
+		}
+		if (dp + be32_to_cpu(ohead->oh_len) > lp) {
+			xfs_warn(p->log->l_mp, "%s: bad length 0x%x",
+				__func__, be32_to_cpu(ohead->oh_len));
+			return XFS_ERROR(EIO);
+		}
+
+		op = &rec->ops[rec->nops];
+		op->next = NULL;
+		op->seq = ((__uint64_t)r << 32) | rec->nops;
+		op->data = dp;
+		op->len = be32_to_cpu(ohead->oh_len);
+		op->tid = be32_to_cpu(ohead->oh_tid);
+		op->flags = ohead->oh_flags;
+		op->lsn = be64_to_cpu(rec->rhead->h_lsn);
+		if (op->flags & XLOG_START_TRANS)
+			t->nstarts++;
+		rec->nops++;
+		dp += op->len;
+	}
+	return 0;
+}
+
+static inline unsigned int
+xlog_tid_hash(
+	xlog_tid_t		tid)
+{
+	return (tid * 0x9e3779b1U) ^ (tid >> 16);
+}
+
+/*
+ * Find a tid's slot, optionally claiming a free one for it.  Slots are
+ * never freed while the table is live, so once a slot is set its tid
+ * never changes.
+ */
+static struct xlog_tslot *
+xlog_tslot_get(
+	struct xlog_parse	*p,
+	xlog_tid_t		tid,
+	int			insert)
+{
+	struct xlog_tslot	*slot;
+	unsigned int		h = xlog_tid_hash(tid) & p->tmask;
+
+	for (;;) {
+		slot = &p->table[h];
+		if (!slot->state) {
+			if (!insert)
+				return NULL;
+			if (__sync_bool_compare_and_swap(&slot->state, 0, 1)) {
+				slot->tid = tid;
+				__sync_synchronize();
+				slot->state = 2;
+				return slot;
+			}
+		}
+		/* somebody else is claiming it; wait for the tid to show */
+		while (*(volatile int *)&slot->state == 1)
+			;
+		__sync_synchronize();
+		if (slot->tid == tid)
+			return slot;
+		h = (h + 1) & p->tmask;
+	}
+}
+
+static int
+xlog_parse_starts(
+	struct xlog_pthread	*t,
+	int			r)
+{
+	struct xlog_prec	*rec = &t->p->recs[r];
+	int			i;
+
+	for (i = 0; i < rec->nops; i++) {
+		if (rec->ops[i].flags & XLOG_START_TRANS)
+			xlog_tslot_get(t->p, rec->ops[i].tid, 1);
+	}
+	return 0;
+}
+
+/*
+ * Push each op onto its transaction's list.  Ops of tids that never start
+ * within the active log belong to transactions that were already on disk
+ * before the tail, and recovery ignores them.
+ */
+static int
+xlog_parse_bucket(
+	struct xlog_pthread	*t,
+	int			r)
+{
+	struct xlog_prec	*rec = &t->p->recs[r];
+	struct xlog_tslot	*slot;
+	struct xlog_op		*op;
+	struct xlog_op		*old;
+	int			i;
+
+	for (i = 0; i < rec->nops; i++) {
+		op = &rec->ops[i];
+		slot = xlog_tslot_get(t->p, op->tid, 0);
+		if (!slot)
+			continue;
+		do {
+			old = slot->ops;
+			op->next = old;
+		} while (!__sync_bool_compare_and_swap(&slot->ops, old, op));
+	}
+	return 0;
+}
+
+static xlog_recover_item_t *
+xlog_parse_add_item(
+	struct xlog_arena	*a,
+	struct list_head	*head)
+{
+	xlog_recover_item_t	*item;
+
+	item = xlog_arena_alloc(a, sizeof(*item));
+	if (!item)
+		return NULL;
+	memset(item, 0, sizeof(*item));
+	INIT_LIST_HEAD(&item->ri_list);
+	list_add_tail(&item->ri_list, head);
+	return item;
+}
+
+/*
+ * Arena versions of xlog_recover_add_to_cont_trans() and
+ * xlog_recover_add_to_trans().
+ */
+static int
+xlog_parse_add_cont(
+	struct xlog_arena	*a,
+	xlog_recover_t		*trans,
+	xfs_caddr_t		dp,
+	int			len)
+{
+	xlog_recover_item_t	*item;
+	xfs_log_iovec_t		*iov;
+	xfs_caddr_t		ptr;
+
+	if (list_empty(&trans->r_itemq)) {
+		/* finish copying rest of trans header */
+		if (len > sizeof(xfs_trans_header_t) ||
+		    !xlog_parse_add_item(a, &trans->r_itemq))
+			return XFS_ERROR(EIO);
+		ptr = (xfs_caddr_t)&trans->r_theader +
+				sizeof(xfs_trans_header_t) - len;
+		memcpy(ptr, dp, len);
+		return 0;
+	}
+
+	item = list_entry(trans->r_itemq.prev, xlog_recover_item_t, ri_list);
+	if (!item->ri_cnt)
+		return XFS_ERROR(EIO);
+	iov = &item->ri_buf[item->ri_cnt - 1];
+	ptr = xlog_arena_alloc(a, iov->i_len + len);
+	if (!ptr)
+		return ENOMEM;
+	memcpy(ptr, iov->i_addr, iov->i_len);
+	memcpy(ptr + iov->i_len, dp, len);
+	iov->i_addr = ptr;
+	iov->i_len += len;
+	return 0;
+}
+
+static int
+xlog_parse_add(
+	struct xlog		*log,
+	struct xlog_arena	*a,
+	xlog_recover_t		*trans,
+	xfs_caddr_t		dp,
+	int			len)
+{
+	xfs_inode_log_format_t	*in_f;			/* any will do */
+	xlog_recover_item_t	*item;
+	xfs_caddr_t		ptr;
+
+	if (!len)
+		return 0;
+	if (list_empty(&trans->r_itemq)) {
+		/* we need to catch log corruptions here */
+		if (*(uint *)dp != XFS_TRANS_HEADER_MAGIC) {
+			xfs_warn(log->l_mp, "%s: bad header magic number",
+				__func__);
+			return XFS_ERROR(EIO);
+		}
+		if (len > sizeof(xfs_trans_header_t))
+			return XFS_ERROR(EIO);
+		if (len == sizeof(xfs_trans_header_t) &&
+		    !xlog_parse_add_item(a, &trans->r_itemq))
+			return ENOMEM;
+		memcpy(&trans->r_theader, dp, len);
+		return 0;
+	}
+
+	ptr = xlog_arena_alloc(a, len);
+	if (!ptr)
+		return ENOMEM;
+	memcpy(ptr, dp, len);
+	in_f = (xfs_inode_log_format_t *)ptr;
+
+	/* take the tail entry */
+	item = list_entry(trans->r_itemq.prev, xlog_recover_item_t, ri_list);
+	if (item->ri_total != 0 && item->ri_total == item->ri_cnt) {
+		/* tail item is in use, get a new one */
+		item = xlog_parse_add_item(a, &trans->r_itemq);
+		if (!item)
+			return ENOMEM;
+	}
+
+	if (item->ri_total == 0) {		/* first region to be added */
+		if (in_f->ilf_size == 0 ||
+		    in_f->ilf_size > XLOG_MAX_REGIONS_IN_ITEM) {
+			xfs_warn(log->l_mp,
+		"bad number of regions (%d) in inode log format",
+				  in_f->ilf_size);
+			return XFS_ERROR(EIO);
+		}
+		item->ri_total = in_f->ilf_size;
+		item->ri_buf = xlog_arena_alloc(a,
+				item->ri_total * sizeof(xfs_log_iovec_t));
+		if (!item->ri_buf)
+			return ENOMEM;
+		memset(item->ri_buf, 0,
+		       item->ri_total * sizeof(xfs_log_iovec_t));
+	}
+	/* Description region is ri_buf[0] */
+	item->ri_buf[item->ri_cnt].i_addr = ptr;
+	item->ri_buf[item->ri_cnt].i_len  = len;
+	item->ri_cnt++;
+	return 0;
+}
+
+static int
+xlog_op_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct xlog_op	*oa = *(struct xlog_op **)a;
+	const struct xlog_op	*ob = *(struct xlog_op **)b;
+
+	if (oa->seq != ob->seq)
+		return oa->seq < ob->seq ? -1 : 1;
+	return 0;
+}
+
+static int
+xlog_parse_done(
+	struct xlog_pthread	*t,
+	xlog_recover_t		*trans,
+	__uint64_t		seq)
+{
+	struct xlog_ctrans	*done;
+
+	if (t->ndone == t->maxdone) {
+		t->maxdone = t->maxdone ? t->maxdone * 2 : 256;
+		done = realloc(t->done, t->maxdone * sizeof(*done));
+		if (!done)
+			return ENOMEM;
+		t->done = done;
+	}
+	t->done[t->ndone].trans = trans;
+	t->done[t->ndone].seq = seq;
+	t->ndone++;
+	return 0;
+}
+
+/*
+ * Replay one tid's ops in log order through the same state machine as
+ * xlog_recover_process_data(), collecting the transactions that commit.
+ * A tid can be reused once its transaction has committed, so there may
+ * be more than one.
+ */
+static int
+xlog_parse_assemble(
+	struct xlog_pthread	*t,
+	int			s)
+{
+	struct xlog_parse	*p = t->p;
+	struct xlog_tslot	*slot = &p->table[s];
+	struct xlog_op		**ops;
+	struct xlog_op		*op;
+	xlog_recover_t		*trans = NULL;
+	uint			flags;
+	int			nops = 0;
+	int			i;
+	int			error = 0;
+
+	if (slot->state != 2 || !slot->ops)
+		return 0;
+	for (op = slot->ops; op; op = op->next)
+		nops++;
+	ops = malloc(nops * sizeof(*ops));
+	if (!ops)
+		return ENOMEM;
+	for (i = 0, op = slot->ops; op; op = op->next)
+		ops[i++] = op;
+	qsort(ops, nops, sizeof(*ops), xlog_op_cmp);
+
+	for (i = 0; i < nops && !error; i++) {
+		op = ops[i];
+		if (!trans) {
+			if (!(op->flags & XLOG_START_TRANS))
+				continue;
+			trans = xlog_arena_alloc(&t->arena, sizeof(*trans));
+			if (!trans) {
+				error = ENOMEM;
+				break;
+			}
+			memset(trans, 0, sizeof(*trans));
+			trans->r_log_tid = op->tid;
+			trans->r_lsn = op->lsn;
+			INIT_LIST_HEAD(&trans->r_itemq);
+			continue;
+		}
+
+		flags = op->flags & ~XLOG_END_TRANS;
+		if (flags & XLOG_WAS_CONT_TRANS)
+			flags &= ~XLOG_CONTINUE_TRANS;
+		switch (flags) {
+		case XLOG_COMMIT_TRANS:
+			error = xlog_parse_done(t, trans, op->seq);
+			trans = NULL;
+			break;
+		case XLOG_UNMOUNT_TRANS:
+			break;
+		case XLOG_WAS_CONT_TRANS:
+			error = xlog_parse_add_cont(&t->arena, trans,
+						    op->data, op->len);
+			break;
+		case XLOG_START_TRANS:
+			xfs_warn(p->log->l_mp, "%s: bad transaction",
+				__func__);
+			error = XFS_ERROR(EIO);
+			break;
+		case 0:
+		case XLOG_CONTINUE_TRANS:
+			error = xlog_parse_add(p->log, &t->arena, trans,
+					       op->data, op->len);
+			break;
+		default:
+			xfs_warn(p->log->l_mp, "%s: bad flag 0x%x",
+				__func__, flags);
+			error = XFS_ERROR(EIO);
+			break;
+		}
+	}
+	free(ops);
+	return error;
+}
+
+static int
+xlog_ctrans_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct xlog_ctrans *ca = a;
+	const struct xlog_ctrans *cb = b;
+
+	if (ca->seq != cb->seq)
+		return ca->seq < cb->seq ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Parse the log between tail_blk and head_blk once and run recovery passes
+ * first_pass through last_pass over the committed transactions.  nthreads
+ * of zero means one per CPU.
+ */
+int
+xlog_do_recovery_passes(
+	struct xlog		*log,
+	xfs_daddr_t		head_blk,
+	xfs_daddr_t		tail_blk,
+	int			first_pass,
+	int			last_pass,
+	int			nthreads)
+{
+	struct xlog_parse	p;
+	struct xlog_ctrans	*ctrans = NULL;
+	xlog_rec_header_t	*rhead;
+	xfs_buf_t		*bp;
+	xfs_caddr_t		offset;
+	__uint64_t		nstarts = 0;
+	__uint64_t		tsize;
+	int			nblks;
+	int			hblks = 1;
+	int			h_size;
+	int			nctrans = 0;
+	int			pass;
+	int			i;
+	int			error;
+
+	ASSERT(head_blk != tail_blk);
+
+	memset(&p, 0, sizeof(p));
+	p.log = log;
+	if (nthreads <= 0)
+		nthreads = libxfs_nproc();
+	p.nthreads = min(nthreads, XLOG_MAX_THREADS);
+	p.threads = calloc(p.nthreads, sizeof(*p.threads));
+	if (!p.threads)
+		return ENOMEM;
+	for (i = 0; i < p.nthreads; i++) {
+		p.threads[i].p = &p;
+		p.threads[i].idx = i;
+	}
+
+	/* see xlog_do_recovery_pass() for how the header size is found */
+	if (xfs_sb_version_haslogv2(&log->l_mp->m_sb)) {
+		bp = xlog_get_bp(log, 1);
+		if (!bp) {
+			error = ENOMEM;
+			goto out;
+		}
+		error = xlog_bread(log, tail_blk, 1, bp, &offset);
+		if (!error) {
+			rhead = (xlog_rec_header_t *)offset;
+			error = xlog_valid_rec_header(log, rhead, tail_blk);
+		}
+		if (!error) {
+			h_size = be32_to_cpu(rhead->h_size);
+			if ((be32_to_cpu(rhead->h_version) & XLOG_VERSION_2) &&
+			    h_size > XLOG_HEADER_CYCLE_SIZE)
+				hblks = howmany(h_size, XLOG_HEADER_CYCLE_SIZE);
+		}
+		xlog_put_bp(bp);
+		if (error)
+			goto out;
+	}
+
+	/* read the active log into one image, unwrapped */
+	nblks = head_blk - tail_blk;
+	if (tail_blk > head_blk)
+		nblks += log->l_logBBsize;
+	p.image = malloc(BBTOB((__uint64_t)nblks));
+	bp = xlog_get_bp(log, min(XLOG_PARSE_CHUNK_BBS, log->l_logBBsize));
+	if (!p.image || !bp) {
+		if (bp)
+			xlog_put_bp(bp);
+		error = ENOMEM;
+		goto out;
+	}
+	if (tail_blk < head_blk) {
+		error = xlog_parse_read(log, bp, p.image, tail_blk, nblks);
+	} else {
+		error = xlog_parse_read(log, bp, p.image, tail_blk,
+					log->l_logBBsize - tail_blk);
+		if (!error)
+			error = xlog_parse_read(log, bp, p.image +
+					BBTOB(log->l_logBBsize - tail_blk),
+					0, head_blk);
+	}
+	xlog_put_bp(bp);
+	if (error)
+		goto out;
+
+	error = xlog_parse_index(&p, tail_blk, nblks, hblks);
+	if (error)
+		goto out;
+	error = xlog_parse_run(&p, p.nrecs, xlog_parse_record);
+	if (error)
+		goto out;
+
+	/* size the tid table to stay at most half full */
+	for (i = 0; i < p.nthreads; i++)
+		nstarts += p.threads[i].nstarts;
+	for (tsize = 64; tsize < nstarts * 2; tsize <<= 1)
+		;
+	p.table = calloc(tsize, sizeof(*p.table));
+	if (!p.table) {
+		error = ENOMEM;
+		goto out;
+	}
+	p.tmask = tsize - 1;
+
+	error = xlog_parse_run(&p, p.nrecs, xlog_parse_starts);
+	if (!error)
+		error = xlog_parse_run(&p, p.nrecs, xlog_parse_bucket);
+	if (!error)
+		error = xlog_parse_run(&p, tsize, xlog_parse_assemble);
+	if (error)
+		goto out;
+
+	for (i = 0; i < p.nthreads; i++)
+		nctrans += p.threads[i].ndone;
+	ctrans = malloc(max(nctrans, 1) * sizeof(*ctrans));
+	if (!ctrans) {
+		error = ENOMEM;
+		goto out;
+	}
+	nctrans = 0;
+	for (i = 0; i < p.nthreads; i++) {
+		memcpy(&ctrans[nctrans], p.threads[i].done,
+		       p.threads[i].ndone * sizeof(*ctrans));
+		nctrans += p.threads[i].ndone;
+	}
+	qsort(ctrans, nctrans, sizeof(*ctrans), xlog_ctrans_cmp);
+
+	for (pass = first_pass; pass <= last_pass && !error; pass++) {
+		for (i = 0; i < nctrans; i++) {
+			xlog_commit_lsn = be64_to_cpu(
+				p.recs[ctrans[i].seq >> 32].rhead->h_lsn);
+			error = xlog_recover_do_trans(log, ctrans[i].trans,
+						      pass);
+			if (error)
+				break;
+		}
+	}
+
+out:
+	free(ctrans);
+	for (i = 0; i < p.nthreads; i++) {
+		xlog_arena_free(&p.threads[i].arena);
+		free(p.threads[i].done);
+	}
+	free(p.threads);
+	free(p.table);
+	free(p.recs);
+	free(p.image);
+	return error;
+}
@@ -21,6 +21,7 @@
 int print_exit;
 int print_skip_uuid;
 int print_record_header;
+xfs_lsn_t xlog_commit_lsn;
 libxfs_init_t x;
 
 static int
@@ -46,6 +47,9 @@ header_check_uuid(xfs_mount_t *mp, xlog_rec_header_t *head)
 int
 xlog_header_check_recover(xfs_mount_t *mp, xlog_rec_header_t *head)
 {
+    /* any commit found before the next header is in this record */
+    xlog_commit_lsn = be64_to_cpu(head->h_lsn);
+
     if (print_record_header)
 	printf(_("\nLOG REC AT LSN cycle %d block %d (0x%x, 0x%x)\n"),
 	       CYCLE_LSN(be64_to_cpu(head->h_lsn)),
@@ -91,6 +95,38 @@ xlog_header_check_mount(xfs_mount_t *mp, xlog_rec_header_t *head)
     return 0;
 }
 
+/*
+ * Checksum a log record as the kernel does when it writes one: the header
+ * with its CRC field zeroed, then the extended headers of a v2 record,
+ * then the record body as it sits on disk.  The extended headers must
+ * follow the header in memory, as they do on disk.
+ */
+__le32
+xlog_cksum(
+	struct xlog		*log,
+	struct xlog_rec_header	*rhead,
+	char			*dp,
+	int			size)
+{
+	xlog_in_core_2_t	*xhdr = (xlog_in_core_2_t *)rhead;
+	__uint32_t		crc;
+	int			heads = 1;
+	int			i;
+
+	crc = xfs_start_cksum((char *)rhead, sizeof(struct xlog_rec_header),
+			      offsetof(struct xlog_rec_header, h_crc));
+
+	if (be32_to_cpu(rhead->h_version) & XLOG_VERSION_2)
+		heads = howmany(be32_to_cpu(rhead->h_size),
+				XLOG_HEADER_CYCLE_SIZE);
+	for (i = 1; i < heads; i++)
+		crc = crc32c(crc, &xhdr[i].hic_xheader,
+			     sizeof(struct xlog_rec_ext_header));
+
+	crc = crc32c(crc, dp, size);
+	return xfs_end_cksum(crc);
+}
+
 /*
  * Userspace versions of common diagnostic routines (varargs fun).
  */
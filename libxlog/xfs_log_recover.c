@@ -1317,8 +1317,9 @@ xlog_recover_process_data(
  *
  * XXX: we do not calculate the CRC here yet. It's not clear what we should do
  * with CRC errors here in userspace, so we'll address that problem later on.
+ * xfs_logprint checks record CRCs with the real xlog_cksum() instead.
  */
-#define xlog_cksum(l,r,dp,len)	((r)->h_crc)
+#define xlog_recover_cksum(l,r,dp,len)	((r)->h_crc)
 STATIC int
 xlog_unpack_data_crc(
 	struct xlog_rec_header	*rhead,
@@ -1327,7 +1328,7 @@ xlog_unpack_data_crc(
 {
 	__le32			crc;
 
-	crc = xlog_cksum(log, rhead, dp, be32_to_cpu(rhead->h_len));
+	crc = xlog_recover_cksum(log, rhead, dp, be32_to_cpu(rhead->h_len));
 	if (crc != rhead->h_crc) {
 		if (rhead->h_crc || xfs_sb_version_hascrc(&log->l_mp->m_sb)) {
 			xfs_alert(log->l_mp,
@@ -1349,7 +1350,7 @@ xlog_unpack_data_crc(
 	return 0;
 }
 
-STATIC int
+int
 xlog_unpack_data(
 	struct xlog_rec_header	*rhead,
 	xfs_caddr_t		dp,
@@ -1381,7 +1382,7 @@ xlog_unpack_data(
 	return 0;
 }
 
-STATIC int
+int
 xlog_valid_rec_header(
 	struct xlog		*log,
 	struct xlog_rec_header	*rhead,
@@ -37,9 +37,10 @@ xfs_log_copy(
 		exit(1);
 	}
 
+	xlog_print_map(log, fd);
 	xlog_print_lseek(log, fd, 0, SEEK_SET);
 	for (blkno = 0; blkno < log->l_logBBsize; blkno++) {
-		r = read(fd, buf, sizeof(buf));
+		r = xlog_print_read(fd, buf, sizeof(buf));
 		if (r < 0) {
 			fprintf(stderr, _("%s: read error (%lld): %s\n"),
 				__FUNCTION__, (long long)blkno,
@@ -68,5 +69,6 @@ xfs_log_copy(
 		}
 	}
 
+	xlog_print_unmap();
 	close(ofd);
 }
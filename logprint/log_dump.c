@@ -36,9 +36,10 @@ xfs_log_dump(
 
 	dupblkno = 0;
 	hdr = (xlog_rec_header_t *)buf;
+	xlog_print_map(log, fd);
 	xlog_print_lseek(log, fd, 0, SEEK_SET);
 	for (blkno = 0; blkno < log->l_logBBsize; blkno++) {
-		r = read(fd, buf, sizeof(buf));
+		r = xlog_print_read(fd, buf, sizeof(buf));
 		if (r < 0) {
 			fprintf(stderr, _("%s: read error (%lld): %s\n"),
 				__FUNCTION__, (long long)blkno,
@@ -71,4 +72,5 @@ xfs_log_dump(
 			dupblkno = blkno;
 		}
 	}
+	xlog_print_unmap();
 }
@@ -16,6 +16,8 @@
  * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <sys/mman.h>
+#include <pthread.h>
 #include "logprint.h"
 
 #define CLEARED_BLKS	(-5)
@@ -865,6 +867,273 @@ xlog_print_trans_icreate(
  ******************************************************************************
  */
 
+/*
+ * Log records are small and are walked one at a time, so rather than
+ * issuing a read() for every header and record the printing code reads
+ * through xlog_print_read().  This copies out of a read-only mapping of
+ * the whole log when the device can be mapped, and otherwise out of a
+ * large readahead buffer.  Reads outside the log fall through to pread()
+ * so that running off the end behaves exactly as a plain read() would.
+ */
+#define XLOG_RA_SIZE	(4 * 1024 * 1024)
+
+static struct {
+	char		*map;		/* mapping of the log, or NULL */
+	xfs_off_t	map_off;	/* device offset of the mapping */
+	size_t		map_len;
+	char		*ra;		/* readahead buffer if not mapped */
+	xfs_off_t	ra_off;
+	ssize_t		ra_len;
+	xfs_off_t	pos;		/* device offset of next read */
+} xlog_rd;
+
+void
+xlog_print_map(struct xlog *log, int fd)
+{
+	xfs_off_t	start = LIBXFS_BBTOOFF64(log->l_logBBstart);
+	xfs_off_t	off = start & ~((xfs_off_t)getpagesize() - 1);
+	size_t		len = BBTOB(log->l_logBBsize) + (start - off);
+	struct stat64	st;
+	void		*p;
+
+	/* touching a page past the end of a file would raise SIGBUS */
+	if (fstat64(fd, &st) < 0 ||
+	    (S_ISREG(st.st_mode) && st.st_size < off + (xfs_off_t)len))
+		return;
+	p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, off);
+	if (p == MAP_FAILED)
+		return;
+	madvise(p, len, MADV_SEQUENTIAL);
+	xlog_rd.map = p;
+	xlog_rd.map_off = off;
+	xlog_rd.map_len = len;
+}
+
+void
+xlog_print_unmap(void)
+{
+	if (xlog_rd.map)
+		munmap(xlog_rd.map, xlog_rd.map_len);
+	free(xlog_rd.ra);
+	memset(&xlog_rd, 0, sizeof(xlog_rd));
+}
+
+ssize_t
+xlog_print_read(int fd, void *buf, size_t len)
+{
+	xfs_off_t	pos = xlog_rd.pos;
+	ssize_t		n;
+
+	if (xlog_rd.map && pos >= xlog_rd.map_off &&
+	    pos + len <= xlog_rd.map_off + xlog_rd.map_len) {
+		memcpy(buf, xlog_rd.map + (pos - xlog_rd.map_off), len);
+		xlog_rd.pos += len;
+		return len;
+	}
+
+	if (xlog_rd.map || len > XLOG_RA_SIZE) {
+		n = pread64(fd, buf, len, pos);
+		if (n > 0)
+			xlog_rd.pos += n;
+		return n;
+	}
+
+	if (!xlog_rd.ra || pos < xlog_rd.ra_off ||
+	    pos + len > xlog_rd.ra_off + xlog_rd.ra_len) {
+		if (!xlog_rd.ra) {
+			xlog_rd.ra = malloc(XLOG_RA_SIZE);
+			if (!xlog_rd.ra) {
+				fprintf(stderr,
+			_("%s: xlog_print_read: malloc failed\n"), progname);
+				exit(1);
+			}
+		}
+		xlog_rd.ra_off = pos;
+		xlog_rd.ra_len = pread64(fd, xlog_rd.ra, XLOG_RA_SIZE, pos);
+		if (xlog_rd.ra_len < 0) {
+			xlog_rd.ra_len = 0;
+			return -1;
+		}
+	}
+
+	n = min((xfs_off_t)len, xlog_rd.ra_off + xlog_rd.ra_len - pos);
+	memcpy(buf, xlog_rd.ra + (pos - xlog_rd.ra_off), n);
+	xlog_rd.pos += n;
+	return n;
+}
+
+/*
+ * Record CRCs are checked before anything is printed.  One pass over the
+ * mapping finds the record headers, then all threads checksum records
+ * until none are left.  Printing stays serial and flags each bad record
+ * as it reaches its header, so the output is still in log order.  Without
+ * a mapping the records are not checked.
+ */
+#define XLOG_CRC_MAX_THREADS	16
+
+struct xlog_crc_rec {
+	xfs_daddr_t	blkno;		/* of the record header */
+	__le32		crc;		/* as calculated */
+	int		bad;
+};
+
+static struct {
+	struct xlog		*log;
+	struct xlog_crc_rec	*recs;
+	int			nrecs;
+	int			next;		/* work counter */
+} xlog_crc;
+
+static xlog_rec_header_t *
+xlog_print_map_blk(struct xlog *log, xfs_daddr_t blkno)
+{
+	return (xlog_rec_header_t *)(xlog_rd.map +
+			(LIBXFS_BBTOOFF64(log->l_logBBstart) - xlog_rd.map_off) +
+			BBTOB(blkno));
+}
+
+/* header blocks in a record, or 0 if this doesn't look like one */
+static int
+xlog_crc_hblks(xlog_rec_header_t *rhead)
+{
+	int		len = be32_to_cpu(rhead->h_len);
+	int		size = be32_to_cpu(rhead->h_size);
+
+	if (be32_to_cpu(rhead->h_magicno) != XLOG_HEADER_MAGIC_NUM ||
+	    !rhead->h_crc || len <= 0 || len > XLOG_MAX_RECORD_BSIZE)
+		return 0;
+	if (!(be32_to_cpu(rhead->h_version) & XLOG_VERSION_2))
+		return 1;
+	if (size <= 0 || size > XLOG_MAX_RECORD_BSIZE)
+		return 0;
+	return howmany(size, XLOG_HEADER_CYCLE_SIZE);
+}
+
+/*
+ * Data blocks start with the cycle number rather than the header magic,
+ * so every block that starts with the magic is a record header.  Records
+ * written without a CRC, by kernels that predate them, are left out.
+ */
+static void
+xlog_crc_find_records(struct xlog *log)
+{
+	xfs_daddr_t	blkno;
+	int		max = 0;
+
+	for (blkno = 0; blkno < log->l_logBBsize; blkno++) {
+		if (!xlog_crc_hblks(xlog_print_map_blk(log, blkno)))
+			continue;
+		if (xlog_crc.nrecs == max) {
+			max = max ? max * 2 : 1024;
+			xlog_crc.recs = realloc(xlog_crc.recs,
+						max * sizeof(*xlog_crc.recs));
+			if (!xlog_crc.recs) {
+				fprintf(stderr,
+		_("%s: xlog_crc_find_records: malloc failed\n"), progname);
+				exit(1);
+			}
+		}
+		xlog_crc.recs[xlog_crc.nrecs].blkno = blkno;
+		xlog_crc.recs[xlog_crc.nrecs].bad = 0;
+		xlog_crc.nrecs++;
+	}
+}
+
+static void *
+xlog_crc_worker(void *arg)
+{
+	struct xlog		*log = xlog_crc.log;
+	struct xlog_crc_rec	*r;
+	xlog_rec_header_t	*rhead;
+	char			*buf = NULL;
+	char			*p;
+	int			i, hblks, len, bbs, n;
+
+	while ((i = __sync_fetch_and_add(&xlog_crc.next, 1)) <
+							xlog_crc.nrecs) {
+		r = &xlog_crc.recs[i];
+		rhead = xlog_print_map_blk(log, r->blkno);
+		hblks = xlog_crc_hblks(rhead);
+		len = be32_to_cpu(rhead->h_len);
+		bbs = hblks + BTOBB(len);
+
+		/* a record that runs off the end carries on at block 0 */
+		if (r->blkno + bbs > log->l_logBBsize) {
+			p = realloc(buf, BBTOB(bbs));
+			if (!p)
+				continue;
+			buf = p;
+			n = log->l_logBBsize - r->blkno;
+			memcpy(buf, rhead, BBTOB(n));
+			memcpy(buf + BBTOB(n), xlog_print_map_blk(log, 0),
+			       BBTOB(bbs - n));
+			rhead = (xlog_rec_header_t *)buf;
+		}
+		r->crc = xlog_cksum(log, rhead, (char *)rhead + BBTOB(hblks),
+				    len);
+		r->bad = r->crc != rhead->h_crc;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void
+xlog_crc_check(struct xlog *log)
+{
+	pthread_t	tids[XLOG_CRC_MAX_THREADS];
+	int		nthreads;
+	int		i;
+
+	if (!xlog_rd.map)
+		return;
+	xlog_crc.log = log;
+	xlog_crc_find_records(log);
+
+	nthreads = min(libxfs_nproc(), XLOG_CRC_MAX_THREADS);
+	for (i = 1; i < nthreads; i++) {
+		if (pthread_create(&tids[i], NULL, xlog_crc_worker, NULL))
+			break;
+	}
+	/* this thread works too, and carries on alone if creates failed */
+	xlog_crc_worker(NULL);
+	while (--i > 0)
+		pthread_join(tids[i], NULL);
+}
+
+static void
+xlog_crc_free(void)
+{
+	free(xlog_crc.recs);
+	memset(&xlog_crc, 0, sizeof(xlog_crc));
+}
+
+/* flag a record whose header is at blkno if its CRC didn't match */
+static void
+xlog_print_rec_crc(xfs_daddr_t blkno, xlog_rec_header_t *head)
+{
+	int		lo = 0;
+	int		hi = xlog_crc.nrecs - 1;
+	int		mid;
+
+	if (print_no_print)
+		return;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (xlog_crc.recs[mid].blkno == blkno) {
+			if (xlog_crc.recs[mid].bad)
+				printf(_(
+	"log record CRC mismatch: found 0x%x, expected 0x%x\n"),
+					le32_to_cpu(head->h_crc),
+					le32_to_cpu(xlog_crc.recs[mid].crc));
+			return;
+		}
+		if (xlog_crc.recs[mid].blkno < blkno)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+}
+
 void
 xlog_print_lseek(struct xlog *log, int fd, xfs_daddr_t blkno, int whence)
 {
@@ -875,11 +1144,12 @@ xlog_print_lseek(struct xlog *log, int fd, xfs_daddr_t blkno, int whence)
 		offset = BBTOOFF64(blkno+log->l_logBBstart);
 	else
 		offset = BBTOOFF64(blkno);
-	if (lseek64(fd, offset, whence) < 0) {
+	if ((offset = lseek64(fd, offset, whence)) < 0) {
 		fprintf(stderr, _("%s: lseek64 to %lld failed: %s\n"),
 			progname, (long long)offset, strerror(errno));
 		exit(1);
 	}
+	xlog_rd.pos = offset;
 }	/* xlog_print_lseek */
 
 
@@ -930,7 +1200,7 @@ xlog_print_record(
 	buf = (xfs_caddr_t)((__psint_t)(*partial_buf) + (__psint_t)(*read_type));
 	ptr = *partial_buf;
     }
-    if ((ret = (int) read(fd, buf, read_len)) == -1) {
+    if ((ret = (int) xlog_print_read(fd, buf, read_len)) == -1) {
 	fprintf(stderr, _("%s: xlog_print_record: read error\n"), progname);
 	exit(1);
     }
@@ -1304,7 +1574,7 @@ xlog_print_extended_headers(
 	/* don't include 1st header */
 	for (i = 1, x = *ret_xhdrs; i < num_hdrs; i++, (*blkno)++, x++) {
 	    /* read one extra header blk */
-	    if (read(fd, xhbuf, 512) == 0) {
+	    if (xlog_print_read(fd, xhbuf, 512) == 0) {
 		printf(_("%s: physical end of log\n"), progname);
 		print_xlog_record_line();
 		/* reached the end so return 1 */
@@ -1372,6 +1642,9 @@ void xfs_log_print(struct xlog  *log,
 	fprintf(stderr, _("%s: problem finding oldest LR\n"), progname);
 	return;
     }
+    xlog_print_map(log, fd);
+    if (!print_only_data)
+	xlog_crc_check(log);
     if (print_block_start == -1)
 	block_start = block_end;
     else
@@ -1380,7 +1653,7 @@ void xfs_log_print(struct xlog  *log,
     blkno = block_start;
 
     for (;;) {
-	if (read(fd, hbuf, 512) == 0) {
+	if (xlog_print_read(fd, hbuf, 512) == 0) {
 	    printf(_("%s: physical end of log\n"), progname);
 	    print_xlog_record_line();
 	    break;
@@ -1426,6 +1699,7 @@ void xfs_log_print(struct xlog  *log,
 	    goto loop;
 	}
 
+	xlog_print_rec_crc(blkno-1, hdr);
 	if (be32_to_cpu(hdr->h_version) == 2) {
 	    if (xlog_print_extended_headers(fd, len, &blkno, hdr, &num_hdrs, &xhdrs) != 0)
 		break;
@@ -1500,7 +1774,7 @@ loop:
 	blkno = 0;
 	xlog_print_lseek(log, fd, 0, SEEK_SET);
 	for (;;) {
-	    if (read(fd, hbuf, 512) == 0) {
+	    if (xlog_print_read(fd, hbuf, 512) == 0) {
 		xlog_panic(_("xlog_find_head: bad read"));
 	    }
 	    if (print_only_data) {
@@ -1526,6 +1800,7 @@ loop:
 		continue;
 	    }
 
+	    xlog_print_rec_crc(blkno-1, hdr);
 	    if (be32_to_cpu(hdr->h_version) == 2) {
 		if (xlog_print_extended_headers(fd, len, &blkno, hdr, &num_hdrs, &xhdrs) != 0)
 		    break;
@@ -1555,6 +1830,8 @@ loop2:
 end:
     printf(_("%s: logical end of log\n"), progname);
     print_xlog_record_line();
+    xlog_crc_free();
+    xlog_print_unmap();
 }
 
 /*
@@ -34,6 +34,8 @@ xlog_recover_do_trans(
 	xlog_recover_t	*trans,
 	int		pass)
 {
+	if (print_query)
+		return xfs_log_query_trans(log, trans);
 	xlog_recover_print_trans(trans, &trans->r_itemq, 3);
 	return 0;
 }
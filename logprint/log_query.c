@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2014 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "logprint.h"
+
+/*
+ * Query mode: print only the transactions that touch the given inodes or
+ * disk addresses, or that have the given tids, optionally restricted to a
+ * range of transaction LSNs.
+ *
+ * The query terms are sorted into one table per key type and every item
+ * of every committed transaction is looked up in them as the log is
+ * parsed, so a single pass over the log answers all of the terms.  Each
+ * term also keeps a count of the transactions it matched and the first
+ * and last of their LSNs, which is printed as a summary at the end.
+ *
+ * Inode and daddr terms match if any of them do; tid and LSN terms
+ * further restrict whatever matched.
+ */
+
+struct query_key {
+	__uint64_t		key;
+	__uint64_t		ntrans;		/* transactions matched */
+	__uint64_t		last_seq;	/* the latest of them */
+	xfs_lsn_t		first_lsn;
+	xfs_lsn_t		last_lsn;
+};
+
+struct query_set {
+	char			*name;
+	struct query_key	*keys;
+	int			nkeys;
+};
+
+static struct query_set	qsets[QUERY_NSETS] = {
+	[QUERY_INO]	= { "ino" },
+	[QUERY_DADDR]	= { "daddr" },
+	[QUERY_TID]	= { "tid" },
+};
+
+static xfs_lsn_t	qlsn_start;
+static xfs_lsn_t	qlsn_end = (xfs_lsn_t)LLONG_MAX;
+static __uint64_t	qseq;		/* transactions seen */
+static __uint64_t	qmatched;	/* transactions printed */
+
+/*
+ * An LSN is either cycle:block or the raw 64 bit value.
+ */
+static int
+query_parse_lsn(
+	char			*s,
+	char			**end,
+	xfs_lsn_t		*lsn)
+{
+	unsigned long long	cycle;
+	unsigned long long	block;
+
+	cycle = strtoull(s, end, 0);
+	if (*end == s)
+		return -1;
+	if (**end != ':') {
+		*lsn = cycle;
+		return 0;
+	}
+	s = *end + 1;
+	block = strtoull(s, end, 0);
+	if (*end == s || cycle > UINT_MAX || block > UINT_MAX)
+		return -1;
+	*lsn = xlog_assign_lsn(cycle, block);
+	return 0;
+}
+
+/*
+ * Add a query term from the command line.  LSN ranges are given as
+ * start-end, either of which may be left out.
+ */
+int
+xfs_log_query_add(
+	int			type,
+	char			*arg)
+{
+	struct query_set	*set;
+	struct query_key	*k;
+	unsigned long long	val;
+	char			*p;
+
+	if (type == QUERY_LSN) {
+		p = arg;
+		if (*p != '-') {
+			if (query_parse_lsn(p, &p, &qlsn_start))
+				return -1;
+			if (*p == '\0') {
+				qlsn_end = qlsn_start;
+				return 0;
+			}
+		}
+		if (*p++ != '-')
+			return -1;
+		if (*p != '\0' && query_parse_lsn(p, &p, &qlsn_end))
+			return -1;
+		return *p != '\0' || qlsn_end < qlsn_start;
+	}
+
+	val = strtoull(arg, &p, 0);
+	if (p == arg || *p != '\0')
+		return -1;
+
+	set = &qsets[type];
+	k = realloc(set->keys, (set->nkeys + 1) * sizeof(*k));
+	if (!k) {
+		fprintf(stderr, _("%s: cannot allocate query\n"), progname);
+		exit(1);
+	}
+	set->keys = k;
+	memset(&k[set->nkeys], 0, sizeof(*k));
+	k[set->nkeys++].key = val;
+	return 0;
+}
+
+static int
+query_key_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct query_key	*ka = a;
+	const struct query_key	*kb = b;
+
+	if (ka->key != kb->key)
+		return ka->key < kb->key ? -1 : 1;
+	return 0;
+}
+
+static void
+query_sort(
+	struct query_set	*set)
+{
+	int			i;
+	int			n = 0;
+
+	if (!set->nkeys)
+		return;
+	qsort(set->keys, set->nkeys, sizeof(*set->keys), query_key_cmp);
+	for (i = 1; i < set->nkeys; i++) {
+		if (set->keys[i].key != set->keys[n].key)
+			set->keys[++n] = set->keys[i];
+	}
+	set->nkeys = n + 1;
+}
+
+static void
+query_hit(
+	struct query_key	*k,
+	xfs_lsn_t		lsn)
+{
+	if (k->last_seq == qseq)
+		return;
+	if (!k->ntrans)
+		k->first_lsn = lsn;
+	k->last_lsn = lsn;
+	k->last_seq = qseq;
+	k->ntrans++;
+}
+
+/*
+ * Mark every key in [start, start + len) as matched, returning whether
+ * there were any.
+ */
+static int
+query_range(
+	struct query_set	*set,
+	__uint64_t		start,
+	__uint64_t		len,
+	xfs_lsn_t		lsn)
+{
+	int			lo = 0;
+	int			hi = set->nkeys;
+	int			mid;
+	int			found = 0;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (set->keys[mid].key < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < set->nkeys && set->keys[lo].key - start < len; lo++) {
+		query_hit(&set->keys[lo], lsn);
+		found = 1;
+	}
+	return found;
+}
+
+static int
+query_match_item(
+	struct xlog		*log,
+	xlog_recover_item_t	*item,
+	xfs_lsn_t		lsn)
+{
+	xfs_buf_log_format_t	*buf_f;
+	xfs_inode_log_format_t	in_buf;
+	xfs_inode_log_format_t	*in_f;
+	xfs_dq_logformat_t	*dq_f;
+	int			found = 0;
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_BUF:
+		buf_f = item->ri_buf[0].i_addr;
+		found = query_range(&qsets[QUERY_DADDR], buf_f->blf_blkno,
+				    buf_f->blf_len, lsn);
+		break;
+	case XFS_LI_INODE:
+		in_f = xfs_inode_item_format_convert(item->ri_buf[0].i_addr,
+				item->ri_buf[0].i_len, &in_buf);
+		found = query_range(&qsets[QUERY_INO], in_f->ilf_ino, 1, lsn);
+		found |= query_range(&qsets[QUERY_DADDR], in_f->ilf_blkno,
+				     in_f->ilf_len, lsn);
+		break;
+	case XFS_LI_DQUOT:
+		/* qlf_len is in filesystem blocks, not sectors */
+		dq_f = item->ri_buf[0].i_addr;
+		found = query_range(&qsets[QUERY_DADDR], dq_f->qlf_blkno,
+				    XFS_FSB_TO_BB(log->l_mp, dq_f->qlf_len),
+				    lsn);
+		break;
+	}
+	return found;
+}
+
+static char *
+query_trans_type(
+	xlog_recover_t		*trans)
+{
+	if (trans->r_theader.th_type > XFS_TRANS_TYPE_MAX)
+		return "UNKNOWN";
+	return trans_type[trans->r_theader.th_type];
+}
+
+static void
+query_print_json_item(
+	struct xlog		*log,
+	xlog_recover_item_t	*item)
+{
+	xfs_buf_log_format_t	*buf_f;
+	xfs_inode_log_format_t	in_buf;
+	xfs_inode_log_format_t	*in_f;
+	xfs_dq_logformat_t	*dq_f;
+	xfs_qoff_logformat_t	*qoff_f;
+	xfs_efi_log_format_t	*efi_f;
+	xfs_efd_log_format_t	*efd_f;
+	struct xfs_icreate_log	*icl;
+	uint			nextents;
+	uint			i;
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_BUF:
+		buf_f = item->ri_buf[0].i_addr;
+		printf("{\"type\":\"buf\",\"blkno\":%lld,\"len\":%u,"
+		       "\"flags\":%u,\"regions\":%d}",
+		       (long long)buf_f->blf_blkno, buf_f->blf_len,
+		       buf_f->blf_flags, buf_f->blf_size - 1);
+		break;
+	case XFS_LI_INODE:
+		in_f = xfs_inode_item_format_convert(item->ri_buf[0].i_addr,
+				item->ri_buf[0].i_len, &in_buf);
+		printf("{\"type\":\"inode\",\"ino\":%llu,\"fields\":%u,"
+		       "\"blkno\":%lld,\"len\":%d,\"boffset\":%d}",
+		       (unsigned long long)in_f->ilf_ino, in_f->ilf_fields,
+		       (long long)in_f->ilf_blkno, in_f->ilf_len,
+		       in_f->ilf_boffset);
+		break;
+	case XFS_LI_ICREATE:
+		icl = item->ri_buf[0].i_addr;
+		printf("{\"type\":\"icreate\",\"agno\":%u,\"agbno\":%u,"
+		       "\"length\":%u,\"count\":%u,\"isize\":%u,\"gen\":%u}",
+		       be32_to_cpu(icl->icl_ag), be32_to_cpu(icl->icl_agbno),
+		       be32_to_cpu(icl->icl_length),
+		       be32_to_cpu(icl->icl_count),
+		       be32_to_cpu(icl->icl_isize), be32_to_cpu(icl->icl_gen));
+		break;
+	case XFS_LI_EFI:
+		nextents = ((xfs_efi_log_format_t *)
+				item->ri_buf[0].i_addr)->efi_nextents;
+		efi_f = malloc(sizeof(*efi_f) +
+			       max(nextents, 1) * sizeof(xfs_extent_t));
+		if (!efi_f || xfs_efi_copy_format(item->ri_buf[0].i_addr,
+					item->ri_buf[0].i_len, efi_f, 0)) {
+			printf("{\"type\":\"efi\"}");
+			free(efi_f);
+			break;
+		}
+		printf("{\"type\":\"efi\",\"id\":%llu,\"extents\":[",
+		       (unsigned long long)efi_f->efi_id);
+		for (i = 0; i < efi_f->efi_nextents; i++)
+			printf("%s[%llu,%u]", i ? "," : "",
+			       (unsigned long long)
+					efi_f->efi_extents[i].ext_start,
+			       efi_f->efi_extents[i].ext_len);
+		printf("]}");
+		free(efi_f);
+		break;
+	case XFS_LI_EFD:
+		efd_f = item->ri_buf[0].i_addr;
+		printf("{\"type\":\"efd\",\"id\":%llu,\"nextents\":%u}",
+		       (unsigned long long)efd_f->efd_efi_id,
+		       efd_f->efd_nextents);
+		break;
+	case XFS_LI_DQUOT:
+		dq_f = item->ri_buf[0].i_addr;
+		printf("{\"type\":\"dquot\",\"id\":%u,\"blkno\":%lld,"
+		       "\"len\":%d,\"boffset\":%u}",
+		       dq_f->qlf_id, (long long)dq_f->qlf_blkno,
+		       (int)XFS_FSB_TO_BB(log->l_mp, dq_f->qlf_len),
+		       dq_f->qlf_boffset);
+		break;
+	case XFS_LI_QUOTAOFF:
+		qoff_f = item->ri_buf[0].i_addr;
+		printf("{\"type\":\"quotaoff\",\"flags\":%u}",
+		       qoff_f->qf_flags);
+		break;
+	default:
+		printf("{\"type\":\"unknown\",\"code\":%u}", ITEM_TYPE(item));
+		break;
+	}
+}
+
+static void
+query_print_json(
+	struct xlog		*log,
+	xlog_recover_t		*trans)
+{
+	xlog_recover_item_t	*item;
+	int			first = 1;
+
+	printf("{\"tid\":%u,\"type\":\"%s\",\"items\":%u,"
+	       "\"lsn\":\"%u:%u\",\"daddr\":%lld,"
+	       "\"commit_lsn\":\"%u:%u\",\"commit_daddr\":%lld,\"log\":[",
+	       trans->r_log_tid, query_trans_type(trans),
+	       trans->r_theader.th_num_items,
+	       CYCLE_LSN(trans->r_lsn), BLOCK_LSN(trans->r_lsn),
+	       (long long)(log->l_logBBstart + BLOCK_LSN(trans->r_lsn)),
+	       CYCLE_LSN(xlog_commit_lsn), BLOCK_LSN(xlog_commit_lsn),
+	       (long long)(log->l_logBBstart + BLOCK_LSN(xlog_commit_lsn)));
+	list_for_each_entry(item, &trans->r_itemq, ri_list) {
+		if (!first)
+			printf(",");
+		query_print_json_item(log, item);
+		first = 0;
+	}
+	printf("]}\n");
+}
+
+static void
+query_print_text(
+	struct xlog		*log,
+	xlog_recover_t		*trans)
+{
+	xlog_recover_item_t	*item;
+
+	print_xlog_record_line();
+	printf(_("LSN %u:%u (daddr %lld), committed at LSN %u:%u "
+		 "(daddr %lld)\n"),
+	       CYCLE_LSN(trans->r_lsn), BLOCK_LSN(trans->r_lsn),
+	       (long long)(log->l_logBBstart + BLOCK_LSN(trans->r_lsn)),
+	       CYCLE_LSN(xlog_commit_lsn), BLOCK_LSN(xlog_commit_lsn),
+	       (long long)(log->l_logBBstart + BLOCK_LSN(xlog_commit_lsn)));
+	xlog_recover_print_trans_head(trans);
+	list_for_each_entry(item, &trans->r_itemq, ri_list)
+		xlog_recover_print_item(item);
+}
+
+/*
+ * Called for each committed transaction, in commit order.
+ */
+int
+xfs_log_query_trans(
+	struct xlog		*log,
+	xlog_recover_t		*trans)
+{
+	xlog_recover_item_t	*item;
+	struct query_key	*tid = NULL;
+	struct query_key	key;
+	xfs_lsn_t		lsn = trans->r_lsn;
+	int			found;
+
+	qseq++;
+	if (lsn < qlsn_start || lsn > qlsn_end)
+		return 0;
+	if (qsets[QUERY_TID].nkeys) {
+		key.key = trans->r_log_tid;
+		tid = bsearch(&key, qsets[QUERY_TID].keys,
+			      qsets[QUERY_TID].nkeys, sizeof(key),
+			      query_key_cmp);
+		if (!tid)
+			return 0;
+	}
+
+	found = !qsets[QUERY_INO].nkeys && !qsets[QUERY_DADDR].nkeys;
+	list_for_each_entry(item, &trans->r_itemq, ri_list)
+		found |= query_match_item(log, item, lsn);
+	if (!found)
+		return 0;
+
+	if (tid)
+		query_hit(tid, lsn);
+	qmatched++;
+	if (print_json)
+		query_print_json(log, trans);
+	else
+		query_print_text(log, trans);
+	return 0;
+}
+
+static void
+query_summary(void)
+{
+	struct query_set	*set;
+	struct query_key	*k;
+	int			s;
+	int			i;
+
+	if (print_json) {
+		printf("{\"summary\":{\"transactions\":%llu,\"matched\":%llu",
+		       (unsigned long long)qseq, (unsigned long long)qmatched);
+		for (s = 0; s < QUERY_NSETS; s++) {
+			set = &qsets[s];
+			if (!set->nkeys)
+				continue;
+			printf(",\"%s\":[", set->name);
+			for (i = 0; i < set->nkeys; i++) {
+				k = &set->keys[i];
+				printf("%s{\"key\":%llu,\"transactions\":%llu",
+				       i ? "," : "",
+				       (unsigned long long)k->key,
+				       (unsigned long long)k->ntrans);
+				if (k->ntrans)
+					printf(",\"first_lsn\":\"%u:%u\","
+					       "\"last_lsn\":\"%u:%u\"",
+					       CYCLE_LSN(k->first_lsn),
+					       BLOCK_LSN(k->first_lsn),
+					       CYCLE_LSN(k->last_lsn),
+					       BLOCK_LSN(k->last_lsn));
+				printf("}");
+			}
+			printf("]");
+		}
+		printf("}}\n");
+		return;
+	}
+
+	print_stars();
+	printf(_("%llu of %llu transactions matched\n"),
+	       (unsigned long long)qmatched, (unsigned long long)qseq);
+	for (s = 0; s < QUERY_NSETS; s++) {
+		set = &qsets[s];
+		for (i = 0; i < set->nkeys; i++) {
+			k = &set->keys[i];
+			printf(_("    %s 0x%llx: %llu transactions"), set->name,
+			       (unsigned long long)k->key,
+			       (unsigned long long)k->ntrans);
+			if (k->ntrans)
+				printf(_(", LSN %u:%u - %u:%u"),
+				       CYCLE_LSN(k->first_lsn),
+				       BLOCK_LSN(k->first_lsn),
+				       CYCLE_LSN(k->last_lsn),
+				       BLOCK_LSN(k->last_lsn));
+			printf("\n");
+		}
+	}
+}
+
+void
+xfs_log_query(
+	struct xlog		*log)
+{
+	xfs_daddr_t		head_blk, tail_blk;
+	int			error;
+	int			s;
+
+	error = xlog_find_tail(log, &head_blk, &tail_blk);
+	if (error) {
+		fprintf(stderr, _("%s: failed to find head and tail, error: %d\n"),
+			progname, error);
+		exit(1);
+	}
+	if (!print_json)
+		printf(_("    log tail: %lld head: %lld state: %s\n\n"),
+			(long long)tail_blk,
+			(long long)head_blk,
+			(tail_blk == head_blk)?"<CLEAN>":"<DIRTY>");
+
+	for (s = 0; s < QUERY_NSETS; s++)
+		query_sort(&qsets[s]);
+
+	/*
+	 * The parser reads the whole active part of the log, tail to head,
+	 * into one buffer before splitting it up, so a query needs that much
+	 * memory however few terms it has.
+	 */
+	if (head_blk != tail_blk) {
+		error = xlog_do_recovery_passes(log, head_blk, tail_blk,
+				XLOG_RECOVER_PASS1, XLOG_RECOVER_PASS1, 0);
+		if (error) {
+			fprintf(stderr,
+				_("%s: failed to parse the log, error: %d\n"),
+				progname, error);
+			exit(1);
+		}
+	}
+	query_summary();
+}
@@ -24,6 +24,7 @@
 #define OP_PRINT_TRANS	1
 #define OP_DUMP		2
 #define OP_COPY		3
+#define OP_QUERY	4
 
 int	print_data;
 int	print_only_data;
@@ -35,6 +36,8 @@ int     print_no_data;
 int     print_no_print;
 int     print_exit = 1; /* -e is now default. specify -c to override */
 int	print_operation = OP_PRINT;
+int	print_query;
+int	print_json;
 
 void
 usage(void)
@@ -55,6 +58,11 @@ Options:\n\
 	-b          in transactional view, extract buffer info\n\
 	-i          in transactional view, extract inode info\n\
 	-q          in transactional view, extract quota info\n\
+    -I <ino>        print only transactions logging this inode\n\
+    -B <daddr>      print only transactions logging this disk address\n\
+    -T <tid>        print only transactions with this tid\n\
+    -R <lsn>[-<lsn>] print only transactions in this LSN range\n\
+    -J              print transactions as JSON, one per line\n\
     -D              print only data; no decoding\n\
     -V              print version information\n"),
 	progname);
@@ -143,7 +151,7 @@ main(int argc, char **argv)
 	memset(&mount, 0, sizeof(mount));
 
 	progname = basename(argv[0]);
-	while ((c = getopt(argc, argv, "bC:cdefl:iqnors:tDVv")) != EOF) {
+	while ((c = getopt(argc, argv, "bB:C:cdefI:Jl:iqnorR:s:T:tDVv")) != EOF) {
 		switch (c) {
 			case 'D':
 				print_only_data++;
@@ -152,6 +160,30 @@ main(int argc, char **argv)
 			case 'b':
 				print_buffer++;
 				break;
+			case 'B':
+				if (xfs_log_query_add(QUERY_DADDR, optarg))
+					usage();
+				print_query++;
+				break;
+			case 'I':
+				if (xfs_log_query_add(QUERY_INO, optarg))
+					usage();
+				print_query++;
+				break;
+			case 'J':
+				print_json++;
+				print_query++;
+				break;
+			case 'R':
+				if (xfs_log_query_add(QUERY_LSN, optarg))
+					usage();
+				print_query++;
+				break;
+			case 'T':
+				if (xfs_log_query_add(QUERY_TID, optarg))
+					usage();
+				print_query++;
+				break;
 			case 'c':
 			    /* default is to stop on error.
 			     * -c turns this off.
@@ -209,6 +241,12 @@ main(int argc, char **argv)
 
 	if (argc - optind != 1)
 		usage();
+	if (print_query) {
+		if (print_operation != OP_PRINT &&
+		    print_operation != OP_PRINT_TRANS)
+			usage();
+		print_operation = OP_QUERY;
+	}
 
 	x.dname = argv[optind];
 
@@ -216,7 +254,9 @@ main(int argc, char **argv)
 		usage();
 
 	x.isreadonly = LIBXFS_ISINACTIVE;
-	printf(_("xfs_logprint:\n"));
+	/* JSON output is for programs, keep it free of anything else */
+	if (!print_json)
+		printf(_("xfs_logprint:\n"));
 	if (!libxfs_init(&x))
 		exit(1);
 
@@ -225,16 +265,20 @@ main(int argc, char **argv)
 
 	logfd = (x.logfd < 0) ? x.dfd : x.logfd;
 
-	printf(_("    data device: 0x%llx\n"), (unsigned long long)x.ddev);
+	if (!print_json) {
+		printf(_("    data device: 0x%llx\n"),
+			(unsigned long long)x.ddev);
 
-	if (x.logname) {
-		printf(_("    log file: \"%s\" "), x.logname);
-	} else {
-		printf(_("    log device: 0x%llx "), (unsigned long long)x.logdev);
-	}
+		if (x.logname) {
+			printf(_("    log file: \"%s\" "), x.logname);
+		} else {
+			printf(_("    log device: 0x%llx "),
+				(unsigned long long)x.logdev);
+		}
 
-	printf(_("daddr: %lld length: %lld\n\n"),
-		(long long)x.logBBstart, (long long)x.logBBsize);
+		printf(_("daddr: %lld length: %lld\n\n"),
+			(long long)x.logBBstart, (long long)x.logBBsize);
+	}
 
 	ASSERT(x.logBBsize <= INT_MAX);
 
@@ -258,6 +302,9 @@ main(int argc, char **argv)
 	case OP_COPY:
 		xfs_log_copy(&log, logfd, copy_file);
 		break;
+	case OP_QUERY:
+		xfs_log_query(&log);
+		break;
 	}
 	exit(0);
 }
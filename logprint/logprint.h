@@ -30,16 +30,32 @@ extern int	print_transactions;
 extern int	print_overwrite;
 extern int	print_no_data;
 extern int	print_no_print;
+extern int	print_query;
+extern int	print_json;
+
+/* query terms */
+#define QUERY_INO	0
+#define QUERY_DADDR	1
+#define QUERY_TID	2
+#define QUERY_NSETS	3
+#define QUERY_LSN	3	/* a range, not a set */
 
 /* exports */
 extern char *trans_type[];
 
 extern void xlog_print_lseek(struct xlog *, int, xfs_daddr_t, int);
+extern void xlog_print_map(struct xlog *, int);
+extern void xlog_print_unmap(void);
+extern ssize_t xlog_print_read(int, void *, size_t);
 
 extern void xfs_log_copy(struct xlog *, int, char *);
 extern void xfs_log_dump(struct xlog *, int, int);
 extern void xfs_log_print(struct xlog *, int, int);
 extern void xfs_log_print_trans(struct xlog *, int);
+extern void xfs_log_query(struct xlog *);
+extern int xfs_log_query_add(int, char *);
+extern int xfs_log_query_trans(struct xlog *, xlog_recover_t *);
+extern void xlog_recover_print_item(xlog_recover_item_t *);
 
 extern void print_xlog_record_line(void);
 extern void print_xlog_op_line(void);
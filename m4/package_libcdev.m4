@@ -219,3 +219,27 @@ AC_DEFUN([AC_HAVE_MLOCK],
     AC_SUBST(have_mlock)
   ])
 
+
+#
+# Check if we have the native Linux AIO system calls (io_setup/io_submit)
+#
+AC_DEFUN([AC_HAVE_LINUX_AIO],
+  [ AC_MSG_CHECKING([for Linux AIO system calls ])
+    AC_TRY_COMPILE([
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+    ], [
+	aio_context_t ctx = 0;
+	struct iocb cb;
+	struct io_event ev;
+	syscall(__NR_io_setup, 1, &ctx);
+	syscall(__NR_io_submit, ctx, 1, &cb);
+	syscall(__NR_io_getevents, ctx, 1, 1, &ev, 0);
+	syscall(__NR_io_destroy, ctx);
+    ],	have_linux_aio=yes
+	AC_MSG_RESULT(yes),
+	AC_MSG_RESULT(no))
+    AC_SUBST(have_linux_aio)
+  ])
@@ -50,22 +50,256 @@ print_progress(const char *fmt, ...)
 	progress_since_warning = 1;
 }
 
+/*
+ * Restoring a dump is dominated by the writes to the target, so the blocks
+ * are decoded into large batches by the main thread and written out by a
+ * small pool of writer threads while the next batch is being read.
+ *
+ * Within a batch the block data is packed in index order, so a run of
+ * adjacent daddrs is also contiguous in memory and goes out as a single
+ * large write.  Each writer owns a fixed set of daddr regions and processes
+ * the batches in order, so if a block appears more than once in a dump the
+ * last copy still wins, exactly as it would for a serial restore.
+ */
+#define MDR_BATCH_METABLOCKS	256	/* metablocks decoded per batch */
+#define MDR_REGION_SHIFT	14	/* 8MB daddr regions per writer */
+#define MDR_MAX_WRITERS		4	/* by default */
+#define MDR_WRITERS_LIMIT	32	/* for -t; each costs about 8MB */
+
+typedef struct restore_batch {
+	int			nblocks;
+	__uint64_t		*daddrs;
+	char			*data;
+} restore_batch_t;
+
+typedef struct restore_ctx {
+	pthread_mutex_t		lock;
+	pthread_cond_t		queued;		/* writers wait for a batch */
+	pthread_cond_t		written;	/* reader waits for a slot */
+	restore_batch_t		*ring;
+	int			nslots;
+	__uint64_t		head;		/* batches queued so far */
+	__uint64_t		*tail;		/* batches written, per writer */
+	int			done;
+	int			nwriters;
+	pthread_t		*threads;
+	int			dst_fd;
+	int			blocklog;
+} restore_ctx_t;
+
+typedef struct restore_writer {
+	restore_ctx_t		*ctx;
+	int			id;
+} restore_writer_t;
+
+static void
+write_run(
+	int			fd,
+	char			*buf,
+	size_t			len,
+	off64_t			off)
+{
+	ssize_t			ret;
+
+	while (len > 0) {
+		ret = pwrite64(fd, buf, len, off);
+		if (ret < 0)
+			fatal("error writing block %llu: %s\n",
+				(unsigned long long)off, strerror(errno));
+		if (ret == 0)
+			fatal("error writing block %llu: short write\n",
+				(unsigned long long)off);
+		buf += ret;
+		len -= ret;
+		off += ret;
+	}
+}
+
+static void
+write_batch(
+	restore_ctx_t		*ctx,
+	restore_batch_t		*b,
+	int			id)
+{
+	__uint64_t		bbs = 1 << (ctx->blocklog - BBSHIFT);
+	__uint64_t		region;
+	int			i;
+	int			j;
+
+	for (i = 0; i < b->nblocks; i = j) {
+		region = b->daddrs[i] >> MDR_REGION_SHIFT;
+		for (j = i + 1; j < b->nblocks; j++) {
+			if (b->daddrs[j] != b->daddrs[j - 1] + bbs ||
+			    (b->daddrs[j] >> MDR_REGION_SHIFT) != region)
+				break;
+		}
+		if (region % ctx->nwriters != id)
+			continue;
+		write_run(ctx->dst_fd, &b->data[(size_t)i << ctx->blocklog],
+			(size_t)(j - i) << ctx->blocklog,
+			b->daddrs[i] << BBSHIFT);
+	}
+}
+
+static void *
+writer_thread(
+	void			*arg)
+{
+	restore_writer_t	*w = arg;
+	restore_ctx_t		*ctx = w->ctx;
+	restore_batch_t		*b;
+
+	for (;;) {
+		pthread_mutex_lock(&ctx->lock);
+		while (ctx->tail[w->id] == ctx->head && !ctx->done)
+			pthread_cond_wait(&ctx->queued, &ctx->lock);
+		if (ctx->tail[w->id] == ctx->head) {
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+		b = &ctx->ring[ctx->tail[w->id] % ctx->nslots];
+		pthread_mutex_unlock(&ctx->lock);
+
+		write_batch(ctx, b, w->id);
+
+		pthread_mutex_lock(&ctx->lock);
+		ctx->tail[w->id]++;
+		pthread_cond_broadcast(&ctx->written);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+	return NULL;
+}
+
+static void
+start_writers(
+	restore_ctx_t		*ctx,
+	restore_writer_t	*writers,
+	int			nwriters,
+	int			dst_fd,
+	int			blocklog,
+	int			batch_blocks)
+{
+	int			i;
+	int			err;
+
+	memset(ctx, 0, sizeof(*ctx));
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->queued, NULL);
+	pthread_cond_init(&ctx->written, NULL);
+	ctx->nwriters = nwriters;
+	ctx->nslots = nwriters + 2;
+	ctx->dst_fd = dst_fd;
+	ctx->blocklog = blocklog;
+
+	ctx->ring = calloc(ctx->nslots, sizeof(restore_batch_t));
+	ctx->tail = calloc(nwriters, sizeof(__uint64_t));
+	ctx->threads = calloc(nwriters, sizeof(pthread_t));
+	if (!ctx->ring || !ctx->tail || !ctx->threads)
+		fatal("memory allocation failure\n");
+	for (i = 0; i < ctx->nslots; i++) {
+		ctx->ring[i].daddrs = malloc(batch_blocks * sizeof(__uint64_t));
+		ctx->ring[i].data = malloc((size_t)batch_blocks << blocklog);
+		if (!ctx->ring[i].daddrs || !ctx->ring[i].data)
+			fatal("memory allocation failure\n");
+	}
+
+	for (i = 0; i < nwriters; i++) {
+		writers[i].ctx = ctx;
+		writers[i].id = i;
+		err = pthread_create(&ctx->threads[i], NULL, writer_thread,
+				&writers[i]);
+		if (err)
+			fatal("cannot create writer thread: %s\n",
+				strerror(err));
+	}
+}
+
+/*
+ * Return the next free batch, waiting for the slowest writer to finish
+ * with it if the ring is full.
+ */
+static restore_batch_t *
+get_batch(
+	restore_ctx_t		*ctx)
+{
+	restore_batch_t		*b;
+	__uint64_t		oldest;
+	int			i;
+
+	pthread_mutex_lock(&ctx->lock);
+	for (;;) {
+		oldest = ctx->head;
+		for (i = 0; i < ctx->nwriters; i++)
+			if (ctx->tail[i] < oldest)
+				oldest = ctx->tail[i];
+		if (ctx->head - oldest < ctx->nslots)
+			break;
+		pthread_cond_wait(&ctx->written, &ctx->lock);
+	}
+	b = &ctx->ring[ctx->head % ctx->nslots];
+	pthread_mutex_unlock(&ctx->lock);
+
+	b->nblocks = 0;
+	return b;
+}
+
+static void
+queue_batch(
+	restore_ctx_t		*ctx)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->head++;
+	pthread_cond_broadcast(&ctx->queued);
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+static void
+stop_writers(
+	restore_ctx_t		*ctx)
+{
+	int			i;
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->done = 1;
+	pthread_cond_broadcast(&ctx->queued);
+	pthread_mutex_unlock(&ctx->lock);
+
+	for (i = 0; i < ctx->nwriters; i++)
+		pthread_join(ctx->threads[i], NULL);
+
+	for (i = 0; i < ctx->nslots; i++) {
+		free(ctx->ring[i].daddrs);
+		free(ctx->ring[i].data);
+	}
+	free(ctx->ring);
+	free(ctx->tail);
+	free(ctx->threads);
+	pthread_mutex_destroy(&ctx->lock);
+	pthread_cond_destroy(&ctx->queued);
+	pthread_cond_destroy(&ctx->written);
+}
+
 static void
 perform_restore(
 	FILE			*src_f,
 	int			dst_fd,
-	int			is_target_file)
+	int			is_target_file,
+	int			nwriters)
 {
-	xfs_metablock_t 	*metablock;	/* header + index + blocks */
+	xfs_metablock_t 	*metablock;	/* header + index */
 	__be64			*block_index;
 	char			*block_buffer;
 	int			block_size;
 	int			max_indicies;
+	int			batch_blocks;
 	int			cur_index;
 	int			mb_count;
 	xfs_metablock_t		tmb;
 	xfs_sb_t		sb;
 	__int64_t		bytes_read;
+	restore_ctx_t		ctx;
+	restore_writer_t	*writers;
+	restore_batch_t		*batch;
 
 	/*
 	 * read in first blocks (superblock 0), set "inprogress" flag for it,
@@ -81,9 +315,11 @@ perform_restore(
 
 	block_size = 1 << tmb.mb_blocklog;
 	max_indicies = (block_size - sizeof(xfs_metablock_t)) / sizeof(__be64);
+	batch_blocks = MDR_BATCH_METABLOCKS * max_indicies;
 
-	metablock = (xfs_metablock_t *)calloc(max_indicies + 1, block_size);
-	if (metablock == NULL)
+	metablock = (xfs_metablock_t *)calloc(1, block_size);
+	writers = calloc(nwriters, sizeof(restore_writer_t));
+	if (metablock == NULL || writers == NULL)
 		fatal("memory allocation failure\n");
 
 	mb_count = be16_to_cpu(tmb.mb_count);
@@ -91,7 +327,6 @@ perform_restore(
 		fatal("bad block count: %u\n", mb_count);
 
 	block_index = (__be64 *)((char *)metablock + sizeof(xfs_metablock_t));
-	block_buffer = (char *)metablock + block_size;
 
 	if (fread(block_index, block_size - sizeof(tmb), 1, src_f) != 1)
 		fatal("error reading from file: %s\n", strerror(errno));
@@ -99,6 +334,10 @@ perform_restore(
 	if (block_index[0] != 0)
 		fatal("first block is not the primary superblock\n");
 
+	start_writers(&ctx, writers, nwriters, dst_fd, tmb.mb_blocklog,
+			batch_blocks);
+	batch = get_batch(&ctx);
+	block_buffer = batch->data;
 
 	if (fread(block_buffer, mb_count << tmb.mb_blocklog,
 			1, src_f) != 1)
@@ -135,15 +374,11 @@ perform_restore(
 		if (show_progress && (bytes_read & ((1 << 20) - 1)) == 0)
 			print_progress("%lld MB read\n", bytes_read >> 20);
 
-		for (cur_index = 0; cur_index < mb_count; cur_index++) {
-			if (pwrite64(dst_fd, &block_buffer[cur_index <<
-					tmb.mb_blocklog], block_size,
-					be64_to_cpu(block_index[cur_index]) <<
-						BBSHIFT) < 0)
-				fatal("error writing block %llu: %s\n",
-					be64_to_cpu(block_index[cur_index]) << BBSHIFT,
-					strerror(errno));
-		}
+		for (cur_index = 0; cur_index < mb_count; cur_index++)
+			batch->daddrs[batch->nblocks + cur_index] =
+				be64_to_cpu(block_index[cur_index]);
+		batch->nblocks += mb_count;
+
 		if (mb_count < max_indicies)
 			break;
 
@@ -156,17 +391,28 @@ perform_restore(
 		if (mb_count > max_indicies)
 			fatal("bad block count: %u\n", mb_count);
 
-		if (fread(block_buffer, mb_count << tmb.mb_blocklog, 
-								1, src_f) != 1)
+		if (batch->nblocks + mb_count > batch_blocks) {
+			queue_batch(&ctx);
+			batch = get_batch(&ctx);
+		}
+
+		if (fread(&batch->data[(size_t)batch->nblocks <<
+					tmb.mb_blocklog],
+				mb_count << tmb.mb_blocklog, 1, src_f) != 1)
 			fatal("error reading from file: %s\n", strerror(errno));
 
 		bytes_read += block_size;
 	}
 
+	queue_batch(&ctx);
+	stop_writers(&ctx);
+
 	if (progress_since_warning)
 		putchar('\n');
 
-	memset(block_buffer, 0, sb.sb_sectsize);
+	block_buffer = calloc(1, sb.sb_sectsize);
+	if (block_buffer == NULL)
+		fatal("memory allocation failure\n");
 	sb.sb_inprogress = 0;
 	libxfs_sb_to_disk((xfs_dsb_t *)block_buffer, &sb, XFS_SB_ALL_BITS);
 	if (xfs_sb_version_hascrc(&sb)) {
@@ -177,13 +423,15 @@ perform_restore(
 	if (pwrite(dst_fd, block_buffer, sb.sb_sectsize, 0) < 0)
 		fatal("error writing primary superblock: %s\n", strerror(errno));
 
+	free(block_buffer);
 	free(metablock);
+	free(writers);
 }
 
 static void
 usage(void)
 {
-	fprintf(stderr, "Usage: %s [-V] [-g] source target\n", progname);
+	fprintf(stderr, "Usage: %s [-V] [-g] [-t writers] source [delta...] target\n", progname);
 	exit(1);
 }
 
@@ -200,14 +448,37 @@ main(
 	int		open_flags;
 	struct stat64	statbuf;
 	int		is_target_file;
+	int		nwriters;
+	unsigned long	n;
+	char		*p;
+	char		*target;
+	int		nsources;
 
 	progname = basename(argv[0]);
 
-	while ((c = getopt(argc, argv, "gV")) != EOF) {
+	nwriters = libxfs_nproc();
+	if (nwriters > MDR_MAX_WRITERS)
+		nwriters = MDR_MAX_WRITERS;
+	if (nwriters < 1)
+		nwriters = 1;
+
+	while ((c = getopt(argc, argv, "gt:V")) != EOF) {
 		switch (c) {
 			case 'g':
 				show_progress = 1;
 				break;
+			case 't':
+				errno = 0;
+				n = strtoul(optarg, &p, 0);
+				if (errno || *p != '\0' || *optarg == '-' ||
+				    n < 1 || n > MDR_WRITERS_LIMIT) {
+					fprintf(stderr,
+		"%s: writer count must be between 1 and %d\n",
+						progname, MDR_WRITERS_LIMIT);
+					usage();
+				}
+				nwriters = n;
+				break;
 			case 'V':
 				printf("%s version %s\n", progname, VERSION);
 				exit(0);
@@ -216,25 +487,20 @@ main(
 		}
 	}
 
-	if (argc - optind != 2)
+	if (argc - optind < 2)
 		usage();
 
-	/* open source */
-	if (strcmp(argv[optind], "-") == 0) {
-		src_f = stdin;
-		if (isatty(fileno(stdin)))
-			fatal("cannot read from a terminal\n");
-	} else {
-		src_f = fopen(argv[optind], "rb");
-		if (src_f == NULL)
-			fatal("cannot open source dump file\n");
-	}
-	optind++;
+	/*
+	 * Any dumps after the first are incremental dumps, which are
+	 * layered on top of the image in the order given.
+	 */
+	target = argv[argc - 1];
+	nsources = argc - optind - 1;
 
 	/* check and open target */
 	open_flags = O_RDWR;
 	is_target_file = 0;
-	if (stat64(argv[optind], &statbuf) < 0)  {
+	if (stat64(target, &statbuf) < 0)  {
 		/* ok, assume it's a file and create it */
 		open_flags |= O_CREAT;
 		is_target_file = 1;
@@ -245,21 +511,36 @@ main(
 		/*
 		 * check to make sure a filesystem isn't mounted on the device
 		 */
-		if (platform_check_ismounted(argv[optind], NULL, &statbuf, 0))
+		if (platform_check_ismounted(target, NULL, &statbuf, 0))
 			fatal("a filesystem is mounted on target device \"%s\","
 				" cannot restore to a mounted filesystem.\n",
-				argv[optind]);
+				target);
 	}
 
-	dst_fd = open(argv[optind], open_flags, 0644);
-	if (dst_fd < 0)
-		fatal("couldn't open target \"%s\"\n", argv[optind]);
+	for (; nsources > 0; nsources--, optind++) {
+		/* open source */
+		if (strcmp(argv[optind], "-") == 0) {
+			src_f = stdin;
+			if (isatty(fileno(stdin)))
+				fatal("cannot read from a terminal\n");
+		} else {
+			src_f = fopen(argv[optind], "rb");
+			if (src_f == NULL)
+				fatal("cannot open source dump file \"%s\"\n",
+					argv[optind]);
+		}
+
+		dst_fd = open(target, open_flags, 0644);
+		if (dst_fd < 0)
+			fatal("couldn't open target \"%s\"\n", target);
+		open_flags &= ~(O_CREAT | O_TRUNC);
 
-	perform_restore(src_f, dst_fd, is_target_file);
+		perform_restore(src_f, dst_fd, is_target_file, nwriters);
 
-	close(dst_fd);
-	if (src_f != stdin)
-		fclose(src_f);
+		close(dst_fd);
+		if (src_f != stdin)
+			fclose(src_f);
+	}
 
 	return 0;
 }
@@ -18,6 +18,7 @@
 
 #include <xfs/libxfs.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include "xfs_mkfs.h"
 
 /*
@@ -30,9 +31,12 @@ static void getres(xfs_trans_t *tp, uint blocks);
 static void rsvfile(xfs_mount_t *mp, xfs_inode_t *ip, long long len);
 static int newfile(xfs_trans_t *tp, xfs_inode_t *ip, xfs_bmap_free_t *flist,
 	xfs_fsblock_t *first, int dolocal, int logit, char *buf, int len);
-static char *newregfile(char **pp, int *len);
+static int newregfile(char **pp, char **fname);
+static void writefile(xfs_mount_t *mp, xfs_inode_t *ip, int fd, char *fname);
+static void populate(xfs_mount_t *mp, xfs_inode_t *pip, struct fsxattr *fsxp,
+	char *path, char *name);
 static void rtinit(xfs_mount_t *mp);
-static long filesize(int fd);
+static long long filesize(int fd);
 
 /*
  * Use this for block reservations needed for mkfs's conditions
@@ -44,6 +48,32 @@ static long filesize(int fd);
 	((uint)(MKFS_BLOCKRES_INODE + XFS_DA_NODE_MAXDEPTH + \
 	(XFS_BM_MAXLEVELS(mp, XFS_DATA_FORK) - 1) + (rb)))
 
+/*
+ * File data is copied in pieces of this size, so memory use does not
+ * depend on the size of the files.
+ */
+#define	MKFS_COPY_SIZE		(4 * 1024 * 1024)
+
+/*
+ * Source directory given with -p, instead of a prototype file.
+ */
+static char	*protodir;
+
+/*
+ * Files with more than one link seen so far in the source directory,
+ * so that the later names can be made links to the same inode.
+ */
+#define	HLINK_HASH	256
+
+typedef struct hlink {
+	struct hlink	*next;
+	dev_t		dev;
+	ino64_t		ino;
+	xfs_ino_t	xino;
+} hlink_t;
+
+static hlink_t	*hlinks[HLINK_HASH];
+
 
 char *
 setup_proto(
@@ -53,9 +83,14 @@ setup_proto(
 	static char	dflt[] = "d--755 0 0 $";
 	int		fd;
 	long		size;
+	struct stat64	stb;
 
 	if (!fname)
 		return dflt;
+	if (stat64(fname, &stb) == 0 && S_ISDIR(stb.st_mode)) {
+		protodir = fname;
+		return dflt;
+	}
 	if ((fd = open(fname, O_RDONLY)) < 0 || (size = filesize(fd)) < 0) {
 		fprintf(stderr, _("%s: failed to open %s: %s\n"),
 			progname, fname, strerror(errno));
@@ -278,33 +313,144 @@ newfile(
 	return flags;
 }
 
-static char *
+static int
 newregfile(
 	char		**pp,
-	int		*len)
+	char		**fname)
 {
-	char		*buf;
 	int		fd;
-	char		*fname;
-	long		size;
 
-	fname = getstr(pp);
-	if ((fd = open(fname, O_RDONLY)) < 0 || (size = filesize(fd)) < 0) {
+	*fname = getstr(pp);
+	if ((fd = open(*fname, O_RDONLY)) < 0) {
 		fprintf(stderr, _("%s: cannot open %s: %s\n"),
+			progname, *fname, strerror(errno));
+		exit(1);
+	}
+	return fd;
+}
+
+/*
+ * Copy the contents of a file into a newly created inode.  The data is
+ * read and written in large pieces, each allocated as however many
+ * extents it takes and written straight to the data device; the kernel
+ * is asked to read the next piece ahead while the current one is written.
+ */
+static void
+writefile(
+	xfs_mount_t	*mp,
+	xfs_inode_t	*ip,
+	int		fd,
+	char		*fname)
+{
+	xfs_fileoff_t	bno;
+	char		*buf;
+	int		committed;
+	xfs_daddr_t	d;
+	int		dfd;
+	xfs_fileoff_t	ebno;
+	int		error;
+	xfs_fsblock_t	first;
+	xfs_bmap_free_t	flist;
+	int		i;
+	ssize_t		len;
+	xfs_bmbt_irec_t	map[XFS_BMAP_MAX_NMAP];
+	ssize_t		n;
+	int		nmap;
+	long long	off;
+	char		*p;
+	long long	size;
+	xfs_trans_t	*tp;
+
+	if ((size = filesize(fd)) < 0) {
+		fprintf(stderr, _("%s: cannot stat %s: %s\n"),
 			progname, fname, strerror(errno));
 		exit(1);
 	}
-	if ((*len = (int)size)) {
-		buf = malloc(size);
-		if (read(fd, buf, size) < size) {
+	if (XFS_IS_REALTIME_INODE(ip))
+		dfd = libxfs_device_to_fd(mp->m_rtdev_targp->dev);
+	else
+		dfd = libxfs_device_to_fd(mp->m_ddev_targp->dev);
+	buf = memalign(libxfs_device_alignment(), MKFS_COPY_SIZE);
+	if (buf == NULL) {
+		fprintf(stderr, _("%s: can't memalign %d bytes: %s\n"),
+			progname, MKFS_COPY_SIZE, strerror(errno));
+		exit(1);
+	}
+#ifdef HAVE_FADVISE
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	for (off = 0; off < size; off += len) {
+		len = (ssize_t)min(size - off, (long long)MKFS_COPY_SIZE);
+		if (pread64(fd, buf, len, off) != len) {
 			fprintf(stderr, _("%s: read failed on %s: %s\n"),
 				progname, fname, strerror(errno));
 			exit(1);
 		}
-	} else
-		buf = 0;
-	close(fd);
-	return buf;
+#ifdef HAVE_FADVISE
+		if (off + len < size)
+			posix_fadvise(fd, off + len, MKFS_COPY_SIZE,
+				      POSIX_FADV_WILLNEED);
+#endif
+		bno = XFS_B_TO_FSBT(mp, off);
+		ebno = XFS_B_TO_FSB(mp, off + len);
+		n = XFS_FSB_TO_B(mp, ebno - bno);
+		if (len < n)
+			memset(buf + len, 0, n - len);
+
+		while (bno < ebno) {
+			tp = libxfs_trans_alloc(mp, 0);
+			getres(tp, ebno - bno);
+			libxfs_trans_ijoin(tp, ip, 0);
+			xfs_bmap_init(&flist, &first);
+			nmap = XFS_BMAP_MAX_NMAP;
+			error = libxfs_bmapi_write(tp, ip, bno, ebno - bno, 0,
+					&first, ebno - bno, map, &nmap, &flist);
+			if (error)
+				fail(_("error allocating space for a file"),
+					error);
+			if (nmap == 0) {
+				fprintf(stderr,
+				_("%s: cannot allocate space for file\n"),
+					progname);
+				exit(1);
+			}
+			libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+			error = libxfs_bmap_finish(&tp, &flist, &committed);
+			if (error)
+				fail(_("error allocating space for a file"),
+					error);
+			libxfs_trans_commit(tp, 0);
+
+			for (i = 0; i < nmap; i++) {
+				p = buf + XFS_FSB_TO_B(mp, map[i].br_startoff -
+						       XFS_B_TO_FSBT(mp, off));
+				n = XFS_FSB_TO_B(mp, map[i].br_blockcount);
+				if (XFS_IS_REALTIME_INODE(ip))
+					d = XFS_FSB_TO_BB(mp,
+						map[i].br_startblock);
+				else
+					d = XFS_FSB_TO_DADDR(mp,
+						map[i].br_startblock);
+				if (pwrite64(dfd, p, n,
+					     LIBXFS_BBTOOFF64(d)) != n) {
+					fprintf(stderr,
+				_("%s: write failed copying %s: %s\n"),
+						progname, fname,
+						strerror(errno));
+					exit(1);
+				}
+				bno += map[i].br_blockcount;
+			}
+		}
+	}
+	free(buf);
+
+	tp = libxfs_trans_alloc(mp, 0);
+	getres(tp, 0);
+	libxfs_trans_ijoin(tp, ip, 0);
+	ip->i_d.di_size = size;
+	libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	libxfs_trans_commit(tp, 0);
 }
 
 static void
@@ -361,6 +507,7 @@ parseproto(
 	int		committed;
 	int		error;
 	xfs_fsblock_t	first;
+	int		fd;
 	int		flags;
 	xfs_bmap_free_t	flist;
 	int		fmt;
@@ -451,19 +598,26 @@ parseproto(
 	xfs_bmap_init(&flist, &first);
 	switch (fmt) {
 	case IF_REGULAR:
-		buf = newregfile(pp, &len);
-		getres(tp, XFS_B_TO_FSB(mp, len));
+		fd = newregfile(pp, &value);
+		getres(tp, 0);
 		error = libxfs_inode_alloc(&tp, pip, mode|S_IFREG, 1, 0,
 					   &creds, fsxp, &ip);
 		if (error)
 			fail(_("Inode allocation failed"), error);
-		flags |= newfile(tp, ip, &flist, &first, 0, 0, buf, len);
-		if (buf)
-			free(buf);
 		libxfs_trans_ijoin(tp, pip, 0);
 		xname.type = XFS_DIR3_FT_REG_FILE;
 		newdirent(mp, tp, pip, &xname, ip->i_ino, &first, &flist);
-		break;
+		libxfs_trans_log_inode(tp, ip, flags);
+
+		error = libxfs_bmap_finish(&tp, &flist, &committed);
+		if (error)
+			fail(_("Error encountered creating file from prototype file"),
+				error);
+		libxfs_trans_commit(tp, 0);
+		writefile(mp, ip, fd, value);
+		close(fd);
+		IRELE(ip);
+		return;
 
 	case IF_RESERVED:			/* pre-allocated space only */
 		value = getstr(pp);
@@ -604,7 +758,251 @@ parse_proto(
 	struct fsxattr	*fsx,
 	char		**pp)
 {
-	parseproto(mp, NULL, fsx, pp, NULL);
+	if (protodir)
+		populate(mp, NULL, fsx, protodir, NULL);
+	else
+		parseproto(mp, NULL, fsx, pp, NULL);
+}
+
+static xfs_ino_t
+hlink_find(
+	struct stat64	*st)
+{
+	hlink_t		*h;
+
+	for (h = hlinks[st->st_ino % HLINK_HASH]; h; h = h->next)
+		if (h->ino == st->st_ino && h->dev == st->st_dev)
+			return h->xino;
+	return NULLFSINO;
+}
+
+static void
+hlink_add(
+	struct stat64	*st,
+	xfs_ino_t	xino)
+{
+	hlink_t		*h;
+
+	if ((h = malloc(sizeof(*h))) == NULL)
+		fail(_("cannot allocate memory"), errno);
+	h->dev = st->st_dev;
+	h->ino = st->st_ino;
+	h->xino = xino;
+	h->next = hlinks[st->st_ino % HLINK_HASH];
+	hlinks[st->st_ino % HLINK_HASH] = h;
+}
+
+static void
+settimes(
+	xfs_inode_t	*ip,
+	struct stat64	*st)
+{
+	ip->i_d.di_atime.t_sec = (__int32_t)st->st_atime;
+	ip->i_d.di_atime.t_nsec = 0;
+	ip->i_d.di_mtime.t_sec = (__int32_t)st->st_mtime;
+	ip->i_d.di_mtime.t_nsec = 0;
+}
+
+static int
+direntcmp(
+	const struct dirent	**a,
+	const struct dirent	**b)
+{
+	return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+/*
+ * Copy a file, or a directory and everything below it, from the source
+ * directory tree.  Ownership, permissions, timestamps and hard links are
+ * kept; entries are created in name order so the result is reproducible.
+ */
+static void
+populate(
+	xfs_mount_t	*mp,
+	xfs_inode_t	*pip,
+	struct fsxattr	*fsxp,
+	char		*path,
+	char		*name)
+{
+	char		buf[MAXPATHLEN];
+	int		committed;
+	cred_t		creds;
+	struct dirent	**dents;
+	int		error;
+	int		fd = -1;
+	xfs_fsblock_t	first;
+	int		flags;
+	xfs_bmap_free_t	flist;
+	int		i;
+	xfs_inode_t	*ip;
+	int		len = 0;
+	int		n;
+	char		*p;
+	xfs_dev_t	rdev = 0;
+	struct stat64	st;
+	xfs_trans_t	*tp;
+	struct xfs_name	xname;
+	xfs_ino_t	xino;
+
+	if (lstat64(path, &st) < 0) {
+		fprintf(stderr, _("%s: cannot stat %s: %s\n"),
+			progname, path, strerror(errno));
+		exit(1);
+	}
+	xname.name = (uchar_t *)name;
+	xname.len = name ? strlen(name) : 0;
+	switch (st.st_mode & S_IFMT) {
+	case S_IFREG:
+		xname.type = XFS_DIR3_FT_REG_FILE;
+		break;
+	case S_IFDIR:
+		xname.type = XFS_DIR3_FT_DIR;
+		break;
+	case S_IFLNK:
+		xname.type = XFS_DIR3_FT_SYMLINK;
+		len = readlink(path, buf, sizeof(buf));
+		if (len < 0) {
+			fprintf(stderr, _("%s: cannot read link %s: %s\n"),
+				progname, path, strerror(errno));
+			exit(1);
+		}
+		break;
+	case S_IFBLK:
+		xname.type = XFS_DIR3_FT_BLKDEV;
+		rdev = IRIX_MKDEV(major(st.st_rdev), minor(st.st_rdev));
+		break;
+	case S_IFCHR:
+		xname.type = XFS_DIR3_FT_CHRDEV;
+		rdev = IRIX_MKDEV(major(st.st_rdev), minor(st.st_rdev));
+		break;
+	case S_IFIFO:
+		xname.type = XFS_DIR3_FT_FIFO;
+		break;
+	case S_IFSOCK:
+		xname.type = XFS_DIR3_FT_SOCK;
+		break;
+	default:
+		fprintf(stderr, _("%s: %s has an unknown file type\n"),
+			progname, path);
+		exit(1);
+	}
+	if (!pip && !S_ISDIR(st.st_mode)) {
+		fprintf(stderr, _("%s: %s is not a directory\n"),
+			progname, path);
+		exit(1);
+	}
+
+	tp = libxfs_trans_alloc(mp, 0);
+	flags = XFS_ILOG_CORE;
+	xfs_bmap_init(&flist, &first);
+
+	/* another name for a file we have already copied */
+	if (!S_ISDIR(st.st_mode) && st.st_nlink > 1 &&
+	    (xino = hlink_find(&st)) != NULLFSINO) {
+		getres(tp, 0);
+		error = libxfs_trans_iget(mp, tp, xino, 0, 0, &ip);
+		if (error)
+			fail(_("Inode lookup failed"), error);
+		ip->i_d.di_nlink++;
+		libxfs_trans_ijoin(tp, pip, 0);
+		newdirent(mp, tp, pip, &xname, ip->i_ino, &first, &flist);
+		libxfs_trans_log_inode(tp, ip, flags);
+		error = libxfs_bmap_finish(&tp, &flist, &committed);
+		if (error)
+			fail(_("Hard link creation failed"), error);
+		libxfs_trans_commit(tp, 0);
+		IRELE(ip);
+		return;
+	}
+
+	if (S_ISREG(st.st_mode) && (fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, _("%s: cannot open %s: %s\n"),
+			progname, path, strerror(errno));
+		exit(1);
+	}
+	getres(tp, XFS_B_TO_FSB(mp, len));
+	memset(&creds, 0, sizeof(creds));
+	creds.cr_uid = st.st_uid;
+	creds.cr_gid = st.st_gid;
+	error = libxfs_inode_alloc(&tp, pip, st.st_mode, 1, rdev,
+				   &creds, fsxp, &ip);
+	if (error)
+		fail(_("Inode allocation failed"), error);
+	if (rdev)
+		flags |= XFS_ILOG_DEV;
+	if (S_ISLNK(st.st_mode))
+		flags |= newfile(tp, ip, &flist, &first, 1, 1, buf, len);
+	settimes(ip, &st);
+	if (S_ISDIR(st.st_mode)) {
+		ip->i_d.di_nlink++;		/* account for . */
+		if (!pip) {
+			pip = ip;
+			mp->m_sb.sb_rootino = ip->i_ino;
+			libxfs_mod_sb(tp, XFS_SB_ROOTINO);
+		}
+	}
+	if (pip != ip) {
+		libxfs_trans_ijoin(tp, pip, 0);
+		newdirent(mp, tp, pip, &xname, ip->i_ino, &first, &flist);
+		if (S_ISDIR(st.st_mode)) {
+			pip->i_d.di_nlink++;
+			libxfs_trans_log_inode(tp, pip, XFS_ILOG_CORE);
+		}
+	}
+	if (S_ISDIR(st.st_mode))
+		newdirectory(mp, tp, ip, pip);
+	libxfs_trans_log_inode(tp, ip, flags);
+	error = libxfs_bmap_finish(&tp, &flist, &committed);
+	if (error)
+		fail(_("Error encountered creating file from source directory"),
+			error);
+	libxfs_trans_commit(tp, 0);
+
+	if (!S_ISDIR(st.st_mode) && st.st_nlink > 1)
+		hlink_add(&st, ip->i_ino);
+	if (S_ISREG(st.st_mode)) {
+		writefile(mp, ip, fd, path);
+		close(fd);
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		IRELE(ip);
+		return;
+	}
+
+	/*
+	 * RT initialization.  Do this here to ensure that
+	 * the RT inodes get placed after the root inode.
+	 */
+	if (pip == ip)
+		rtinit(mp);
+	n = scandir(path, &dents, NULL, direntcmp);
+	if (n < 0) {
+		fprintf(stderr, _("%s: cannot read directory %s: %s\n"),
+			progname, path, strerror(errno));
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		if (strcmp(dents[i]->d_name, ".") != 0 &&
+		    strcmp(dents[i]->d_name, "..") != 0) {
+			if ((p = malloc(strlen(path) +
+					strlen(dents[i]->d_name) + 2)) == NULL)
+				fail(_("cannot allocate memory"), errno);
+			sprintf(p, "%s/%s", path, dents[i]->d_name);
+			populate(mp, ip, fsxp, p, dents[i]->d_name);
+			free(p);
+		}
+		free(dents[i]);
+	}
+	free(dents);
+
+	/* adding the entries updated the directory's timestamps */
+	tp = libxfs_trans_alloc(mp, 0);
+	getres(tp, 0);
+	libxfs_trans_ijoin(tp, ip, 0);
+	settimes(ip, &st);
+	libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	libxfs_trans_commit(tp, 0);
+	IRELE(ip);
 }
 
 /*
@@ -767,7 +1165,7 @@ rtinit(
 	}
 }
 
-static long
+static long long
 filesize(
 	int		fd)
 {
@@ -775,5 +1173,5 @@ filesize(
 
 	if (fstat64(fd, &stb) < 0)
 		return -1;
-	return (long)stb.st_size;
+	return (long long)stb.st_size;
 }
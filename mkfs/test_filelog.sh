@@ -0,0 +1,45 @@
+#!/bin/sh -f
+#
+# Copyright (c) 2014 Silicon Graphics, Inc.  All Rights Reserved.
+#
+# Make a filesystem in an image file with its log in a second file, and
+# check that the log file was grown to the size asked for and that
+# xfs_repair can make sense of the pair.  libxfs_device_zero() must
+# extend a file-backed log as writing zeroes would, even when it zeroes
+# the range with fallocate.
+#
+# MKFS and XFS_REPAIR may be set to use binaries from a build tree.
+#
+
+MKFS=${MKFS:-mkfs.xfs}
+XFS_REPAIR=${XFS_REPAIR:-xfs_repair}
+LOGSIZE=16777216
+
+dir=`mktemp -d ${TMPDIR:-/tmp}/xfs_filelog.XXXXXX` || exit 1
+trap "rm -rf $dir" 0 1 2 3 15
+
+fail()
+{
+	echo "test_filelog: $*" 1>&2
+	exit 1
+}
+
+# a stale, short log file must be grown, not just zeroed in place
+echo stale > $dir/log
+
+$MKFS -q -d file,name=$dir/data,size=256m \
+	-l name=$dir/log,file,size=$LOGSIZE >$dir/mkfs.out 2>&1 || \
+	fail "mkfs failed: `cat $dir/mkfs.out`"
+grep -q "error" $dir/mkfs.out && fail "mkfs: `cat $dir/mkfs.out`"
+
+size=`stat -c %s $dir/log`
+[ "$size" -eq $LOGSIZE ] || fail "log file is $size bytes, not $LOGSIZE"
+
+$XFS_REPAIR -n -f -l $dir/log $dir/data >$dir/repair.out 2>&1
+grep -q "Phase 7" $dir/repair.out || \
+	fail "xfs_repair did not finish: `cat $dir/repair.out`"
+grep -qi "could not\|bad\|corrupt" $dir/repair.out && \
+	fail "xfs_repair found problems: `cat $dir/repair.out`"
+
+echo "test_filelog: passed"
+exit 0
@@ -887,20 +887,446 @@ discard_blocks(dev_t dev, __uint64_t nsectors)
 		platform_discard_blocks(fd, 0, nsectors << 9);
 }
 
+/*
+ * Everything needed to lay down the headers of each AG.  The AGs do not
+ * depend on each other, so a number of threads take them in turn.
+ */
+#define	MKFS_MAX_AG_THREADS	32
+
+struct aginit {
+	xfs_mount_t		*mp;
+	xfs_sb_t		*sbp;
+	xfs_drfsbno_t		dblocks;
+	xfs_agblock_t		agsize;
+	int			loginternal;
+	xfs_agnumber_t		logagno;
+	xfs_dfsbno_t		logstart;
+	xfs_extlen_t		logblocks;
+	int			lalign;
+	pthread_mutex_t		lock;
+	xfs_agnumber_t		next;
+};
+
+/*
+ * Point a buffer at one header within the memory for an AG's headers.
+ */
+static void
+agbuf_init(
+	xfs_mount_t		*mp,
+	struct xfs_buf		*bp,
+	char			*hdrs,
+	xfs_daddr_t		base,
+	xfs_daddr_t		daddr,
+	int			bblen,
+	const struct xfs_buf_ops *ops)
+{
+	memset(bp, 0, sizeof(*bp));
+	bp->b_target = mp->m_ddev_targp;
+	bp->b_bn = daddr;
+	bp->b_length = bblen;
+	bp->b_bcount = BBTOB(bblen);
+	bp->b_addr = hdrs + BBTOB(daddr - base);
+	bp->b_ops = ops;
+}
+
+static void
+agbuf_write_verify(
+	struct xfs_buf		*bp)
+{
+	bp->b_ops->verify_write(bp);
+	if (bp->b_error) {
+		fprintf(stderr,
+	_("%s: AG header at block 0x%llx failed verification\n"),
+			progname, (unsigned long long)bp->b_bn);
+		exit(1);
+	}
+}
+
+/*
+ * Move the first few free blocks onto the AG free list, picking them the
+ * same way xfs_alloc_fix_freelist() would: the smallest free extent that
+ * has enough of them, otherwise as many as the largest one has.
+ */
+static void
+agf_fill_freelist(
+	xfs_mount_t		*mp,
+	xfs_agf_t		*agf,
+	__be32			*agfl_bno,
+	xfs_alloc_rec_incore_t	*recs,
+	int			*nrecs)
+{
+	int			best;
+	int			i;
+	xfs_extlen_t		len;
+	xfs_extlen_t		longest;
+	int			n;
+	int			need;
+	xfs_extlen_t		want;
+
+	need = XFS_MIN_FREELIST(agf, mp);
+	for (n = 0; n < need && *nrecs > 0; ) {
+		want = need - n;
+		for (best = 0, i = 1; i < *nrecs; i++) {
+			len = recs[i].ar_blockcount;
+			if (recs[best].ar_blockcount >= want) {
+				if (len >= want && len < recs[best].ar_blockcount)
+					best = i;
+			} else if (len >= want || len >= recs[best].ar_blockcount)
+				best = i;
+		}
+		len = MIN(want, recs[best].ar_blockcount);
+		for (i = 0; i < len; i++)
+			agfl_bno[n++] = cpu_to_be32(recs[best].ar_startblock + i);
+		recs[best].ar_startblock += len;
+		recs[best].ar_blockcount -= len;
+		if (recs[best].ar_blockcount == 0) {
+			memmove(&recs[best], &recs[best + 1],
+				(*nrecs - best - 1) * sizeof(*recs));
+			(*nrecs)--;
+		}
+	}
+	if (n == 0)
+		return;
+	for (longest = 0, i = 0; i < *nrecs; i++)
+		longest = MAX(longest, recs[i].ar_blockcount);
+	agf->agf_flfirst = 0;
+	agf->agf_fllast = cpu_to_be32(n - 1);
+	agf->agf_flcount = cpu_to_be32(n);
+	be32_add_cpu(&agf->agf_freeblks, -n);
+	agf->agf_longest = cpu_to_be32(longest);
+}
+
+/*
+ * Build the superblock copy, AG headers, free list and btree roots of an
+ * AG, which are all at its start, and write them out in one go.
+ *
+ * XXX: this code is effectively shared with the kernel growfs code.
+ * These initialisations should be pulled into libxfs to keep the
+ * kernel/userspace header initialisation code the same.
+ */
+static void
+initialise_ag(
+	struct aginit		*ai,
+	xfs_agnumber_t		agno,
+	char			*hdrs)
+{
+	xfs_mount_t		*mp = ai->mp;
+	xfs_agf_t		*agf;
+	struct xfs_agfl		*agfl;
+	struct xfs_buf		agfbuf;
+	struct xfs_buf		agflbuf;
+	xfs_agi_t		*agi;
+	struct xfs_buf		agibuf;
+	xfs_agblock_t		agsize;
+	xfs_daddr_t		base;
+	struct xfs_btree_block	*block;
+	xfs_agblock_t		bno;
+	struct xfs_buf		bnobuf;
+	int			bucket;
+	int			c;
+	struct xfs_buf		cntbuf;
+	int			crc;
+	struct xfs_buf		finobuf;
+	struct xfs_buf		inobuf;
+	ssize_t			len;
+	xfs_extlen_t		nbmblocks;
+	int			nrecs;
+	xfs_alloc_rec_incore_t	recs[2];
+	xfs_alloc_rec_incore_t	rec;
+	int			sectorsize = mp->m_sb.sb_sectsize;
+	struct xfs_buf		sbbuf;
+
+	crc = xfs_sb_version_hascrc(&mp->m_sb);
+	agsize = ai->agsize;
+	if (agno == mp->m_sb.sb_agcount - 1)
+		agsize = ai->dblocks - (xfs_drfsbno_t)(agno * ai->agsize);
+	base = XFS_AG_DADDR(mp, agno, 0);
+	len = XFS_FSB_TO_B(mp, XFS_PREALLOC_BLOCKS(mp));
+	memset(hdrs, 0, len);
+
+	/*
+	 * Superblock.
+	 */
+	agbuf_init(mp, &sbbuf, hdrs, base, XFS_AG_DADDR(mp, agno, XFS_SB_DADDR),
+		   XFS_FSS_TO_BB(mp, 1), &xfs_sb_buf_ops);
+	libxfs_sb_to_disk((void *)XFS_BUF_PTR(&sbbuf), ai->sbp,
+			  XFS_SB_ALL_BITS);
+
+	/*
+	 * Free space: the blocks after the headers and btree roots, less
+	 * the internal log if it is in this AG.
+	 */
+	nrecs = 0;
+	bno = XFS_PREALLOC_BLOCKS(mp);
+	if (ai->loginternal && agno == ai->logagno) {
+		if (ai->lalign) {
+			/*
+			 * Pad record for stripe align of log
+			 */
+			recs[nrecs].ar_startblock = bno;
+			recs[nrecs].ar_blockcount =
+				XFS_FSB_TO_AGBNO(mp, ai->logstart) - bno;
+			nrecs++;
+			bno = XFS_FSB_TO_AGBNO(mp, ai->logstart);
+		}
+		bno += ai->logblocks;
+	}
+	if (bno < agsize) {
+		recs[nrecs].ar_startblock = bno;
+		recs[nrecs].ar_blockcount = agsize - bno;
+		nrecs++;
+	}
+
+	/*
+	 * AG header block: freespace
+	 */
+	agbuf_init(mp, &agfbuf, hdrs, base,
+		   XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
+		   XFS_FSS_TO_BB(mp, 1), &xfs_agf_buf_ops);
+	agf = XFS_BUF_TO_AGF(&agfbuf);
+	agf->agf_magicnum = cpu_to_be32(XFS_AGF_MAGIC);
+	agf->agf_versionnum = cpu_to_be32(XFS_AGF_VERSION);
+	agf->agf_seqno = cpu_to_be32(agno);
+	agf->agf_length = cpu_to_be32(agsize);
+	agf->agf_roots[XFS_BTNUM_BNOi] = cpu_to_be32(XFS_BNO_BLOCK(mp));
+	agf->agf_roots[XFS_BTNUM_CNTi] = cpu_to_be32(XFS_CNT_BLOCK(mp));
+	agf->agf_levels[XFS_BTNUM_BNOi] = cpu_to_be32(1);
+	agf->agf_levels[XFS_BTNUM_CNTi] = cpu_to_be32(1);
+	agf->agf_flfirst = 0;
+	agf->agf_fllast = cpu_to_be32(XFS_AGFL_SIZE(mp) - 1);
+	agf->agf_flcount = 0;
+	nbmblocks = (xfs_extlen_t)(agsize - XFS_PREALLOC_BLOCKS(mp));
+	agf->agf_freeblks = cpu_to_be32(nbmblocks);
+	agf->agf_longest = cpu_to_be32(nbmblocks);
+	if (crc)
+		platform_uuid_copy(&agf->agf_uuid, &mp->m_sb.sb_uuid);
+
+	if (ai->loginternal && agno == ai->logagno) {
+		be32_add_cpu(&agf->agf_freeblks, -ai->logblocks);
+		agf->agf_longest = cpu_to_be32(agsize -
+			XFS_FSB_TO_AGBNO(mp, ai->logstart) - ai->logblocks);
+	}
+
+	/*
+	 * AG freelist header block
+	 */
+	agbuf_init(mp, &agflbuf, hdrs, base,
+		   XFS_AG_DADDR(mp, agno, XFS_AGFL_DADDR(mp)),
+		   XFS_FSS_TO_BB(mp, 1), &xfs_agfl_buf_ops);
+	agfl = XFS_BUF_TO_AGFL(&agflbuf);
+	/* setting to 0xff results in initialisation to NULLAGBLOCK */
+	memset(agfl, 0xff, sectorsize);
+	if (crc) {
+		agfl->agfl_magicnum = cpu_to_be32(XFS_AGFL_MAGIC);
+		agfl->agfl_seqno = cpu_to_be32(agno);
+		platform_uuid_copy(&agfl->agfl_uuid, &mp->m_sb.sb_uuid);
+		for (bucket = 0; bucket < XFS_AGFL_SIZE(mp); bucket++)
+			agfl->agfl_bno[bucket] = cpu_to_be32(NULLAGBLOCK);
+	}
+
+	/*
+	 * Fill the free list now rather than in a transaction per AG once
+	 * the headers have been written.
+	 */
+	agf_fill_freelist(mp, agf, XFS_BUF_TO_AGFL_BNO(mp, &agflbuf),
+			  recs, &nrecs);
+
+	/*
+	 * AG header block: inodes
+	 */
+	agbuf_init(mp, &agibuf, hdrs, base,
+		   XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
+		   XFS_FSS_TO_BB(mp, 1), &xfs_agi_buf_ops);
+	agi = XFS_BUF_TO_AGI(&agibuf);
+	agi->agi_magicnum = cpu_to_be32(XFS_AGI_MAGIC);
+	agi->agi_versionnum = cpu_to_be32(XFS_AGI_VERSION);
+	agi->agi_seqno = cpu_to_be32(agno);
+	agi->agi_length = cpu_to_be32((xfs_agblock_t)agsize);
+	agi->agi_count = 0;
+	agi->agi_root = cpu_to_be32(XFS_IBT_BLOCK(mp));
+	agi->agi_level = cpu_to_be32(1);
+	if (xfs_sb_version_hasfinobt(&mp->m_sb)) {
+		agi->agi_free_root = cpu_to_be32(XFS_FIBT_BLOCK(mp));
+		agi->agi_free_level = cpu_to_be32(1);
+	}
+	agi->agi_freecount = 0;
+	agi->agi_newino = cpu_to_be32(NULLAGINO);
+	agi->agi_dirino = cpu_to_be32(NULLAGINO);
+	if (crc)
+		platform_uuid_copy(&agi->agi_uuid, &mp->m_sb.sb_uuid);
+	for (c = 0; c < XFS_AGI_UNLINKED_BUCKETS; c++)
+		agi->agi_unlinked[c] = cpu_to_be32(NULLAGINO);
+
+	/*
+	 * BNO btree root block
+	 */
+	agbuf_init(mp, &bnobuf, hdrs, base,
+		   XFS_AGB_TO_DADDR(mp, agno, XFS_BNO_BLOCK(mp)),
+		   XFS_FSB_TO_BB(mp, 1), &xfs_allocbt_buf_ops);
+	block = XFS_BUF_TO_BLOCK(&bnobuf);
+	if (crc)
+		xfs_btree_init_block(mp, &bnobuf, XFS_ABTB_CRC_MAGIC, 0, nrecs,
+					agno, XFS_BTREE_CRC_BLOCKS);
+	else
+		xfs_btree_init_block(mp, &bnobuf, XFS_ABTB_MAGIC, 0, nrecs,
+					agno, 0);
+	for (c = 0; c < nrecs; c++) {
+		XFS_ALLOC_REC_ADDR(mp, block, c + 1)->ar_startblock =
+			cpu_to_be32(recs[c].ar_startblock);
+		XFS_ALLOC_REC_ADDR(mp, block, c + 1)->ar_blockcount =
+			cpu_to_be32(recs[c].ar_blockcount);
+	}
+
+	/*
+	 * CNT btree root block, with the records in length order
+	 */
+	if (nrecs == 2 && (recs[0].ar_blockcount > recs[1].ar_blockcount)) {
+		rec = recs[0];
+		recs[0] = recs[1];
+		recs[1] = rec;
+	}
+	agbuf_init(mp, &cntbuf, hdrs, base,
+		   XFS_AGB_TO_DADDR(mp, agno, XFS_CNT_BLOCK(mp)),
+		   XFS_FSB_TO_BB(mp, 1), &xfs_allocbt_buf_ops);
+	block = XFS_BUF_TO_BLOCK(&cntbuf);
+	if (crc)
+		xfs_btree_init_block(mp, &cntbuf, XFS_ABTC_CRC_MAGIC, 0, nrecs,
+					agno, XFS_BTREE_CRC_BLOCKS);
+	else
+		xfs_btree_init_block(mp, &cntbuf, XFS_ABTC_MAGIC, 0, nrecs,
+					agno, 0);
+	for (c = 0; c < nrecs; c++) {
+		XFS_ALLOC_REC_ADDR(mp, block, c + 1)->ar_startblock =
+			cpu_to_be32(recs[c].ar_startblock);
+		XFS_ALLOC_REC_ADDR(mp, block, c + 1)->ar_blockcount =
+			cpu_to_be32(recs[c].ar_blockcount);
+	}
+
+	/*
+	 * INO btree root block
+	 */
+	agbuf_init(mp, &inobuf, hdrs, base,
+		   XFS_AGB_TO_DADDR(mp, agno, XFS_IBT_BLOCK(mp)),
+		   XFS_FSB_TO_BB(mp, 1), &xfs_inobt_buf_ops);
+	if (crc)
+		xfs_btree_init_block(mp, &inobuf, XFS_IBT_CRC_MAGIC, 0, 0,
+					agno, XFS_BTREE_CRC_BLOCKS);
+	else
+		xfs_btree_init_block(mp, &inobuf, XFS_IBT_MAGIC, 0, 0,
+					agno, 0);
+
+	/*
+	 * Free INO btree root block
+	 */
+	if (xfs_sb_version_hasfinobt(&mp->m_sb)) {
+		agbuf_init(mp, &finobuf, hdrs, base,
+			   XFS_AGB_TO_DADDR(mp, agno, XFS_FIBT_BLOCK(mp)),
+			   XFS_FSB_TO_BB(mp, 1), &xfs_inobt_buf_ops);
+		if (crc)
+			xfs_btree_init_block(mp, &finobuf, XFS_FIBT_CRC_MAGIC,
+					0, 0, agno, XFS_BTREE_CRC_BLOCKS);
+		else
+			xfs_btree_init_block(mp, &finobuf, XFS_FIBT_MAGIC,
+					0, 0, agno, 0);
+		agbuf_write_verify(&finobuf);
+	}
+
+	agbuf_write_verify(&sbbuf);
+	agbuf_write_verify(&agfbuf);
+	agbuf_write_verify(&agflbuf);
+	agbuf_write_verify(&agibuf);
+	agbuf_write_verify(&bnobuf);
+	agbuf_write_verify(&cntbuf);
+	agbuf_write_verify(&inobuf);
+
+	if (pwrite64(libxfs_device_to_fd(mp->m_ddev_targp->dev), hdrs, len,
+		     BBTOB(base)) != len) {
+		fprintf(stderr, _("%s: failed to write AG %u headers: %s\n"),
+			progname, agno, strerror(errno));
+		exit(1);
+	}
+}
+
+static void *
+initialise_ag_worker(
+	void			*arg)
+{
+	struct aginit		*ai = arg;
+	xfs_agnumber_t		agno;
+	char			*hdrs;
+	ssize_t			len;
+
+	len = XFS_FSB_TO_B(ai->mp, XFS_PREALLOC_BLOCKS(ai->mp));
+	hdrs = memalign(libxfs_device_alignment(), len);
+	if (hdrs == NULL) {
+		fprintf(stderr, _("%s: can't memalign %d bytes: %s\n"),
+			progname, (int)len, strerror(errno));
+		exit(1);
+	}
+	for (;;) {
+		pthread_mutex_lock(&ai->lock);
+		agno = ai->next++;
+		pthread_mutex_unlock(&ai->lock);
+		if (agno >= ai->mp->m_sb.sb_agcount)
+			break;
+		initialise_ag(ai, agno, hdrs);
+	}
+	free(hdrs);
+	return NULL;
+}
+
+/*
+ * The headers of each AG are a few small writes a long way from the next
+ * AG's, so on a large device the time goes in waiting for each one.  Keep
+ * several in flight by giving the AGs out to more threads than there are
+ * CPUs.
+ */
+static void
+initialise_ags(
+	struct aginit		*ai)
+{
+	int			i;
+	int			nthreads;
+	pthread_t		*threads;
+
+	nthreads = MIN(ai->mp->m_sb.sb_agcount, MIN(4 * platform_nproc(),
+					       MKFS_MAX_AG_THREADS));
+	pthread_mutex_init(&ai->lock, NULL);
+	ai->next = 0;
+	if (nthreads <= 1) {
+		initialise_ag_worker(ai);
+		return;
+	}
+	threads = calloc(nthreads, sizeof(*threads));
+	if (threads == NULL) {
+		fprintf(stderr, _("%s: cannot allocate memory\n"), progname);
+		exit(1);
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, initialise_ag_worker,
+				   ai)) {
+			nthreads = i;
+			break;
+		}
+	}
+	/* if no threads could be started, do the work here */
+	if (nthreads == 0)
+		initialise_ag_worker(ai);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
 int
 main(
 	int			argc,
 	char			**argv)
 {
 	__uint64_t		agcount;
-	xfs_agf_t		*agf;
-	xfs_agi_t		*agi;
-	xfs_agnumber_t		agno;
 	__uint64_t		agsize;
-	xfs_alloc_rec_t		*arec;
+	struct aginit		ai;
 	int			attrversion;
 	int			projid16bit;
-	struct xfs_btree_block	*block;
 	int			blflag;
 	int			blocklog;
 	unsigned int		blocksize;
@@ -961,7 +1387,6 @@ main(
 	int			nlflag;
 	int			nodsflag;
 	int			norsflag;
-	xfs_alloc_rec_t		*nrec;
 	int			nftype;
 	int			nsflag;
 	int			nvflag;
@@ -986,7 +1411,6 @@ main(
 	int			ssflag;
 	__uint64_t		tmp_agsize;
 	uuid_t			uuid;
-	int			worst_freelist;
 	libxfs_init_t		xi;
 	struct fs_topology	ft;
 	int			lazy_sb_counters;
@@ -1022,7 +1446,6 @@ main(
 	dsu = dsw = dsunit = dswidth = lalign = lsu = lsunit = 0;
 	nodsflag = norsflag = 0;
 	force_overwrite = 0;
-	worst_freelist = 0;
 	lazy_sb_counters = 1;
 	crcs_enabled = 0;
 	finobt = 0;
@@ -2688,7 +3111,7 @@ _("size %s specified for log subvolume is too large, maximum is %lld blocks\n"),
 	libxfs_log_clear(mp->m_logdev_targp,
 		XFS_FSB_TO_DADDR(mp, logstart),
 		(xfs_extlen_t)XFS_FSB_TO_BB(mp, logblocks),
-		&sbp->sb_uuid, logversion, lsunit, XLOG_FMT);
+		&sbp->sb_uuid, logversion, lsunit, XLOG_FMT, XLOG_INIT_CYCLE);
 
 	mp = libxfs_mount(mp, sbp, xi.ddev, xi.logdev, xi.rtdev, 0);
 	if (mp == NULL) {
@@ -2697,249 +3120,16 @@ _("size %s specified for log subvolume is too large, maximum is %lld blocks\n"),
 		exit(1);
 	}
 
-	/*
-	 * XXX: this code is effectively shared with the kernel growfs code.
-	 * These initialisations should be pulled into libxfs to keep the
-	 * kernel/userspace header initialisation code the same.
-	 */
-	for (agno = 0; agno < agcount; agno++) {
-		struct xfs_agfl	*agfl;
-		int		bucket;
-
-		/*
-		 * Superblock.
-		 */
-		buf = libxfs_getbuf(mp->m_ddev_targp,
-				XFS_AG_DADDR(mp, agno, XFS_SB_DADDR),
-				XFS_FSS_TO_BB(mp, 1));
-		buf->b_ops = &xfs_sb_buf_ops;
-		memset(XFS_BUF_PTR(buf), 0, sectorsize);
-		libxfs_sb_to_disk((void *)XFS_BUF_PTR(buf), sbp, XFS_SB_ALL_BITS);
-		libxfs_writebuf(buf, LIBXFS_EXIT_ON_FAILURE);
-
-		/*
-		 * AG header block: freespace
-		 */
-		buf = libxfs_getbuf(mp->m_ddev_targp,
-				XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
-				XFS_FSS_TO_BB(mp, 1));
-		buf->b_ops = &xfs_agf_buf_ops;
-		agf = XFS_BUF_TO_AGF(buf);
-		memset(agf, 0, sectorsize);
-		if (agno == agcount - 1)
-			agsize = dblocks - (xfs_drfsbno_t)(agno * agsize);
-		agf->agf_magicnum = cpu_to_be32(XFS_AGF_MAGIC);
-		agf->agf_versionnum = cpu_to_be32(XFS_AGF_VERSION);
-		agf->agf_seqno = cpu_to_be32(agno);
-		agf->agf_length = cpu_to_be32(agsize);
-		agf->agf_roots[XFS_BTNUM_BNOi] = cpu_to_be32(XFS_BNO_BLOCK(mp));
-		agf->agf_roots[XFS_BTNUM_CNTi] = cpu_to_be32(XFS_CNT_BLOCK(mp));
-		agf->agf_levels[XFS_BTNUM_BNOi] = cpu_to_be32(1);
-		agf->agf_levels[XFS_BTNUM_CNTi] = cpu_to_be32(1);
-		agf->agf_flfirst = 0;
-		agf->agf_fllast = cpu_to_be32(XFS_AGFL_SIZE(mp) - 1);
-		agf->agf_flcount = 0;
-		nbmblocks = (xfs_extlen_t)(agsize - XFS_PREALLOC_BLOCKS(mp));
-		agf->agf_freeblks = cpu_to_be32(nbmblocks);
-		agf->agf_longest = cpu_to_be32(nbmblocks);
-		if (xfs_sb_version_hascrc(&mp->m_sb))
-			platform_uuid_copy(&agf->agf_uuid, &mp->m_sb.sb_uuid);
-
-		if (loginternal && agno == logagno) {
-			be32_add_cpu(&agf->agf_freeblks, -logblocks);
-			agf->agf_longest = cpu_to_be32(agsize -
-				XFS_FSB_TO_AGBNO(mp, logstart) - logblocks);
-		}
-		if (XFS_MIN_FREELIST(agf, mp) > worst_freelist)
-			worst_freelist = XFS_MIN_FREELIST(agf, mp);
-		libxfs_writebuf(buf, LIBXFS_EXIT_ON_FAILURE);
-
-		/*
-		 * AG freelist header block
-		 */
-		buf = libxfs_getbuf(mp->m_ddev_targp,
-				XFS_AG_DADDR(mp, agno, XFS_AGFL_DADDR(mp)),
-				XFS_FSS_TO_BB(mp, 1));
-		buf->b_ops = &xfs_agfl_buf_ops;
-		agfl = XFS_BUF_TO_AGFL(buf);
-		/* setting to 0xff results in initialisation to NULLAGBLOCK */
-		memset(agfl, 0xff, sectorsize);
-		if (xfs_sb_version_hascrc(&mp->m_sb)) {
-			agfl->agfl_magicnum = cpu_to_be32(XFS_AGFL_MAGIC);
-			agfl->agfl_seqno = cpu_to_be32(agno);
-			platform_uuid_copy(&agfl->agfl_uuid, &mp->m_sb.sb_uuid);
-			for (bucket = 0; bucket < XFS_AGFL_SIZE(mp); bucket++)
-				agfl->agfl_bno[bucket] = cpu_to_be32(NULLAGBLOCK);
-		}
-
-		libxfs_writebuf(buf, LIBXFS_EXIT_ON_FAILURE);
-
-		/*
-		 * AG header block: inodes
-		 */
-		buf = libxfs_getbuf(mp->m_ddev_targp,
-				XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
-				XFS_FSS_TO_BB(mp, 1));
-		agi = XFS_BUF_TO_AGI(buf);
-		buf->b_ops = &xfs_agi_buf_ops;
-		memset(agi, 0, sectorsize);
-		agi->agi_magicnum = cpu_to_be32(XFS_AGI_MAGIC);
-		agi->agi_versionnum = cpu_to_be32(XFS_AGI_VERSION);
-		agi->agi_seqno = cpu_to_be32(agno);
-		agi->agi_length = cpu_to_be32((xfs_agblock_t)agsize);
-		agi->agi_count = 0;
-		agi->agi_root = cpu_to_be32(XFS_IBT_BLOCK(mp));
-		agi->agi_level = cpu_to_be32(1);
-		if (finobt) {
-			agi->agi_free_root = cpu_to_be32(XFS_FIBT_BLOCK(mp));
-			agi->agi_free_level = cpu_to_be32(1);
-		}
-		agi->agi_freecount = 0;
-		agi->agi_newino = cpu_to_be32(NULLAGINO);
-		agi->agi_dirino = cpu_to_be32(NULLAGINO);
-		if (xfs_sb_version_hascrc(&mp->m_sb))
-			platform_uuid_copy(&agi->agi_uuid, &mp->m_sb.sb_uuid);
-		for (c = 0; c < XFS_AGI_UNLINKED_BUCKETS; c++)
-			agi->agi_unlinked[c] = cpu_to_be32(NULLAGINO);
-		libxfs_writebuf(buf, LIBXFS_EXIT_ON_FAILURE);
-
-		/*
-		 * BNO btree root block
-		 */
-		buf = libxfs_getbuf(mp->m_ddev_targp,
-				XFS_AGB_TO_DADDR(mp, agno, XFS_BNO_BLOCK(mp)),
-				bsize);
-		buf->b_ops = &xfs_allocbt_buf_ops;
-		block = XFS_BUF_TO_BLOCK(buf);
-		memset(block, 0, blocksize);
-		if (xfs_sb_version_hascrc(&mp->m_sb))
-			xfs_btree_init_block(mp, buf, XFS_ABTB_CRC_MAGIC, 0, 1,
-						agno, XFS_BTREE_CRC_BLOCKS);
-		else
-			xfs_btree_init_block(mp, buf, XFS_ABTB_MAGIC, 0, 1,
-						agno, 0);
-
-		arec = XFS_ALLOC_REC_ADDR(mp, block, 1);
-		arec->ar_startblock = cpu_to_be32(XFS_PREALLOC_BLOCKS(mp));
-		if (loginternal && agno == logagno) {
-			if (lalign) {
-				/*
-				 * Have to insert two records
-				 * Insert pad record for stripe align of log
-				 */
-				arec->ar_blockcount = cpu_to_be32(
-					XFS_FSB_TO_AGBNO(mp, logstart) -
-					be32_to_cpu(arec->ar_startblock));
-				nrec = arec + 1;
-				/*
-				 * Insert record at start of internal log
-				 */
-				nrec->ar_startblock = cpu_to_be32(
-					be32_to_cpu(arec->ar_startblock) +
-					be32_to_cpu(arec->ar_blockcount));
-				arec = nrec;
-				be16_add_cpu(&block->bb_numrecs, 1);
-			}
-			/*
-			 * Change record start to after the internal log
-			 */
-			be32_add_cpu(&arec->ar_startblock, logblocks);
-		}
-		/*
-		 * Calculate the record block count and check for the case where
-		 * the log might have consumed all available space in the AG. If
-		 * so, reset the record count to 0 to avoid exposure of an invalid
-		 * record start block.
-		 */
-		arec->ar_blockcount = cpu_to_be32(agsize - 
-					be32_to_cpu(arec->ar_startblock));
-		if (!arec->ar_blockcount)
-			block->bb_numrecs = 0;
-
-		libxfs_writebuf(buf, LIBXFS_EXIT_ON_FAILURE);
-
-		/*
-		 * CNT btree root block
-		 */
-		buf = libxfs_getbuf(mp->m_ddev_targp,
-				XFS_AGB_TO_DADDR(mp, agno, XFS_CNT_BLOCK(mp)),
-				bsize);
-		buf->b_ops = &xfs_allocbt_buf_ops;
-		block = XFS_BUF_TO_BLOCK(buf);
-		memset(block, 0, blocksize);
-		if (xfs_sb_version_hascrc(&mp->m_sb))
-			xfs_btree_init_block(mp, buf, XFS_ABTC_CRC_MAGIC, 0, 1,
-						agno, XFS_BTREE_CRC_BLOCKS);
-		else
-			xfs_btree_init_block(mp, buf, XFS_ABTC_MAGIC, 0, 1,
-						agno, 0);
-
-		arec = XFS_ALLOC_REC_ADDR(mp, block, 1);
-		arec->ar_startblock = cpu_to_be32(XFS_PREALLOC_BLOCKS(mp));
-		if (loginternal && agno == logagno) {
-			if (lalign) {
-				arec->ar_blockcount = cpu_to_be32(
-					XFS_FSB_TO_AGBNO(mp, logstart) -
-					be32_to_cpu(arec->ar_startblock));
-				nrec = arec + 1;
-				nrec->ar_startblock = cpu_to_be32(
-					be32_to_cpu(arec->ar_startblock) +
-					be32_to_cpu(arec->ar_blockcount));
-				arec = nrec;
-				be16_add_cpu(&block->bb_numrecs, 1);
-			}
-			be32_add_cpu(&arec->ar_startblock, logblocks);
-		}
-		/*
-		 * Calculate the record block count and check for the case where
-		 * the log might have consumed all available space in the AG. If
-		 * so, reset the record count to 0 to avoid exposure of an invalid
-		 * record start block.
-		 */
-		arec->ar_blockcount = cpu_to_be32(agsize - 
-					be32_to_cpu(arec->ar_startblock));
-		if (!arec->ar_blockcount)
-			block->bb_numrecs = 0;
-
-		libxfs_writebuf(buf, LIBXFS_EXIT_ON_FAILURE);
-
-		/*
-		 * INO btree root block
-		 */
-		buf = libxfs_getbuf(mp->m_ddev_targp,
-				XFS_AGB_TO_DADDR(mp, agno, XFS_IBT_BLOCK(mp)),
-				bsize);
-		buf->b_ops = &xfs_inobt_buf_ops;
-		block = XFS_BUF_TO_BLOCK(buf);
-		memset(block, 0, blocksize);
-		if (xfs_sb_version_hascrc(&mp->m_sb))
-			xfs_btree_init_block(mp, buf, XFS_IBT_CRC_MAGIC, 0, 0,
-						agno, XFS_BTREE_CRC_BLOCKS);
-		else
-			xfs_btree_init_block(mp, buf, XFS_IBT_MAGIC, 0, 0,
-						agno, 0);
-		libxfs_writebuf(buf, LIBXFS_EXIT_ON_FAILURE);
-
-		/*
-		 * Free INO btree root block
-		 */
-		if (!finobt)
-			continue;
-
-		buf = libxfs_getbuf(mp->m_ddev_targp,
-				XFS_AGB_TO_DADDR(mp, agno, XFS_FIBT_BLOCK(mp)),
-				bsize);
-		buf->b_ops = &xfs_inobt_buf_ops;
-		block = XFS_BUF_TO_BLOCK(buf);
-		memset(block, 0, blocksize);
-		if (xfs_sb_version_hascrc(&mp->m_sb))
-			xfs_btree_init_block(mp, buf, XFS_FIBT_CRC_MAGIC, 0, 0,
-						agno, XFS_BTREE_CRC_BLOCKS);
-		else
-			xfs_btree_init_block(mp, buf, XFS_FIBT_MAGIC, 0, 0,
-						agno, 0);
-		libxfs_writebuf(buf, LIBXFS_EXIT_ON_FAILURE);
-	}
+	ai.mp = mp;
+	ai.sbp = sbp;
+	ai.dblocks = dblocks;
+	ai.agsize = agsize;
+	ai.loginternal = loginternal;
+	ai.logagno = logagno;
+	ai.logstart = logstart;
+	ai.logblocks = logblocks;
+	ai.lalign = lalign;
+	initialise_ags(&ai);
 
 	/*
 	 * Touch last block, make fs the right size if it's a file.
@@ -2959,29 +3149,6 @@ _("size %s specified for log subvolume is too large, maximum is %lld blocks\n"),
 		libxfs_writebuf(buf, LIBXFS_EXIT_ON_FAILURE);
 	}
 
-	/*
-	 * BNO, CNT free block list
-	 */
-	for (agno = 0; agno < agcount; agno++) {
-		xfs_alloc_arg_t	args;
-		xfs_trans_t	*tp;
-		struct xfs_trans_res tres = {0};
-
-		memset(&args, 0, sizeof(args));
-		args.tp = tp = libxfs_trans_alloc(mp, 0);
-		args.mp = mp;
-		args.agno = agno;
-		args.alignment = 1;
-		args.pag = xfs_perag_get(mp,agno);
-		c = libxfs_trans_reserve(tp, &tres, worst_freelist, 0);
-		if (c)
-			res_failed(c);
-
-		libxfs_alloc_fix_freelist(&args, 0);
-		xfs_perag_put(args.pag);
-		libxfs_trans_commit(tp, 0);
-	}
-
 	/*
 	 * Allocate the root inode and anything else in the proto file.
 	 */
@@ -0,0 +1,1432 @@
+/*
+ * Copyright (c) 2000-2006 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <xfs/libxlog.h>
+#include "btree.h"
+#include "globals.h"
+#include "protos.h"
+#include "err_protos.h"
+
+/*
+ * Userspace log replay.
+ *
+ * libxlog parses the log from tail to head once and hands us each
+ * committed transaction, in commit order, once per pass.  Pass 1 only
+ * builds the buffer cancellation table.  Pass 2 replays buffer, inode and
+ * inode create items into the buffer cache, skipping anything that was
+ * cancelled later in the log.
+ *
+ * Every buffer a transaction touches is read up front in daddr order and
+ * held until the next flush, so a buffer modified by many transactions is
+ * only read and written once.  Flushes write the held buffers back in
+ * daddr order.
+ *
+ * Dquot items are replayed into their buffers unless quotas are off or a
+ * later quotaoff throws them away.  Extent free intents that never saw
+ * their done item are finished once everything else is on disk, as log
+ * recovery in the kernel does.  Unlinked inodes are left to the rest of
+ * xfs_repair, which deals with them itself.
+ */
+
+/* flush once this many buffers are held */
+#define XLOG_REPLAY_MAX_HELD	2048
+
+struct xlog_buf_cancel {
+	struct list_head	bc_list;
+	xfs_daddr_t		bc_blkno;
+	uint			bc_len;
+	int			bc_refcount;
+};
+
+#define XLOG_BUF_CANCEL_BUCKET(blkno) \
+	(&buf_cancel_table[(__uint64_t)(blkno) % XLOG_BC_TABLE_SIZE])
+
+static struct list_head		buf_cancel_table[XLOG_BC_TABLE_SIZE];
+
+/* held buffers, keyed by daddr */
+static struct btree_root	*held_bufs;
+static int			nheld;
+static int			sb_replayed;
+
+/* dquot types turned off somewhere in the log, found in pass 1 */
+static uint			quotaoffs;
+
+/* extent free intents without a done item yet */
+struct xlog_efi {
+	struct list_head	efi_list;
+	__uint64_t		efi_id;
+	uint			efi_nextents;
+	xfs_extent_t		efi_extents[0];
+};
+
+static struct list_head		efi_list;
+
+static struct {
+	__uint64_t		trans;
+	__uint64_t		bufs;
+	__uint64_t		inodes;
+	__uint64_t		icreates;
+	__uint64_t		dquots;
+	__uint64_t		efis;
+	__uint64_t		cancelled;
+	__uint64_t		skipped;
+	__uint64_t		writes;
+} rstats;
+
+static struct xlog_buf_cancel *
+xlog_find_buffer_cancelled(
+	xfs_daddr_t		blkno,
+	uint			len)
+{
+	struct list_head	*bucket = XLOG_BUF_CANCEL_BUCKET(blkno);
+	struct xlog_buf_cancel	*bcp;
+
+	list_for_each_entry(bcp, bucket, bc_list) {
+		if (bcp->bc_blkno == blkno && bcp->bc_len == len)
+			return bcp;
+	}
+	return NULL;
+}
+
+/*
+ * Pass 1: count the cancel records for each buffer.  Pass 2 then skips
+ * the buffer until it has seen the last of them.
+ */
+static void
+xlog_recover_buffer_pass1(
+	xfs_buf_log_format_t	*buf_f)
+{
+	struct xlog_buf_cancel	*bcp;
+
+	if (!(buf_f->blf_flags & XFS_BLF_CANCEL))
+		return;
+
+	bcp = xlog_find_buffer_cancelled(buf_f->blf_blkno, buf_f->blf_len);
+	if (bcp) {
+		bcp->bc_refcount++;
+		return;
+	}
+
+	bcp = malloc(sizeof(*bcp));
+	if (!bcp)
+		do_error(_("couldn't allocate log buffer cancel record\n"));
+	bcp->bc_blkno = buf_f->blf_blkno;
+	bcp->bc_len = buf_f->blf_len;
+	bcp->bc_refcount = 1;
+	list_add_tail(&bcp->bc_list, XLOG_BUF_CANCEL_BUCKET(bcp->bc_blkno));
+}
+
+/*
+ * Is this buffer cancelled by a later transaction?  Passing XFS_BLF_CANCEL
+ * in flags consumes one cancel record, the last of which removes the
+ * buffer from the table so that later uses of it are replayed.
+ */
+static int
+xlog_check_buffer_cancelled(
+	xfs_daddr_t		blkno,
+	uint			len,
+	ushort			flags)
+{
+	struct xlog_buf_cancel	*bcp;
+
+	bcp = xlog_find_buffer_cancelled(blkno, len);
+	if (!bcp)
+		return 0;
+
+	if (flags & XFS_BLF_CANCEL) {
+		if (--bcp->bc_refcount == 0) {
+			list_del(&bcp->bc_list);
+			free(bcp);
+		}
+	}
+	return 1;
+}
+
+/*
+ * Work out the verifier for a replayed buffer so that the write path
+ * recalculates its CRC.  Buffers we can't identify are written as is.
+ */
+static const struct xfs_buf_ops *
+xlog_recover_buf_ops(
+	struct xfs_mount	*mp,
+	struct xfs_buf		*bp,
+	xfs_buf_log_format_t	*buf_f)
+{
+	__uint32_t		magic32;
+
+	if (!xfs_sb_version_hascrc(&mp->m_sb))
+		return NULL;
+
+	magic32 = be32_to_cpu(*(__be32 *)bp->b_addr);
+	switch (xfs_blft_from_flags(buf_f)) {
+	case XFS_BLFT_BTREE_BUF:
+		switch (magic32) {
+		case XFS_ABTB_CRC_MAGIC:
+		case XFS_ABTC_CRC_MAGIC:
+			return &xfs_allocbt_buf_ops;
+		case XFS_IBT_CRC_MAGIC:
+		case XFS_FIBT_CRC_MAGIC:
+			return &xfs_inobt_buf_ops;
+		case XFS_BMAP_CRC_MAGIC:
+			return &xfs_bmbt_buf_ops;
+		}
+		return NULL;
+	case XFS_BLFT_AGF_BUF:
+		return &xfs_agf_buf_ops;
+	case XFS_BLFT_AGFL_BUF:
+		return &xfs_agfl_buf_ops;
+	case XFS_BLFT_AGI_BUF:
+		return &xfs_agi_buf_ops;
+	case XFS_BLFT_DINO_BUF:
+		return &xfs_inode_buf_ops;
+	case XFS_BLFT_SYMLINK_BUF:
+		return &xfs_symlink_buf_ops;
+	case XFS_BLFT_DIR_BLOCK_BUF:
+		return &xfs_dir3_block_buf_ops;
+	case XFS_BLFT_DIR_DATA_BUF:
+		return &xfs_dir3_data_buf_ops;
+	case XFS_BLFT_DIR_FREE_BUF:
+		return &xfs_dir3_free_buf_ops;
+	case XFS_BLFT_DIR_LEAF1_BUF:
+		return &xfs_dir3_leaf1_buf_ops;
+	case XFS_BLFT_DIR_LEAFN_BUF:
+		return &xfs_dir3_leafn_buf_ops;
+	case XFS_BLFT_DA_NODE_BUF:
+		return &xfs_da3_node_buf_ops;
+	case XFS_BLFT_ATTR_LEAF_BUF:
+		return &xfs_attr3_leaf_buf_ops;
+	case XFS_BLFT_ATTR_RMT_BUF:
+		return &xfs_attr3_rmt_buf_ops;
+	case XFS_BLFT_SB_BUF:
+		return &xfs_sb_buf_ops;
+	}
+	return NULL;
+}
+
+/*
+ * v5 metadata records the LSN of its last write.  If that is at or beyond
+ * the transaction being replayed, the block was written back after this
+ * change was logged and replaying it would roll the block backwards.
+ * Returns -1 for anything we can't date (v4, inode and dquot buffers,
+ * which are checked per object, and blocks from another filesystem).
+ */
+static xfs_lsn_t
+xlog_recover_get_buf_lsn(
+	struct xfs_mount	*mp,
+	struct xfs_buf		*bp)
+{
+	void			*blk = bp->b_addr;
+	uuid_t			*uuid = NULL;
+	xfs_lsn_t		lsn = -1;
+
+	if (!xfs_sb_version_hascrc(&mp->m_sb))
+		return -1;
+
+	switch (be32_to_cpu(*(__be32 *)blk)) {
+	case XFS_ABTB_CRC_MAGIC:
+	case XFS_ABTC_CRC_MAGIC:
+	case XFS_IBT_CRC_MAGIC:
+	case XFS_FIBT_CRC_MAGIC: {
+		struct xfs_btree_block *btb = blk;
+
+		lsn = be64_to_cpu(btb->bb_u.s.bb_lsn);
+		uuid = &btb->bb_u.s.bb_uuid;
+		break;
+	}
+	case XFS_BMAP_CRC_MAGIC: {
+		struct xfs_btree_block *btb = blk;
+
+		lsn = be64_to_cpu(btb->bb_u.l.bb_lsn);
+		uuid = &btb->bb_u.l.bb_uuid;
+		break;
+	}
+	case XFS_AGF_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_agf *)blk)->agf_lsn);
+		uuid = &((struct xfs_agf *)blk)->agf_uuid;
+		break;
+	case XFS_AGFL_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_agfl *)blk)->agfl_lsn);
+		uuid = &((struct xfs_agfl *)blk)->agfl_uuid;
+		break;
+	case XFS_AGI_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_agi *)blk)->agi_lsn);
+		uuid = &((struct xfs_agi *)blk)->agi_uuid;
+		break;
+	case XFS_SYMLINK_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_dsymlink_hdr *)blk)->sl_lsn);
+		uuid = &((struct xfs_dsymlink_hdr *)blk)->sl_uuid;
+		break;
+	case XFS_DIR3_BLOCK_MAGIC:
+	case XFS_DIR3_DATA_MAGIC:
+	case XFS_DIR3_FREE_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_dir3_blk_hdr *)blk)->lsn);
+		uuid = &((struct xfs_dir3_blk_hdr *)blk)->uuid;
+		break;
+	case XFS_ATTR3_RMT_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_attr3_rmt_hdr *)blk)->rm_lsn);
+		uuid = &((struct xfs_attr3_rmt_hdr *)blk)->rm_uuid;
+		break;
+	case XFS_SB_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_dsb *)blk)->sb_lsn);
+		uuid = &((struct xfs_dsb *)blk)->sb_uuid;
+		break;
+	}
+
+	if (!uuid) {
+		switch (be16_to_cpu(((struct xfs_da_blkinfo *)blk)->magic)) {
+		case XFS_DIR3_LEAF1_MAGIC:
+		case XFS_DIR3_LEAFN_MAGIC:
+		case XFS_DA3_NODE_MAGIC:
+		case XFS_ATTR3_LEAF_MAGIC:
+			lsn = be64_to_cpu(((struct xfs_da3_blkinfo *)blk)->lsn);
+			uuid = &((struct xfs_da3_blkinfo *)blk)->uuid;
+			break;
+		}
+	}
+
+	if (!uuid || platform_uuid_compare(uuid, &mp->m_sb.sb_uuid))
+		return -1;
+	return lsn;
+}
+
+/*
+ * Write back everything we hold, in daddr order.  A buffer that fails its
+ * write verifier is still written - without the CRC update - as the log
+ * says that is what belongs there; the rest of repair will sort it out.
+ */
+static int
+xlog_replay_flush(void)
+{
+	struct xfs_buf		*bp;
+	unsigned long		key;
+	int			error = 0;
+
+	for (bp = btree_find(held_bufs, 0, &key); bp;
+	     bp = btree_lookup_next(held_bufs, &key)) {
+		if (bp->b_flags & LIBXFS_B_DIRTY) {
+			if (libxfs_writebufr(bp) && bp->b_ops) {
+				do_warn(
+	_("replayed buffer at daddr %" PRIu64 " failed verification\n"),
+					(__uint64_t)bp->b_bn);
+				bp->b_ops = NULL;
+				libxfs_writebufr(bp);
+			}
+			if (bp->b_error && !error)
+				error = bp->b_error;
+			rstats.writes++;
+		}
+		libxfs_putbuf(bp);
+	}
+	btree_clear(held_bufs);
+	nheld = 0;
+	return error;
+}
+
+/*
+ * Find or read a buffer to replay into and hold it until the next flush.
+ * The same daddr can come back with a different length once the blocks
+ * are freed and reused, so flush everything before picking up the new
+ * shape rather than let the cache purge a buffer we still hold.
+ */
+static struct xfs_buf *
+xlog_replay_get_buf(
+	struct xfs_mount	*mp,
+	xfs_daddr_t		blkno,
+	int			len)
+{
+	struct xfs_buf		*bp;
+
+	bp = btree_lookup(held_bufs, blkno);
+	if (bp) {
+		if (bp->b_length == len)
+			return bp;
+		if (xlog_replay_flush())
+			return NULL;
+	}
+
+	bp = libxfs_readbuf(mp->m_ddev_targp, blkno, len, 0, NULL);
+	if (!bp)
+		return NULL;
+	if (bp->b_error) {
+		do_warn(_("couldn't read daddr %" PRId64 " for log replay\n"),
+			blkno);
+		libxfs_putbuf(bp);
+		return NULL;
+	}
+	btree_insert(held_bufs, blkno, bp);
+	nheld++;
+	return bp;
+}
+
+/*
+ * Sort the items in a transaction the way the kernel does: buffers first,
+ * then inodes, then inode buffers, then cancellations.  Inode buffers carry
+ * di_next_unlinked updates, which must not be overwritten by the older
+ * copy of the inode core in an inode item.
+ */
+static void
+xlog_recover_reorder_trans(
+	struct xlog_recover	*trans)
+{
+	xlog_recover_item_t	*item, *n;
+	xfs_buf_log_format_t	*buf_f;
+	LIST_HEAD(sort_list);
+	LIST_HEAD(cancel_list);
+	LIST_HEAD(buffer_list);
+	LIST_HEAD(inode_buffer_list);
+	LIST_HEAD(inode_list);
+
+	list_splice_init(&trans->r_itemq, &sort_list);
+	list_for_each_entry_safe(item, n, &sort_list, ri_list) {
+		switch (ITEM_TYPE(item)) {
+		case XFS_LI_ICREATE:
+			list_move_tail(&item->ri_list, &buffer_list);
+			break;
+		case XFS_LI_BUF:
+			buf_f = item->ri_buf[0].i_addr;
+			if (buf_f->blf_flags & XFS_BLF_CANCEL)
+				list_move(&item->ri_list, &cancel_list);
+			else if (buf_f->blf_flags & XFS_BLF_INODE_BUF)
+				list_move(&item->ri_list, &inode_buffer_list);
+			else
+				list_move_tail(&item->ri_list, &buffer_list);
+			break;
+		default:
+			list_move_tail(&item->ri_list, &inode_list);
+			break;
+		}
+	}
+	list_splice(&cancel_list, &trans->r_itemq);
+	list_splice(&inode_buffer_list, &trans->r_itemq);
+	list_splice(&inode_list, &trans->r_itemq);
+	list_splice(&buffer_list, &trans->r_itemq);
+}
+
+/*
+ * Inode log formats are laid out differently by 32 and 64 bit kernels;
+ * unpack whichever one this is.
+ */
+static int
+xlog_recover_inode_format(
+	xfs_log_iovec_t			*iov,
+	xfs_inode_log_format_t		*in_f)
+{
+	xfs_inode_log_format_32_t	*in_f32;
+	xfs_inode_log_format_64_t	*in_f64;
+
+	if (iov->i_len == sizeof(xfs_inode_log_format_t)) {
+		memcpy(in_f, iov->i_addr, sizeof(*in_f));
+		return 0;
+	}
+	if (iov->i_len == sizeof(xfs_inode_log_format_32_t)) {
+		in_f32 = iov->i_addr;
+		in_f->ilf_type = in_f32->ilf_type;
+		in_f->ilf_size = in_f32->ilf_size;
+		in_f->ilf_fields = in_f32->ilf_fields;
+		in_f->ilf_asize = in_f32->ilf_asize;
+		in_f->ilf_dsize = in_f32->ilf_dsize;
+		in_f->ilf_ino = in_f32->ilf_ino;
+		memcpy(&in_f->ilf_u, &in_f32->ilf_u, sizeof(in_f->ilf_u));
+		in_f->ilf_blkno = in_f32->ilf_blkno;
+		in_f->ilf_len = in_f32->ilf_len;
+		in_f->ilf_boffset = in_f32->ilf_boffset;
+		return 0;
+	}
+	if (iov->i_len == sizeof(xfs_inode_log_format_64_t)) {
+		in_f64 = iov->i_addr;
+		in_f->ilf_type = in_f64->ilf_type;
+		in_f->ilf_size = in_f64->ilf_size;
+		in_f->ilf_fields = in_f64->ilf_fields;
+		in_f->ilf_asize = in_f64->ilf_asize;
+		in_f->ilf_dsize = in_f64->ilf_dsize;
+		in_f->ilf_ino = in_f64->ilf_ino;
+		memcpy(&in_f->ilf_u, &in_f64->ilf_u, sizeof(in_f->ilf_u));
+		in_f->ilf_blkno = in_f64->ilf_blkno;
+		in_f->ilf_len = in_f64->ilf_len;
+		in_f->ilf_boffset = in_f64->ilf_boffset;
+		return 0;
+	}
+	return EFSCORRUPTED;
+}
+
+/*
+ * Pick up all the buffers this transaction touches in one sorted sweep
+ * before replaying any of it, so that the reads go out in disk order.
+ */
+struct xlog_ra {
+	xfs_daddr_t		blkno;
+	int			len;
+};
+
+static int
+xlog_ra_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct xlog_ra	*ra = a;
+	const struct xlog_ra	*rb = b;
+
+	if (ra->blkno != rb->blkno)
+		return ra->blkno < rb->blkno ? -1 : 1;
+	return ra->len - rb->len;
+}
+
+static void
+xlog_recover_readahead(
+	struct xfs_mount	*mp,
+	struct xlog_recover	*trans)
+{
+	xlog_recover_item_t	*item;
+	xfs_buf_log_format_t	*buf_f;
+	xfs_inode_log_format_t	in_f;
+	xfs_dq_logformat_t	*dq_f;
+	struct xlog_ra		*ra;
+	int			nra = 0;
+	int			i;
+
+	list_for_each_entry(item, &trans->r_itemq, ri_list)
+		nra++;
+	ra = malloc(nra * sizeof(*ra));
+	if (!ra)
+		return;
+
+	nra = 0;
+	list_for_each_entry(item, &trans->r_itemq, ri_list) {
+		switch (ITEM_TYPE(item)) {
+		case XFS_LI_BUF:
+			buf_f = item->ri_buf[0].i_addr;
+			if (buf_f->blf_flags & XFS_BLF_CANCEL)
+				continue;
+			ra[nra].blkno = buf_f->blf_blkno;
+			ra[nra].len = buf_f->blf_len;
+			break;
+		case XFS_LI_INODE:
+			if (xlog_recover_inode_format(&item->ri_buf[0], &in_f))
+				continue;
+			ra[nra].blkno = in_f.ilf_blkno;
+			ra[nra].len = in_f.ilf_len;
+			break;
+		case XFS_LI_DQUOT:
+			if (!mp->m_sb.sb_qflags ||
+			    item->ri_buf[0].i_len < sizeof(xfs_dq_logformat_t))
+				continue;
+			dq_f = item->ri_buf[0].i_addr;
+			ra[nra].blkno = dq_f->qlf_blkno;
+			ra[nra].len = XFS_FSB_TO_BB(mp, dq_f->qlf_len);
+			break;
+		default:
+			continue;
+		}
+		if (!xlog_find_buffer_cancelled(ra[nra].blkno, ra[nra].len))
+			nra++;
+	}
+
+	qsort(ra, nra, sizeof(*ra), xlog_ra_cmp);
+	for (i = 0; i < nra; i++) {
+		if (i && ra[i].blkno == ra[i - 1].blkno &&
+		    ra[i].len == ra[i - 1].len)
+			continue;
+		xlog_replay_get_buf(mp, ra[i].blkno, ra[i].len);
+	}
+	free(ra);
+}
+
+/*
+ * Walk the dirty chunk bitmap of a buffer log item.  The map is at most
+ * a few hundred bits, so there's no point being clever.
+ */
+static int
+xlog_next_bit(
+	uint			*map,
+	uint			size,
+	uint			start_bit)
+{
+	uint			bit;
+
+	for (bit = start_bit; bit < size * NBWORD; bit++) {
+		if (map[bit / NBWORD] & (1U << (bit % NBWORD)))
+			return bit;
+	}
+	return -1;
+}
+
+static int
+xlog_contig_bits(
+	uint			*map,
+	uint			size,
+	uint			start_bit)
+{
+	uint			bit;
+
+	for (bit = start_bit; bit < size * NBWORD; bit++) {
+		if (!(map[bit / NBWORD] & (1U << (bit % NBWORD))))
+			break;
+	}
+	return bit - start_bit;
+}
+
+/*
+ * Inode buffers are logged only for their unlinked list pointers; the
+ * inodes themselves come from inode items.  Copy just the pointers that
+ * fall in logged regions.
+ */
+static int
+xlog_recover_do_inode_buffer(
+	struct xfs_mount	*mp,
+	xlog_recover_item_t	*item,
+	struct xfs_buf		*bp,
+	xfs_buf_log_format_t	*buf_f)
+{
+	int			i;
+	int			item_index = 0;
+	int			bit = 0;
+	int			nbits = 0;
+	int			reg_buf_offset = 0;
+	int			reg_buf_bytes = 0;
+	int			next_unlinked_offset;
+	int			inodes_per_buf;
+	xfs_agino_t		*logged_nextp;
+	xfs_agino_t		*buffer_nextp;
+
+	inodes_per_buf = BBTOB(bp->b_length) >> mp->m_sb.sb_inodelog;
+	for (i = 0; i < inodes_per_buf; i++) {
+		next_unlinked_offset = (i * mp->m_sb.sb_inodesize) +
+			offsetof(xfs_dinode_t, di_next_unlinked);
+
+		while (next_unlinked_offset >=
+		       (reg_buf_offset + reg_buf_bytes)) {
+			/*
+			 * The next di_next_unlinked field is beyond the
+			 * current logged region.  Find the next logged
+			 * region that contains or is beyond it.
+			 */
+			bit += nbits;
+			bit = xlog_next_bit(buf_f->blf_data_map,
+					   buf_f->blf_map_size, bit);
+
+			/* nothing logged past here, we're done */
+			if (bit == -1)
+				return 0;
+
+			nbits = xlog_contig_bits(buf_f->blf_data_map,
+						buf_f->blf_map_size, bit);
+			reg_buf_offset = bit << XFS_BLF_SHIFT;
+			reg_buf_bytes = nbits << XFS_BLF_SHIFT;
+			item_index++;
+		}
+
+		/* field is before the current region, move to the next inode */
+		if (next_unlinked_offset < reg_buf_offset)
+			continue;
+
+		if (item_index >= item->ri_cnt ||
+		    next_unlinked_offset - reg_buf_offset + sizeof(xfs_agino_t) >
+				item->ri_buf[item_index].i_len)
+			return EFSCORRUPTED;
+
+		logged_nextp = (xfs_agino_t *)
+				((char *)item->ri_buf[item_index].i_addr +
+				 next_unlinked_offset - reg_buf_offset);
+		if (*logged_nextp == 0) {
+			do_warn(
+	_("bad inode buffer log record (ptr = %p, bp = %p), "
+	  "trying to replay bad (0) inode di_next_unlinked field\n"),
+				item, bp);
+			return EFSCORRUPTED;
+		}
+
+		buffer_nextp = (xfs_agino_t *)((char *)bp->b_addr +
+					       next_unlinked_offset);
+		*buffer_nextp = *logged_nextp;
+
+		/* the inode CRC covers the pointer we just changed */
+		xfs_dinode_calc_crc(mp, (xfs_dinode_t *)((char *)bp->b_addr +
+					i * mp->m_sb.sb_inodesize));
+	}
+	return 0;
+}
+
+/*
+ * Copy the logged regions into the buffer, one run of dirty chunks in the
+ * bitmap per region.
+ */
+static int
+xlog_recover_do_reg_buffer(
+	xlog_recover_item_t	*item,
+	struct xfs_buf		*bp,
+	xfs_buf_log_format_t	*buf_f)
+{
+	int			i = 1;
+	int			bit = 0;
+	int			nbits;
+
+	for (;;) {
+		bit = xlog_next_bit(buf_f->blf_data_map,
+				   buf_f->blf_map_size, bit);
+		if (bit == -1)
+			break;
+		nbits = xlog_contig_bits(buf_f->blf_data_map,
+					buf_f->blf_map_size, bit);
+		if (i >= item->ri_cnt ||
+		    BBTOB(bp->b_length) < (bit + nbits) << XFS_BLF_SHIFT)
+			return EFSCORRUPTED;
+
+		/*
+		 * A run of dirty chunks can be logged as several regions, so
+		 * only copy what this region holds and pick the rest up from
+		 * the next one.
+		 */
+		if (item->ri_buf[i].i_len < (nbits << XFS_BLF_SHIFT))
+			nbits = item->ri_buf[i].i_len >> XFS_BLF_SHIFT;
+		memcpy((char *)bp->b_addr + (bit << XFS_BLF_SHIFT),
+		       item->ri_buf[i].i_addr, nbits << XFS_BLF_SHIFT);
+		i++;
+		bit += nbits;
+	}
+	return 0;
+}
+
+/*
+ * Quota state is only replayed while that quota type is on.  A quotaoff
+ * anywhere in the log means the dquots of that type get thrown away, so
+ * there is no point replaying them.
+ */
+static int
+xlog_recover_quota_off(
+	struct xfs_mount	*mp,
+	uint			type)
+{
+	if (!type)
+		return 0;
+	return !mp->m_sb.sb_qflags || (quotaoffs & type);
+}
+
+static uint
+xlog_dquot_buf_type(
+	xfs_buf_log_format_t	*buf_f)
+{
+	if (buf_f->blf_flags & XFS_BLF_UDQUOT_BUF)
+		return XFS_DQ_USER;
+	if (buf_f->blf_flags & XFS_BLF_PDQUOT_BUF)
+		return XFS_DQ_PROJ;
+	if (buf_f->blf_flags & XFS_BLF_GDQUOT_BUF)
+		return XFS_DQ_GROUP;
+	return 0;
+}
+
+static void
+xlog_recover_quotaoff_pass1(
+	xlog_recover_item_t	*item)
+{
+	xfs_qoff_logformat_t	*qoff_f = item->ri_buf[0].i_addr;
+
+	if (qoff_f->qf_flags & XFS_UQUOTA_ACCT)
+		quotaoffs |= XFS_DQ_USER;
+	if (qoff_f->qf_flags & XFS_PQUOTA_ACCT)
+		quotaoffs |= XFS_DQ_PROJ;
+	if (qoff_f->qf_flags & XFS_GQUOTA_ACCT)
+		quotaoffs |= XFS_DQ_GROUP;
+}
+
+static int
+xlog_recover_buffer_pass2(
+	struct xfs_mount	*mp,
+	xlog_recover_item_t	*item,
+	xfs_lsn_t		current_lsn)
+{
+	xfs_buf_log_format_t	*buf_f = item->ri_buf[0].i_addr;
+	struct xfs_buf		*bp;
+	xfs_lsn_t		lsn;
+	int			error;
+
+	if (xlog_check_buffer_cancelled(buf_f->blf_blkno, buf_f->blf_len,
+					buf_f->blf_flags)) {
+		rstats.cancelled++;
+		return 0;
+	}
+
+	if (xlog_recover_quota_off(mp, xlog_dquot_buf_type(buf_f)))
+		return 0;
+
+	bp = xlog_replay_get_buf(mp, buf_f->blf_blkno, buf_f->blf_len);
+	if (!bp)
+		return EIO;
+
+	lsn = xlog_recover_get_buf_lsn(mp, bp);
+	if (lsn && lsn != -1 && lsn >= current_lsn) {
+		rstats.skipped++;
+		return 0;
+	}
+
+	if (buf_f->blf_flags & XFS_BLF_INODE_BUF)
+		error = xlog_recover_do_inode_buffer(mp, item, bp, buf_f);
+	else
+		error = xlog_recover_do_reg_buffer(item, bp, buf_f);
+	if (error)
+		return error;
+
+	/* blocks change type as they are reused, the latest use wins */
+	bp->b_ops = xlog_recover_buf_ops(mp, bp, buf_f);
+	bp->b_flags |= LIBXFS_B_DIRTY;
+	if (buf_f->blf_blkno == XFS_SB_DADDR)
+		sb_replayed = 1;
+	rstats.bufs++;
+	return 0;
+}
+
+/*
+ * Stamp every block of an inode fork's bmap btree with a new owner, one
+ * level at a time from the left hand block along the sibling pointers,
+ * the same walk xfs_btree_change_owner() does.  The root lives in the
+ * inode and has no owner field.
+ */
+static int
+xlog_recover_bmbt_owner(
+	struct xfs_mount	*mp,
+	xfs_ino_t		ino,
+	xfs_dinode_t		*dip,
+	int			whichfork)
+{
+	xfs_bmdr_block_t	*rblock;
+	struct xfs_btree_block	*block;
+	struct xfs_buf		*bp;
+	xfs_fsblock_t		fsbno;
+	xfs_fsblock_t		left;
+	xfs_daddr_t		daddr;
+	__uint64_t		nblocks = 0;
+	int			cancelled;
+	int			level;
+	int			maxrecs;
+
+	if (!xfs_sb_version_hascrc(&mp->m_sb) ||
+	    XFS_DFORK_FORMAT(dip, whichfork) != XFS_DINODE_FMT_BTREE)
+		return 0;
+
+	rblock = (xfs_bmdr_block_t *)XFS_DFORK_PTR(dip, whichfork);
+	level = be16_to_cpu(rblock->bb_level);
+	if (level < 1 || !be16_to_cpu(rblock->bb_numrecs))
+		return EFSCORRUPTED;
+	maxrecs = xfs_bmdr_maxrecs(mp, XFS_DFORK_SIZE(dip, mp, whichfork), 0);
+	left = be64_to_cpu(*XFS_BMDR_PTR_ADDR(rblock, 1, maxrecs));
+
+	maxrecs = xfs_bmbt_maxrecs(mp, mp->m_sb.sb_blocksize, 0);
+	while (--level >= 0) {
+		fsbno = left;
+		left = NULLFSBLOCK;
+		while (fsbno != NULLFSBLOCK) {
+			/* a sibling loop would never end */
+			if (XFS_FSB_TO_AGNO(mp, fsbno) >= mp->m_sb.sb_agcount ||
+			    XFS_FSB_TO_AGBNO(mp, fsbno) >=
+						mp->m_sb.sb_agblocks ||
+			    ++nblocks > mp->m_sb.sb_dblocks)
+				return EFSCORRUPTED;
+
+			daddr = XFS_FSB_TO_DADDR(mp, fsbno);
+			cancelled = xlog_find_buffer_cancelled(daddr,
+						XFS_FSB_TO_BB(mp, 1)) != NULL;
+			bp = xlog_replay_get_buf(mp, daddr,
+						 XFS_FSB_TO_BB(mp, 1));
+			if (!bp)
+				return EIO;
+
+			/*
+			 * A block freed later in the log may never have been
+			 * written, so there may be nothing to follow.  Its
+			 * owner doesn't matter any more either way.
+			 */
+			block = XFS_BUF_TO_BLOCK(bp);
+			if (be32_to_cpu(block->bb_magic) !=
+						XFS_BMAP_CRC_MAGIC ||
+			    be16_to_cpu(block->bb_level) != level) {
+				if (cancelled)
+					break;
+				return EFSCORRUPTED;
+			}
+
+			if (level > 0 && left == NULLFSBLOCK)
+				left = be64_to_cpu(*XFS_BMBT_PTR_ADDR(mp, block,
+								1, maxrecs));
+			if (!cancelled &&
+			    be64_to_cpu(block->bb_u.l.bb_owner) != ino) {
+				block->bb_u.l.bb_owner = cpu_to_be64(ino);
+				bp->b_ops = &xfs_bmbt_buf_ops;
+				bp->b_flags |= LIBXFS_B_DIRTY;
+			}
+			fsbno = be64_to_cpu(block->bb_u.l.bb_rightsib);
+		}
+	}
+	return 0;
+}
+
+static int
+xlog_recover_inode_pass2(
+	struct xfs_mount	*mp,
+	xlog_recover_item_t	*item,
+	xfs_lsn_t		current_lsn)
+{
+	xfs_inode_log_format_t	in_f;
+	struct xfs_buf		*bp;
+	xfs_dinode_t		*dip;
+	xfs_icdinode_t		*dicp;
+	xfs_caddr_t		src;
+	xfs_lsn_t		lsn;
+	uint			fields;
+	uint			isize;
+	int			len;
+	int			attr_index;
+	int			error;
+
+	if (xlog_recover_inode_format(&item->ri_buf[0], &in_f))
+		return EFSCORRUPTED;
+
+	if (xlog_check_buffer_cancelled(in_f.ilf_blkno, in_f.ilf_len, 0)) {
+		rstats.cancelled++;
+		return 0;
+	}
+
+	if (item->ri_cnt < 2 || item->ri_cnt < in_f.ilf_size ||
+	    item->ri_buf[1].i_len > sizeof(xfs_icdinode_t))
+		return EFSCORRUPTED;
+
+	bp = xlog_replay_get_buf(mp, in_f.ilf_blkno, in_f.ilf_len);
+	if (!bp)
+		return EIO;
+	if (in_f.ilf_boffset + mp->m_sb.sb_inodesize > BBTOB(bp->b_length))
+		return EFSCORRUPTED;
+
+	dip = (xfs_dinode_t *)((char *)bp->b_addr + in_f.ilf_boffset);
+	dicp = item->ri_buf[1].i_addr;
+	if (be16_to_cpu(dip->di_magic) != XFS_DINODE_MAGIC ||
+	    dicp->di_magic != XFS_DINODE_MAGIC) {
+		do_warn(_("bad inode magic in log replay of inode %" PRIu64
+			  "\n"), in_f.ilf_ino);
+		return EFSCORRUPTED;
+	}
+
+	/*
+	 * Skip the replay if the inode on disk was flushed after this copy
+	 * was logged.  v5 inodes carry the LSN of their last flush; older
+	 * ones only have a flush counter, which wraps, so a large value on disk
+	 * against a small one in the log means the log copy is newer.
+	 */
+	if (dip->di_version >= 3) {
+		lsn = be64_to_cpu(dip->di_lsn);
+		if (lsn && lsn != -1 && lsn >= current_lsn) {
+			rstats.skipped++;
+			return 0;
+		}
+	}
+	if (dicp->di_version < 3 &&
+	    dicp->di_flushiter < be16_to_cpu(dip->di_flushiter) &&
+	    !(be16_to_cpu(dip->di_flushiter) == DI_MAX_FLUSH &&
+	      dicp->di_flushiter < (DI_MAX_FLUSH >> 1))) {
+		rstats.skipped++;
+		return 0;
+	}
+	dicp->di_flushiter = 0;
+
+	/* the core was logged in host order, anything after it is on-disk */
+	xfs_dinode_to_disk(dip, dicp);
+	isize = xfs_icdinode_size(dicp->di_version);
+	if (item->ri_buf[1].i_len > isize)
+		memcpy((char *)dip + isize,
+		       (char *)item->ri_buf[1].i_addr + isize,
+		       item->ri_buf[1].i_len - isize);
+
+	fields = in_f.ilf_fields;
+	switch (fields & (XFS_ILOG_DEV | XFS_ILOG_UUID)) {
+	case XFS_ILOG_DEV:
+		xfs_dinode_put_rdev(dip, in_f.ilf_u.ilfu_rdev);
+		break;
+	case XFS_ILOG_UUID:
+		memcpy(XFS_DFORK_DPTR(dip), &in_f.ilf_u.ilfu_uuid,
+		       sizeof(uuid_t));
+		break;
+	}
+
+	if (in_f.ilf_size > 2) {
+		len = item->ri_buf[2].i_len;
+		src = item->ri_buf[2].i_addr;
+		switch (fields & XFS_ILOG_DFORK) {
+		case XFS_ILOG_DDATA:
+		case XFS_ILOG_DEXT:
+			memcpy(XFS_DFORK_DPTR(dip), src, len);
+			break;
+		case XFS_ILOG_DBROOT:
+			xfs_bmbt_to_bmdr(mp, (struct xfs_btree_block *)src, len,
+				(xfs_bmdr_block_t *)XFS_DFORK_DPTR(dip),
+				XFS_DFORK_DSIZE(dip, mp));
+			break;
+		}
+
+		if (fields & XFS_ILOG_AFORK) {
+			attr_index = (fields & XFS_ILOG_DFORK) ? 3 : 2;
+			if (attr_index >= item->ri_cnt)
+				return EFSCORRUPTED;
+			len = item->ri_buf[attr_index].i_len;
+			src = item->ri_buf[attr_index].i_addr;
+			switch (fields & XFS_ILOG_AFORK) {
+			case XFS_ILOG_ADATA:
+			case XFS_ILOG_AEXT:
+				memcpy(XFS_DFORK_APTR(dip), src, len);
+				break;
+			case XFS_ILOG_ABROOT:
+				xfs_bmbt_to_bmdr(mp,
+					(struct xfs_btree_block *)src, len,
+					(xfs_bmdr_block_t *)XFS_DFORK_APTR(dip),
+					XFS_DFORK_ASIZE(dip, mp));
+				break;
+			}
+		}
+	}
+
+	xfs_dinode_calc_crc(mp, dip);
+	bp->b_flags |= LIBXFS_B_DIRTY;
+	rstats.inodes++;
+
+	/*
+	 * Extent swaps log an owner change for the fork's btree blocks
+	 * rather than the blocks themselves.  This may flush the held
+	 * buffers, so dip can't be touched after the first of these.
+	 */
+	if (fields & XFS_ILOG_DOWNER) {
+		error = xlog_recover_bmbt_owner(mp, in_f.ilf_ino, dip,
+						XFS_DATA_FORK);
+		if (error)
+			return error;
+	}
+	if (fields & XFS_ILOG_AOWNER)
+		return xlog_recover_bmbt_owner(mp, in_f.ilf_ino, dip,
+					       XFS_ATTR_FORK);
+	return 0;
+}
+
+/*
+ * A dquot item holds the whole on-disk dquot; copy it over the one in the
+ * dquot buffer.
+ */
+static int
+xlog_recover_dquot_pass2(
+	struct xfs_mount	*mp,
+	xlog_recover_item_t	*item)
+{
+	xfs_dq_logformat_t	*dq_f;
+	xfs_disk_dquot_t	*recddq;
+	xfs_disk_dquot_t	*ddq;
+	struct xfs_buf		*bp;
+	int			len;
+
+	if (item->ri_cnt < 2 ||
+	    item->ri_buf[0].i_len < sizeof(xfs_dq_logformat_t) ||
+	    item->ri_buf[1].i_len < sizeof(xfs_disk_dquot_t))
+		return EFSCORRUPTED;
+	dq_f = item->ri_buf[0].i_addr;
+	recddq = item->ri_buf[1].i_addr;
+
+	if (!mp->m_sb.sb_qflags ||
+	    xlog_recover_quota_off(mp, recddq->d_flags & XFS_DQ_ALLTYPES))
+		return 0;
+	if (xfs_dqcheck(mp, recddq, dq_f->qlf_id, 0, XFS_QMOPT_DOWARN,
+			"xlog_recover_dquot_pass2 (log copy)"))
+		return EFSCORRUPTED;
+
+	len = XFS_FSB_TO_BB(mp, dq_f->qlf_len);
+	if (xlog_check_buffer_cancelled(dq_f->qlf_blkno, len, 0)) {
+		rstats.cancelled++;
+		return 0;
+	}
+	bp = xlog_replay_get_buf(mp, dq_f->qlf_blkno, len);
+	if (!bp)
+		return EIO;
+	if (dq_f->qlf_boffset + sizeof(xfs_dqblk_t) > BBTOB(bp->b_length))
+		return EFSCORRUPTED;
+
+	ddq = (xfs_disk_dquot_t *)((char *)bp->b_addr + dq_f->qlf_boffset);
+	if (xfs_dqcheck(mp, ddq, dq_f->qlf_id, 0, XFS_QMOPT_DOWARN,
+			"xlog_recover_dquot_pass2"))
+		return EFSCORRUPTED;
+
+	memcpy(ddq, recddq, sizeof(xfs_disk_dquot_t));
+	if (xfs_sb_version_hascrc(&mp->m_sb))
+		xfs_update_cksum((char *)ddq, sizeof(xfs_dqblk_t),
+				 XFS_DQUOT_CRC_OFF);
+	bp->b_ops = &xfs_dquot_buf_ops;
+	bp->b_flags |= LIBXFS_B_DIRTY;
+	rstats.dquots++;
+	return 0;
+}
+
+/*
+ * Extent free intents are logged by 32 and 64 bit kernels with different
+ * extent layouts; keep a native copy until the done item turns up.
+ */
+static int
+xlog_recover_efi_pass2(
+	xlog_recover_item_t	*item)
+{
+	xfs_efi_log_format_t	*efi_f = item->ri_buf[0].i_addr;
+	xfs_efi_log_format_32_t	*efi_f32 = item->ri_buf[0].i_addr;
+	xfs_efi_log_format_64_t	*efi_f64 = item->ri_buf[0].i_addr;
+	uint			len = item->ri_buf[0].i_len;
+	struct xlog_efi		*efi;
+	uint			n;
+	uint			i;
+
+	if (len < sizeof(xfs_efi_log_format_32_t) || !efi_f->efi_nextents)
+		return EFSCORRUPTED;
+	n = efi_f->efi_nextents;
+
+	efi = malloc(sizeof(*efi) + n * sizeof(xfs_extent_t));
+	if (!efi)
+		do_error(_("couldn't allocate log extent free intent\n"));
+	efi->efi_id = efi_f->efi_id;
+	efi->efi_nextents = n;
+
+	if (len == sizeof(*efi_f) + (n - 1) * sizeof(xfs_extent_t)) {
+		memcpy(efi->efi_extents, efi_f->efi_extents,
+		       n * sizeof(xfs_extent_t));
+	} else if (len == sizeof(*efi_f32) +
+			  (n - 1) * sizeof(xfs_extent_32_t)) {
+		for (i = 0; i < n; i++) {
+			efi->efi_extents[i].ext_start =
+					efi_f32->efi_extents[i].ext_start;
+			efi->efi_extents[i].ext_len =
+					efi_f32->efi_extents[i].ext_len;
+		}
+	} else if (len == sizeof(*efi_f64) +
+			  (n - 1) * sizeof(xfs_extent_64_t)) {
+		for (i = 0; i < n; i++) {
+			efi->efi_extents[i].ext_start =
+					efi_f64->efi_extents[i].ext_start;
+			efi->efi_extents[i].ext_len =
+					efi_f64->efi_extents[i].ext_len;
+		}
+	} else {
+		free(efi);
+		return EFSCORRUPTED;
+	}
+	list_add_tail(&efi->efi_list, &efi_list);
+	return 0;
+}
+
+static int
+xlog_recover_efd_pass2(
+	xlog_recover_item_t	*item)
+{
+	xfs_efd_log_format_t	*efd_f = item->ri_buf[0].i_addr;
+	struct xlog_efi		*efi;
+
+	if (item->ri_buf[0].i_len < sizeof(xfs_efd_log_format_32_t))
+		return EFSCORRUPTED;
+
+	list_for_each_entry(efi, &efi_list, efi_list) {
+		if (efi->efi_id == efd_f->efd_efi_id) {
+			list_del(&efi->efi_list);
+			free(efi);
+			break;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Free the extents of every intent that never saw its done item, one
+ * transaction per intent.  If the free space btrees are too broken for
+ * that, the blocks are left to phase 5, which rebuilds them from what
+ * the inodes actually use.
+ */
+static void
+xlog_recover_process_efis(
+	struct xfs_mount	*mp)
+{
+	struct xlog_efi		*efi, *n;
+	xfs_extent_t		*ext;
+	xfs_trans_t		*tp;
+	int			error;
+	uint			i;
+
+	list_for_each_entry_safe(efi, n, &efi_list, efi_list) {
+		tp = libxfs_trans_alloc(mp, 0);
+		error = libxfs_trans_reserve(tp, &M_RES(mp)->tr_itruncate,
+					     0, 0);
+		for (i = 0; !error && i < efi->efi_nextents; i++) {
+			ext = &efi->efi_extents[i];
+			if (!ext->ext_start || !ext->ext_len ||
+			    ext->ext_start >= mp->m_sb.sb_dblocks ||
+			    ext->ext_len >= mp->m_sb.sb_agblocks)
+				error = EFSCORRUPTED;
+			else
+				error = xfs_free_extent(tp, ext->ext_start,
+							ext->ext_len);
+		}
+		if (error) {
+			libxfs_trans_cancel(tp, 0);
+			do_warn(
+	_("couldn't finish extent free intent 0x%" PRIx64 " (error %d)\n"),
+				efi->efi_id, error);
+		} else {
+			libxfs_trans_commit(tp, 0);
+			rstats.efis++;
+		}
+		list_del(&efi->efi_list);
+		free(efi);
+	}
+	/* write back what was freed, drop anything a failed free left */
+	libxfs_bcache_purge();
+}
+
+/*
+ * Inode chunk allocations on v5 filesystems are logged logically; redo the
+ * initialisation unless the whole chunk was freed again later.
+ */
+static int
+xlog_recover_icreate_pass2(
+	struct xfs_mount	*mp,
+	xlog_recover_item_t	*item)
+{
+	struct xfs_icreate_log	*icl = item->ri_buf[0].i_addr;
+	xfs_agnumber_t		agno;
+	xfs_agblock_t		agbno;
+	unsigned int		count;
+	unsigned int		isize;
+	xfs_agblock_t		length;
+	int			bb_per_cluster;
+	int			nbufs;
+	int			ncancel = 0;
+	int			i;
+	int			error;
+
+	if (item->ri_buf[0].i_len != sizeof(*icl))
+		return EFSCORRUPTED;
+
+	agno = be32_to_cpu(icl->icl_ag);
+	agbno = be32_to_cpu(icl->icl_agbno);
+	count = be32_to_cpu(icl->icl_count);
+	isize = be32_to_cpu(icl->icl_isize);
+	length = be32_to_cpu(icl->icl_length);
+	if (agno >= mp->m_sb.sb_agcount || !agbno || agbno == NULLAGBLOCK ||
+	    agbno + length > mp->m_sb.sb_agblocks ||
+	    isize != mp->m_sb.sb_inodesize ||
+	    count != XFS_IALLOC_INODES(mp) ||
+	    length != XFS_IALLOC_BLOCKS(mp))
+		return EFSCORRUPTED;
+
+	/* xfs_ialloc_inode_init() lays out the buffers the same way */
+	if (mp->m_sb.sb_blocksize >= XFS_INODE_CLUSTER_SIZE(mp)) {
+		bb_per_cluster = XFS_FSB_TO_BB(mp, 1);
+		nbufs = length;
+	} else {
+		bb_per_cluster = BTOBB(XFS_INODE_CLUSTER_SIZE(mp));
+		nbufs = length / (XFS_INODE_CLUSTER_SIZE(mp) >>
+				  mp->m_sb.sb_blocklog);
+	}
+	for (i = 0; i < nbufs; i++) {
+		if (xlog_find_buffer_cancelled(
+				XFS_AGB_TO_DADDR(mp, agno, agbno) +
+					i * bb_per_cluster,
+				bb_per_cluster))
+			ncancel++;
+	}
+	if (ncancel == nbufs) {
+		rstats.cancelled++;
+		return 0;
+	}
+
+	/*
+	 * The chunk is initialised through the cache, possibly in different
+	 * sized buffers to the ones the log uses for it.  Write everything
+	 * out and empty the cache so nothing stale aliases the new inodes.
+	 */
+	error = xlog_replay_flush();
+	if (error)
+		return error;
+	libxfs_bcache_purge();
+	error = xfs_ialloc_inode_init(mp, NULL, NULL, agno, agbno, length,
+				      be32_to_cpu(icl->icl_gen));
+	if (error)
+		return error;
+	libxfs_bcache_purge();
+	rstats.icreates++;
+	return 0;
+}
+
+int
+xlog_recover_do_trans(
+	struct xlog		*log,
+	xlog_recover_t		*trans,
+	int			pass)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	xlog_recover_item_t	*item;
+	int			error = 0;
+
+	xlog_recover_reorder_trans(trans);
+
+	if (pass == XLOG_RECOVER_PASS1) {
+		list_for_each_entry(item, &trans->r_itemq, ri_list) {
+			if (ITEM_TYPE(item) == XFS_LI_BUF)
+				xlog_recover_buffer_pass1(
+						item->ri_buf[0].i_addr);
+			else if (ITEM_TYPE(item) == XFS_LI_QUOTAOFF)
+				xlog_recover_quotaoff_pass1(item);
+		}
+		return 0;
+	}
+
+	if (nheld >= XLOG_REPLAY_MAX_HELD) {
+		error = xlog_replay_flush();
+		if (error)
+			return error;
+	}
+	xlog_recover_readahead(mp, trans);
+
+	list_for_each_entry(item, &trans->r_itemq, ri_list) {
+		switch (ITEM_TYPE(item)) {
+		case XFS_LI_BUF:
+			error = xlog_recover_buffer_pass2(mp, item,
+							  trans->r_lsn);
+			break;
+		case XFS_LI_INODE:
+			error = xlog_recover_inode_pass2(mp, item,
+							 trans->r_lsn);
+			break;
+		case XFS_LI_ICREATE:
+			error = xlog_recover_icreate_pass2(mp, item);
+			break;
+		case XFS_LI_DQUOT:
+			error = xlog_recover_dquot_pass2(mp, item);
+			break;
+		case XFS_LI_EFI:
+			error = xlog_recover_efi_pass2(item);
+			break;
+		case XFS_LI_EFD:
+			error = xlog_recover_efd_pass2(item);
+			break;
+		case XFS_LI_QUOTAOFF:
+			/* handled in pass 1 */
+			break;
+		default:
+			do_warn(_("unknown log item type 0x%x in transaction "
+				  "0x%x\n"), ITEM_TYPE(item), trans->r_log_tid);
+			error = EFSCORRUPTED;
+			break;
+		}
+		if (error) {
+			do_warn(_("log replay of transaction 0x%x failed "
+				  "(error %d)\n"), trans->r_log_tid, error);
+			return error;
+		}
+	}
+	rstats.trans++;
+	return 0;
+}
+
+/*
+ * Replay the active part of the log, tail to head, into the filesystem.
+ * Returns zero once everything has been written back.
+ */
+int
+replay_log(
+	struct xlog		*log,
+	xfs_daddr_t		head_blk,
+	xfs_daddr_t		tail_blk)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	struct xfs_buf		*bp;
+	struct xlog_buf_cancel	*bcp, *n;
+	struct xlog_efi		*efi, *en;
+	int			error;
+	int			i;
+
+	for (i = 0; i < XLOG_BC_TABLE_SIZE; i++)
+		INIT_LIST_HEAD(&buf_cancel_table[i]);
+	INIT_LIST_HEAD(&efi_list);
+	sb_replayed = 0;
+	btree_init(&held_bufs);
+	memset(&rstats, 0, sizeof(rstats));
+	quotaoffs = 0;
+
+	error = xlog_do_recovery_passes(log, head_blk, tail_blk,
+					XLOG_RECOVER_PASS1, XLOG_RECOVER_PASS2, 0);
+	if (!error)
+		error = xlog_replay_flush();
+	else
+		xlog_replay_flush();
+	/* drop anything cached under the old contents before repair starts */
+	if (!error)
+		libxfs_bcache_purge();
+
+	btree_destroy(held_bufs);
+	for (i = 0; i < XLOG_BC_TABLE_SIZE; i++) {
+		list_for_each_entry_safe(bcp, n, &buf_cancel_table[i], bc_list)
+			free(bcp);
+	}
+	if (error)
+		goto out_efis;
+
+	/*
+	 * The superblock we mounted with may predate the log.  Pick up the
+	 * replayed one; a geometry change (growfs) can't be taken on board
+	 * this late, so have the admin start again on the replayed fs.
+	 */
+	if (sb_replayed) {
+		struct xfs_sb	sb;
+
+		bp = libxfs_readbuf(mp->m_ddev_targp, XFS_SB_DADDR,
+				    XFS_FSS_TO_BB(mp, 1), 0, NULL);
+		if (!bp) {
+			error = EIO;
+			goto out_efis;
+		}
+		if (bp->b_error) {
+			libxfs_putbuf(bp);
+			libxfs_purgebuf(bp);
+			error = EIO;
+			goto out_efis;
+		}
+		libxfs_sb_from_disk(&sb, XFS_BUF_TO_SBP(bp));
+		libxfs_putbuf(bp);
+		libxfs_purgebuf(bp);
+		if (sb.sb_dblocks != mp->m_sb.sb_dblocks ||
+		    sb.sb_agcount != mp->m_sb.sb_agcount ||
+		    sb.sb_rblocks != mp->m_sb.sb_rblocks) {
+			/* the rerun's phase 5 picks up the intents' blocks */
+			error = EAGAIN;
+			goto out_efis;
+		}
+		mp->m_sb = sb;
+	}
+
+	xlog_recover_process_efis(mp);
+
+	if (verbose)
+		do_log(_("        - replayed %" PRIu64 " transactions: "
+			 "%" PRIu64 " buffers, %" PRIu64 " inodes, "
+			 "%" PRIu64 " inode chunks, %" PRIu64 " dquots, "
+			 "%" PRIu64 " cancelled, %" PRIu64 " stale, "
+			 "%" PRIu64 " writes, %" PRIu64 " extent frees\n"),
+			rstats.trans, rstats.bufs, rstats.inodes,
+			rstats.icreates, rstats.dquots, rstats.cancelled,
+			rstats.skipped, rstats.writes, rstats.efis);
+	return 0;
+
+out_efis:
+	list_for_each_entry_safe(efi, en, &efi_list, efi_list)
+		free(efi);
+	return error;
+}
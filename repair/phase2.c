@@ -28,16 +28,12 @@
 
 void	set_mp(xfs_mount_t *mpp);
 
-/* workaround craziness in the xlog routines */
-int xlog_recover_do_trans(struct xlog *log, xlog_recover_t *t, int p)
-{
-	return 0;
-}
-
 static void
 zero_log(xfs_mount_t *mp)
 {
 	int error;
+	int new_geometry = 0;
+	int cycle;
 	struct xlog	log;
 	xfs_daddr_t head_blk, tail_blk;
 
@@ -81,24 +77,45 @@ zero_log(xfs_mount_t *mp)
 "ALERT: The filesystem has valuable metadata changes in a log which is being\n"
 "destroyed because the -L option was used.\n"));
 			} else {
-				do_warn(_(
-"ERROR: The filesystem has valuable metadata changes in a log which needs to\n"
-"be replayed.  Mount the filesystem to replay the log, and unmount it before\n"
-"re-running xfs_repair.  If you are unable to mount the filesystem, then use\n"
-"the -L option to destroy the log and attempt a repair.\n"
+				do_log(_("        - replay log...\n"));
+				error = replay_log(&log, head_blk, tail_blk);
+				if (error && error != EAGAIN) {
+					do_warn(_(
+"ERROR: The filesystem has valuable metadata changes in a log which could\n"
+"not be replayed (error %d).  Mount the filesystem to replay the log, and\n"
+"unmount it before re-running xfs_repair.  If you are unable to mount the\n"
+"filesystem, then use the -L option to destroy the log and attempt a repair.\n"
 "Note that destroying the log may cause corruption -- please attempt a mount\n"
-"of the filesystem before doing this.\n"));
-				exit(2);
+"of the filesystem before doing this.\n"), error);
+					exit(2);
+				}
+				new_geometry = (error == EAGAIN);
 			}
 		}
 	}
 
+	/*
+	 * v5 metadata is stamped with the LSN of its last write, and the
+	 * kernel refuses metadata from the future.  Start the new log on a
+	 * cycle past anything the old one could have handed out.
+	 */
+	cycle = XLOG_INIT_CYCLE;
+	if (xfs_sb_version_hascrc(&mp->m_sb))
+		cycle = log.l_curr_cycle + 1;
+
 	libxfs_log_clear(log.l_dev,
 		XFS_FSB_TO_DADDR(mp, mp->m_sb.sb_logstart),
 		(xfs_extlen_t)XFS_FSB_TO_BB(mp, mp->m_sb.sb_logblocks),
 		&mp->m_sb.sb_uuid,
 		xfs_sb_version_haslogv2(&mp->m_sb) ? 2 : 1,
-		mp->m_sb.sb_logsunit, XLOG_FMT);
+		mp->m_sb.sb_logsunit, XLOG_FMT, cycle);
+
+	if (new_geometry) {
+		do_warn(_(
+"The log replay changed the filesystem geometry.  Re-run xfs_repair to\n"
+"check the filesystem.\n"));
+		exit(2);
+	}
 }
 
 /*
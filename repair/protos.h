@@ -44,6 +44,9 @@ char	*err_string(int err_code);
 
 void	thread_init(void);
 
+struct xlog;
+int	replay_log(struct xlog *, xfs_daddr_t, xfs_daddr_t);
+
 void	phase1(struct xfs_mount *);
 void	phase2(struct xfs_mount *, int);
 void	phase3(struct xfs_mount *);